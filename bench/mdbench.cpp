@@ -0,0 +1,355 @@
+// mdbench - MarkdownParser benchmark (portable; builds against mdparser)
+//
+// Usage: mdbench [-n ITERATIONS] [--synthetic-only] [FILE|DIR ...]
+//
+// Parses every document in the corpus with MarkdownParser::ConvertToHtml
+// and reports, per document: throughput (MB/s of UTF-8 input), heap
+// allocations per parse, and p50 / p99 latency. The corpus is a set of
+// generated documents (mixed content, inline-markup stress, mermaid-heavy)
+// plus real Markdown files: the ones given on the command line, or by
+// default every *.md in the source tree.
+
+#include "MarkdownParser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Allocation counter: global operator new replacement
+// ============================================================================
+static std::atomic<size_t> g_allocCount{ 0 };
+static std::atomic<size_t> g_allocBytes{ 0 };
+
+void* operator new(size_t size)
+{
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// ============================================================================
+// Corpus
+// ============================================================================
+struct BenchDoc {
+    std::string  name;
+    std::wstring text;
+    size_t       utf8Bytes = 0;
+};
+
+static std::wstring DecodeUtf8(const std::string& in)
+{
+    std::wstring out;
+    out.reserve(in.size());
+    size_t i = 0;
+    if (in.size() >= 3 && (unsigned char)in[0] == 0xEF &&
+        (unsigned char)in[1] == 0xBB && (unsigned char)in[2] == 0xBF)
+        i = 3; // BOM
+    while (i < in.size()) {
+        unsigned char c = (unsigned char)in[i];
+        uint32_t cp;
+        int extra;
+        if (c < 0x80)           { cp = c;        extra = 0; }
+        else if (c >> 5 == 0x6) { cp = c & 0x1F; extra = 1; }
+        else if (c >> 4 == 0xE) { cp = c & 0x0F; extra = 2; }
+        else if (c >> 3 == 0x1E) { cp = c & 0x07; extra = 3; }
+        else                     { cp = 0xFFFD;   extra = 0; }
+        i++;
+        for (int k = 0; k < extra; k++, i++) {
+            if (i >= in.size() || ((unsigned char)in[i] >> 6) != 0x2) { cp = 0xFFFD; break; }
+            cp = (cp << 6) | ((unsigned char)in[i] & 0x3F);
+        }
+        if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+            cp -= 0x10000;
+            out += (wchar_t)(0xD800 + (cp >> 10));
+            out += (wchar_t)(0xDC00 + (cp & 0x3FF));
+        } else {
+            out += (wchar_t)cp;
+        }
+    }
+    return out;
+}
+
+static size_t Utf8Length(const std::wstring& s)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        uint32_t c = (uint32_t)s[i];
+        if (c < 0x80) n += 1;
+        else if (c < 0x800) n += 2;
+        else if (c >= 0xD800 && c <= 0xDBFF && i + 1 < s.size()) { n += 4; i++; }
+        else if (c < 0x10000) n += 3;
+        else n += 4;
+    }
+    return n;
+}
+
+// Deterministic generator so runs are comparable across commits.
+struct Lcg {
+    uint32_t state;
+    uint32_t Next() { state = state * 1664525u + 1013904223u; return state >> 8; }
+    uint32_t Below(uint32_t n) { return Next() % n; }
+};
+
+static std::wstring MakeMixed(size_t targetChars, uint32_t seed)
+{
+    static const wchar_t* const kWords[] = {
+        L"mermaid", L"preview", L"render", L"diagram", L"parser", L"block",
+        L"inline", L"editor", L"latency", L"bun", L"webview", L"cache",
+        L"流程圖", L"預覽", L"圖表", L"效能",
+    };
+    Lcg rng{ seed };
+    auto word = [&]() -> std::wstring { return kWords[rng.Below(16)]; };
+    auto sentence = [&]() {
+        std::wstring s;
+        int n = 6 + (int)rng.Below(14);
+        for (int k = 0; k < n; k++) {
+            if (k) s += L' ';
+            switch (rng.Below(12)) {
+            case 0:  s += L"**" + word() + L"**"; break;
+            case 1:  s += L"*" + word() + L"*"; break;
+            case 2:  s += L"`" + word() + L"()`"; break;
+            case 3:  s += L"[" + word() + L"](https://example.com/" + word() + L")"; break;
+            case 4:  s += L"~~" + word() + L"~~"; break;
+            default: s += word(); break;
+            }
+        }
+        return s + L".";
+    };
+
+    std::wstring doc;
+    int section = 0;
+    while (doc.size() < targetChars) {
+        doc += L"## Section " + std::to_wstring(++section) + L"\n\n";
+        switch (rng.Below(6)) {
+        case 0:
+            for (int k = 0; k < 5; k++) doc += L"- " + sentence() + L"\n";
+            doc += L"\n";
+            break;
+        case 1:
+            doc += L"| Name | Value | Notes |\n|---|---|---|\n";
+            for (int k = 0; k < 6; k++)
+                doc += L"| " + word() + L" | " + std::to_wstring(rng.Below(1000)) + L" | " + sentence() + L" |\n";
+            doc += L"\n";
+            break;
+        case 2:
+            doc += L"```mermaid\nflowchart TD\n";
+            for (int k = 0; k < 8; k++)
+                doc += L"    N" + std::to_wstring(k) + L"[" + word() + L"] --> N" + std::to_wstring(k + 1) + L"\n";
+            doc += L"```\n\n";
+            break;
+        case 3:
+            doc += L"```cpp\nint main() {\n    return " + std::to_wstring(rng.Below(100)) + L";\n}\n```\n\n";
+            break;
+        case 4:
+            doc += L"> " + sentence() + L"\n> " + sentence() + L"\n\n";
+            break;
+        default:
+            doc += sentence() + L" " + sentence() + L"\n" + sentence() + L"\n\n";
+            break;
+        }
+    }
+    return doc;
+}
+
+// Long paragraphs full of unmatched openers: the shape that made the old
+// recursive inline parser quadratic.
+static std::wstring MakeInlineStress(size_t targetChars)
+{
+    static const wchar_t* const kNoise[] = {
+        L"a * b ", L"[x ", L"` ", L"** c ", L"](", L"~~ ", L"![y ", L"_z_ ",
+    };
+    std::wstring doc;
+    size_t k = 0;
+    while (doc.size() < targetChars) {
+        for (int line = 0; line < 200; line++)
+            doc += kNoise[(k++) % 8];
+        doc += L"\n\n";
+    }
+    return doc;
+}
+
+static std::wstring MakeMermaidHeavy(int blocks)
+{
+    std::wstring doc = L"# Diagrams\n\n";
+    for (int b = 0; b < blocks; b++) {
+        doc += L"### Diagram " + std::to_wstring(b) + L"\n\n```mermaid\nsequenceDiagram\n";
+        for (int k = 0; k < 20; k++)
+            doc += L"    A" + std::to_wstring(k % 4) + L"->>B" + std::to_wstring(k % 3) + L": step " + std::to_wstring(k) + L"\n";
+        doc += L"```\n\n";
+    }
+    return doc;
+}
+
+static void AddDoc(std::vector<BenchDoc>& corpus, std::string name, std::wstring text)
+{
+    BenchDoc d;
+    d.name = std::move(name);
+    d.utf8Bytes = Utf8Length(text);
+    d.text = std::move(text);
+    corpus.push_back(std::move(d));
+}
+
+static void AddFile(std::vector<BenchDoc>& corpus, const std::filesystem::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "mdbench: cannot read %s\n", path.string().c_str());
+        return;
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    std::string raw = ss.str();
+    BenchDoc d;
+    d.name = path.filename().string();
+    d.utf8Bytes = raw.size();
+    d.text = DecodeUtf8(raw);
+    corpus.push_back(std::move(d));
+}
+
+static void AddPath(std::vector<BenchDoc>& corpus, const std::filesystem::path& path)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (!fs::is_directory(path, ec)) {
+        AddFile(corpus, path);
+        return;
+    }
+    std::vector<fs::path> files;
+    for (auto it = fs::recursive_directory_iterator(path, ec);
+         it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) break;
+        std::string name = it->path().filename().string();
+        if (it->is_directory() && (name.empty() || name[0] == '.' || name[0] == '_' ||
+                                   name == "node_modules" || name.rfind("build", 0) == 0)) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (it->is_regular_file() && it->path().extension() == ".md")
+            files.push_back(it->path());
+    }
+    std::sort(files.begin(), files.end());
+    for (const auto& f : files) AddFile(corpus, f);
+}
+
+// ============================================================================
+// Measurement
+// ============================================================================
+struct BenchResult {
+    double mbPerSec;
+    double allocsPerParse;
+    double p50Ms;
+    double p99Ms;
+};
+
+static double Percentile(std::vector<double> v, double p)
+{
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    size_t idx = (size_t)(p * (double)(v.size() - 1) + 0.5);
+    return v[std::min(idx, v.size() - 1)];
+}
+
+static BenchResult Measure(const BenchDoc& doc, int iterations)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Warm-up (also sizes the iteration count when not forced).
+    auto t0 = Clock::now();
+    volatile size_t sink = MarkdownParser::ConvertToHtml(doc.text).size();
+    double firstMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    if (iterations <= 0)
+        iterations = (int)std::clamp(500.0 / std::max(firstMs, 0.01), 20.0, 2000.0);
+
+    std::vector<double> samples;
+    samples.reserve((size_t)iterations);
+    size_t allocs = 0;
+    double totalMs = 0.0;
+    for (int i = 0; i < iterations; i++) {
+        size_t a0 = g_allocCount.load(std::memory_order_relaxed);
+        auto s = Clock::now();
+        std::wstring html = MarkdownParser::ConvertToHtml(doc.text);
+        auto e = Clock::now();
+        allocs += g_allocCount.load(std::memory_order_relaxed) - a0;
+        sink = sink + html.size();
+        double ms = std::chrono::duration<double, std::milli>(e - s).count();
+        samples.push_back(ms);
+        totalMs += ms;
+    }
+    (void)sink;
+
+    BenchResult r;
+    r.mbPerSec = totalMs > 0.0
+        ? ((double)doc.utf8Bytes * iterations / 1e6) / (totalMs / 1000.0) : 0.0;
+    r.allocsPerParse = (double)allocs / iterations;
+    r.p50Ms = Percentile(samples, 0.50);
+    r.p99Ms = Percentile(samples, 0.99);
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 0;
+    bool syntheticOnly = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if ((a == "-n" || a == "--iterations") && i + 1 < argc) {
+            iterations = std::atoi(argv[++i]);
+        } else if (a == "--synthetic-only") {
+            syntheticOnly = true;
+        } else if (a == "-h" || a == "--help") {
+            std::printf("usage: mdbench [-n ITERATIONS] [--synthetic-only] [FILE|DIR ...]\n");
+            return 0;
+        } else {
+            paths.push_back(a);
+        }
+    }
+
+    std::vector<BenchDoc> corpus;
+    AddDoc(corpus, "synthetic/mixed-64K", MakeMixed(64 * 1024, 1));
+    AddDoc(corpus, "synthetic/mixed-1M", MakeMixed(1024 * 1024, 2));
+    AddDoc(corpus, "synthetic/mixed-5M", MakeMixed(5 * 1024 * 1024, 3));
+    AddDoc(corpus, "synthetic/inline-stress-256K", MakeInlineStress(256 * 1024));
+    AddDoc(corpus, "synthetic/mermaid-200", MakeMermaidHeavy(200));
+    if (!syntheticOnly) {
+        if (paths.empty()) {
+#ifdef MDBENCH_DEFAULT_CORPUS
+            AddPath(corpus, MDBENCH_DEFAULT_CORPUS);
+#endif
+        } else {
+            for (const auto& p : paths) AddPath(corpus, p);
+        }
+    }
+
+    std::printf("%-36s %10s %9s %13s %9s %9s\n",
+                "document", "bytes", "MB/s", "allocs/parse", "p50 ms", "p99 ms");
+    double totalBytes = 0.0, totalSec = 0.0;
+    for (const auto& doc : corpus) {
+        if (doc.text.empty()) continue;
+        BenchResult r = Measure(doc, iterations);
+        std::string name = doc.name.size() > 36 ? "..." + doc.name.substr(doc.name.size() - 33) : doc.name;
+        std::printf("%-36s %10zu %9.1f %13.1f %9.3f %9.3f\n",
+                    name.c_str(), doc.utf8Bytes, r.mbPerSec, r.allocsPerParse, r.p50Ms, r.p99Ms);
+        totalBytes += (double)doc.utf8Bytes;
+        totalSec += r.p50Ms / 1000.0;
+    }
+    if (totalSec > 0.0)
+        std::printf("\ncorpus: %zu documents, %.1f MB, %.1f MB/s at p50\n",
+                    corpus.size(), totalBytes / 1e6, totalBytes / 1e6 / totalSec);
+    return 0;
+}
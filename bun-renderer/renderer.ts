@@ -5,8 +5,30 @@
  * Request:  {"type":"render","blocks":[{"id":"mmd-0","code":"graph TD\nA-->B"}],"theme":"default"}
  * Response: {"type":"result","results":[{"id":"mmd-0","svg":"<svg>...</svg>","error":null}]}
  *
+ * With "stream":true in the render request, each block is answered on its
+ * own line as soon as it is rendered, then the batch is closed:
+ * Response: {"type":"block","id":"mmd-0","svg":"<svg>...</svg>","error":null}   (× N)
+ *           {"type":"done","count":N}
+ * A "req" number in the render request is echoed on every response line.
+ *
  * Request:  {"type":"ping"}
  * Response: {"type":"pong"}
+ *
+ * Framed mode: "ready" advertises {"framing":["frame2"]}. After the host
+ * sends {"type":"framing","mode":"frame2"} (acknowledged with a K frame),
+ * both directions switch to length-prefixed frames carrying raw UTF-8, so
+ * diagram sources and SVGs are never JSON-escaped. Every frame carries the
+ * request id it belongs to:
+ *   host → Bun:  R (id = theme), C (id, payload = code) × N, Z
+ *   Bun → host:  S (id, payload = svg) or E (id, payload = error) × N,
+ *                D (payload = count), X (payload = message) on bad input
+ *
+ * Requests are queued as they arrive and rendered one at a time, so the
+ * host may send the next one without waiting for the previous answer.
+ *
+ * Cancellation ("ready" carries "cancel":true): a Q frame, or
+ * {"type":"cancel","req":N} in JSON mode, makes request N skip every block
+ * it hasn't started. The request is still closed with its D / done.
  */
 
 import { JSDOM } from 'jsdom';
@@ -192,96 +214,245 @@ mermaid.initialize({
     architecture: { randomize: false },
 });
 
-// ── Signal readiness ────────────────────────────────────────────────
-console.log(JSON.stringify({ type: 'ready' }));
+// ── Rendering (shared by the JSON and framed protocols) ─────────────
+type BlockResult = { id: string; svg: string | null; error: string | null };
+
+const VALID_THEMES = ['default', 'dark', 'neutral', 'forest', 'base'];
+const VALID_LOOKS = ['classic', 'neo', 'handDrawn'] as const;
+const MAX_CODE_LENGTH = 100000; // 100KB per block
+
+async function renderBlocks(blocks: any[], reqTheme: unknown, reqLook: unknown,
+                            emit: (r: BlockResult) => void,
+                            cancelled: () => boolean = () => false) {
+    // Validate theme (whitelist only)
+    const theme = (typeof reqTheme === 'string' && VALID_THEMES.includes(reqTheme))
+        ? reqTheme : 'default';
+
+    // Validate look (mermaid 11.14+: 'classic' | 'neo' | 'handDrawn')
+    const look = (typeof reqLook === 'string' && (VALID_LOOKS as readonly string[]).includes(reqLook))
+        ? (reqLook as typeof currentLook) : currentLook;
+
+    if (theme !== currentTheme || look !== currentLook) {
+        currentTheme = theme;
+        currentLook = look;
+        mermaid.initialize({
+            startOnLoad: false,
+            securityLevel: 'strict',
+            theme: currentTheme,
+            look: currentLook,
+            flowchart: { useMaxWidth: true, nodeSpacing: 60, rankSpacing: 80, curve: 'basis' },
+            sequence: { useMaxWidth: true },
+            architecture: { randomize: false },
+        });
+    }
 
-// ── Process stdin line by line ──────────────────────────────────────
-const decoder = new TextDecoder();
-let buffer = '';
+    for (const block of blocks) {
+        // Superseded by a newer request: the host won't show the rest.
+        if (cancelled()) break;
 
-for await (const chunk of Bun.stdin.stream()) {
-    buffer += decoder.decode(chunk, { stream: true });
+        // Validate block.id: must be string, alphanumeric + dash/underscore
+        if (typeof block.id !== 'string' || !/^[a-zA-Z0-9_-]+$/.test(block.id)) {
+            emit({ id: String(block.id || 'invalid'), svg: null, error: 'Invalid block id' });
+            continue;
+        }
+        // Validate block.code: must be string with length limit
+        if (typeof block.code !== 'string') {
+            emit({ id: block.id, svg: null, error: 'Invalid block code type' });
+            continue;
+        }
+        if (block.code.length > MAX_CODE_LENGTH) {
+            emit({ id: block.id, svg: null, error: 'Code too long' });
+            continue;
+        }
+
+        try {
+            dom.window.document.body.innerHTML = '<div id="container"></div>';
+            const { svg } = await mermaid.render(block.id, block.code);
+            emit({ id: block.id, svg: fixSvgBounds(svg), error: null });
+        } catch (e: any) {
+            emit({
+                id: block.id,
+                svg: null,
+                error: (e.message || String(e)).substring(0, 500),
+            });
+        }
+    }
+}
+
+// ── Render queue ────────────────────────────────────────────────────
+// One mermaid instance and one jsdom document: renders must not overlap.
+// stdin keeps being read while a render runs, so pipelined requests pile up
+// here rather than in the pipe.
+let renderChain: Promise<void> = Promise.resolve();
+
+function enqueue(job: () => Promise<void>) {
+    renderChain = renderChain.then(job).catch(() => {});
+}
 
-    let newlineIdx: number;
-    while ((newlineIdx = buffer.indexOf('\n')) !== -1) {
-        const line = buffer.substring(0, newlineIdx).trim();
-        buffer = buffer.substring(newlineIdx + 1);
+// Ids of queued / running requests, and those of them the host cancelled.
+const activeRequests = new Set<number>();
+const cancelledRequests = new Set<number>();
 
-        if (!line) continue;
+function cancelRequest(req: number) {
+    if (activeRequests.has(req)) cancelledRequests.add(req);
+}
 
+// Queue a tagged request; `run` gets its cancellation check.
+function enqueueRequest(req: number | undefined, run: (cancelled: () => boolean) => Promise<void>) {
+    if (req === undefined) {
+        enqueue(() => run(() => false));
+        return;
+    }
+    activeRequests.add(req);
+    enqueue(async () => {
         try {
-            const req = JSON.parse(line);
+            await run(() => cancelledRequests.has(req));
+        } finally {
+            activeRequests.delete(req);
+            cancelledRequests.delete(req);
+        }
+    });
+}
 
-            if (req.type === 'ping') {
-                console.log(JSON.stringify({ type: 'pong' }));
-                continue;
-            }
+// ── Framed protocol ("frame2") ──────────────────────────────────────
+// 20-byte header: "MPF2", type (1 ASCII byte), 3 zero bytes, then request
+// id, id length and payload length (uint32 LE each); then id and payload
+// as raw UTF-8.
+const FRAME_MAGIC = Buffer.from('MPF2');
+const FRAME_HEADER = 20;
+
+function writeFrame(type: string, req: number, id: string, payload: string) {
+    const idBytes = Buffer.from(id, 'utf8');
+    const body = Buffer.from(payload, 'utf8');
+    const header = Buffer.alloc(FRAME_HEADER);
+    FRAME_MAGIC.copy(header, 0);
+    header[4] = type.charCodeAt(0);
+    header.writeUInt32LE(req, 8);
+    header.writeUInt32LE(idBytes.length, 12);
+    header.writeUInt32LE(body.length, 16);
+    process.stdout.write(Buffer.concat([header, idBytes, body]));
+}
 
-            if (req.type === 'render') {
-                // Validate theme (whitelist only)
-                const VALID_THEMES = ['default', 'dark', 'neutral', 'forest', 'base'];
-                const theme = (typeof req.theme === 'string' && VALID_THEMES.includes(req.theme))
-                    ? req.theme : 'default';
-
-                // Validate look (mermaid 11.14+: 'classic' | 'neo' | 'handDrawn')
-                const VALID_LOOKS = ['classic', 'neo', 'handDrawn'] as const;
-                const look = (typeof req.look === 'string' && (VALID_LOOKS as readonly string[]).includes(req.look))
-                    ? (req.look as typeof currentLook) : currentLook;
-
-                if (theme !== currentTheme || look !== currentLook) {
-                    currentTheme = theme;
-                    currentLook = look;
-                    mermaid.initialize({
-                        startOnLoad: false,
-                        securityLevel: 'strict',
-                        theme: currentTheme,
-                        look: currentLook,
-                        flowchart: { useMaxWidth: true, nodeSpacing: 60, rankSpacing: 80, curve: 'basis' },
-                        sequence: { useMaxWidth: true },
-                        architecture: { randomize: false },
-                    });
-                }
-
-                const results: Array<{ id: string; svg: string | null; error: string | null }> = [];
-                const blocks = Array.isArray(req.blocks) ? req.blocks : [];
-                const MAX_CODE_LENGTH = 100000; // 100KB per block
-
-                for (const block of blocks) {
-                    // Validate block.id: must be string, alphanumeric + dash/underscore
-                    if (typeof block.id !== 'string' || !/^[a-zA-Z0-9_-]+$/.test(block.id)) {
-                        results.push({ id: String(block.id || 'invalid'), svg: null, error: 'Invalid block id' });
-                        continue;
-                    }
-                    // Validate block.code: must be string with length limit
-                    if (typeof block.code !== 'string') {
-                        results.push({ id: block.id, svg: null, error: 'Invalid block code type' });
-                        continue;
-                    }
-                    if (block.code.length > MAX_CODE_LENGTH) {
-                        results.push({ id: block.id, svg: null, error: 'Code too long' });
-                        continue;
-                    }
-
-                    try {
-                        dom.window.document.body.innerHTML = '<div id="container"></div>';
-                        const { svg } = await mermaid.render(block.id, block.code);
-                        results.push({ id: block.id, svg: fixSvgBounds(svg), error: null });
-                    } catch (e: any) {
-                        results.push({
-                            id: block.id,
-                            svg: null,
-                            error: (e.message || String(e)).substring(0, 500),
-                        });
-                    }
-                }
-
-                console.log(JSON.stringify({ type: 'result', results }));
-                continue;
-            }
+let framed = false;
+const frameRequests = new Map<number, { theme: string; blocks: { id: string; code: string }[] }>();
+
+function handleFrame(type: string, req: number, id: string, payload: string) {
+    switch (type) {
+    case 'R': // begin render request; id = theme
+        frameRequests.set(req, { theme: id, blocks: [] });
+        return;
+    case 'C': // one block; id = block id, payload = mermaid source
+        frameRequests.get(req)?.blocks.push({ id, code: payload });
+        return;
+    case 'Z': { // end of request: render, one S / E frame per block, then D
+        const request = frameRequests.get(req);
+        frameRequests.delete(req);
+        if (!request) return;
+        enqueueRequest(req, async (cancelled) => {
+            await renderBlocks(request.blocks, request.theme, undefined, (r) => {
+                if (r.error !== null) writeFrame('E', req, r.id, r.error);
+                else writeFrame('S', req, r.id, r.svg ?? '');
+            }, cancelled);
+            writeFrame('D', req, '', String(request.blocks.length));
+        });
+        return;
+    }
+    case 'Q': // cancel request `req`
+        cancelRequest(req);
+        return;
+    default:
+        writeFrame('X', req, '', 'Unknown frame type: ' + type);
+    }
+}
 
-            console.log(JSON.stringify({ type: 'error', message: 'Unknown request type: ' + req.type }));
-        } catch (e: any) {
-            console.log(JSON.stringify({ type: 'error', message: 'JSON parse error: ' + e.message }));
+// ── JSON line requests ──────────────────────────────────────────────
+function handleLine(line: string) {
+    try {
+        const req = JSON.parse(line);
+
+        if (req.type === 'ping') {
+            console.log(JSON.stringify({ type: 'pong' }));
+            return;
+        }
+
+        if (req.type === 'cancel') {
+            if (typeof req.req === 'number') cancelRequest(req.req);
+            return;
+        }
+
+        if (req.type === 'framing' && req.mode === 'frame2') {
+            // Everything after this line, both ways, is framed.
+            framed = true;
+            writeFrame('K', 0, '', '');
+            return;
+        }
+
+        if (req.type === 'render') {
+            const results: BlockResult[] = [];
+            const blocks = Array.isArray(req.blocks) ? req.blocks : [];
+            const id = typeof req.req === 'number' ? req.req : undefined;
+            const tag = id !== undefined ? { req: id } : {};
+
+            // Streaming: flush each block the moment it is done so the
+            // host can show the first diagram without waiting for the
+            // slowest one.
+            const stream = req.stream === true;
+            enqueueRequest(id, async (cancelled) => {
+                await renderBlocks(blocks, req.theme, req.look, (r) => {
+                    if (stream) console.log(JSON.stringify({ type: 'block', ...tag, ...r }));
+                    else results.push(r);
+                }, cancelled);
+
+                if (stream) console.log(JSON.stringify({ type: 'done', ...tag, count: blocks.length }));
+                else console.log(JSON.stringify({ type: 'result', ...tag, results }));
+            });
+            return;
+        }
+
+        console.log(JSON.stringify({ type: 'error', message: 'Unknown request type: ' + req.type }));
+    } catch (e: any) {
+        console.log(JSON.stringify({ type: 'error', message: 'JSON parse error: ' + e.message }));
+    }
+}
+
+// ── Signal readiness ────────────────────────────────────────────────
+// "framing" lists the binary protocols this renderer accepts; the host
+// opts in with {"type":"framing","mode":"frame2"}. "cancel": requests can
+// be cancelled (see the header comment).
+console.log(JSON.stringify({ type: 'ready', framing: ['frame2'], cancel: true }));
+
+// ── Process stdin: JSON lines, then frames once negotiated ──────────
+let input = Buffer.alloc(0);
+
+for await (const chunk of Bun.stdin.stream()) {
+    input = input.length ? Buffer.concat([input, chunk]) : Buffer.from(chunk);
+
+    while (true) {
+        if (framed) {
+            if (input.length < FRAME_HEADER) break;
+            if (!input.subarray(0, 4).equals(FRAME_MAGIC)) {
+                writeFrame('X', 0, '', 'Bad frame header');
+                input = Buffer.alloc(0);
+                frameRequests.clear();
+                break;
+            }
+            const req = input.readUInt32LE(8);
+            const idLen = input.readUInt32LE(12);
+            const total = FRAME_HEADER + idLen + input.readUInt32LE(16);
+            if (input.length < total) break;
+            const type = String.fromCharCode(input[4]);
+            const id = input.toString('utf8', FRAME_HEADER, FRAME_HEADER + idLen);
+            const payload = input.toString('utf8', FRAME_HEADER + idLen, total);
+            input = input.subarray(total);
+            handleFrame(type, req, id, payload);
+        } else {
+            // '\n' never occurs inside a UTF-8 multi-byte sequence, so
+            // splitting bytes before decoding is safe.
+            const nl = input.indexOf(10);
+            if (nl === -1) break;
+            const line = input.toString('utf8', 0, nl).trim();
+            input = input.subarray(nl + 1);
+            if (line) handleLine(line);
         }
     }
 }
@@ -32,6 +32,7 @@
 #define IDT_SYNC_RESET_P2E      1004
 #define SYNC_RESET_MS           150
 
-// Background Bun render polling
-#define IDT_BUN_POLL            1005
-#define BUN_POLL_MS             40
+// Posted by render workers when results arrive (MermaidResultQueue notify)
+#define WM_BUN_RENDER_READY     (WM_APP + 1)
+// Posted by the preview builder when a page is ready (PreviewBuilder notify)
+#define WM_PREVIEW_READY        (WM_APP + 2)
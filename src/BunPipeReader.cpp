@@ -0,0 +1,274 @@
+#include "BunPipeReader.h"
+#include <algorithm>
+#include <chrono>
+
+static constexpr char   kFrameMagic[4] = { 'M', 'P', 'F', '2' };
+static constexpr size_t kFrameHeaderBytes = 20;
+static constexpr size_t kMaxFrameIdBytes = 1024;
+
+// Bytes requested per read. A frame whose header has arrived is read in
+// one go up to its full size.
+static constexpr size_t kReadChunk = 256 * 1024;
+
+static uint32_t ReadU32LE(const char* p)
+{
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+static void AppendU32LE(std::string& out, uint32_t v)
+{
+    out += (char)(v & 0xFF);
+    out += (char)((v >> 8) & 0xFF);
+    out += (char)((v >> 16) & 0xFF);
+    out += (char)((v >> 24) & 0xFF);
+}
+
+BunPipeReader::~BunPipeReader()
+{
+    Stop();
+}
+
+// ============================================================================
+// Start / Stop
+// ============================================================================
+bool BunPipeReader::Start(PipeHandle pipe)
+{
+    Stop();
+    m_pipe = pipe;
+    m_framed = false;
+    m_closed = false;
+    m_overflow = false;
+    m_closedDelivered = false;
+    if (!PlatformOpen()) {
+        PlatformClose();
+        return false;
+    }
+    m_thread = std::thread(&BunPipeReader::Run, this);
+    return true;
+}
+
+void BunPipeReader::Stop()
+{
+    if (m_thread.joinable()) {
+        PlatformWake();
+        m_thread.join();
+    }
+    PlatformClose();
+    m_buf.clear();
+    m_buf.shrink_to_fit();
+    m_pos = 0;
+    m_scanPos = 0;
+    m_want = 0;
+    {
+        std::lock_guard<std::mutex> deliver(m_deliverMutex);
+        m_onMessage = nullptr;
+        m_onClosed = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_messages.clear();
+}
+
+// ============================================================================
+// SetHandler - switch from Wait() to push delivery on the reader thread
+// ============================================================================
+void BunPipeReader::SetHandler(MessageHandler onMessage, std::function<void()> onClosed)
+{
+    std::lock_guard<std::mutex> deliver(m_deliverMutex);
+    std::deque<std::string> queued;
+    bool closed;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (onMessage) queued.swap(m_messages);
+        closed = m_closed;
+    }
+    m_onMessage = std::move(onMessage);
+    m_onClosed = std::move(onClosed);
+    if (m_onMessage)
+        for (auto& m : queued) m_onMessage(m);
+    if (closed && m_onClosed && !m_closedDelivered) {
+        m_closedDelivered = true;
+        m_onClosed();
+    }
+}
+
+// ============================================================================
+// Wait - next complete message, or false on timeout / closed pipe
+// ============================================================================
+bool BunPipeReader::Wait(std::string& message, unsigned timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                  [this] { return !m_messages.empty() || m_closed; });
+    if (m_messages.empty())
+        return false;
+    message = std::move(m_messages.front());
+    m_messages.pop_front();
+    return true;
+}
+
+// ============================================================================
+// Run - reader thread: read, split, publish
+// ============================================================================
+void BunPipeReader::Run()
+{
+    std::deque<std::string> ready;
+    while (true) {
+        // Read straight into the tail of the buffer, a whole pending frame
+        // at once when its size is known.
+        size_t used = m_buf.size();
+        size_t cap = std::max(kReadChunk, m_want > used ? m_want - used : 0);
+        m_buf.resize(used + cap);
+        long got = PlatformRead(&m_buf[used], cap);
+        m_buf.resize(used + (got > 0 ? (size_t)got : 0));
+        if (got <= 0)
+            break; // EOF, error or Stop()
+
+        bool ok = Split(ready);
+        if (!ok || m_buf.size() > kMaxMessageBytes) {
+            m_overflow = true;
+            break;
+        }
+        if (!ready.empty()) {
+            std::lock_guard<std::mutex> deliver(m_deliverMutex);
+            if (m_onMessage) {
+                for (auto& m : ready) m_onMessage(m);
+            } else {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    for (auto& m : ready) m_messages.push_back(std::move(m));
+                }
+                m_cv.notify_all();
+            }
+            ready.clear();
+        }
+    }
+    std::lock_guard<std::mutex> deliver(m_deliverMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_cv.notify_all();
+    if (m_onClosed && !m_closedDelivered) {
+        m_closedDelivered = true;
+        m_onClosed();
+    }
+}
+
+// ============================================================================
+// Split - cut complete lines / frames off the front of m_buf. Messages are
+// taken from a read offset and the rest is moved to the front once per
+// call, so a read holding many short messages costs one pass, not one
+// shift of the buffer per message.
+// ============================================================================
+void BunPipeReader::Take(std::deque<std::string>& out, size_t consumed, size_t length)
+{
+    std::string msg;
+    if (m_pos == 0 && m_buf.size() - consumed <= consumed) {
+        // Usually a large message is (almost) the whole buffer: hand the
+        // buffer itself over and copy only the few bytes after it.
+        msg = std::move(m_buf);
+        m_buf.assign(msg, consumed, std::string::npos);
+        msg.resize(length);
+    } else {
+        msg.assign(m_buf, m_pos, length);
+        m_pos += consumed;
+    }
+    m_scanPos = m_pos;
+    out.push_back(std::move(msg));
+}
+
+bool BunPipeReader::Split(std::deque<std::string>& out)
+{
+    bool ok = SplitFrom(out);
+    if (m_pos > 0) {
+        m_buf.erase(0, m_pos);
+        m_scanPos -= m_pos;
+        m_pos = 0;
+    }
+    if (m_want > 0)
+        m_buf.reserve(m_want);
+    return ok;
+}
+
+bool BunPipeReader::SplitFrom(std::deque<std::string>& out)
+{
+    const std::string_view magic(kFrameMagic, sizeof(kFrameMagic));
+
+    while (true) {
+        if (m_framed) {
+            // Resync: skip stray text before the magic, keeping a tail that
+            // could be the start of a split magic.
+            size_t start = m_buf.find(magic, m_pos);
+            if (start == std::string::npos) {
+                size_t keep = std::min(m_buf.size() - m_pos, magic.size() - 1);
+                m_pos = m_buf.size() - keep;
+                m_scanPos = m_pos;
+                return true;
+            }
+            m_pos = m_scanPos = start;
+            size_t avail = m_buf.size() - m_pos;
+            if (avail < kFrameHeaderBytes) return true;
+
+            const char* header = m_buf.data() + m_pos;
+            size_t idLen = ReadU32LE(header + 12);
+            size_t payloadLen = ReadU32LE(header + 16);
+            if (idLen > kMaxFrameIdBytes ||
+                payloadLen > kMaxMessageBytes - kFrameHeaderBytes - idLen)
+                return false;
+            size_t total = kFrameHeaderBytes + idLen + payloadLen;
+            if (avail < total) {
+                m_want = total;
+                return true;
+            }
+            m_want = 0;
+            Take(out, total, total);
+        } else {
+            size_t nl = m_buf.find('\n', std::max(m_scanPos, m_pos));
+            if (nl == std::string::npos) {
+                m_scanPos = m_buf.size();
+                return true;
+            }
+            size_t len = nl - m_pos;
+            if (len > 0 && m_buf[nl - 1] == '\r') len--;
+            if (len == 0) {
+                m_pos = m_scanPos = nl + 1;
+                continue;
+            }
+            Take(out, nl + 1 - m_pos, len);
+        }
+    }
+}
+
+// ============================================================================
+// AppendFrame / ParseFrame
+// ============================================================================
+void BunPipeReader::AppendFrame(std::string& out, char type, uint32_t request,
+                                std::string_view id, std::string_view payload)
+{
+    out.append(kFrameMagic, sizeof(kFrameMagic));
+    out += type;
+    out.append(3, '\0');
+    AppendU32LE(out, request);
+    AppendU32LE(out, (uint32_t)id.size());
+    AppendU32LE(out, (uint32_t)payload.size());
+    out.append(id);
+    out.append(payload);
+}
+
+bool BunPipeReader::ParseFrame(std::string_view message, Frame& frame)
+{
+    if (message.size() < kFrameHeaderBytes ||
+        message.compare(0, sizeof(kFrameMagic), std::string_view(kFrameMagic, sizeof(kFrameMagic))) != 0)
+        return false;
+    size_t idLen = ReadU32LE(message.data() + 12);
+    size_t payloadLen = ReadU32LE(message.data() + 16);
+    if (message.size() - kFrameHeaderBytes < idLen ||
+        message.size() - kFrameHeaderBytes - idLen != payloadLen)
+        return false;
+    frame.type = message[4];
+    frame.request = ReadU32LE(message.data() + 8);
+    frame.id = message.substr(kFrameHeaderBytes, idLen);
+    frame.payload = message.substr(kFrameHeaderBytes + idLen, payloadLen);
+    return true;
+}
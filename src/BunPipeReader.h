@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Read end of a Bun renderer's stdout. A dedicated thread blocks on the
+// pipe (overlapped ReadFile on Windows, poll() elsewhere — see
+// BunPipeReaderWin32.cpp / BunPipeReaderPosix.cpp), splits what arrives
+// into complete messages and hands them to Wait() through a condition
+// variable, so a waiting render wakes as soon as a reply is complete
+// instead of on the next 10 ms poll. Once a handler is installed
+// (SetHandler) messages go straight to it on the reader thread instead.
+//
+// Messages are '\n'-terminated lines (CR trimmed, empty lines dropped)
+// until SetFramed(true), then "frame2" frames: a 20-byte header — "MPF2",
+// type byte, 3 reserved bytes, then uint32 LE request id, id length and
+// payload length — followed by id and payload. Text before a frame magic
+// (stderr shares the pipe) is skipped.
+//
+// The platform layer is the only non-portable part, so the reader can be
+// driven from a stub child process on Linux.
+class BunPipeReader {
+public:
+#ifdef _WIN32
+    using PipeHandle = void*;   // HANDLE
+    static constexpr PipeHandle kNoPipe = nullptr;
+#else
+    using PipeHandle = int;     // file descriptor
+    static constexpr PipeHandle kNoPipe = -1;
+#endif
+
+    // One decoded frame; views into the message it was parsed from.
+    struct Frame {
+        char             type = 0;
+        uint32_t         request = 0;   // 0: not tied to a request
+        std::string_view id;
+        std::string_view payload;
+    };
+
+    // Nothing a renderer sends legitimately comes close: a 10 MB SVG cap
+    // applies per block. A message that outgrows this closes the reader.
+    static constexpr size_t kMaxMessageBytes = 20 * 1024 * 1024;
+
+    BunPipeReader() = default;
+    ~BunPipeReader();
+
+    BunPipeReader(const BunPipeReader&) = delete;
+    BunPipeReader& operator=(const BunPipeReader&) = delete;
+
+    // Create a pipe for a child's stdout: the read end for Start(), the
+    // write end inheritable for the child. On Windows the read end is an
+    // overlapped named pipe so the reader thread can be stopped at will.
+    static bool CreateStdoutPipe(PipeHandle& readEnd, PipeHandle& writeEnd);
+    static void ClosePipe(PipeHandle h);
+
+    // Take ownership of `pipe` and start the reader thread.
+    bool Start(PipeHandle pipe);
+
+    // Stop the thread, close the pipe, drop anything unread.
+    void Stop();
+
+    // Switch the splitter to frames. Call before asking the child to
+    // switch, so no frame byte can be read as text.
+    void SetFramed(bool framed) { m_framed = framed; }
+
+    // Hand every message to onMessage on the reader thread instead of
+    // queueing it for Wait(); messages already queued are delivered first,
+    // from the calling thread. onClosed runs once when the pipe closes or
+    // the reader is stopped (here, if that has already happened). Both are
+    // dropped by Stop().
+    using MessageHandler = std::function<void(std::string& message)>;
+    void SetHandler(MessageHandler onMessage, std::function<void()> onClosed);
+
+    // Wait up to timeoutMs for the next message. False on timeout, or once
+    // the pipe is closed and every complete message has been taken.
+    bool Wait(std::string& message, unsigned timeoutMs);
+
+    // The pipe reached EOF / failed, or a message exceeded kMaxMessageBytes
+    // (Overflowed). Complete messages may still be queued.
+    bool IsClosed() const { return m_closed; }
+    bool Overflowed() const { return m_overflow; }
+
+    // Frame layout helpers shared with the writing side.
+    static void AppendFrame(std::string& out, char type, uint32_t request,
+                            std::string_view id, std::string_view payload);
+    static bool ParseFrame(std::string_view message, Frame& frame);
+
+private:
+    void Run();
+
+    // Move complete messages from m_buf to `out`. False on a corrupt or
+    // oversized frame header.
+    // Split compacts once after SplitFrom has taken what it can from m_pos.
+    bool Split(std::deque<std::string>& out);
+    bool SplitFrom(std::deque<std::string>& out);
+    void Take(std::deque<std::string>& out, size_t consumed, size_t length);
+
+    // Platform layer
+    bool PlatformOpen();
+    long PlatformRead(char* dst, size_t cap);   // >0 bytes, 0 EOF, -1 error / stopped
+    void PlatformWake();
+    void PlatformClose();
+
+    PipeHandle m_pipe = kNoPipe;
+#ifdef _WIN32
+    void* m_hReadEvent = nullptr;
+    void* m_hStopEvent = nullptr;
+#else
+    int   m_wakeRead = -1;
+    int   m_wakeWrite = -1;
+#endif
+
+    std::thread             m_thread;
+    std::atomic<bool>       m_framed{false};
+    std::atomic<bool>       m_closed{false};
+    std::atomic<bool>       m_overflow{false};
+
+    // Reader thread only
+    std::string             m_buf;
+    size_t                  m_pos = 0;       // m_buf[0, m_pos) is consumed; 0 between Splits
+    size_t                  m_scanPos = 0;   // m_buf[m_pos, m_scanPos) has no '\n'
+    size_t                  m_want = 0;      // size of the frame being received
+
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::string> m_messages;      // guarded by m_mutex
+
+    // Held while a handler runs, so SetHandler's hand-over can't reorder
+    // messages and onClosed runs exactly once.
+    std::mutex              m_deliverMutex;
+    MessageHandler          m_onMessage;     // guarded by m_deliverMutex
+    std::function<void()>   m_onClosed;      // guarded by m_deliverMutex
+    bool                    m_closedDelivered = false;
+};
@@ -0,0 +1,71 @@
+#include "BunPipeReader.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// POSIX half of BunPipeReader: poll() on the pipe plus a self-pipe that
+// Stop() writes to. Not used by the plugin itself; it lets the reader be
+// exercised against a stub child process on Linux.
+
+bool BunPipeReader::CreateStdoutPipe(PipeHandle& readEnd, PipeHandle& writeEnd)
+{
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC); // the child only gets the write end
+    readEnd = fds[0];
+    writeEnd = fds[1];
+    return true;
+}
+
+void BunPipeReader::ClosePipe(PipeHandle h)
+{
+    if (h != kNoPipe) close(h);
+}
+
+bool BunPipeReader::PlatformOpen()
+{
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    m_wakeRead = fds[0];
+    m_wakeWrite = fds[1];
+    return true;
+}
+
+long BunPipeReader::PlatformRead(char* dst, size_t cap)
+{
+    while (true) {
+        pollfd fds[2] = { { m_pipe, POLLIN, 0 }, { m_wakeRead, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (fds[1].revents) return -1; // Stop()
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(m_pipe, dst, cap);
+            if (n < 0 && errno == EINTR) continue;
+            return n < 0 ? -1 : (long)n;
+        }
+        if (fds[0].revents) return -1; // POLLERR / POLLNVAL
+    }
+}
+
+void BunPipeReader::PlatformWake()
+{
+    if (m_wakeWrite >= 0) {
+        char c = 0;
+        ssize_t ignored = write(m_wakeWrite, &c, 1);
+        (void)ignored;
+    }
+}
+
+void BunPipeReader::PlatformClose()
+{
+    ClosePipe(m_pipe);
+    m_pipe = kNoPipe;
+    if (m_wakeRead >= 0) close(m_wakeRead);
+    if (m_wakeWrite >= 0) close(m_wakeWrite);
+    m_wakeRead = m_wakeWrite = -1;
+}
@@ -0,0 +1,103 @@
+#include <windows.h>
+#include "BunPipeReader.h"
+
+// Windows half of BunPipeReader. CreatePipe() pipes are synchronous, so a
+// blocked ReadFile could only be interrupted by killing the child; the
+// read end is instead a uniquely named, overlapped, inbound pipe and the
+// reader thread waits on the read event and a stop event together.
+
+// ============================================================================
+// CreateStdoutPipe - overlapped read end, inheritable synchronous write end
+// ============================================================================
+bool BunPipeReader::CreateStdoutPipe(PipeHandle& readEnd, PipeHandle& writeEnd)
+{
+    static volatile LONG s_serial = 0;
+
+    for (int attempt = 0; attempt < 4; attempt++) {
+        WCHAR name[96];
+        swprintf_s(name, L"\\\\.\\pipe\\MermaidPreview.%lu.%ld.%lu",
+                   GetCurrentProcessId(), InterlockedIncrement(&s_serial), GetTickCount());
+
+        HANDLE hRead = CreateNamedPipeW(
+            name,
+            PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+            PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            1, 64 * 1024, 64 * 1024, 0, nullptr);
+        if (hRead == INVALID_HANDLE_VALUE) {
+            if (GetLastError() == ERROR_ACCESS_DENIED) continue; // name taken
+            return false;
+        }
+
+        SECURITY_ATTRIBUTES sa = {};
+        sa.nLength = sizeof(sa);
+        sa.bInheritHandle = TRUE;
+        HANDLE hWrite = CreateFileW(name, GENERIC_WRITE, 0, &sa, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hWrite == INVALID_HANDLE_VALUE) {
+            CloseHandle(hRead);
+            return false;
+        }
+
+        readEnd = hRead;
+        writeEnd = hWrite;
+        return true;
+    }
+    return false;
+}
+
+void BunPipeReader::ClosePipe(PipeHandle h)
+{
+    if (h) CloseHandle(h);
+}
+
+bool BunPipeReader::PlatformOpen()
+{
+    m_hReadEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    m_hStopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    return m_hReadEvent && m_hStopEvent;
+}
+
+// ============================================================================
+// PlatformRead - one overlapped read, abandoned if the stop event fires
+// ============================================================================
+long BunPipeReader::PlatformRead(char* dst, size_t cap)
+{
+    HANDLE hPipe = (HANDLE)m_pipe;
+    OVERLAPPED ov = {};
+    ov.hEvent = (HANDLE)m_hReadEvent;
+    DWORD got = 0;
+
+    if (cap > MAXDWORD) cap = MAXDWORD;
+    if (!ReadFile(hPipe, dst, (DWORD)cap, nullptr, &ov)) {
+        DWORD err = GetLastError();
+        if (err == ERROR_BROKEN_PIPE) return 0;
+        if (err != ERROR_IO_PENDING) return -1;
+
+        HANDLE waits[2] = { (HANDLE)m_hReadEvent, (HANDLE)m_hStopEvent };
+        DWORD w = WaitForMultipleObjects(2, waits, FALSE, INFINITE);
+        if (w != WAIT_OBJECT_0) {
+            // Stop(): cancel and wait for the cancellation, since `ov` and
+            // `dst` must outlive the I/O.
+            CancelIoEx(hPipe, &ov);
+            GetOverlappedResult(hPipe, &ov, &got, TRUE);
+            return -1;
+        }
+    }
+    if (!GetOverlappedResult(hPipe, &ov, &got, FALSE))
+        return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+    return (long)got;
+}
+
+void BunPipeReader::PlatformWake()
+{
+    if (m_hStopEvent) SetEvent((HANDLE)m_hStopEvent);
+}
+
+void BunPipeReader::PlatformClose()
+{
+    ClosePipe(m_pipe);
+    m_pipe = kNoPipe;
+    if (m_hReadEvent) CloseHandle((HANDLE)m_hReadEvent);
+    if (m_hStopEvent) CloseHandle((HANDLE)m_hStopEvent);
+    m_hReadEvent = m_hStopEvent = nullptr;
+}
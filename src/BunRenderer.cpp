@@ -1,9 +1,28 @@
 #include "BunRenderer.h"
+#include "JsonReader.h"
 #include <shlobj.h>
+#include <chrono>
 
 // Get the DLL's HMODULE
 extern HINSTANCE EEGetInstanceHandle();
 
+// ============================================================================
+// "frame2" frame types (layout: see BunPipeReader.h). renderer.ts offers the
+// protocol in its ready line; Start() accepts it. Every frame of a render
+// request carries its request id, and Bun echoes it on each reply.
+// ============================================================================
+// host → Bun
+static constexpr char kFrameRender = 'R';  // id = theme
+static constexpr char kFrameCode   = 'C';  // id = block id, payload = source
+static constexpr char kFrameEnd    = 'Z';  // end of render request
+static constexpr char kFrameCancel = 'Q';  // skip what's left of the request
+// Bun → host
+static constexpr char kFrameAck    = 'K';  // framing accepted
+static constexpr char kFrameSvg    = 'S';  // id = block id, payload = SVG
+static constexpr char kFrameError  = 'E';  // id = block id, payload = message
+static constexpr char kFrameDone   = 'D';  // payload = block count
+static constexpr char kFrameFatal  = 'X';  // payload = message (request 0: all lost)
+
 BunRenderer::BunRenderer() = default;
 
 BunRenderer::~BunRenderer()
@@ -23,12 +42,12 @@ std::string BunRenderer::WtoU8(const std::wstring& ws)
     return s;
 }
 
-std::wstring BunRenderer::U8toW(const std::string& s)
+std::wstring BunRenderer::U8toW(std::string_view s)
 {
     if (s.empty()) return {};
-    int len = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), nullptr, 0);
+    int len = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), nullptr, 0);
     std::wstring ws(len, L'\0');
-    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.size(), ws.data(), len);
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), ws.data(), len);
     return ws;
 }
 
@@ -99,6 +118,44 @@ std::wstring BunRenderer::GetRendererPath() const
     return dir + L"\\bun-renderer\\renderer.ts";
 }
 
+// ============================================================================
+// OutputVersion - "mermaid@<version>/<renderer.ts stamp>" for cache keys
+// ============================================================================
+std::wstring BunRenderer::OutputVersion() const
+{
+    std::wstring rendererPath = GetRendererPath();
+    std::wstring dir = rendererPath.substr(0, rendererPath.find_last_of(L"\\/"));
+    std::wstring packagePath = dir + L"\\node_modules\\mermaid\\package.json";
+
+    HANDLE hFile = CreateFileW(packagePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return L"";
+    std::string json(64 * 1024, '\0'); // "version" comes early; the file is ~10 KB
+    DWORD bytesRead = 0;
+    ReadFile(hFile, &json[0], (DWORD)json.size(), &bytesRead, nullptr);
+    CloseHandle(hFile);
+    json.resize(bytesRead);
+
+    std::wstring version;
+    JsonReader r(json);
+    std::string_view key;
+    if (r.EnterObject())
+        while (version.empty() && r.NextMember(key)) {
+            if (key == "version") r.ReadString(version, 64);
+            else r.Skip();
+        }
+    if (version.empty())
+        return L"";
+
+    WIN32_FILE_ATTRIBUTE_DATA info = {};
+    GetFileAttributesExW(rendererPath.c_str(), GetFileExInfoStandard, &info);
+    WCHAR stamp[64];
+    swprintf_s(stamp, L"/%08lx%08lx-%lu", info.ftLastWriteTime.dwHighDateTime,
+               info.ftLastWriteTime.dwLowDateTime, info.nFileSizeLow);
+    return L"mermaid@" + version + stamp;
+}
+
 // ============================================================================
 // EnsureSetup - verify bun-renderer directory and node_modules exist
 // ============================================================================
@@ -144,9 +201,25 @@ bool BunRenderer::EnsureSetup()
 }
 
 // ============================================================================
-// Start - spawn the persistent Bun process
+// Start / Stop - serialized, since pool threads may restart a worker while
+// another batch is still talking to it
 // ============================================================================
 bool BunRenderer::Start()
+{
+    std::lock_guard<std::mutex> lock(m_lifecycleMutex);
+    return Launch();
+}
+
+void BunRenderer::Stop()
+{
+    std::lock_guard<std::mutex> lock(m_lifecycleMutex);
+    Shutdown();
+}
+
+// ============================================================================
+// Launch - spawn the persistent Bun process
+// ============================================================================
+bool BunRenderer::Launch()
 {
     if (m_bReady)
         return true;
@@ -174,7 +247,8 @@ bool BunRenderer::Start()
 
     if (!CreatePipe(&hStdinRead, &hStdinWrite, &sa, 0))
         return false;
-    if (!CreatePipe(&hStdoutRead, &hStdoutWrite, &sa, 0)) {
+    // stdout is an overlapped pipe drained by m_reader's thread
+    if (!BunPipeReader::CreateStdoutPipe(hStdoutRead, hStdoutWrite)) {
         CloseHandle(hStdinRead);
         CloseHandle(hStdinWrite);
         return false;
@@ -182,7 +256,6 @@ bool BunRenderer::Start()
 
     // Ensure our end of the pipes are not inherited
     SetHandleInformation(hStdinWrite, HANDLE_FLAG_INHERIT, 0);
-    SetHandleInformation(hStdoutRead, HANDLE_FLAG_INHERIT, 0);
 
     // Build command line: bun run renderer.ts
     std::wstring cmd = L"\"" + bunPath + L"\" run \"" + rendererPath + L"\"";
@@ -213,258 +286,479 @@ bool BunRenderer::Start()
 
     m_hProcess = pi.hProcess;
     CloseHandle(pi.hThread);
-    m_hStdinWrite = hStdinWrite;
-    m_hStdoutRead = hStdoutRead;
+    {
+        std::lock_guard<std::mutex> write(m_writeMutex);
+        m_hStdinWrite = hStdinWrite;
+    }
+    if (!m_reader.Start(hStdoutRead)) {
+        Shutdown();
+        return false;
+    }
 
     // Wait for "ready" message (up to 5 seconds)
     std::string line = ReadLine(5000);
-    if (line.find("\"ready\"") != std::string::npos) {
-        m_bReady = true;
-        return true;
+    if (line.find("\"ready\"") == std::string::npos) {
+        // Failed to start
+        Shutdown();
+        return false;
     }
 
-    // Failed to start
-    Stop();
-    return false;
+    // Cancellation arrived after framing; an older renderer.ts would answer
+    // an unknown request with an error line.
+    m_bCancel = line.find("\"cancel\":true") != std::string::npos;
+
+    // Switch to binary frames if the renderer offers them. An older
+    // renderer.ts doesn't, and keeps talking JSON lines.
+    if (line.find("\"frame2\"") != std::string::npos) {
+        m_reader.SetFramed(true);
+        if (!SendLine("{\"type\":\"framing\",\"mode\":\"frame2\"}")) {
+            Shutdown();
+            return false;
+        }
+        // Stray stderr lines queued before the switch come out as unknown
+        // frames; wait past them for the ack.
+        BunPipeReader::Frame ack;
+        DWORD ackStart = GetTickCount();
+        do {
+            DWORD elapsed = GetTickCount() - ackStart;
+            if (elapsed >= 5000 || !ReadFrame(5000 - elapsed, ack)) {
+                Shutdown();
+                return false;
+            }
+        } while (ack.type != kFrameAck);
+        m_bFramed = true;
+    }
+
+    // From here on the reader thread routes every reply to its request
+    // itself; nothing calls ReadLine / ReadFrame any more.
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        m_channelOpen = true;
+    }
+    m_reader.SetHandler([this](std::string& message) { OnMessage(message); },
+                        [this]() { FailPending(true); });
+
+    m_bReady = true;
+    return true;
 }
 
 // ============================================================================
-// Stop - terminate the Bun process
+// Shutdown - terminate the Bun process
 // ============================================================================
-void BunRenderer::Stop()
+void BunRenderer::Shutdown()
 {
     m_bReady = false;
 
-    if (m_hStdinWrite) {
-        CloseHandle(m_hStdinWrite);
-        m_hStdinWrite = nullptr;
-    }
-    if (m_hStdoutRead) {
-        CloseHandle(m_hStdoutRead);
-        m_hStdoutRead = nullptr;
-    }
+    // Kill first: a writer blocked on a full stdin pipe then fails at once
+    // and releases m_writeMutex.
     if (m_hProcess) {
         TerminateProcess(m_hProcess, 0);
         WaitForSingleObject(m_hProcess, 3000);
         CloseHandle(m_hProcess);
         m_hProcess = nullptr;
     }
-    m_readBuffer.clear();
+    {
+        std::lock_guard<std::mutex> write(m_writeMutex);
+        if (m_hStdinWrite) {
+            CloseHandle(m_hStdinWrite);
+            m_hStdinWrite = nullptr;
+        }
+    }
+    // After the process is gone, so the reader thread sees EOF if it
+    // hasn't been woken already. Its close handler fails whatever is still
+    // in flight.
+    m_reader.Stop();
+    m_bFramed = false;
+    m_bCancel = false;
+    m_frameMessage.clear();
 }
 
 // ============================================================================
-// SendLine - write JSON line to stdin pipe
+// SendBytes / SendLine - write to stdin pipe
 // ============================================================================
-bool BunRenderer::SendLine(const std::string& json)
+bool BunRenderer::SendBytes(const char* data, size_t size)
 {
     if (!m_hStdinWrite) return false;
-    std::string line = json + "\n";
     DWORD written = 0;
-    return WriteFile(m_hStdinWrite, line.data(), (DWORD)line.size(), &written, nullptr) && written == line.size();
+    return WriteFile(m_hStdinWrite, data, (DWORD)size, &written, nullptr) && written == size;
+}
+
+bool BunRenderer::SendLine(const std::string& json)
+{
+    std::string line = json + "\n";
+    return SendBytes(line.data(), line.size());
 }
 
 // ============================================================================
-// ReadLine - read a line from stdout pipe (with timeout)
+// ReadLine - next line from the reader thread (with timeout). Start-up only.
 // ============================================================================
 std::string BunRenderer::ReadLine(DWORD timeoutMs)
 {
-    if (!m_hStdoutRead) return "";
-
-    // Hard cap on accumulated buffer size to prevent OOM if Bun goes berserk
-    // (crash loop, infinite output, no newline ever). 20 MB covers any
-    // realistic single-frame mermaid render response with margin.
-    constexpr size_t kMaxBufferBytes = 20 * 1024 * 1024;
-
-    DWORD startTime = GetTickCount();
-    char buf[4096];
-
-    while (true) {
-        // Check if we already have a line in the buffer
-        size_t nl = m_readBuffer.find('\n');
-        if (nl != std::string::npos) {
-            std::string line = m_readBuffer.substr(0, nl);
-            m_readBuffer = m_readBuffer.substr(nl + 1);
-            // Trim \r
-            if (!line.empty() && line.back() == '\r')
-                line.pop_back();
-            return line;
-        }
+    std::string line;
+    if (!m_reader.Wait(line, timeoutMs)) {
+        // Runaway output (no newline within BunPipeReader::kMaxMessageBytes):
+        // kill the process rather than leave it blocked on a full pipe.
+        if (m_reader.Overflowed()) Shutdown();
+        return "";
+    }
+    return line;
+}
 
-        // Check timeout
-        DWORD elapsed = GetTickCount() - startTime;
-        if (elapsed >= timeoutMs)
-            return "";
-
-        // Check if data available
-        DWORD available = 0;
-        if (!PeekNamedPipe(m_hStdoutRead, nullptr, 0, nullptr, &available, nullptr))
-            return "";
-
-        if (available == 0) {
-            // Check if process is still alive
-            DWORD exitCode = 0;
-            if (!GetExitCodeProcess(m_hProcess, &exitCode) || exitCode != STILL_ACTIVE)
-                return "";
-            Sleep(10);
-            continue;
-        }
+// ============================================================================
+// ReadFrame - next frame from the reader thread (with timeout). Start-up only.
+// ============================================================================
+bool BunRenderer::ReadFrame(DWORD timeoutMs, BunPipeReader::Frame& frame)
+{
+    if (!m_reader.Wait(m_frameMessage, timeoutMs)) {
+        if (m_reader.Overflowed()) Shutdown(); // corrupt or oversized frame
+        return false;
+    }
+    // Lines queued before the switch (stray stderr output) parse as
+    // nothing; report them as an unknown frame type.
+    if (!BunPipeReader::ParseFrame(m_frameMessage, frame))
+        frame = BunPipeReader::Frame{};
+    return true;
+}
 
-        DWORD toRead = (available < sizeof(buf)) ? available : sizeof(buf);
-        DWORD bytesRead = 0;
-        if (!ReadFile(m_hStdoutRead, buf, toRead, &bytesRead, nullptr) || bytesRead == 0)
-            return "";
+// ============================================================================
+// DecodeResult / DecodeMessage - single-pass decode of a Bun response line
+// straight into MermaidRenderResult (any key order, unknown keys skipped)
+// ============================================================================
 
-        m_readBuffer.append(buf, bytesRead);
+// Per-block cap: a single malicious/runaway block can't make the decoder
+// allocate without bound. In wchar_t units.
+static constexpr size_t kMaxSvgChars = 10 * 1024 * 1024;
+static constexpr size_t kMaxErrorChars = 64 * 1024;
 
-        // Buffer overflow guard: kill the runaway process and bail out.
-        if (m_readBuffer.size() > kMaxBufferBytes) {
-            m_readBuffer.clear();
-            Stop();
-            return "";
+// Fields shared by a streamed {"type":"block",...} line and the elements of
+// a legacy "results" array.
+static bool DecodeResultField(JsonReader& json, std::string_view key,
+                              MermaidRenderResult& r, bool& svgTooLarge)
+{
+    bool truncated = false;
+    if (key == "id")
+        return json.ReadString(r.id, 256, nullptr, true);
+    if (key == "svg") {
+        if (!json.ReadString(r.svg, kMaxSvgChars, &truncated, true)) return false;
+        if (truncated) svgTooLarge = true;
+        return true;
+    }
+    if (key == "error") {
+        if (!json.ReadString(r.error, kMaxErrorChars, &truncated, true)) return false;
+        if (truncated) r.error = L"Render failed";
+        return true;
+    }
+    return json.Skip();
+}
+
+static void FinishResult(MermaidRenderResult& r, bool svgTooLarge)
+{
+    if (svgTooLarge) {
+        r.svg.clear();
+        r.error = L"SVG too large";
+    }
+}
+
+static bool DecodeResult(JsonReader& json, MermaidRenderResult& r)
+{
+    bool svgTooLarge = false;
+    std::string_view key;
+    if (!json.EnterObject()) return false;
+    while (json.NextMember(key))
+        if (!DecodeResultField(json, key, r, svgTooLarge)) return false;
+    if (json.Failed() || r.id.empty()) return false;
+    FinishResult(r, svgTooLarge);
+    return true;
+}
+
+enum class BunMessage { Block, Done, Result, Error, Other };
+
+// Decode one line into `results` (empty for done/error). `request` is the
+// echoed "req"; hasRequest stays false for a renderer.ts that predates
+// request ids. A legacy batch line that breaks half-way still yields the
+// blocks before the damage.
+static BunMessage DecodeMessage(std::string_view line,
+                                std::vector<MermaidRenderResult>& results,
+                                uint32_t& request, bool& hasRequest)
+{
+    JsonReader json(line);
+    std::string_view key, type;
+    MermaidRenderResult r;
+    bool svgTooLarge = false;
+
+    if (json.Peek() != JsonReader::Type::Object || !json.EnterObject())
+        return BunMessage::Other; // stray stderr output (merged into stdout)
+
+    while (json.NextMember(key)) {
+        bool ok;
+        if (key == "type") {
+            ok = json.ReadRawString(type);
+        } else if (key == "req") {
+            ok = json.ReadUInt32(request);
+            hasRequest = ok;
+        } else if (key == "results") {
+            // Non-streaming renderer: whole batch in one line.
+            ok = json.EnterArray();
+            while (ok && json.NextElement()) {
+                MermaidRenderResult item;
+                ok = DecodeResult(json, item);
+                if (ok) results.push_back(std::move(item));
+            }
+            ok = ok && !json.Failed();
+        } else {
+            ok = DecodeResultField(json, key, r, svgTooLarge);
         }
+        if (!ok) break;
+    }
+
+    if (type == "block") {
+        if (json.Failed() || r.id.empty()) return BunMessage::Other;
+        FinishResult(r, svgTooLarge);
+        results.push_back(std::move(r));
+        return BunMessage::Block;
     }
+    if (type == "done")   return BunMessage::Done;
+    if (type == "result") return BunMessage::Result;
+    if (type == "error")  return BunMessage::Error;
+    return BunMessage::Other;
 }
 
 // ============================================================================
-// RenderBlocks - send mermaid code to Bun, get SVG back
+// OnMessage - reader thread: route one reply to its request
+//
+// Framed replies carry the request id in the header, JSON lines in "req".
+// A renderer.ts without ids answers strictly in order, so its replies go to
+// the oldest request. Either way a late reply to an abandoned (timed out)
+// request is dropped, so it can never be read as the result of a later one.
 // ============================================================================
-std::vector<MermaidRenderResult> BunRenderer::RenderBlocks(
-    const std::vector<std::pair<std::wstring, std::wstring>>& blocks,
-    const std::wstring& theme)
+void BunRenderer::OnMessage(std::string& message)
 {
     std::vector<MermaidRenderResult> results;
 
-    if (!m_bReady || blocks.empty())
-        return results;
-
-    // Build JSON request
-    std::string json = "{\"type\":\"render\",\"blocks\":[";
-    for (size_t i = 0; i < blocks.size(); i++) {
-        if (i > 0) json += ",";
-        json += "{\"id\":\"" + JsonEscape(WtoU8(blocks[i].first)) + "\",";
-        json += "\"code\":\"" + JsonEscape(WtoU8(blocks[i].second)) + "\"}";
-    }
-    json += "],\"theme\":\"" + JsonEscape(WtoU8(theme)) + "\"}";
-
-    if (!SendLine(json))
-        return results;
-
-    // Read response. Cap the timeout at 15 s so a hung Bun can't freeze the
-    // EmEditor UI thread for minutes — the caller falls back to client-side
-    // rendering when this returns empty.
-    DWORD timeout = 5000 + (DWORD)blocks.size() * 1000;
-    if (timeout > 15000) timeout = 15000;
-    std::string response = ReadLine(timeout);
-
-    if (response.empty())
-        return results;
-
-    // Simple JSON parsing for the response
-    // Format: {"type":"result","results":[{"id":"...","svg":"...","error":null},...]}
-    // We use a basic approach since we control both sides of the protocol
-
-    // Find "results" array
-    size_t resultsStart = response.find("\"results\":[");
-    if (resultsStart == std::string::npos)
-        return results;
-
-    resultsStart += 11; // Skip "results":[
-
-    // Parse each result object
-    size_t pos = resultsStart;
-    while (pos < response.size()) {
-        size_t objStart = response.find('{', pos);
-        if (objStart == std::string::npos) break;
-
-        // Find id
-        size_t idKey = response.find("\"id\":\"", objStart);
-        if (idKey == std::string::npos) break;
-        idKey += 6;
-        size_t idEnd = response.find('"', idKey);
-        std::string id = response.substr(idKey, idEnd - idKey);
-
-        MermaidRenderResult r;
-        r.id = U8toW(id);
-
-        // Check for svg
-        size_t svgKey = response.find("\"svg\":", idEnd);
-        if (svgKey != std::string::npos) {
-            size_t svgValStart = svgKey + 6;
-            // Skip whitespace
-            while (svgValStart < response.size() && response[svgValStart] == ' ') svgValStart++;
-
-            if (response[svgValStart] == '"') {
-                // SVG string value - find the matching close quote (handle escaped quotes)
-                svgValStart++;
-                std::string svgStr;
-                // Per-block SVG cap: prevents a single malicious/runaway block
-                // from consuming unbounded memory during JSON unescape.
-                constexpr size_t kMaxSvgBytes = 10 * 1024 * 1024; // 10 MB
-                bool svgOverflow = false;
-                size_t si = svgValStart;
-                while (si < response.size()) {
-                    if (response[si] == '\\' && si + 1 < response.size()) {
-                        char next = response[si + 1];
-                        if (next == '"') { svgStr += '"'; si += 2; }
-                        else if (next == '\\') { svgStr += '\\'; si += 2; }
-                        else if (next == 'n') { svgStr += '\n'; si += 2; }
-                        else if (next == 'r') { svgStr += '\r'; si += 2; }
-                        else if (next == 't') { svgStr += '\t'; si += 2; }
-                        else if (next == '/') { svgStr += '/'; si += 2; }
-                        else { svgStr += response[si]; si++; }
-                    } else if (response[si] == '"') {
-                        break;
-                    } else {
-                        svgStr += response[si];
-                        si++;
-                    }
-                    if (svgStr.size() > kMaxSvgBytes) { svgOverflow = true; break; }
-                }
-                if (svgOverflow) {
-                    r.svg.clear();
-                    r.error = L"SVG too large";
-                    // Skip to the next block boundary
-                    size_t closeQ = response.find('"', si);
-                    pos = (closeQ != std::string::npos) ? closeQ + 1 : response.size();
-                } else {
-                    r.svg = U8toW(svgStr);
-                    pos = si + 1;
-                }
-            } else if (response.substr(svgValStart, 4) == "null") {
-                pos = svgValStart + 4;
+    if (m_bFramed) {
+        BunPipeReader::Frame f;
+        if (!BunPipeReader::ParseFrame(message, f))
+            return; // a stray stderr line queued before the switch
+        if (f.type == kFrameSvg || f.type == kFrameError) {
+            MermaidRenderResult r;
+            r.id = U8toW(f.id);
+            if (f.type == kFrameError) {
+                r.error = U8toW(f.payload.substr(0, kMaxErrorChars));
+                if (r.error.empty()) r.error = L"Render failed";
             }
+            else if ((r.svg = U8toW(f.payload)).size() > kMaxSvgChars) {
+                r.svg.clear();
+                r.error = L"SVG too large";
+            }
+            if (r.id.empty()) return;
+            results.push_back(std::move(r));
+            Deliver(f.request, false, results, false);
+        } else if (f.type == kFrameDone || f.type == kFrameFatal) {
+            if (f.type == kFrameFatal && f.request == 0)
+                FailPending(false); // Bun lost sync and dropped its input
+            else
+                Deliver(f.request, false, results, true);
         }
+        // Anything else: unknown frame type from a newer renderer — skip.
+        return;
+    }
+
+    uint32_t request = 0;
+    bool hasRequest = false;
+    BunMessage msg = DecodeMessage(message, results, request, hasRequest);
+    if (msg == BunMessage::Other)
+        return; // stray stderr output
+    Deliver(request, !hasRequest, results, msg != BunMessage::Block);
+}
 
-        // Check for error
-        size_t errKey = response.find("\"error\":", pos);
-        if (errKey != std::string::npos) {
-            size_t errValStart = errKey + 8;
-            while (errValStart < response.size() && response[errValStart] == ' ') errValStart++;
-            if (response[errValStart] == '"') {
-                errValStart++;
-                size_t errEnd = response.find('"', errValStart);
-                if (errEnd != std::string::npos) {
-                    r.error = U8toW(response.substr(errValStart, errEnd - errValStart));
-                    pos = errEnd + 1;
-                }
-            } else if (response.substr(errValStart, 4) == "null") {
-                pos = errValStart + 4;
+// ============================================================================
+// Deliver / FailPending / Abandon - the pending-request table
+//
+// onResult runs under m_pendingMutex, which is what lets Abandon promise
+// that no callback is in progress or still to come once it returns.
+// ============================================================================
+void BunRenderer::Deliver(uint32_t request, bool oldest,
+                          std::vector<MermaidRenderResult>& results, bool complete)
+{
+    std::shared_ptr<PendingRender> done;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        auto it = oldest ? m_pending.begin() : m_pending.find(request);
+        if (it == m_pending.end())
+            return; // no such request (any more)
+        PendingRender& p = *it->second;
+        if (!p.abandoned) {
+            for (auto& r : results) {
+                if (p.onResult) p.onResult(r);
+                p.results.push_back(std::move(r));
             }
         }
+        if (complete) {
+            if (!p.abandoned) done = std::move(it->second);
+            m_pending.erase(it);
+        }
+    }
+    if (done)
+        done->promise.set_value(std::move(done->results));
+}
 
-        results.push_back(std::move(r));
+void BunRenderer::FailPending(bool closed)
+{
+    std::map<uint32_t, std::shared_ptr<PendingRender>> failed;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        if (closed) m_channelOpen = false;
+        failed.swap(m_pending);
+    }
+    for (auto& entry : failed)
+        if (!entry.second->abandoned)
+            entry.second->promise.set_value(std::move(entry.second->results));
+}
+
+void BunRenderer::Abandon(uint32_t requestId)
+{
+    std::shared_ptr<PendingRender> p;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        auto it = m_pending.find(requestId);
+        if (it == m_pending.end() || it->second->abandoned)
+            return;
+        p = it->second;
+        p->abandoned = true;
+        p->onResult = nullptr;
+    }
+    // Deliver no longer touches an abandoned entry's results or promise.
+    p->promise.set_value(std::move(p->results));
+}
+
+// ============================================================================
+// Cancel - abandon a request and tell Bun to drop the rest of it
+//
+// Bun still closes the request with its usual "done", which retires the
+// abandoned entry, so in-order matching stays aligned.
+// ============================================================================
+void BunRenderer::Cancel(uint32_t requestId)
+{
+    bool pending;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        pending = m_pending.count(requestId) != 0;
+    }
+    if (!pending)
+        return; // finished, or never sent
+    Abandon(requestId);
+    if (!m_bCancel)
+        return;
+
+    std::lock_guard<std::mutex> write(m_writeMutex);
+    if (m_bFramed) {
+        std::string frame;
+        BunPipeReader::AppendFrame(frame, kFrameCancel, requestId, {}, {});
+        SendBytes(frame.data(), frame.size());
+    } else {
+        SendLine("{\"type\":\"cancel\",\"req\":" + std::to_string(requestId) + "}");
+    }
+}
+
+// ============================================================================
+// RenderBlocksAsync - send mermaid code to Bun without waiting for the reply
+//
+// Both protocols stream: every result is handed to `onResult` on arrival,
+// so the caller can show the first diagram without waiting for the slowest.
+//
+// Framed mode (see "frame2" above): R, C × N, Z out; one S / E frame per
+// block, then D back, all tagged with the request id. JSON mode asks for
+// "stream":true with a "req" id: one {"type":"block",...} line per block,
+// then {"type":"done"}. A renderer.ts that predates streaming answers with
+// one {"type":"result"} line, which is still understood.
+//
+// Requests are written whole and in id order under m_writeMutex; renderer.ts
+// queues them and answers one after another, so many can be in flight.
+// ============================================================================
+std::future<std::vector<MermaidRenderResult>> BunRenderer::RenderBlocksAsync(
+    const std::vector<std::pair<std::wstring, std::wstring>>& blocks,
+    const std::wstring& theme,
+    std::function<void(MermaidRenderResult&)> onResult,
+    uint32_t* requestId)
+{
+    auto pending = std::make_shared<PendingRender>();
+    pending->onResult = std::move(onResult);
+    auto future = pending->promise.get_future();
+    if (requestId) *requestId = 0;
+
+    if (!m_bReady || blocks.empty()) {
+        pending->promise.set_value({});
+        return future;
+    }
 
-        // Find next object or end of array
-        size_t nextComma = response.find(',', pos);
-        size_t nextBracket = response.find(']', pos);
-        if (nextBracket != std::string::npos &&
-            (nextComma == std::string::npos || nextBracket < nextComma))
-            break;
-        if (nextComma != std::string::npos)
-            pos = nextComma + 1;
-        else
-            break;
+    std::lock_guard<std::mutex> write(m_writeMutex);
+    uint32_t id;
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        if (!m_channelOpen) {
+            pending->promise.set_value({});
+            return future;
+        }
+        id = m_nextRequest++;
+        if (m_nextRequest == 0) m_nextRequest = 1;
+        m_pending[id] = pending;
     }
+    if (requestId) *requestId = id;
+
+    bool sent;
+    if (m_bFramed) {
+        // Sources go out as raw UTF-8, no escaping.
+        std::string req;
+        BunPipeReader::AppendFrame(req, kFrameRender, id, WtoU8(theme), {});
+        for (const auto& b : blocks)
+            BunPipeReader::AppendFrame(req, kFrameCode, id, WtoU8(b.first), WtoU8(b.second));
+        BunPipeReader::AppendFrame(req, kFrameEnd, id, {}, {});
+        sent = SendBytes(req.data(), req.size());
+    } else {
+        // Build JSON request
+        std::string json = "{\"type\":\"render\",\"req\":" + std::to_string(id) +
+                           ",\"stream\":true,\"blocks\":[";
+        for (size_t i = 0; i < blocks.size(); i++) {
+            if (i > 0) json += ",";
+            json += "{\"id\":\"" + JsonEscape(WtoU8(blocks[i].first)) + "\",";
+            json += "\"code\":\"" + JsonEscape(WtoU8(blocks[i].second)) + "\"}";
+        }
+        json += "],\"theme\":\"" + JsonEscape(WtoU8(theme)) + "\"}";
+        sent = SendLine(json);
+    }
+    if (!sent) {
+        // Nothing will answer: drop the entry outright rather than leave a
+        // tombstone waiting for a "done" that never comes.
+        Abandon(id);
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        m_pending.erase(id);
+    }
+    return future;
+}
 
-    return results;
+// ============================================================================
+// RenderBlocks - RenderBlocksAsync + wait
+//
+// Cap the wait at 15 s so a hung Bun can't hold the render worker for
+// minutes — the caller falls back to client-side rendering for whatever
+// hasn't arrived. A timed-out request is abandoned, so its late replies are
+// dropped rather than read as the answer to the next one.
+// ============================================================================
+unsigned BunRenderer::TimeoutMs(size_t blocks)
+{
+    size_t timeout = 5000 + blocks * 1000;
+    return timeout > 15000 ? 15000 : (unsigned)timeout;
+}
+
+std::vector<MermaidRenderResult> BunRenderer::RenderBlocks(
+    const std::vector<std::pair<std::wstring, std::wstring>>& blocks,
+    const std::wstring& theme,
+    const std::function<void(MermaidRenderResult&)>& onResult)
+{
+    uint32_t request = 0;
+    auto future = RenderBlocksAsync(blocks, theme, onResult, &request);
+    if (future.wait_for(std::chrono::milliseconds(TimeoutMs(blocks.size()))) !=
+        std::future_status::ready)
+        Abandon(request);
+    return future.get();
 }
@@ -1,16 +1,18 @@
 #pragma once
 
 #include <windows.h>
+#include "BunPipeReader.h"
+#include "MermaidResultQueue.h"   // MermaidRenderResult
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
 
-struct MermaidRenderResult {
-    std::wstring id;
-    std::wstring svg;    // Empty on error
-    std::wstring error;  // Empty on success
-};
-
 class BunRenderer {
 public:
     BunRenderer();
@@ -25,19 +27,85 @@ public:
     // Is the Bun process running and ready?
     bool IsReady() const { return m_bReady; }
 
+    // Did the renderer accept the binary framed protocol at startup?
+    // (False: JSON lines, e.g. an older renderer.ts.)
+    bool IsFramed() const { return m_bFramed; }
+
     // Render mermaid blocks to SVG. Blocks the calling thread briefly.
     // theme: "default" or "dark"
+    // onResult (optional) sees each result as soon as Bun streams it, before
+    // it is added to the returned vector.
     std::vector<MermaidRenderResult> RenderBlocks(
         const std::vector<std::pair<std::wstring, std::wstring>>& blocks, // {id, code}
-        const std::wstring& theme);
+        const std::wstring& theme,
+        const std::function<void(MermaidRenderResult&)>& onResult = nullptr);
+
+    // Queue a render and return at once; any number of requests may be in
+    // flight, from any thread. Each carries a request id that Bun echoes on
+    // every reply, so results reach the right future whatever the order.
+    // onResult runs on the reader thread as blocks arrive and must not call
+    // back into this renderer. The future is fulfilled at the request's
+    // "done" — early, with what arrived, if Bun dies or it is abandoned.
+    std::future<std::vector<MermaidRenderResult>> RenderBlocksAsync(
+        const std::vector<std::pair<std::wstring, std::wstring>>& blocks,
+        const std::wstring& theme,
+        std::function<void(MermaidRenderResult&)> onResult = nullptr,
+        uint32_t* requestId = nullptr);
+
+    // Stop waiting for a request: its future completes now and its late
+    // replies are dropped. onResult is not called again once this returns.
+    void Abandon(uint32_t requestId);
+
+    // Abandon, and ask Bun to skip the blocks of the request it hasn't
+    // started yet (the one being rendered runs to completion). A renderer.ts
+    // that doesn't advertise cancellation only gets the Abandon.
+    void Cancel(uint32_t requestId);
+
+    // How long RenderBlocks waits for a request of `blocks` diagrams.
+    static unsigned TimeoutMs(size_t blocks);
+
+    // What the SVG depends on besides the diagram and theme: the installed
+    // mermaid version and renderer.ts (write time + size). Read from disk,
+    // so it is known before Bun starts; empty while mermaid isn't installed.
+    std::wstring OutputVersion() const;
 
 private:
+    struct PendingRender {
+        std::function<void(MermaidRenderResult&)>      onResult;
+        std::vector<MermaidRenderResult>               results;
+        std::promise<std::vector<MermaidRenderResult>> promise;
+        // Future already fulfilled; the entry only swallows late replies
+        // until Bun's "done", keeping in-order matching aligned.
+        bool                                           abandoned = false;
+    };
+
+    // Start / Stop bodies; callers hold m_lifecycleMutex.
+    bool Launch();
+    void Shutdown();
+
+    // Reader-thread side of the channel once the handshake is done.
+    void OnMessage(std::string& message);
+    // Hand results to a request (the oldest one for a renderer that doesn't
+    // echo ids) and, if `complete`, fulfil and retire it.
+    void Deliver(uint32_t request, bool oldest, std::vector<MermaidRenderResult>& results,
+                 bool complete);
+    // Fulfil every in-flight request with what it has; `closed` also stops
+    // new ones being accepted until the next Start().
+    void FailPending(bool closed);
+
+    // Write raw bytes to Bun's stdin
+    bool SendBytes(const char* data, size_t size);
+
     // Send a line of JSON to Bun's stdin
     bool SendLine(const std::string& json);
 
     // Read a line of JSON from Bun's stdout (with timeout)
     std::string ReadLine(DWORD timeoutMs = 5000);
 
+    // Read one frame from Bun's stdout (with timeout). The views point
+    // into m_frameMessage and stay valid until the next call.
+    bool ReadFrame(DWORD timeoutMs, BunPipeReader::Frame& frame);
+
     // Find Bun executable path
     std::wstring FindBunPath() const;
 
@@ -51,14 +119,25 @@ private:
     static std::string WtoU8(const std::wstring& ws);
 
     // Convert UTF-8 to wstring
-    static std::wstring U8toW(const std::string& s);
+    static std::wstring U8toW(std::string_view s);
 
     // Escape a string for JSON value
     static std::string JsonEscape(const std::string& s);
 
     HANDLE m_hProcess = nullptr;
-    HANDLE m_hStdinWrite = nullptr;
-    HANDLE m_hStdoutRead = nullptr;
-    bool m_bReady = false;
-    std::string m_readBuffer;
+    HANDLE m_hStdinWrite = nullptr;     // guarded by m_writeMutex
+    std::atomic<bool> m_bReady{false};  // read by the pool / UI thread
+    std::atomic<bool> m_bFramed{false};
+    std::atomic<bool> m_bCancel{false};   // renderer accepts cancel requests
+    BunPipeReader m_reader;        // stdout (+ merged stderr)
+    std::string m_frameMessage;    // backing store of the last ReadFrame
+
+    std::mutex m_lifecycleMutex;   // Start / Stop
+    std::mutex m_writeMutex;       // one request on stdin at a time, in id order
+
+    // In-flight requests by id, oldest first.
+    std::mutex m_pendingMutex;
+    std::map<uint32_t, std::shared_ptr<PendingRender>> m_pending;
+    uint32_t m_nextRequest = 1;    // 0 is never used
+    bool m_channelOpen = false;    // false once the reader has closed
 };
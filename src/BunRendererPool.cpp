@@ -0,0 +1,318 @@
+#include "BunRendererPool.h"
+#include <algorithm>
+#include <thread>
+
+// A crashed worker is respawned at once the first time, then at most this
+// often, so a diagram that reliably kills Bun can't turn every update into
+// a process spawn.
+static constexpr std::chrono::seconds kRestartCooldown(30);
+
+// Each block is tried on at most this many workers.
+static constexpr int kMaxAttempts = 2;
+
+// Whole-batch cap, same as the single-process 15 s ceiling: blocks still
+// queued after this are left to the client-side fallback.
+static constexpr std::chrono::seconds kBatchDeadline(15);
+
+BunRendererPool::BunRendererPool(unsigned workers)
+{
+    if (workers == 0) workers = DefaultWorkerCount();
+    m_workers.resize(workers);
+    for (auto& w : m_workers)
+        w.renderer = std::make_unique<BunRenderer>();
+}
+
+BunRendererPool::~BunRendererPool()
+{
+    Stop();
+}
+
+unsigned BunRendererPool::DefaultWorkerCount()
+{
+    unsigned cores = std::thread::hardware_concurrency();
+    return std::clamp(cores / 2, 1u, 4u);
+}
+
+// ============================================================================
+// Start - worker 0 first (EnsureSetup may run `bun install`, which must not
+// race with itself), then the rest concurrently; then the driver threads
+// ============================================================================
+bool BunRendererPool::Start()
+{
+    if (m_workers.empty()) return false;
+    m_stopping = false;
+
+    auto startOne = [](Worker& w) {
+        w.restarted = false;
+        w.renderer->Start();
+    };
+
+    startOne(m_workers[0]);
+    if (!m_workers[0].renderer->IsReady())
+        return false; // bun missing / setup failed — the others would fail too
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < m_workers.size(); i++)
+        threads.emplace_back(startOne, std::ref(m_workers[i]));
+    for (auto& t : threads) t.join();
+
+    {
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        if (m_stopping) return false; // Stop() came in while starting
+        if (m_drivers.empty())
+            for (auto& w : m_workers)
+                m_drivers.emplace_back(&BunRendererPool::Drive, this, std::ref(w));
+    }
+    m_bStarted = true;
+    return true;
+}
+
+// ============================================================================
+// Stop - release every running batch, kill the processes (in-flight
+// futures complete at once), join the drivers
+// ============================================================================
+void BunRendererPool::Stop()
+{
+    m_bStarted = false;
+    std::vector<std::thread> drivers;
+    {
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        m_stopping = true;
+        for (Batch* b : m_batches) b->cancelled = true;
+        drivers.swap(m_drivers);
+    }
+    m_work.notify_all();
+    m_progress.notify_all();
+    for (auto& w : m_workers)
+        w.renderer->Stop();
+    for (auto& t : drivers) t.join();
+}
+
+
+bool BunRendererPool::EnsureWorker(Worker& w)
+{
+    std::lock_guard<std::mutex> lock(m_workerMutex);
+    if (w.renderer->IsReady()) return true;
+    if (m_stopping) return false;
+    auto now = std::chrono::steady_clock::now();
+    if (w.restarted && now - w.lastRestart < kRestartCooldown) return false;
+    w.lastRestart = now;
+    w.restarted = true;
+    if (!w.renderer->Start()) return false;
+    if (m_stopping) {           // Stop() raced the spawn: don't leave it running
+        w.renderer->Stop();
+        return false;
+    }
+    return true;
+}
+
+BunRendererPool::Batch* BunRendererPool::NextBatch()
+{
+    auto now = std::chrono::steady_clock::now();
+    for (Batch* b : m_batches)
+        if (!b->cancelled && !b->queue.empty() && now < b->deadline)
+            return b;
+    return nullptr;
+}
+
+bool BunRendererPool::Settled(const Batch& b) const
+{
+    if (b.busy != 0) return false;
+    if (b.cancelled || b.queue.empty() || m_stopping || m_drivers.empty() ||
+        std::chrono::steady_clock::now() >= b.deadline)
+        return true;
+    // Blocks left but every worker down and in its cooldown.
+    return std::all_of(m_workers.begin(), m_workers.end(),
+                       [](const Worker& w) { return w.down; });
+}
+
+// ============================================================================
+// OutputVersion - the version read at the last batch (or now, if none has
+// run yet). The read touches renderer.ts and mermaid's package.json, so
+// it happens once per batch, not once per cache lookup.
+// ============================================================================
+std::wstring BunRendererPool::OutputVersion() const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_versionMutex);
+        if (!m_outputVersion.empty()) return m_outputVersion;
+    }
+    return RefreshOutputVersion();
+}
+
+std::wstring BunRendererPool::RefreshOutputVersion() const
+{
+    if (m_workers.empty()) return std::wstring();
+    std::wstring version = m_workers[0].renderer->OutputVersion();
+    std::lock_guard<std::mutex> lock(m_versionMutex);
+    m_outputVersion = version;
+    return version;
+}
+
+// ============================================================================
+// CancelBefore - supersede older batches
+// ============================================================================
+void BunRendererPool::CancelBefore(uint64_t generation)
+{
+    std::vector<std::pair<BunRenderer*, uint32_t>> requests;
+    {
+        std::lock_guard<std::mutex> lock(m_batchMutex);
+        for (Batch* b : m_batches) {
+            if (b->generation == 0 || b->generation >= generation) continue;
+            b->cancelled = true;
+            requests.insert(requests.end(), b->inFlight.begin(), b->inFlight.end());
+        }
+    }
+    m_progress.notify_all();
+    // Outside the lock: Cancel writes to Bun's stdin, which can block.
+    for (auto& r : requests)
+        r.first->Cancel(r.second);
+}
+
+// ============================================================================
+// Prioritize - move queued blocks of a batch to the front
+// ============================================================================
+void BunRendererPool::Prioritize(uint64_t generation, const std::vector<std::wstring>& ids)
+{
+    if (generation == 0 || ids.empty()) return;
+    std::lock_guard<std::mutex> lock(m_batchMutex);
+    for (Batch* b : m_batches) {
+        if (b->generation != generation) continue;
+        // Walk the ids back to front, pulling each match to the head, so
+        // they end up first and in the caller's order.
+        for (auto id = ids.rbegin(); id != ids.rend(); ++id) {
+            auto it = std::find_if(b->queue.begin(), b->queue.end(),
+                [&](size_t idx) { return (*b->blocks)[idx].first == *id; });
+            if (it == b->queue.end() || it == b->queue.begin()) continue;
+            size_t idx = *it;
+            b->queue.erase(it);
+            b->queue.push_front(idx);
+        }
+    }
+}
+
+// ============================================================================
+// Drive - a worker's driver thread. Pulls single blocks so a slow diagram
+// only holds up the worker that drew it.
+// ============================================================================
+void BunRendererPool::Drive(Worker& w)
+{
+    std::unique_lock<std::mutex> lock(m_batchMutex);
+    while (true) {
+        // The batch the predicate found is the one taken: asking NextBatch
+        // again could find none (its deadline may pass in between).
+        Batch* next = nullptr;
+        m_work.wait(lock, [&] { return m_stopping || (!w.down && (next = NextBatch())); });
+        if (m_stopping) return;
+
+        // Respawn only with work waiting; the queue may have drained (or
+        // another batch become first) meanwhile, so look again after.
+        if (!w.renderer->IsReady()) {
+            lock.unlock();
+            bool up = EnsureWorker(w);
+            lock.lock();
+            if (!up) {
+                w.down = true;  // until the next batch is queued
+                m_progress.notify_all();
+            }
+            continue;
+        }
+
+        Batch& batch = *next;
+        size_t idx = batch.queue.front();
+        batch.queue.pop_front();
+        batch.busy++;
+        const auto& block = (*batch.blocks)[idx];
+        lock.unlock();
+
+        // Requests in flight are visible to CancelBefore; one registered
+        // after the batch was cancelled is cancelled on the spot.
+        auto track = [&](uint32_t request, bool add) {
+            std::lock_guard<std::mutex> guard(m_batchMutex);
+            auto& v = batch.inFlight;
+            auto entry = std::make_pair(w.renderer.get(), request);
+            if (add) v.push_back(entry);
+            else v.erase(std::find(v.begin(), v.end(), entry));
+            return !batch.cancelled;
+        };
+
+        uint32_t request = 0;
+        auto future = w.renderer->RenderBlocksAsync({ block }, *batch.theme, nullptr, &request);
+        if (!track(request, true))
+            w.renderer->Cancel(request);
+        bool hung = future.wait_for(std::chrono::milliseconds(BunRenderer::TimeoutMs(1))) !=
+                    std::future_status::ready;
+        if (hung)
+            w.renderer->Abandon(request);
+        track(request, false);
+        auto r = future.get();
+        bool ok = r.size() == 1 && r[0].id == block.first;
+        if (ok && !batch.cancelled) {   // superseded: whatever arrived is stale
+            batch.slots[idx] = std::move(r[0]);
+            batch.done[idx] = 1;
+            if (*batch.onResult) (*batch.onResult)(batch.slots[idx]);
+        } else if (!ok && (!batch.cancelled || hung)) {
+            // No usable reply: Bun died or is stuck on this block. Kill it
+            // (everything queued behind would wait too; late replies are
+            // dropped by request id); the block goes back for another
+            // worker. A request cancelled with its batch comes back empty
+            // by design; its worker is fine and stays up.
+            w.renderer->Stop();
+        }
+
+        lock.lock();
+        if (!ok && !batch.cancelled && ++batch.attempts[idx] < kMaxAttempts) {
+            batch.queue.push_back(idx);
+            m_work.notify_all();
+        }
+        batch.busy--;
+        m_progress.notify_all();
+    }
+}
+
+// ============================================================================
+// RenderBlocks - queue the batch for the drivers, wait, merge in input order
+// ============================================================================
+std::vector<MermaidRenderResult> BunRendererPool::RenderBlocks(
+    const std::vector<std::pair<std::wstring, std::wstring>>& blocks,
+    const std::wstring& theme,
+    const std::function<void(MermaidRenderResult&)>& onResult,
+    uint64_t generation)
+{
+    RefreshOutputVersion();
+
+    const size_t n = blocks.size();
+    Batch batch;
+    batch.generation = generation;
+    batch.blocks = &blocks;
+    batch.theme = &theme;
+    batch.onResult = &onResult;
+    batch.slots.resize(n);
+    batch.done.assign(n, 0);
+    batch.attempts.assign(n, 0);
+    for (size_t i = 0; i < n; i++) batch.queue.push_back(i);
+    batch.deadline = std::chrono::steady_clock::now() + kBatchDeadline;
+
+    {
+        std::unique_lock<std::mutex> lock(m_batchMutex);
+        m_batches.push_back(&batch);
+        for (auto& w : m_workers) w.down = false; // new work: try respawning
+        m_work.notify_all();
+        // Past the deadline the blocks being rendered are still waited for
+        // (each is bounded by BunRenderer::TimeoutMs): the drivers hold
+        // references into `batch`.
+        while (!Settled(batch)) {
+            if (std::chrono::steady_clock::now() < batch.deadline)
+                m_progress.wait_until(lock, batch.deadline);
+            else
+                m_progress.wait(lock);
+        }
+        m_batches.erase(std::find(m_batches.begin(), m_batches.end(), &batch));
+    }
+
+    std::vector<MermaidRenderResult> results;
+    results.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        if (batch.done[i]) results.push_back(std::move(batch.slots[i]));
+    return results;
+}
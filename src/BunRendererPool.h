@@ -0,0 +1,143 @@
+#pragma once
+
+#include "BunRenderer.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// N persistent Bun renderer processes behind the BunRenderer interface.
+// renderer.ts renders one diagram at a time, so a document with many
+// diagrams is spread across processes instead: RenderBlocks puts every
+// block on a queue and waits while each worker's driver thread — started
+// once by Start, joined by Stop — pulls blocks from it, then the results
+// are merged back into input order. No thread is created per batch.
+//
+// Batches may overlap: a second RenderBlocks call doesn't wait for the
+// first, its blocks are handed out once the older batches' queues are
+// empty (or cancelled). A batch tagged with a generation
+// can be superseded by a newer one (CancelBefore), which frees the workers
+// for the newer batch instead of finishing diagrams nobody will show.
+// Blocks are handed out in the order given; Prioritize moves blocks of a
+// running batch to the front (e.g. the ones scrolled into view).
+//
+// A worker that fails a block (crash, hang) is stopped — renderer.ts
+// answers in order, so a hung process would stall everything queued
+// behind — the block is retried on another worker, and the dead worker is
+// respawned on a later call (rate-limited). Blocks that exhaust their
+// retries are left out of the result — the caller's client-side fallback
+// draws them.
+class BunRendererPool {
+public:
+    // workers == 0 → DefaultWorkerCount().
+    explicit BunRendererPool(unsigned workers = 0);
+    ~BunRendererPool();
+
+    BunRendererPool(const BunRendererPool&) = delete;
+    BunRendererPool& operator=(const BunRendererPool&) = delete;
+
+    // Half the logical cores, clamped to [1, 4]: each worker is a full Bun +
+    // jsdom + mermaid instance (~100–150 MB), and diagrams rarely number in
+    // the dozens.
+    static unsigned DefaultWorkerCount();
+
+    // Start every worker and its driver thread. The first one starts alone
+    // (it may run `bun install`), the rest in parallel. True once the first
+    // is ready.
+    bool Start();
+
+    // Stop every worker process and join the driver threads; running
+    // batches return with what they have.
+    void Stop();
+
+    // Start() succeeded and Stop() hasn't been called. Individual workers
+    // may be down; RenderBlocks respawns them.
+    bool IsReady() const { return m_bStarted; }
+
+    unsigned WorkerCount() const { return (unsigned)m_workers.size(); }
+
+    // BunRenderer::OutputVersion (all workers run the same renderer.ts).
+    // Re-read from disk at the start of every RenderBlocks batch, so an
+    // upgrade while EmEditor runs is picked up; cached in between.
+    std::wstring OutputVersion() const;
+
+    // Same contract as BunRenderer::RenderBlocks; calls may overlap.
+    // onResult is invoked from the worker threads — concurrently when
+    // there is more than one worker — as each block completes.
+    // generation tags the batch for CancelBefore (0: never cancelled).
+    std::vector<MermaidRenderResult> RenderBlocks(
+        const std::vector<std::pair<std::wstring, std::wstring>>& blocks, // {id, code}
+        const std::wstring& theme,
+        const std::function<void(MermaidRenderResult&)>& onResult = nullptr,
+        uint64_t generation = 0);
+
+    // Supersede every running batch tagged below `generation`: its queued
+    // blocks are dropped, its requests in flight are cancelled in Bun, and
+    // it returns at once without the results still outstanding.
+    void CancelBefore(uint64_t generation);
+
+    // Hand the still-queued blocks with these ids (in this order) to the
+    // next free workers, ahead of the rest of the batch tagged `generation`.
+    // Blocks already rendering or done are unaffected.
+    void Prioritize(uint64_t generation, const std::vector<std::wstring>& ids);
+
+private:
+    // A running RenderBlocks call, as the drivers, CancelBefore and
+    // Prioritize see it. Guarded by m_batchMutex, except the result slots:
+    // a block's slot is written only by the driver that took it, and read
+    // once none is busy.
+    struct Batch {
+        uint64_t          generation = 0;
+        std::atomic<bool> cancelled{false};
+        std::vector<std::pair<BunRenderer*, uint32_t>> inFlight;
+        const std::vector<std::pair<std::wstring, std::wstring>>* blocks = nullptr;
+        const std::wstring* theme = nullptr;
+        const std::function<void(MermaidRenderResult&)>* onResult = nullptr;
+        std::deque<size_t> queue;        // indices into *blocks not yet handed out
+        std::vector<MermaidRenderResult> slots;
+        std::vector<char> done;          // not vector<bool>: written from several threads
+        std::vector<int>  attempts;
+        size_t            busy = 0;      // blocks taken, not yet settled
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    struct Worker {
+        std::unique_ptr<BunRenderer>          renderer;
+        std::chrono::steady_clock::time_point lastRestart;
+        bool                                  restarted = false; // since Start()
+        bool                                  down = false; // respawn refused; guarded by m_batchMutex
+    };
+
+    // Read BunRenderer::OutputVersion into m_outputVersion.
+    std::wstring RefreshOutputVersion() const;
+
+    // Respawn a stopped worker unless it was (re)started too recently.
+    bool EnsureWorker(Worker& w);
+
+    // Driver thread of one worker: render blocks of the oldest batch that
+    // has any, one at a time, until Stop.
+    void Drive(Worker& w);
+    // The batch the drivers take from next, if any. m_batchMutex held.
+    Batch* NextBatch();
+    // Nothing more will come of `b`. m_batchMutex held.
+    bool Settled(const Batch& b) const;
+
+    std::vector<Worker> m_workers;
+    std::mutex          m_workerMutex;   // EnsureWorker across drivers
+    std::mutex          m_batchMutex;
+    std::condition_variable m_work;      // drivers: a batch has blocks, or Stop
+    std::condition_variable m_progress;  // RenderBlocks: a block settled
+    std::vector<Batch*> m_batches;       // running batches, oldest first; guarded by m_batchMutex
+    std::vector<std::thread> m_drivers;  // one per worker once started; guarded by m_batchMutex
+    std::atomic<bool>   m_stopping{false}; // set under m_batchMutex
+    std::atomic<bool>   m_bStarted{false};
+
+    mutable std::mutex   m_versionMutex;
+    mutable std::wstring m_outputVersion;  // guarded by m_versionMutex; empty: not read yet
+};
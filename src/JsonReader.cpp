@@ -0,0 +1,355 @@
+#include "JsonReader.h"
+
+static constexpr uint32_t kReplacementChar = 0xFFFD;
+
+static bool IsHighSurrogate(uint32_t cp) { return cp >= 0xD800 && cp <= 0xDBFF; }
+static bool IsLowSurrogate(uint32_t cp)  { return cp >= 0xDC00 && cp <= 0xDFFF; }
+
+// ============================================================================
+// AppendCodePoint - UTF-16 on Windows (surrogate pair above the BMP),
+// one unit per code point where wchar_t is 32-bit
+// ============================================================================
+void JsonReader::AppendCodePoint(std::wstring& out, uint32_t cp)
+{
+    if constexpr (sizeof(wchar_t) == 2) {
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            out.push_back((wchar_t)(0xD800 + (cp >> 10)));
+            out.push_back((wchar_t)(0xDC00 + (cp & 0x3FF)));
+            return;
+        }
+    }
+    out.push_back((wchar_t)cp);
+}
+
+void JsonReader::SkipWs()
+{
+    while (m_pos < m_text.size()) {
+        char c = m_text[m_pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+        m_pos++;
+    }
+}
+
+bool JsonReader::Expect(char c)
+{
+    SkipWs();
+    if (m_pos >= m_text.size() || m_text[m_pos] != c) return Fail();
+    m_pos++;
+    return true;
+}
+
+JsonReader::Type JsonReader::Peek()
+{
+    if (m_failed) return Type::Invalid;
+    SkipWs();
+    if (m_pos >= m_text.size()) return Type::End;
+    switch (m_text[m_pos]) {
+    case '{': return Type::Object;
+    case '[': return Type::Array;
+    case '"': return Type::String;
+    case 'n': return Type::Null;
+    case 't': case 'f': return Type::Bool;
+    case '-': case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        return Type::Number;
+    default:  return Type::Invalid;
+    }
+}
+
+// ============================================================================
+// Containers
+// ============================================================================
+bool JsonReader::EnterObject()
+{
+    if (m_failed || m_depth >= kMaxDepth || !Expect('{')) return Fail();
+    m_first[++m_depth] = true;
+    return true;
+}
+
+bool JsonReader::EnterArray()
+{
+    if (m_failed || m_depth >= kMaxDepth || !Expect('[')) return Fail();
+    m_first[++m_depth] = true;
+    return true;
+}
+
+bool JsonReader::NextItem(char closer)
+{
+    if (m_failed || m_depth == 0) return Fail();
+    SkipWs();
+    if (m_pos >= m_text.size()) return Fail();
+    if (m_text[m_pos] == closer) {
+        m_pos++;
+        m_depth--;
+        return false;
+    }
+    if (m_first[m_depth]) {
+        m_first[m_depth] = false;
+        return true;
+    }
+    return Expect(',');
+}
+
+bool JsonReader::NextMember(std::string_view& key)
+{
+    if (!NextItem('}')) return false;
+    return ReadRawString(key) && Expect(':');
+}
+
+bool JsonReader::NextElement()
+{
+    return NextItem(']');
+}
+
+// ============================================================================
+// Strings
+// ============================================================================
+bool JsonReader::ReadRawString(std::string_view& out)
+{
+    if (m_failed || !Expect('"')) return Fail();
+    size_t start = m_pos;
+    while (m_pos < m_text.size()) {
+        unsigned char c = (unsigned char)m_text[m_pos];
+        if (c == '"') {
+            out = m_text.substr(start, m_pos - start);
+            m_pos++;
+            return true;
+        }
+        if (c == '\\' || c < 0x20) break;
+        m_pos++;
+    }
+    return Fail();
+}
+
+bool JsonReader::SkipStringBody()
+{
+    while (m_pos < m_text.size()) {
+        unsigned char c = (unsigned char)m_text[m_pos++];
+        if (c == '"') return true;
+        if (c < 0x20) break;
+        if (c == '\\') {
+            if (m_pos >= m_text.size()) break;
+            m_pos++; // \uXXXX digits are ordinary characters here
+        }
+    }
+    return Fail();
+}
+
+bool JsonReader::SkipString()
+{
+    return !m_failed && Expect('"') && SkipStringBody();
+}
+
+bool JsonReader::ReadHex4(uint32_t& cp)
+{
+    if (m_text.size() - m_pos < 4) return Fail();
+    cp = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = m_text[m_pos++];
+        cp <<= 4;
+        if (c >= '0' && c <= '9')      cp |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') cp |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') cp |= (uint32_t)(c - 'A' + 10);
+        else return Fail();
+    }
+    return true;
+}
+
+// ============================================================================
+// ReadString - single pass UTF-8 → wchar_t with JSON unescaping
+//
+// The common case (SVG markup) is long runs of printable ASCII; those are
+// located first and widened into the output in one resize + copy instead of
+// a push_back per byte. Malformed UTF-8 is replaced per maximal subpart
+// (Unicode §3.9), so a stray byte costs one U+FFFD and never swallows the
+// closing quote.
+// ============================================================================
+bool JsonReader::ReadString(std::wstring& out, size_t maxChars, bool* truncated, bool nullOk)
+{
+    out.clear();
+    if (truncated) *truncated = false;
+    if (m_failed) return false;
+    if (nullOk && Peek() == Type::Null) return ReadNull();
+    if (!Expect('"')) return false;
+
+    const char* s = m_text.data();
+    const size_t n = m_text.size();
+
+    auto overflow = [&]() {
+        out.clear();
+        out.shrink_to_fit();
+        if (truncated) *truncated = true;
+        return SkipStringBody();
+    };
+
+    while (m_pos < n) {
+        // Plain ASCII run
+        size_t start = m_pos;
+        while (m_pos < n) {
+            unsigned char c = (unsigned char)s[m_pos];
+            if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') break;
+            m_pos++;
+        }
+        if (m_pos > start) {
+            size_t run = m_pos - start;
+            if (run > maxChars - out.size()) return overflow();
+            size_t old = out.size();
+            out.resize(old + run);
+            wchar_t* dst = &out[old];
+            for (size_t i = 0; i < run; i++)
+                dst[i] = (wchar_t)(unsigned char)s[start + i];
+        }
+        if (m_pos >= n) break;
+
+        unsigned char c = (unsigned char)s[m_pos];
+        if (c == '"') {
+            m_pos++;
+            return true;
+        }
+        if (c < 0x20) return Fail(); // raw control characters are not JSON
+
+        uint32_t cp;
+        if (c == '\\') {
+            if (++m_pos >= n) break;
+            char e = s[m_pos++];
+            switch (e) {
+            case '"':  cp = '"';  break;
+            case '\\': cp = '\\'; break;
+            case '/':  cp = '/';  break;
+            case 'b':  cp = '\b'; break;
+            case 'f':  cp = '\f'; break;
+            case 'n':  cp = '\n'; break;
+            case 'r':  cp = '\r'; break;
+            case 't':  cp = '\t'; break;
+            case 'u':
+                if (!ReadHex4(cp)) return false;
+                if (IsHighSurrogate(cp)) {
+                    // Pair only with an immediately following \uDC00-\uDFFF;
+                    // otherwise the high half is lone and the next escape is
+                    // decoded on its own.
+                    uint32_t lo;
+                    if (n - m_pos >= 6 && s[m_pos] == '\\' && s[m_pos + 1] == 'u') {
+                        size_t save = m_pos;
+                        m_pos += 2;
+                        if (!ReadHex4(lo)) return false;
+                        if (IsLowSurrogate(lo))
+                            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        else {
+                            m_pos = save;
+                            cp = kReplacementChar;
+                        }
+                    } else {
+                        cp = kReplacementChar;
+                    }
+                } else if (IsLowSurrogate(cp)) {
+                    cp = kReplacementChar;
+                }
+                break;
+            default:
+                return Fail();
+            }
+        } else {
+            // Multi-byte UTF-8. Second-byte ranges exclude overlongs,
+            // encoded surrogates and code points above U+10FFFF.
+            int need;
+            unsigned char lo = 0x80, hi = 0xBF;
+            if (c >= 0xC2 && c <= 0xDF)      { need = 1; cp = c & 0x1F; }
+            else if (c >= 0xE0 && c <= 0xEF) { need = 2; cp = c & 0x0F;
+                                               if (c == 0xE0) lo = 0xA0;
+                                               if (c == 0xED) hi = 0x9F; }
+            else if (c >= 0xF0 && c <= 0xF4) { need = 3; cp = c & 0x07;
+                                               if (c == 0xF0) lo = 0x90;
+                                               if (c == 0xF4) hi = 0x8F; }
+            else                             { need = 0; cp = kReplacementChar; }
+            m_pos++;
+            for (int i = 0; i < need; i++) {
+                unsigned char cc = m_pos < n ? (unsigned char)s[m_pos] : 0;
+                if (cc < lo || cc > hi) {
+                    cp = kReplacementChar;
+                    break;
+                }
+                cp = (cp << 6) | (cc & 0x3F);
+                m_pos++;
+                lo = 0x80;
+                hi = 0xBF;
+            }
+        }
+
+        size_t units = (sizeof(wchar_t) == 2 && cp >= 0x10000) ? 2 : 1;
+        if (units > maxChars - out.size()) return overflow();
+        AppendCodePoint(out, cp);
+    }
+    return Fail(); // unterminated
+}
+
+// ============================================================================
+// Scalars / Skip
+// ============================================================================
+bool JsonReader::SkipLiteral(std::string_view lit)
+{
+    if (m_text.compare(m_pos, lit.size(), lit) != 0) return Fail();
+    m_pos += lit.size();
+    return true;
+}
+
+bool JsonReader::ReadNull()
+{
+    if (Peek() != Type::Null) return Fail();
+    return SkipLiteral("null");
+}
+
+bool JsonReader::ReadUInt32(uint32_t& out)
+{
+    if (Peek() != Type::Number) return Fail();
+    uint64_t v = 0;
+    size_t start = m_pos;
+    while (m_pos < m_text.size() && m_text[m_pos] >= '0' && m_text[m_pos] <= '9') {
+        v = v * 10 + (uint64_t)(m_text[m_pos++] - '0');
+        if (v > UINT32_MAX) return Fail();
+    }
+    if (m_pos == start) return Fail(); // '-'
+    if (m_pos < m_text.size()) {
+        char c = m_text[m_pos];
+        if (c == '.' || c == 'e' || c == 'E') return Fail();
+    }
+    out = (uint32_t)v;
+    return true;
+}
+
+bool JsonReader::SkipNumber()
+{
+    size_t start = m_pos;
+    bool digits = false;
+    while (m_pos < m_text.size()) {
+        char c = m_text[m_pos];
+        if (c >= '0' && c <= '9') digits = true;
+        else if (c != '-' && c != '+' && c != '.' && c != 'e' && c != 'E') break;
+        m_pos++;
+    }
+    return (digits && m_pos > start) || Fail();
+}
+
+bool JsonReader::Skip()
+{
+    std::string_view key;
+    switch (Peek()) {
+    case Type::String: return SkipString();
+    case Type::Number: return SkipNumber();
+    case Type::Null:   return SkipLiteral("null");
+    case Type::Bool:
+        return SkipLiteral(m_text[m_pos] == 't' ? "true" : "false");
+    case Type::Object:
+        if (!EnterObject()) return false;
+        while (NextMember(key))
+            if (!Skip()) return false;
+        return !m_failed;
+    case Type::Array:
+        if (!EnterArray()) return false;
+        while (NextElement())
+            if (!Skip()) return false;
+        return !m_failed;
+    default:
+        return Fail();
+    }
+}
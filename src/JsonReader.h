@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Minimal pull-style JSON reader for the Bun renderer protocol. Reads a
+// UTF-8 buffer in place (no DOM, no intermediate std::string per value)
+// and decodes strings straight into std::wstring: runs of plain ASCII are
+// widened in bulk, escapes (incl. \uXXXX and surrogate pairs) are decoded,
+// and malformed UTF-8 / lone surrogates become U+FFFD, matching what
+// MultiByteToWideChar did for the old scanner.
+//
+// Every method returns false on malformed input; after the first failure
+// the reader stays failed. Nesting is limited to kMaxDepth.
+//
+//   JsonReader r(line);
+//   std::string_view key;
+//   if (r.EnterObject())
+//       while (r.NextMember(key)) {
+//           if (key == "id") r.ReadString(id);
+//           else r.Skip();
+//       }
+class JsonReader {
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object, End, Invalid };
+
+    static constexpr int kMaxDepth = 64;
+
+    explicit JsonReader(std::string_view text) : m_text(text) {}
+
+    // Type of the next value without consuming it (End at end of input).
+    Type Peek();
+
+    // Objects: EnterObject consumes '{'; each NextMember call moves to the
+    // next "key": and returns false (without failing) after the closing '}'.
+    // Keys are returned raw; keys containing escapes are rejected, which
+    // the protocol never produces.
+    bool EnterObject();
+    bool NextMember(std::string_view& key);
+
+    // Arrays: EnterArray consumes '['; NextElement returns false after ']'.
+    bool EnterArray();
+    bool NextElement();
+
+    // Decode a string value into `out` (replacing its contents). If the
+    // decoded value would exceed maxChars wchar_t units the rest is
+    // skipped, `out` is cleared and *truncated is set; the reader stays
+    // valid. Null is accepted as an empty string when nullOk is set.
+    bool ReadString(std::wstring& out, size_t maxChars = SIZE_MAX,
+                    bool* truncated = nullptr, bool nullOk = false);
+
+    // Raw (undecoded) contents of a string without escapes, e.g. a "type"
+    // tag. Fails on strings that contain escapes.
+    bool ReadRawString(std::string_view& out);
+
+    bool ReadNull();
+
+    // A non-negative integer that fits in 32 bits (no fraction/exponent).
+    bool ReadUInt32(uint32_t& out);
+
+    // Skip one value of any type, including nested containers.
+    bool Skip();
+
+    bool Failed() const { return m_failed; }
+
+private:
+    void SkipWs();
+    bool Fail() { m_failed = true; return false; }
+    bool Expect(char c);
+    bool SkipString();
+    bool SkipStringBody();          // after the opening quote
+    bool SkipLiteral(std::string_view lit);
+    bool SkipNumber();
+    bool ReadHex4(uint32_t& cp);
+    // Shared by NextMember / NextElement: consume ',' before every item
+    // but the first; false (and leave the container) at `closer`.
+    bool NextItem(char closer);
+
+    static void AppendCodePoint(std::wstring& out, uint32_t cp);
+
+    std::string_view m_text;
+    size_t           m_pos = 0;
+    int              m_depth = 0;
+    bool             m_failed = false;
+    // Per-container "first item" flags so NextMember / NextElement know
+    // whether a ',' must precede the next item.
+    bool             m_first[kMaxDepth + 1] = {};
+};
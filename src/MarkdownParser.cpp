@@ -1,75 +1,135 @@
-#include <windows.h>
 #include "MarkdownParser.h"
-#include "plugin.h"
+#include <cstdint>
+#include <cwchar>
 #include <cwctype>
 #include <algorithm>
-#include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 
 // ============================================================================
-// ExtractMermaidBlocks - unchanged from original
+// Helper: skip spaces / tabs starting at `i`
 // ============================================================================
-std::vector<MermaidBlock> MarkdownParser::ExtractMermaidBlocks(const std::wstring& content)
+static size_t SkipBlanks(std::wstring_view s, size_t i)
 {
-    std::vector<MermaidBlock> blocks;
-    bool inBlock = false;
-    MermaidBlock current;
-    int lineNum = 0;
+    while (i < s.size() && (s[i] == L' ' || s[i] == L'\t'))
+        i++;
+    return i;
+}
 
-    size_t pos = 0;
-    while (pos < content.size()) {
-        size_t eol = content.find(L'\n', pos);
-        if (eol == std::wstring::npos)
-            eol = content.size();
-
-        std::wstring line = content.substr(pos, eol - pos);
-        if (!line.empty() && line.back() == L'\r')
-            line.pop_back();
-
-        if (!inBlock) {
-            size_t i = 0;
-            while (i < line.size() && (line[i] == L' ' || line[i] == L'\t'))
-                i++;
-            if (line.size() - i >= 10 &&
-                line.substr(i, 10) == L"```mermaid") {
-                size_t j = i + 10;
-                while (j < line.size() && (line[j] == L' ' || line[j] == L'\t'))
-                    j++;
-                if (j >= line.size()) {
-                    inBlock = true;
-                    current = {};
-                    current.startLine = lineNum;
-                }
-            }
-        } else {
-            size_t i = 0;
-            while (i < line.size() && (line[i] == L' ' || line[i] == L'\t'))
-                i++;
-            if (line.size() - i >= 3 && line.substr(i, 3) == L"```") {
-                size_t j = i + 3;
-                while (j < line.size() && (line[j] == L' ' || line[j] == L'\t'))
-                    j++;
-                if (j >= line.size()) {
-                    current.endLine = lineNum;
-                    if (!current.code.empty() && current.code.back() == L'\n')
-                        current.code.pop_back();
-                    blocks.push_back(std::move(current));
-                    inBlock = false;
-                }
-            } else {
-                current.code += line;
-                current.code += L'\n';
-            }
-        }
+// ============================================================================
+// Helper: ASCII case-insensitive compare against a lowercase literal
+// ============================================================================
+static bool EqualsNoCase(std::wstring_view s, std::wstring_view lower)
+{
+    if (s.size() != lower.size()) return false;
+    for (size_t i = 0; i < s.size(); i++)
+        if ((wchar_t)towlower(s[i]) != lower[i]) return false;
+    return true;
+}
 
-        lineNum++;
+static bool StartsWithNoCase(std::wstring_view s, std::wstring_view lower)
+{
+    return s.size() >= lower.size() && EqualsNoCase(s.substr(0, lower.size()), lower);
+}
+
+// ============================================================================
+// LineIndex::Assign - one pass over the buffer, no per-line allocation
+// ============================================================================
+void LineIndex::Assign(std::wstring_view text)
+{
+    m_text = text;
+    m_spans.clear();
+    // Count first so the span vector is sized by a single allocation.
+    m_spans.reserve((size_t)std::count(text.begin(), text.end(), L'\n') + 1);
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t eol = text.find(L'\n', pos);
+        if (eol == std::wstring_view::npos) eol = text.size();
+        size_t len = eol - pos;
+        if (len > 0 && text[eol - 1] == L'\r')
+            len--;
+        m_spans.push_back({ pos, len });
         pos = eol + 1;
     }
+}
 
+// ============================================================================
+// ExtractMermaidBlocks - the mermaid half of Parse(). Uses the real block
+// parser so fence flavour (``` / ~~~, case), nesting and numbering always
+// agree with the placeholders in the HTML.
+// ============================================================================
+std::vector<MermaidBlock> MarkdownParser::ExtractMermaidBlocks(const std::wstring& content,
+                                                               std::wstring_view mermaidSalt)
+{
+    std::vector<MermaidBlock> blocks;
+    LineIndex lines(content);
+    BlockContext ctx;
+    ctx.mermaidSalt = mermaidSalt;
+    ctx.blockKeys = false;
+    ParseBlocks(lines, 0, 0, ctx, [&](MarkdownBlock& blk) {
+        for (auto& m : blk.mermaid) blocks.push_back(std::move(m));
+        return true;
+    });
     return blocks;
 }
 
+// ============================================================================
+// MermaidHash / MermaidBlockId - content-addressed placeholder ids
+//
+// FNV-1a over the UTF-16 code units (wchar_t is truncated to 16 bits so
+// Linux builds hash like Windows ones), then a 0 separator and the salt.
+// Not cryptographic: a collision only makes two diagrams share a base id,
+// and the "-N" ordinal keeps the ids themselves unique.
+// ============================================================================
+uint64_t MarkdownParser::MermaidHash(std::wstring_view code, std::wstring_view salt)
+{
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&](std::wstring_view s) {
+        for (wchar_t ch : s) {
+            uint16_t u = (uint16_t)ch;
+            h = (h ^ (u & 0xFF)) * 1099511628211ull;
+            h = (h ^ (u >> 8)) * 1099511628211ull;
+        }
+    };
+    mix(code);
+    h = (h ^ 0) * 1099511628211ull;
+    mix(salt);
+    return h;
+}
+
+std::wstring MarkdownParser::MermaidBlockId(uint64_t hash, int ordinal)
+{
+    static const wchar_t kHex[] = L"0123456789abcdef";
+    std::wstring id = L"mermaid-";
+    for (int shift = 60; shift >= 0; shift -= 4)
+        id += kHex[(hash >> shift) & 0xF];
+    if (ordinal > 0) {
+        id += L'-';
+        id += std::to_wstring(ordinal);
+    }
+    return id;
+}
+
+bool MarkdownParser::IsMermaidBlockId(std::wstring_view id)
+{
+    const std::wstring_view prefix = L"mermaid-";
+    if (id.size() < prefix.size() + 16 || id.substr(0, prefix.size()) != prefix)
+        return false;
+    size_t i = prefix.size();
+    for (size_t end = i + 16; i < end; i++) {
+        wchar_t c = id[i];
+        if (!((c >= L'0' && c <= L'9') || (c >= L'a' && c <= L'f'))) return false;
+    }
+    if (i == id.size()) return true;
+    // "-N": 1–6 digits, no leading zero (ordinal 0 has no suffix)
+    if (id[i++] != L'-') return false;
+    size_t digits = id.size() - i;
+    if (digits == 0 || digits > 6 || id[i] == L'0') return false;
+    for (; i < id.size(); i++)
+        if (id[i] < L'0' || id[i] > L'9') return false;
+    return true;
+}
+
 // ============================================================================
 // ExtractFlowchartNodes - index every `id[label]` / `id{label}` / `id(label)`
 // definition in a flowchart mermaid block. Quote-aware so `A["a > b"]` is
@@ -90,20 +150,8 @@ MarkdownParser::ExtractFlowchartNodes(const std::wstring& blockSource)
     std::vector<MermaidNodeRef> out;
     if (blockSource.empty()) return out;
 
-    // Split into lines, preserving offsets for in-line label slicing.
-    std::vector<std::wstring> lines;
-    {
-        size_t pos = 0;
-        while (pos <= blockSource.size()) {
-            size_t eol = blockSource.find(L'\n', pos);
-            if (eol == std::wstring::npos) eol = blockSource.size();
-            std::wstring l = blockSource.substr(pos, eol - pos);
-            if (!l.empty() && l.back() == L'\r') l.pop_back();
-            lines.push_back(std::move(l));
-            if (eol >= blockSource.size()) break;
-            pos = eol + 1;
-        }
-    }
+    // Line views preserve offsets for in-line label slicing.
+    LineIndex lines(blockSource);
 
     auto isIdStart = [](wchar_t c) {
         return (c >= L'A' && c <= L'Z') || (c >= L'a' && c <= L'z') || c == L'_';
@@ -115,16 +163,16 @@ MarkdownParser::ExtractFlowchartNodes(const std::wstring& blockSource)
 
     // First non-blank, non-comment line must declare flowchart/graph.
     bool isFlowchart = false;
-    for (const auto& l : lines) {
-        size_t i = 0;
-        while (i < l.size() && (l[i] == L' ' || l[i] == L'\t')) i++;
+    for (size_t lineIdx = 0; lineIdx < lines.size(); ++lineIdx) {
+        std::wstring_view l = lines[lineIdx];
+        size_t i = SkipBlanks(l, 0);
         if (i >= l.size()) continue;
         if (l[i] == L'%' && i + 1 < l.size() && l[i + 1] == L'%') continue;
-        std::wstring lower;
         size_t j = i;
         while (j < l.size() && j < i + 16 && l[j] != L' ' && l[j] != L'\t')
-            lower += (wchar_t)towlower(l[j++]);
-        isFlowchart = (lower == L"flowchart" || lower == L"graph");
+            j++;
+        std::wstring_view word = l.substr(i, j - i);
+        isFlowchart = EqualsNoCase(word, L"flowchart") || EqualsNoCase(word, L"graph");
         break;
     }
     if (!isFlowchart) return out;
@@ -133,24 +181,22 @@ MarkdownParser::ExtractFlowchartNodes(const std::wstring& blockSource)
     // PERF-005: hash set instead of linear vector — the inline-edit path
     // calls this on every keystroke, and a 100-node block was O(N²)
     // worst-case (~10k string compares per call).
-    std::unordered_set<std::wstring> seen;
-    auto alreadySeen = [&](const std::wstring& id) {
+    // Keys are views into blockSource, which outlives the set.
+    std::unordered_set<std::wstring_view> seen;
+    auto alreadySeen = [&](std::wstring_view id) {
         return seen.find(id) != seen.end();
     };
 
     for (int lineIdx = 0; lineIdx < (int)lines.size(); ++lineIdx) {
-        const std::wstring& l = lines[lineIdx];
-        size_t i = 0;
-        while (i < l.size() && (l[i] == L' ' || l[i] == L'\t')) i++;
+        std::wstring_view l = lines[lineIdx];
+        size_t i = SkipBlanks(l, 0);
         if (i >= l.size()) continue;
 
         // Skip directive (%%{...}%%) and plain comments (%% ...).
         if (l[i] == L'%' && i + 1 < l.size() && l[i + 1] == L'%') continue;
 
         // Skip subgraph/end keywords (their argument is a label, not a node).
-        std::wstring leading;
-        for (size_t k = i; k < l.size() && k < i + 9; ++k) leading += (wchar_t)towlower(l[k]);
-        if (leading.rfind(L"subgraph", 0) == 0 || leading.rfind(L"end", 0) == 0)
+        if (StartsWithNoCase(l.substr(i), L"subgraph") || StartsWithNoCase(l.substr(i), L"end"))
             continue;
 
         // Walk the line looking for `<id><open>...<close>` patterns. Skip
@@ -174,7 +220,7 @@ MarkdownParser::ExtractFlowchartNodes(const std::wstring& blockSource)
             // Read identifier.
             size_t idStart = k;
             while (k < l.size() && isIdCont(l[k])) k++;
-            std::wstring nodeId = l.substr(idStart, k - idStart);
+            std::wstring_view nodeId = l.substr(idStart, k - idStart);
             if (k >= l.size()) break;
 
             // Reserved words that can sit next to a node id without one.
@@ -223,7 +269,7 @@ MarkdownParser::ExtractFlowchartNodes(const std::wstring& blockSource)
 
             if (!alreadySeen(nodeId)) {
                 MermaidNodeRef ref;
-                ref.nodeId = nodeId;
+                ref.nodeId.assign(nodeId.data(), nodeId.size());
                 ref.lineOffsetInBlock = lineIdx;
                 ref.labelStart = labelStart;
                 ref.labelEnd = labelEnd;
@@ -246,51 +292,10 @@ MarkdownParser::ExtractFlowchartNodes(const std::wstring& blockSource)
     return out;
 }
 
-// ============================================================================
-// GetDocumentContent - unchanged from original
-// ============================================================================
-std::wstring MarkdownParser::GetDocumentContent(HWND hwndView)
-{
-    std::wstring content;
-
-    UINT_PTR totalLines = (UINT_PTR)SendMessage(
-        hwndView, EE_GET_LINES, (WPARAM)0, 0);
-
-    if (totalLines == 0)
-        return content;
-
-    content.reserve(totalLines * 80);
-
-    for (UINT_PTR i = 0; i < totalLines; i++) {
-        GET_LINE_INFO gli = {};
-        gli.cch = 0;
-        gli.flags = 0;
-        gli.yLine = i;
-
-        UINT_PTR cch = (UINT_PTR)SendMessage(
-            hwndView, EE_GET_LINEW, (WPARAM)&gli, (LPARAM)nullptr);
-
-        if (cch == 0)
-            continue;
-
-        std::wstring lineBuf(cch, L'\0');
-        gli.cch = cch;
-        SendMessage(hwndView, EE_GET_LINEW, (WPARAM)&gli, (LPARAM)lineBuf.data());
-
-        while (!lineBuf.empty() && lineBuf.back() == L'\0')
-            lineBuf.pop_back();
-
-        content += lineBuf;
-        content += L'\n';
-    }
-
-    return content;
-}
-
 // ============================================================================
 // HtmlEscape
 // ============================================================================
-std::wstring MarkdownParser::HtmlEscape(const std::wstring& text)
+std::wstring MarkdownParser::HtmlEscape(std::wstring_view text)
 {
     std::wstring out;
     out.reserve(text.size() + text.size() / 8);
@@ -309,14 +314,23 @@ std::wstring MarkdownParser::HtmlEscape(const std::wstring& text)
 // ============================================================================
 // UrlEncode - for mermaid data attributes
 // ============================================================================
-std::wstring MarkdownParser::UrlEncode(const std::wstring& text)
+std::wstring MarkdownParser::UrlEncode(std::wstring_view text)
 {
-    // Index-based loop so we can pair UTF-16 surrogates. Feeding a lone
-    // high-surrogate (U+D800–U+DBFF) to WideCharToMultiByte produces a
-    // U+FFFD replacement, which would corrupt emoji etc. inside mermaid
-    // labels (audit v2 LOW-4.7).
+    // Index-based loop so we can pair UTF-16 surrogates. A lone surrogate
+    // (U+D800–U+DFFF) is encoded as U+FFFD, the same recovery
+    // WideCharToMultiByte used to apply; pairing keeps emoji etc. inside
+    // mermaid labels intact (audit v2 LOW-4.7). UTF-8 is produced by hand so
+    // this builds without Win32; where wchar_t is 32-bit the code point
+    // arrives unsplit.
+    static const wchar_t kHex[] = L"0123456789ABCDEF";
     std::wstring out;
     out.reserve(text.size() * 2);
+    auto pct = [&](unsigned b) {
+        out += L'%';
+        out += kHex[(b >> 4) & 0xF];
+        out += kHex[b & 0xF];
+    };
+
     const size_t n = text.size();
     for (size_t i = 0; i < n; ++i) {
         wchar_t ch = text[i];
@@ -327,37 +341,31 @@ std::wstring MarkdownParser::UrlEncode(const std::wstring& text)
                 out += L"%20";
             else
                 out += ch;
-        } else if (ch == L'\n') {
-            out += L"%0A";
-        } else if (ch == L'\r') {
-            out += L"%0D";
         } else if (ch < 0x80) {
-            // Single-byte ASCII: %XX
-            wchar_t buf[8];
-            swprintf_s(buf, L"%%%02X", (unsigned)ch);
-            out += buf;
+            // Single-byte ASCII (incl. \n → %0A, \r → %0D): %XX
+            pct((unsigned)ch);
         } else {
-            // Non-ASCII: encode as UTF-8. Pair UTF-16 high+low surrogate
-            // when present; lone surrogates fall through to the 1-wchar
-            // path and WideCharToMultiByte will emit U+FFFD (the only
-            // sane recovery for malformed input).
-            wchar_t buf[2] = { ch, 0 };
-            int wlen = 1;
-            if (ch >= 0xD800 && ch <= 0xDBFF && i + 1 < n) {
-                wchar_t low = text[i + 1];
-                if (low >= 0xDC00 && low <= 0xDFFF) {
-                    buf[1] = low;
-                    wlen = 2;
-                    ++i; // consume the low surrogate too
-                }
+            // Non-ASCII: encode as UTF-8.
+            uint32_t cp = (uint32_t)ch;
+            if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < n &&
+                (uint32_t)text[i + 1] >= 0xDC00 && (uint32_t)text[i + 1] <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + ((uint32_t)text[i + 1] - 0xDC00);
+                ++i; // consume the low surrogate too
+            } else if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+                cp = 0xFFFD;
             }
-            char utf8[8] = {};
-            int len = WideCharToMultiByte(CP_UTF8, 0, buf, wlen,
-                                          utf8, sizeof(utf8), nullptr, nullptr);
-            for (int k = 0; k < len; k++) {
-                wchar_t hex[8];
-                swprintf_s(hex, L"%%%02X", (unsigned char)utf8[k]);
-                out += hex;
+            if (cp < 0x800) {
+                pct(0xC0 | (cp >> 6));
+                pct(0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                pct(0xE0 | (cp >> 12));
+                pct(0x80 | ((cp >> 6) & 0x3F));
+                pct(0x80 | (cp & 0x3F));
+            } else {
+                pct(0xF0 | (cp >> 18));
+                pct(0x80 | ((cp >> 12) & 0x3F));
+                pct(0x80 | ((cp >> 6) & 0x3F));
+                pct(0x80 | (cp & 0x3F));
             }
         }
     }
@@ -367,7 +375,7 @@ std::wstring MarkdownParser::UrlEncode(const std::wstring& text)
 // ============================================================================
 // IsSafeUrl - Block dangerous URL schemes (javascript:, data:, vbscript:)
 // ============================================================================
-bool MarkdownParser::IsSafeUrl(const std::wstring& url)
+bool MarkdownParser::IsSafeUrl(std::wstring_view url)
 {
     // Trim leading whitespace (including \n, \r for multiline bypass prevention)
     size_t i = 0;
@@ -407,7 +415,7 @@ bool MarkdownParser::IsSafeUrl(const std::wstring& url)
 // GenerateSlug - Convert heading text to URL-safe anchor id
 // e.g. "My Heading!" -> "my-heading", "Hello World 123" -> "hello-world-123"
 // ============================================================================
-std::wstring MarkdownParser::GenerateSlug(const std::wstring& text)
+std::wstring MarkdownParser::GenerateSlug(std::wstring_view text)
 {
     std::wstring slug;
     slug.reserve(text.size());
@@ -443,7 +451,7 @@ std::wstring MarkdownParser::GenerateSlug(const std::wstring& text)
 // ============================================================================
 // IsHorizontalRule
 // ============================================================================
-bool MarkdownParser::IsHorizontalRule(const std::wstring& line)
+bool MarkdownParser::IsHorizontalRule(std::wstring_view line)
 {
     size_t i = 0;
     while (i < line.size() && line[i] == L' ') i++;
@@ -466,7 +474,7 @@ bool MarkdownParser::IsHorizontalRule(const std::wstring& line)
 // ============================================================================
 // IsTableSeparator - |---|---|
 // ============================================================================
-bool MarkdownParser::IsTableSeparator(const std::wstring& line)
+bool MarkdownParser::IsTableSeparator(std::wstring_view line)
 {
     size_t i = 0;
     while (i < line.size() && line[i] == L' ') i++;
@@ -484,10 +492,10 @@ bool MarkdownParser::IsTableSeparator(const std::wstring& line)
 // ============================================================================
 // ParseTableRow
 // ============================================================================
-std::vector<std::wstring> MarkdownParser::ParseTableRow(const std::wstring& line)
+std::vector<std::wstring_view> MarkdownParser::ParseTableRow(std::wstring_view line)
 {
-    std::vector<std::wstring> cells;
-    std::wstring trimmed = line;
+    std::vector<std::wstring_view> cells;
+    std::wstring_view trimmed = line;
 
     // Trim leading/trailing whitespace
     size_t s = 0, e = trimmed.size();
@@ -499,14 +507,14 @@ std::vector<std::wstring> MarkdownParser::ParseTableRow(const std::wstring& line
     if (!trimmed.empty() && trimmed.front() == L'|')
         trimmed = trimmed.substr(1);
     if (!trimmed.empty() && trimmed.back() == L'|')
-        trimmed.pop_back();
+        trimmed.remove_suffix(1);
 
     // Split by |
     size_t pos = 0;
     while (pos < trimmed.size()) {
         size_t pipe = trimmed.find(L'|', pos);
-        if (pipe == std::wstring::npos) pipe = trimmed.size();
-        std::wstring cell = trimmed.substr(pos, pipe - pos);
+        if (pipe == std::wstring_view::npos) pipe = trimmed.size();
+        std::wstring_view cell = trimmed.substr(pos, pipe - pos);
         // Trim cell
         size_t cs = 0, ce = cell.size();
         while (cs < ce && cell[cs] == L' ') cs++;
@@ -519,214 +527,445 @@ std::vector<std::wstring> MarkdownParser::ParseTableRow(const std::wstring& line
 
 // ============================================================================
 // ProcessInline - Handle inline formatting
+//
+// One left-to-right pass in the CommonMark style. Text is collected into a
+// flat node list that only references ranges of `text` (no substrings);
+// `*` / `~~` runs go on a delimiter stack and `[` / `![` on a bracket
+// stack. A `](url)` closes the nearest bracket and resolves the emphasis
+// inside it, and whatever is left is resolved once at the end.
+//
+// Linear time: the openers-bottom bounds (per delimiter char / run length
+// mod 3 / can-open) only ever move up, so a paragraph full of stray `*` or
+// `[` no longer rescans to the end once per opener; code-span and `)`
+// lookups remember how far they already searched. There is no recursion,
+// which also retires the old depth>20 fuse against stack overflow.
 // ============================================================================
-std::wstring MarkdownParser::ProcessInline(const std::wstring& text, int depth)
+// Text is escaped like the old ProcessInline did (& < > only); attribute
+// values and code spans additionally escape '"'.
+static void AppendEscaped(std::wstring& out, std::wstring_view s, bool quotes)
 {
-    // Recursion fuse: malicious markdown like `**[**x**](u)**` recurses
-    // through inline → link-text → bold/italic etc. Cap the depth and
-    // fall back to plain HTML-escape so we cannot trigger
-    // STATUS_STACK_OVERFLOW (uncatchable on Windows).
-    if (depth > 20) return HtmlEscape(text);
+    for (wchar_t ch : s) {
+        switch (ch) {
+        case L'&':  out += L"&amp;";  break;
+        case L'<':  out += L"&lt;";   break;
+        case L'>':  out += L"&gt;";   break;
+        case L'"':
+            if (quotes) { out += L"&quot;"; break; }
+            out += ch;
+            break;
+        default:    out += ch;        break;
+        }
+    }
+}
 
-    std::wstring out;
-    out.reserve(text.size() + text.size() / 4);
-    size_t len = text.size();
-    size_t i = 0;
+static bool IsInlineEscapable(wchar_t c)
+{
+    return c == L'\\' || c == L'`' || c == L'*' || c == L'_' ||
+           c == L'{' || c == L'}' || c == L'[' || c == L']' ||
+           c == L'(' || c == L')' || c == L'#' || c == L'+' ||
+           c == L'-' || c == L'.' || c == L'!' || c == L'|' ||
+           c == L'~';
+}
 
-    while (i < len) {
-        // --- Escaped character ---
-        if (text[i] == L'\\' && i + 1 < len) {
-            wchar_t next = text[i + 1];
-            if (next == L'\\' || next == L'`' || next == L'*' || next == L'_' ||
-                next == L'{' || next == L'}' || next == L'[' || next == L']' ||
-                next == L'(' || next == L')' || next == L'#' || next == L'+' ||
-                next == L'-' || next == L'.' || next == L'!' || next == L'|' ||
-                next == L'~') {
-                out += HtmlEscape(std::wstring(1, next));
-                i += 2;
-                continue;
-            }
-        }
+class MarkdownParser::InlineParser {
+public:
+    explicit InlineParser(std::wstring_view text) : m_text(text) {}
 
-        // --- Inline code: `code` ---
-        if (text[i] == L'`') {
-            // Count opening backticks
-            size_t btStart = i;
-            int btCount = 0;
-            while (i < len && text[i] == L'`') { btCount++; i++; }
-
-            // Find matching closing backticks
-            size_t closePos = std::wstring::npos;
-            for (size_t j = i; j <= len - btCount; j++) {
-                bool match = true;
-                for (int k = 0; k < btCount; k++) {
-                    if (text[j + k] != L'`') { match = false; break; }
-                }
-                if (match) {
-                    // Make sure it's exactly btCount backticks
-                    if (j + btCount < len && text[j + btCount] == L'`')
-                        continue;
-                    closePos = j;
-                    break;
+    std::wstring Run()
+    {
+        Scan();
+        ProcessEmphasis(-1);
+        return Render();
+    }
+
+private:
+    struct Node {
+        enum Kind : unsigned char { Text, Delim, Code, LinkOpen, LinkClose, Image, Skip };
+        Kind   kind;
+        size_t start;           // Text / Code content / LinkOpen + Image URL
+        size_t len;
+        size_t altStart = 0;    // Image alt text
+        size_t altLen = 0;
+        bool   safe = true;     // Image: URL passed IsSafeUrl
+        int    delim = -1;      // Delim: index into the delimiter list
+        int    openHead = -1;   // matches opened here, outermost first
+        int    closeHead = -1;  // matches closed here, innermost first
+        int    closeTail = -1;
+    };
+
+    struct Delim {
+        int     node;
+        wchar_t ch;
+        int     count;          // chars not yet consumed by a match
+        int     origCount;
+        bool    canOpen;
+        bool    canClose;
+        int     prev;
+        int     next;
+    };
+
+    struct Match {
+        enum Tag : unsigned char { Em, Strong, Del };
+        Tag tag;
+        int nextOpen;
+        int nextClose;
+    };
+
+    struct Bracket {
+        int  node;
+        int  delimBottom;       // last delimiter pushed before this bracket
+        bool image;
+    };
+
+    // --- Delimiter list (doubly linked over a vector, in source order) ---
+    void Unlink(int d)
+    {
+        Delim& x = m_delims[d];
+        if (x.prev >= 0) m_delims[x.prev].next = x.next;
+        if (x.next >= 0) m_delims[x.next].prev = x.prev;
+        if (m_tail == d) m_tail = x.prev;
+        x.prev = x.next = -1;
+    }
+
+    void AddMatch(int opener, int closer, Match::Tag tag)
+    {
+        Node& o = m_nodes[m_delims[opener].node];
+        Node& c = m_nodes[m_delims[closer].node];
+        int m = (int)m_matches.size();
+        m_matches.push_back({ tag, o.openHead, -1 });
+        o.openHead = m;
+        if (c.closeTail < 0) c.closeHead = m;
+        else m_matches[c.closeTail].nextClose = m;
+        c.closeTail = m;
+    }
+
+    // Resolve emphasis among delimiters above `stackBottom` (CommonMark
+    // "process emphasis"), then drop them from the stack.
+    void ProcessEmphasis(int stackBottom)
+    {
+        int closer = m_tail;
+        if (closer <= stackBottom) return;
+        while (m_delims[closer].prev > stackBottom) closer = m_delims[closer].prev;
+
+        int openersBottom[2][3][2];
+        for (auto& a : openersBottom)
+            for (auto& b : a)
+                b[0] = b[1] = stackBottom;
+
+        while (closer >= 0) {
+            Delim& c = m_delims[closer];
+            if (!c.canClose) { closer = c.next; continue; }
+
+            int& bottom = openersBottom[c.ch == L'~'][c.origCount % 3][c.canOpen];
+            int opener = c.prev;
+            bool found = false;
+            while (opener > bottom) {
+                const Delim& o = m_delims[opener];
+                if (o.ch == c.ch && o.canOpen) {
+                    // Rule of 3: a run that can both open and close only
+                    // pairs if the combined length is not a multiple of 3
+                    // (unless both are).
+                    bool oddMatch = c.ch == L'*' && (c.canOpen || o.canClose) &&
+                                    (o.origCount + c.origCount) % 3 == 0 &&
+                                    !(o.origCount % 3 == 0 && c.origCount % 3 == 0);
+                    if (!oddMatch) { found = true; break; }
                 }
+                opener = o.prev;
             }
 
-            if (closePos != std::wstring::npos) {
-                std::wstring code = text.substr(i, closePos - i);
-                // Trim single leading/trailing space
-                if (code.size() >= 2 && code.front() == L' ' && code.back() == L' ')
-                    code = code.substr(1, code.size() - 2);
-                out += L"<code>";
-                out += HtmlEscape(code);
-                out += L"</code>";
-                i = closePos + btCount;
+            if (found) {
+                Delim& o = m_delims[opener];
+                int use = (c.ch == L'~') ? 2 : (c.count >= 2 && o.count >= 2) ? 2 : 1;
+                AddMatch(opener, closer,
+                         c.ch == L'~' ? Match::Del
+                                      : use == 2 ? Match::Strong : Match::Em);
+                o.count -= use;
+                c.count -= use;
+                for (int d = o.next; d != closer; ) {
+                    int nx = m_delims[d].next;
+                    Unlink(d);
+                    d = nx;
+                }
+                if (o.count == 0) Unlink(opener);
+                if (c.count == 0) {
+                    int nx = c.next;
+                    Unlink(closer);
+                    closer = nx;
+                }
             } else {
-                // No closing backticks: output literally
-                for (int k = 0; k < btCount; k++) out += L'`';
+                bottom = c.prev;
+                int nx = c.next;
+                if (!c.canOpen) Unlink(closer);
+                closer = nx;
             }
-            continue;
         }
 
-        // --- Image: ![alt](url) ---
-        if (text[i] == L'!' && i + 1 < len && text[i + 1] == L'[') {
-            size_t altStart = i + 2;
-            size_t altEnd = text.find(L']', altStart);
-            if (altEnd != std::wstring::npos && altEnd + 1 < len && text[altEnd + 1] == L'(') {
-                size_t urlStart = altEnd + 2;
-                size_t urlEnd = text.find(L')', urlStart);
-                if (urlEnd != std::wstring::npos) {
-                    std::wstring alt = text.substr(altStart, altEnd - altStart);
-                    std::wstring url = text.substr(urlStart, urlEnd - urlStart);
-                    if (IsSafeUrl(url)) {
-                        out += L"<img src=\"";
-                        out += HtmlEscape(url);
-                        out += L"\" alt=\"";
-                        out += HtmlEscape(alt);
-                        out += L"\">";
-                    } else {
-                        out += L"[image blocked: unsafe URL]";
-                    }
-                    i = urlEnd + 1;
-                    continue;
-                }
-            }
+        while (m_tail > stackBottom) Unlink(m_tail);
+    }
+
+    // --- Bounded lookups ---
+    // Start of the closing backtick run of exactly `k` ticks at or after
+    // `from`, or npos. Every run seen on the way is recorded, so once a
+    // scan has hit the end, a length with no later run fails in O(1).
+    size_t FindBacktickCloser(size_t from, size_t k)
+    {
+        if (m_backticksScanned && (k >= m_lastRun.size() || m_lastRun[k] <= from))
+            return std::wstring_view::npos;
+        size_t p = from;
+        const size_t n = m_text.size();
+        while (p < n) {
+            if (m_text[p] != L'`') { p++; continue; }
+            size_t r = 0;
+            while (p + r < n && m_text[p + r] == L'`') r++;
+            if (r >= m_lastRun.size()) m_lastRun.resize(r + 1, 0);
+            m_lastRun[r] = p + 1;
+            if (r == k) return p;
+            p += r;
         }
+        m_backticksScanned = true;
+        return std::wstring_view::npos;
+    }
 
-        // --- Link: [text](url) ---
-        if (text[i] == L'[') {
-            size_t textEnd = std::wstring::npos;
-            int depth = 1;
-            for (size_t j = i + 1; j < len; j++) {
-                if (text[j] == L'[') depth++;
-                else if (text[j] == L']') { depth--; if (depth == 0) { textEnd = j; break; } }
+    // First ')' at or after `from`. Callers only ever ask from increasing
+    // positions, so the previous answer is reused while it still applies.
+    size_t FindCloseParen(size_t from)
+    {
+        if (m_parenFrom != std::wstring_view::npos && from >= m_parenFrom &&
+            (m_parenAt == std::wstring_view::npos || from <= m_parenAt))
+            return m_parenAt;
+        m_parenFrom = from;
+        m_parenAt = m_text.find(L')', from);
+        return m_parenAt;
+    }
+
+    // --- Tokenizer ---
+    void PushText(size_t start, size_t len)
+    {
+        m_nodes.push_back({ Node::Text, start, len });
+    }
+
+    void Scan()
+    {
+        const std::wstring_view text = m_text;
+        const size_t len = text.size();
+        size_t i = 0;
+        size_t textStart = std::wstring_view::npos;
+        auto flushText = [&](size_t end) {
+            if (textStart != std::wstring_view::npos && end > textStart)
+                PushText(textStart, end - textStart);
+            textStart = std::wstring_view::npos;
+        };
+        auto literal = [&](size_t count) {
+            if (textStart == std::wstring_view::npos) textStart = i;
+            i += count;
+        };
+        // Link openers below this bracket depth are dead: CommonMark does
+        // not allow a link inside a link.
+        size_t noLinkBelow = 0;
+
+        while (i < len) {
+            wchar_t c = text[i];
+
+            // --- Escaped character ---
+            if (c == L'\\' && i + 1 < len && IsInlineEscapable(text[i + 1])) {
+                flushText(i);
+                PushText(i + 1, 1);
+                i += 2;
+                continue;
             }
-            if (textEnd != std::wstring::npos && textEnd + 1 < len && text[textEnd + 1] == L'(') {
-                size_t urlStart = textEnd + 2;
-                size_t urlEnd = text.find(L')', urlStart);
-                if (urlEnd != std::wstring::npos) {
-                    std::wstring linkText = text.substr(i + 1, textEnd - i - 1);
-                    std::wstring url = text.substr(urlStart, urlEnd - urlStart);
-                    if (IsSafeUrl(url)) {
-                        out += L"<a href=\"";
-                        out += HtmlEscape(url);
-                        out += L"\">";
-                        out += ProcessInline(linkText, depth + 1);
-                        out += L"</a>";
-                    } else {
-                        out += ProcessInline(linkText, depth + 1);
-                    }
-                    i = urlEnd + 1;
+
+            // --- Inline code: `code` ---
+            if (c == L'`') {
+                size_t btCount = 0;
+                while (i + btCount < len && text[i + btCount] == L'`') btCount++;
+                size_t closePos = FindBacktickCloser(i + btCount, btCount);
+                if (closePos == std::wstring_view::npos) {
+                    // No closing backticks: output literally
+                    literal(btCount);
                     continue;
                 }
+                flushText(i);
+                size_t cs = i + btCount, ce = closePos;
+                // Trim single leading/trailing space
+                if (ce - cs >= 2 && text[cs] == L' ' && text[ce - 1] == L' ') { cs++; ce--; }
+                m_nodes.push_back({ Node::Code, cs, ce - cs });
+                i = closePos + btCount;
+                continue;
             }
-        }
 
-        // --- Bold + Italic: ***text*** ---
-        if (i + 2 < len && text[i] == L'*' && text[i + 1] == L'*' && text[i + 2] == L'*') {
-            size_t end = text.find(L"***", i + 3);
-            if (end != std::wstring::npos) {
-                out += L"<strong><em>";
-                out += ProcessInline(text.substr(i + 3, end - i - 3), depth + 1);
-                out += L"</em></strong>";
-                i = end + 3;
+            // --- Link / image openers: [ and ![ ---
+            if (c == L'[' || (c == L'!' && i + 1 < len && text[i + 1] == L'[')) {
+                bool image = (c == L'!');
+                flushText(i);
+                if (m_brackets.size() < noLinkBelow) noLinkBelow = m_brackets.size();
+                m_brackets.push_back({ (int)m_nodes.size(), m_tail, image });
+                PushText(i, image ? 2 : 1);
+                i += image ? 2 : 1;
                 continue;
             }
-        }
 
-        // --- Bold: **text** ---
-        if (i + 1 < len && text[i] == L'*' && text[i + 1] == L'*') {
-            size_t end = text.find(L"**", i + 2);
-            if (end != std::wstring::npos) {
-                out += L"<strong>";
-                out += ProcessInline(text.substr(i + 2, end - i - 2), depth + 1);
-                out += L"</strong>";
-                i = end + 2;
+            // --- Link / image closer: ](url) ---
+            if (c == L']') {
+                flushText(i);
+                size_t urlEnd = std::wstring_view::npos;
+                if (!m_brackets.empty() && i + 1 < len && text[i + 1] == L'(')
+                    urlEnd = FindCloseParen(i + 2);
+                bool dead = !m_brackets.empty() && !m_brackets.back().image &&
+                            m_brackets.size() - 1 < noLinkBelow;
+                if (urlEnd == std::wstring_view::npos || dead) {
+                    if (!m_brackets.empty()) m_brackets.pop_back();
+                    PushText(i, 1);
+                    i++;
+                    continue;
+                }
+
+                Bracket b = m_brackets.back();
+                m_brackets.pop_back();
+                size_t urlStart = i + 2;
+                std::wstring_view url = text.substr(urlStart, urlEnd - urlStart);
+                Node& open = m_nodes[b.node];
+
+                if (b.image) {
+                    // Alt text is the raw source between ![ and ]; nothing
+                    // inside it is rendered as markup.
+                    size_t altStart = open.start + 2;
+                    for (size_t k = (size_t)b.node + 1; k < m_nodes.size(); k++)
+                        m_nodes[k].kind = Node::Skip;
+                    while (m_tail > b.delimBottom) Unlink(m_tail);
+                    open.kind = Node::Image;
+                    open.altStart = altStart;
+                    open.altLen = i - altStart;
+                    open.start = urlStart;
+                    open.len = url.size();
+                    open.safe = IsSafeUrl(url);
+                } else {
+                    ProcessEmphasis(b.delimBottom);
+                    if (IsSafeUrl(url)) {
+                        open.kind = Node::LinkOpen;
+                        open.start = urlStart;
+                        open.len = url.size();
+                        m_nodes.push_back({ Node::LinkClose, i, 0 });
+                    } else {
+                        // Unsafe scheme: keep the link text, drop the link.
+                        open.kind = Node::Skip;
+                    }
+                    noLinkBelow = m_brackets.size();
+                }
+                i = urlEnd + 1;
                 continue;
             }
-        }
 
-        // --- Italic: *text* ---
-        if (text[i] == L'*' && i + 1 < len && text[i + 1] != L' ') {
-            size_t end = text.find(L'*', i + 1);
-            if (end != std::wstring::npos && text[end - 1] != L' ') {
-                out += L"<em>";
-                out += ProcessInline(text.substr(i + 1, end - i - 1), depth + 1);
-                out += L"</em>";
-                i = end + 1;
+            // --- Emphasis / strikethrough delimiter runs ---
+            if (c == L'*' || c == L'~') {
+                size_t run = 0;
+                while (i + run < len && text[i + run] == c) run++;
+                if (c == L'~' && run != 2) {
+                    literal(run);
+                    continue;
+                }
+                flushText(i);
+                wchar_t before = i > 0 ? text[i - 1] : 0;
+                wchar_t after = i + run < len ? text[i + run] : 0;
+                auto isWs = [](wchar_t ch) { return ch == 0 || iswspace(ch); };
+                auto isPunct = [](wchar_t ch) { return ch != 0 && iswpunct(ch); };
+                bool leftFlanking = !isWs(after) &&
+                    (!isPunct(after) || isWs(before) || isPunct(before));
+                bool rightFlanking = !isWs(before) &&
+                    (!isPunct(before) || isWs(after) || isPunct(after));
+
+                int d = (int)m_delims.size();
+                m_delims.push_back({ (int)m_nodes.size(), c, (int)run, (int)run,
+                                     leftFlanking, rightFlanking, m_tail, -1 });
+                if (m_tail >= 0) m_delims[m_tail].next = d;
+                m_tail = d;
+                Node node{ Node::Delim, i, run };
+                node.delim = d;
+                m_nodes.push_back(node);
+                i += run;
                 continue;
             }
+
+            // --- Normal character ---
+            literal(1);
         }
+        flushText(len);
+    }
 
-        // --- Strikethrough: ~~text~~ ---
-        if (i + 1 < len && text[i] == L'~' && text[i + 1] == L'~') {
-            size_t end = text.find(L"~~", i + 2);
-            if (end != std::wstring::npos) {
-                out += L"<del>";
-                out += ProcessInline(text.substr(i + 2, end - i - 2), depth + 1);
-                out += L"</del>";
-                i = end + 2;
-                continue;
+    // --- Output ---
+    std::wstring Render() const
+    {
+        static const wchar_t* const kOpen[]  = { L"<em>", L"<strong>", L"<del>" };
+        static const wchar_t* const kClose[] = { L"</em>", L"</strong>", L"</del>" };
+
+        std::wstring out;
+        out.reserve(m_text.size() + m_text.size() / 4);
+        for (const Node& n : m_nodes) {
+            switch (n.kind) {
+            case Node::Text:
+                AppendEscaped(out, m_text.substr(n.start, n.len), false);
+                break;
+            case Node::Delim:
+                for (int m = n.closeHead; m >= 0; m = m_matches[m].nextClose)
+                    out += kClose[m_matches[m].tag];
+                out.append((size_t)m_delims[n.delim].count, m_delims[n.delim].ch);
+                for (int m = n.openHead; m >= 0; m = m_matches[m].nextOpen)
+                    out += kOpen[m_matches[m].tag];
+                break;
+            case Node::Code:
+                out += L"<code>";
+                AppendEscaped(out, m_text.substr(n.start, n.len), true);
+                out += L"</code>";
+                break;
+            case Node::LinkOpen:
+                out += L"<a href=\"";
+                AppendEscaped(out, m_text.substr(n.start, n.len), true);
+                out += L"\">";
+                break;
+            case Node::LinkClose:
+                out += L"</a>";
+                break;
+            case Node::Image:
+                if (n.safe) {
+                    out += L"<img src=\"";
+                    AppendEscaped(out, m_text.substr(n.start, n.len), true);
+                    out += L"\" alt=\"";
+                    AppendEscaped(out, m_text.substr(n.altStart, n.altLen), true);
+                    out += L"\">";
+                } else {
+                    out += L"[image blocked: unsafe URL]";
+                }
+                break;
+            case Node::Skip:
+                break;
             }
         }
+        return out;
+    }
 
-        // --- HTML entities ---
-        if (text[i] == L'&') { out += L"&amp;"; i++; continue; }
-        if (text[i] == L'<') { out += L"&lt;";  i++; continue; }
-        if (text[i] == L'>') { out += L"&gt;";  i++; continue; }
+    std::wstring_view          m_text;
+    std::vector<Node>    m_nodes;
+    std::vector<Delim>   m_delims;
+    std::vector<Match>   m_matches;
+    std::vector<Bracket> m_brackets;
+    int                        m_tail = -1;     // last live delimiter
 
-        // --- Normal character ---
-        out += text[i];
-        i++;
-    }
-    return out;
-}
+    std::vector<size_t>        m_lastRun;       // backtick run length -> last start + 1
+    bool                       m_backticksScanned = false;
+    size_t                     m_parenFrom = std::wstring_view::npos;
+    size_t                     m_parenAt = std::wstring_view::npos;
+};
 
-// ============================================================================
-// Helper: split content into lines
-// ============================================================================
-static std::vector<std::wstring> SplitLines(const std::wstring& content)
+std::wstring MarkdownParser::ProcessInline(std::wstring_view text)
 {
-    std::vector<std::wstring> lines;
-    size_t pos = 0;
-    while (pos < content.size()) {
-        size_t eol = content.find(L'\n', pos);
-        if (eol == std::wstring::npos) eol = content.size();
-        std::wstring line = content.substr(pos, eol - pos);
-        if (!line.empty() && line.back() == L'\r')
-            line.pop_back();
-        lines.push_back(std::move(line));
-        pos = eol + 1;
-    }
-    return lines;
+    return InlineParser(text).Run();
 }
 
 // ============================================================================
 // Helper: trim leading whitespace, return indent count
 // ============================================================================
-static std::wstring TrimLeft(const std::wstring& s, size_t* indentOut = nullptr)
+static std::wstring_view TrimLeft(std::wstring_view s, size_t* indentOut = nullptr)
 {
-    size_t i = 0;
-    while (i < s.size() && (s[i] == L' ' || s[i] == L'\t')) i++;
+    size_t i = SkipBlanks(s, 0);
     if (indentOut) *indentOut = i;
     return s.substr(i);
 }
@@ -734,35 +973,174 @@ static std::wstring TrimLeft(const std::wstring& s, size_t* indentOut = nullptr)
 // ============================================================================
 // Helper: check if line is blank
 // ============================================================================
-static bool IsBlank(const std::wstring& line)
+static bool IsBlank(std::wstring_view line)
 {
-    for (wchar_t ch : line)
-        if (ch != L' ' && ch != L'\t') return false;
-    return true;
+    return SkipBlanks(line, 0) == line.size();
 }
 
 // ============================================================================
 // ConvertToHtml - Main markdown-to-HTML converter
 // ============================================================================
-std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
+std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown,
+                                          std::wstring_view mermaidSalt)
 {
-    auto lines = SplitLines(markdown);
+    LineIndex lines(markdown);
     std::wstring html;
     html.reserve(markdown.size() * 2);
 
+    BlockContext ctx;
+    ctx.mermaidSalt = mermaidSalt;
+    ParseBlocks(lines, 0, 0, ctx, [&](MarkdownBlock& blk) {
+        html += blk.html;
+        return true;
+    });
+    return html;
+}
+
+// ============================================================================
+// Helper: add one top-level block to the heading / line maps
+// ============================================================================
+static void AppendMaps(MarkdownParseResult& r, const MarkdownBlock& blk, size_t htmlOffset)
+{
+    r.lineMap.push_back({ blk.startLine, blk.endLine, blk.key, htmlOffset, blk.html.size() });
+    if (blk.headingLevel > 0) {
+        std::wstring id = blk.slug;
+        if (blk.slugOrdinal > 0) id += L"-" + std::to_wstring(blk.slugOrdinal);
+        r.headings.push_back({ blk.headingLevel, blk.startLine, std::move(id) });
+    }
+}
+
+// ============================================================================
+// Parse - ConvertToHtml + mermaid blocks + heading / line maps, one pass
+// ============================================================================
+MarkdownParseResult MarkdownParser::Parse(const std::wstring& markdown,
+                                          std::wstring_view mermaidSalt)
+{
+    LineIndex lines(markdown);
+    MarkdownParseResult result;
+    result.html.reserve(markdown.size() * 2);
+
+    BlockContext ctx;
+    ctx.mermaidSalt = mermaidSalt;
+    ParseBlocks(lines, 0, 0, ctx, [&](MarkdownBlock& blk) {
+        AppendMaps(result, blk, result.html.size());
+        for (auto& m : blk.mermaid) {
+            m.htmlOffset += result.html.size();
+            result.mermaidBlocks.push_back(std::move(m));
+        }
+        result.html += blk.html;
+        return true;
+    });
+    return result;
+}
+
+// ============================================================================
+// Helper: stamp a top-level block's reconciliation key into its opening
+// tag (see MarkdownBlock). The hash is FNV-1a like MermaidHash, with the
+// digits of every data-line-* value skipped, so RebaseLineAttrs never
+// changes it; data-line-block is rebased along with the other attributes.
+// The block's mermaid placeholder spans move with the inserted text.
+// ============================================================================
+static void StampBlockKey(MarkdownBlock& blk)
+{
+    std::wstring& html = blk.html;
+    if (html.size() < 2 || html[0] != L'<') return;
+    size_t tagEnd = html.find_first_of(L" >", 1);
+    if (tagEnd == std::wstring::npos) return;
+
+    // One multiply per UTF-16 unit: the key only has to be stable within
+    // a session, not match MermaidHash.
+    static const wchar_t kAttr[] = L"data-line-";
+    const size_t kAttrLen = sizeof(kAttr) / sizeof(kAttr[0]) - 1;
+    uint64_t h = 14695981039346656037ull;
+    auto mix = [&](size_t from, size_t to) {
+        const wchar_t* p = html.data();
+        for (size_t k = from; k < to; k++)
+            h = (h ^ (uint16_t)p[k]) * 1099511628211ull;
+    };
+    size_t pos = 0;
+    while (true) {
+        size_t hit = html.find(kAttr, pos);
+        size_t q = hit == std::wstring::npos ? hit : html.find(L"=\"", hit + kAttrLen);
+        if (q == std::wstring::npos) break;
+        mix(pos, q + 2);
+        pos = q + 2;
+        while (pos < html.size() && html[pos] >= L'0' && html[pos] <= L'9') pos++;
+    }
+    mix(pos, html.size());
+    h = (h ^ (uint64_t)(blk.endLine - blk.startLine)) * 1099511628211ull;
+
+    // ` data-key="<16 hex>" data-line-block="<line>"`, built in place.
+    static const wchar_t kHex[] = L"0123456789abcdef";
+    static const wchar_t kKey[] = L" data-key=\"";
+    static const wchar_t kLine[] = L"\" data-line-block=\"";
+    blk.key = h;
+    wchar_t stamp[80];
+    size_t n = 0;
+    for (const wchar_t* c = kKey; *c; c++) stamp[n++] = *c;
+    for (int shift = 60; shift >= 0; shift -= 4) stamp[n++] = kHex[(h >> shift) & 0xF];
+    for (const wchar_t* c = kLine; *c; c++) stamp[n++] = *c;
+    wchar_t digits[12];
+    size_t d = 0;
+    unsigned line = (unsigned)(blk.startLine < 0 ? 0 : blk.startLine);
+    do { digits[d++] = (wchar_t)(L'0' + line % 10); line /= 10; } while (line);
+    while (d) stamp[n++] = digits[--d];
+    stamp[n++] = L'"';
+    html.insert(tagEnd, stamp, n);
+
+    for (auto& m : blk.mermaid) {
+        if (m.htmlOffset >= tagEnd) m.htmlOffset += n;
+        else if (m.htmlOffset + m.htmlLength > tagEnd) m.htmlLength += n;
+    }
+}
+
+// ============================================================================
+// ParseBlocks - Block-level parser shared by ConvertToHtml and
+// MarkdownDocument. Every top-level construct (paragraph, heading, list,
+// table, fence, blockquote, hr, anchor) is emitted as one MarkdownBlock.
+//
+// Parsing from the first line of any block depends only on the lines from
+// there on plus `ctx` — lines between blocks are always blank — which is
+// what lets MarkdownDocument restart the parse at an arbitrary block.
+// ============================================================================
+void MarkdownParser::ParseBlocks(const LineIndex& lines, size_t first,
+                                 int lineBase, BlockContext& ctx,
+                                 const std::function<bool(MarkdownBlock&)>& sink)
+{
     size_t n = lines.size();
-    size_t i = 0;
-    int mermaidIdx = 0;
-    std::unordered_map<std::wstring, int> slugCount; // Track duplicate heading IDs
-    auto uniqueSlug = [&](const std::wstring& text) -> std::wstring {
+    size_t i = first;
+
+    MarkdownBlock blk;
+    bool stopped = false;
+    auto emit = [&](int startLine, int endLine) {
+        if (!stopped) {
+            blk.startLine = startLine + lineBase;
+            blk.endLine = endLine + lineBase;
+            if (ctx.blockKeys) StampBlockKey(blk);
+            if (!sink(blk)) stopped = true;
+        }
+        blk.html.clear();
+        blk.slug.clear();
+        blk.slugOrdinal = 0;
+        blk.headingLevel = 0;
+        blk.key = 0;
+        blk.mermaid.clear();
+    };
+    auto lineNo = [&](size_t ln) { return std::to_wstring((int)ln + lineBase); };
+
+    // Track duplicate heading IDs; records the base slug on the block so
+    // MarkdownDocument can replay the numbering without reparsing.
+    auto uniqueSlug = [&](std::wstring_view text) -> std::wstring {
         std::wstring slug = GenerateSlug(text);
         if (slug.empty()) return slug;
-        auto it = slugCount.find(slug);
-        if (it != slugCount.end()) {
+        blk.slug = slug;
+        auto it = ctx.slugCount.find(slug);
+        if (it != ctx.slugCount.end()) {
             it->second++;
+            blk.slugOrdinal = it->second;
             slug += L"-" + std::to_wstring(it->second);
         } else {
-            slugCount[slug] = 0;
+            ctx.slugCount[slug] = 0;
         }
         return slug;
     };
@@ -774,19 +1152,20 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
 
     auto flushParagraph = [&]() {
         if (!paraAccum.empty()) {
-            html += L"<p data-line-start=\"" + std::to_wstring(paraStartLine)
-                 + L"\" data-line-end=\"" + std::to_wstring(paraEndLine) + L"\">";
-            html += ProcessInline(paraAccum);
-            html += L"</p>\n";
+            blk.html += L"<p data-line-start=\"" + lineNo(paraStartLine)
+                     + L"\" data-line-end=\"" + lineNo(paraEndLine) + L"\">";
+            blk.html += ProcessInline(paraAccum);
+            blk.html += L"</p>\n";
+            emit(paraStartLine, paraEndLine);
             paraAccum.clear();
             paraStartLine = -1;
             paraEndLine = -1;
         }
     };
 
-    while (i < n) {
-        const std::wstring& rawLine = lines[i];
-        std::wstring trimmed = TrimLeft(rawLine);
+    while (i < n && !stopped) {
+        std::wstring_view rawLine = lines[i];
+        std::wstring_view trimmed = TrimLeft(rawLine);
 
         // --- Blank line: flush paragraph ---
         if (IsBlank(rawLine)) {
@@ -800,16 +1179,16 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
         if (trimmed.size() >= 8 && trimmed[0] == L'<' && trimmed[1] == L'a' && trimmed[2] == L' ') {
             // Extract and validate id/name value with strict character whitelist
             // Only allow: [A-Za-z0-9_\-\.] in the attribute value
-            auto extractSafeAnchorId = [](const std::wstring& tag) -> std::wstring {
+            auto extractSafeAnchorId = [](std::wstring_view tag) -> std::wstring_view {
                 // Try id="..." first, then name="..."
                 const wchar_t* attrs[] = { L"id=\"", L"name=\"" };
                 for (const wchar_t* attr : attrs) {
                     size_t pos = tag.find(attr);
-                    if (pos == std::wstring::npos) continue;
+                    if (pos == std::wstring_view::npos) continue;
                     pos += wcslen(attr);
                     size_t endQuote = tag.find(L'"', pos);
-                    if (endQuote == std::wstring::npos || endQuote == pos) continue;
-                    std::wstring val = tag.substr(pos, endQuote - pos);
+                    if (endQuote == std::wstring_view::npos || endQuote == pos) continue;
+                    std::wstring_view val = tag.substr(pos, endQuote - pos);
                     // Validate: only safe characters
                     bool safe = true;
                     for (wchar_t ch : val) {
@@ -822,18 +1201,19 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
                     }
                     if (safe) return val;
                 }
-                return L"";
+                return {};
             };
 
             size_t closeTag = trimmed.find(L"</a>");
-            if (closeTag != std::wstring::npos) {
-                std::wstring anchorId = extractSafeAnchorId(trimmed);
+            if (closeTag != std::wstring_view::npos) {
+                std::wstring_view anchorId = extractSafeAnchorId(trimmed);
                 if (!anchorId.empty()) {
                     flushParagraph();
                     // Generate safe anchor (never pass raw HTML through)
-                    html += L"<a id=\"";
-                    html += HtmlEscape(anchorId);
-                    html += L"\"></a>\n";
+                    blk.html += L"<a id=\"";
+                    blk.html += HtmlEscape(anchorId);
+                    blk.html += L"\"></a>\n";
+                    emit((int)i, (int)i);
                     i++;
                     continue;
                 }
@@ -852,7 +1232,7 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
             while (fenceLen < trimmed.size() && trimmed[fenceLen] == fence) fenceLen++;
 
             // Extract language tag
-            std::wstring lang = trimmed.substr(fenceLen);
+            std::wstring_view lang = trimmed.substr(fenceLen);
             // Trim whitespace from lang
             size_t ls = 0;
             while (ls < lang.size() && lang[ls] == L' ') ls++;
@@ -860,25 +1240,23 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
             while (le > ls && lang[le - 1] == L' ') le--;
             lang = lang.substr(ls, le - ls);
 
-            // Lowercase lang for comparison
-            std::wstring langLower = lang;
-            for (auto& c : langLower) c = towlower(c);
-
             // Collect code block content
             int codeBlockStartLine = (int)i; // opening fence line
             std::wstring codeContent;
+            bool closed = false;
             i++;
             while (i < n) {
-                std::wstring ct = TrimLeft(lines[i]);
+                std::wstring_view ct = TrimLeft(lines[i]);
                 // Check for closing fence
                 size_t closeFenceLen = 0;
                 while (closeFenceLen < ct.size() && ct[closeFenceLen] == fence) closeFenceLen++;
                 if (closeFenceLen >= fenceLen) {
-                    std::wstring rest = ct.substr(closeFenceLen);
+                    std::wstring_view rest = ct.substr(closeFenceLen);
                     bool onlyWhitespace = true;
                     for (wchar_t ch : rest)
                         if (ch != L' ' && ch != L'\t') { onlyWhitespace = false; break; }
                     if (onlyWhitespace) {
+                        closed = true;
                         i++;
                         break;
                     }
@@ -892,30 +1270,44 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
             if (!codeContent.empty() && codeContent.back() == L'\n')
                 codeContent.pop_back();
 
-            // Mermaid block → placeholder div
-            if (langLower == L"mermaid") {
-                std::wstring id = L"mermaid-placeholder-" + std::to_wstring(mermaidIdx++);
-                html += L"<div class=\"mermaid-container\" data-mermaid-id=\"";
-                html += id;
-                html += L"\" data-mermaid-src=\"";
-                html += UrlEncode(codeContent);
-                html += L"\" data-line-start=\"";
-                html += std::to_wstring(codeBlockStartLine);
-                html += L"\" data-line-end=\"";
-                html += std::to_wstring(codeBlockEndLine);
-                html += L"\"></div>\n";
+            // Mermaid block → placeholder div, id addressed by content
+            if (EqualsNoCase(lang, L"mermaid")) {
+                uint64_t hash = MermaidHash(codeContent, ctx.mermaidSalt);
+                int ordinal = 0;
+                auto it = ctx.mermaidCount.find(hash);
+                if (it != ctx.mermaidCount.end()) ordinal = ++it->second;
+                else ctx.mermaidCount[hash] = 0;
+                std::wstring id = MermaidBlockId(hash, ordinal);
+                size_t htmlOffset = blk.html.size();
+                blk.html += L"<div class=\"mermaid-container\" data-mermaid-id=\"";
+                blk.html += id;
+                blk.html += L"\" data-mermaid-src=\"";
+                blk.html += UrlEncode(codeContent);
+                blk.html += L"\" data-line-start=\"";
+                blk.html += lineNo(codeBlockStartLine);
+                blk.html += L"\" data-line-end=\"";
+                blk.html += lineNo(codeBlockEndLine);
+                blk.html += L"\"></div>";
+                size_t htmlLength = blk.html.size() - htmlOffset;
+                blk.html += L'\n';
+                blk.mermaid.push_back({ std::move(codeContent),
+                                        codeBlockStartLine + lineBase,
+                                        codeBlockEndLine + lineBase,
+                                        std::move(id), hash, ordinal, closed,
+                                        htmlOffset, htmlLength });
             } else {
                 // Regular code block
-                html += L"<pre><code";
+                blk.html += L"<pre><code";
                 if (!lang.empty()) {
-                    html += L" class=\"language-";
-                    html += HtmlEscape(lang);
-                    html += L"\"";
+                    blk.html += L" class=\"language-";
+                    blk.html += HtmlEscape(lang);
+                    blk.html += L"\"";
                 }
-                html += L">";
-                html += HtmlEscape(codeContent);
-                html += L"</code></pre>\n";
+                blk.html += L">";
+                blk.html += HtmlEscape(codeContent);
+                blk.html += L"</code></pre>\n";
             }
+            emit(codeBlockStartLine, codeBlockEndLine);
             continue;
         }
 
@@ -926,7 +1318,7 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
             while (hi < trimmed.size() && hi < 6 && trimmed[hi] == L'#') { level++; hi++; }
             if (hi < trimmed.size() && trimmed[hi] == L' ') {
                 flushParagraph();
-                std::wstring headText = trimmed.substr(hi + 1);
+                std::wstring_view headText = trimmed.substr(hi + 1);
                 // Remove trailing #s
                 size_t te = headText.size();
                 while (te > 0 && headText[te - 1] == L'#') te--;
@@ -934,17 +1326,19 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
                 headText = headText.substr(0, te);
 
                 std::wstring slug = uniqueSlug(headText);
-                html += L"<h" + std::to_wstring(level);
+                blk.headingLevel = level;
+                blk.html += L"<h" + std::to_wstring(level);
                 if (!slug.empty()) {
-                    html += L" id=\"";
-                    html += HtmlEscape(slug);
-                    html += L"\"";
+                    blk.html += L" id=\"";
+                    blk.html += HtmlEscape(slug);
+                    blk.html += L"\"";
                 }
-                html += L" data-line-start=\""
-                     + std::to_wstring((int)i) + L"\" data-line-end=\""
-                     + std::to_wstring((int)i) + L"\">";
-                html += ProcessInline(headText);
-                html += L"</h" + std::to_wstring(level) + L">\n";
+                blk.html += L" data-line-start=\""
+                          + lineNo(i) + L"\" data-line-end=\""
+                          + lineNo(i) + L"\">";
+                blk.html += ProcessInline(headText);
+                blk.html += L"</h" + std::to_wstring(level) + L">\n";
+                emit((int)i, (int)i);
                 i++;
                 continue;
             }
@@ -953,7 +1347,8 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
         // --- Horizontal rule ---
         if (IsHorizontalRule(trimmed)) {
             flushParagraph();
-            html += L"<hr>\n";
+            blk.html += L"<hr>\n";
+            emit((int)i, (int)i);
             i++;
             continue;
         }
@@ -961,21 +1356,40 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
         // --- Blockquote: > ---
         if (trimmed.size() >= 1 && trimmed[0] == L'>') {
             flushParagraph();
-            std::wstring bqContent;
+            int bqStartLine = (int)i;
+            // Stripped lines are still substrings of the same buffer, so the
+            // blockquote body is a sub-index rather than a copy.
+            LineIndex bqLines;
+            bqLines.Clear(lines.Text());
             while (i < n) {
-                std::wstring t = TrimLeft(lines[i]);
+                std::wstring_view t = TrimLeft(lines[i]);
                 if (t.empty() || t[0] != L'>') break;
                 // Remove > and optional space
-                std::wstring bqLine = t.substr(1);
-                if (!bqLine.empty() && bqLine[0] == L' ')
-                    bqLine = bqLine.substr(1);
-                bqContent += bqLine + L'\n';
+                size_t skip = (t.size() >= 2 && t[1] == L' ') ? 2 : 1;
+                bqLines.Append(t.substr(skip));
                 i++;
             }
-            // Recursively convert blockquote content
-            html += L"<blockquote>\n";
-            html += ConvertToHtml(bqContent);
-            html += L"</blockquote>\n";
+            // Recursively convert blockquote content. Each stripped line
+            // maps 1:1 onto a source line, so offsetting by the blockquote
+            // start keeps inner data-line-* attributes document-absolute.
+            // Heading slugs stay local to the quote; mermaid duplicate
+            // counts are document-wide so nested diagrams get unique ids.
+            blk.html += L"<blockquote>\n";
+            BlockContext inner;
+            inner.mermaidCount.swap(ctx.mermaidCount);
+            inner.mermaidSalt = ctx.mermaidSalt;
+            inner.blockKeys = false;
+            ParseBlocks(bqLines, 0, lineBase + bqStartLine, inner, [&](MarkdownBlock& b) {
+                for (auto& m : b.mermaid) {
+                    m.htmlOffset += blk.html.size();
+                    blk.mermaid.push_back(std::move(m));
+                }
+                blk.html += b.html;
+                return true;
+            });
+            ctx.mermaidCount.swap(inner.mermaidCount);
+            blk.html += L"</blockquote>\n";
+            emit(bqStartLine, (int)(i - 1));
             continue;
         }
 
@@ -983,34 +1397,36 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
         if (trimmed.size() >= 1 && trimmed[0] == L'|' &&
             i + 1 < n && IsTableSeparator(TrimLeft(lines[i + 1]))) {
             flushParagraph();
+            int tableStartLine = (int)i;
             // Header row
             auto headerCells = ParseTableRow(trimmed);
             i++; // skip separator
             i++;
 
-            html += L"<table>\n<thead>\n<tr>\n";
+            blk.html += L"<table>\n<thead>\n<tr>\n";
             for (auto& cell : headerCells) {
-                html += L"<th>";
-                html += ProcessInline(cell);
-                html += L"</th>\n";
+                blk.html += L"<th>";
+                blk.html += ProcessInline(cell);
+                blk.html += L"</th>\n";
             }
-            html += L"</tr>\n</thead>\n<tbody>\n";
+            blk.html += L"</tr>\n</thead>\n<tbody>\n";
 
             // Body rows
             while (i < n) {
-                std::wstring t = TrimLeft(lines[i]);
+                std::wstring_view t = TrimLeft(lines[i]);
                 if (t.empty() || t[0] != L'|') break;
                 auto cells = ParseTableRow(t);
-                html += L"<tr>\n";
+                blk.html += L"<tr>\n";
                 for (size_t ci = 0; ci < cells.size(); ci++) {
-                    html += L"<td>";
-                    html += ProcessInline(cells[ci]);
-                    html += L"</td>\n";
+                    blk.html += L"<td>";
+                    blk.html += ProcessInline(cells[ci]);
+                    blk.html += L"</td>\n";
                 }
-                html += L"</tr>\n";
+                blk.html += L"</tr>\n";
                 i++;
             }
-            html += L"</tbody>\n</table>\n";
+            blk.html += L"</tbody>\n</table>\n";
+            emit(tableStartLine, (int)(i - 1));
             continue;
         }
 
@@ -1019,9 +1435,10 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
             (trimmed[0] == L'-' || trimmed[0] == L'*' || trimmed[0] == L'+') &&
             trimmed[1] == L' ') {
             flushParagraph();
-            html += L"<ul>\n";
+            int listStartLine = (int)i;
+            blk.html += L"<ul>\n";
             while (i < n) {
-                std::wstring t = TrimLeft(lines[i]);
+                std::wstring_view t = TrimLeft(lines[i]);
                 if (t.size() < 2) break;
 
                 // Check for list item or task list
@@ -1029,56 +1446,59 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
                 if (!isItem) break;
 
                 int itemStartLine = (int)i;
-                std::wstring itemText = t.substr(2);
+                std::wstring_view item = t.substr(2);
 
                 // Check for task list: [ ] or [x]
                 bool isTask = false;
                 bool isChecked = false;
-                if (itemText.size() >= 3 && itemText[0] == L'[') {
-                    if (itemText[1] == L' ' && itemText[2] == L']') {
+                if (item.size() >= 3 && item[0] == L'[') {
+                    if (item[1] == L' ' && item[2] == L']') {
                         isTask = true; isChecked = false;
-                        itemText = itemText.substr(3);
-                        if (!itemText.empty() && itemText[0] == L' ')
-                            itemText = itemText.substr(1);
-                    } else if ((itemText[1] == L'x' || itemText[1] == L'X') && itemText[2] == L']') {
+                        item.remove_prefix(3);
+                        if (!item.empty() && item[0] == L' ')
+                            item.remove_prefix(1);
+                    } else if ((item[1] == L'x' || item[1] == L'X') && item[2] == L']') {
                         isTask = true; isChecked = true;
-                        itemText = itemText.substr(3);
-                        if (!itemText.empty() && itemText[0] == L' ')
-                            itemText = itemText.substr(1);
+                        item.remove_prefix(3);
+                        if (!item.empty() && item[0] == L' ')
+                            item.remove_prefix(1);
                     }
                 }
+                std::wstring itemText(item);
 
                 // Collect continuation lines (indented)
                 i++;
                 while (i < n && !IsBlank(lines[i])) {
                     size_t indent = 0;
-                    std::wstring ct = TrimLeft(lines[i], &indent);
+                    std::wstring_view ct = TrimLeft(lines[i], &indent);
                     if (indent < 2) break;
                     // Check if next line is a new list item
                     if (ct.size() >= 2 &&
                         (ct[0] == L'-' || ct[0] == L'*' || ct[0] == L'+') &&
                         ct[1] == L' ')
                         break;
-                    itemText += L" " + ct;
+                    itemText += L' ';
+                    itemText += ct;
                     i++;
                 }
 
                 int itemEndLine = (int)(i - 1);
-                std::wstring lineAttr = L" data-line-start=\"" + std::to_wstring(itemStartLine)
-                                      + L"\" data-line-end=\"" + std::to_wstring(itemEndLine) + L"\"";
+                std::wstring lineAttr = L" data-line-start=\"" + lineNo(itemStartLine)
+                                      + L"\" data-line-end=\"" + lineNo(itemEndLine) + L"\"";
                 if (isTask) {
-                    html += L"<li class=\"task-list-item\"" + lineAttr + L"><input type=\"checkbox\" disabled";
-                    if (isChecked) html += L" checked";
-                    html += L"> ";
-                    html += ProcessInline(itemText);
-                    html += L"</li>\n";
+                    blk.html += L"<li class=\"task-list-item\"" + lineAttr + L"><input type=\"checkbox\" disabled";
+                    if (isChecked) blk.html += L" checked";
+                    blk.html += L"> ";
+                    blk.html += ProcessInline(itemText);
+                    blk.html += L"</li>\n";
                 } else {
-                    html += L"<li" + lineAttr + L">";
-                    html += ProcessInline(itemText);
-                    html += L"</li>\n";
+                    blk.html += L"<li" + lineAttr + L">";
+                    blk.html += ProcessInline(itemText);
+                    blk.html += L"</li>\n";
                 }
             }
-            html += L"</ul>\n";
+            blk.html += L"</ul>\n";
+            emit(listStartLine, (int)(i - 1));
             continue;
         }
 
@@ -1089,9 +1509,10 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
             if (di > 0 && di < trimmed.size() && trimmed[di] == L'.' &&
                 di + 1 < trimmed.size() && trimmed[di + 1] == L' ') {
                 flushParagraph();
-                html += L"<ol>\n";
+                int listStartLine = (int)i;
+                blk.html += L"<ol>\n";
                 while (i < n) {
-                    std::wstring t = TrimLeft(lines[i]);
+                    std::wstring_view t = TrimLeft(lines[i]);
                     size_t d = 0;
                     while (d < t.size() && t[d] >= L'0' && t[d] <= L'9') d++;
                     if (d == 0 || d >= t.size() || t[d] != L'.' ||
@@ -1099,57 +1520,61 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
                         break;
 
                     int olItemStart = (int)i;
-                    std::wstring itemText = t.substr(d + 2);
+                    std::wstring itemText(t.substr(d + 2));
 
                     // Collect continuation lines
                     i++;
                     while (i < n && !IsBlank(lines[i])) {
                         size_t indent = 0;
-                        std::wstring ct = TrimLeft(lines[i], &indent);
+                        std::wstring_view ct = TrimLeft(lines[i], &indent);
                         if (indent < 2) break;
                         // Check if next line is a new list item
                         size_t nd = 0;
                         while (nd < ct.size() && ct[nd] >= L'0' && ct[nd] <= L'9') nd++;
                         if (nd > 0 && nd < ct.size() && ct[nd] == L'.')
                             break;
-                        itemText += L" " + ct;
+                        itemText += L' ';
+                        itemText += ct;
                         i++;
                     }
 
                     int olItemEnd = (int)(i - 1);
-                    html += L"<li data-line-start=\"" + std::to_wstring(olItemStart)
-                         + L"\" data-line-end=\"" + std::to_wstring(olItemEnd) + L"\">";
-                    html += ProcessInline(itemText);
-                    html += L"</li>\n";
+                    blk.html += L"<li data-line-start=\"" + lineNo(olItemStart)
+                              + L"\" data-line-end=\"" + lineNo(olItemEnd) + L"\">";
+                    blk.html += ProcessInline(itemText);
+                    blk.html += L"</li>\n";
                 }
-                html += L"</ol>\n";
+                blk.html += L"</ol>\n";
+                emit(listStartLine, (int)(i - 1));
                 continue;
             }
         }
 
         // --- Setext heading (underline-style): ==== or ---- ---
         if (i + 1 < n) {
-            std::wstring nextTrimmed = TrimLeft(lines[i + 1]);
-            bool isH1 = !nextTrimmed.empty() && nextTrimmed.find_first_not_of(L"= ") == std::wstring::npos
-                         && nextTrimmed.find(L'=') != std::wstring::npos;
-            bool isH2 = !nextTrimmed.empty() && nextTrimmed.find_first_not_of(L"- ") == std::wstring::npos
-                         && nextTrimmed.find(L'-') != std::wstring::npos
+            std::wstring_view nextTrimmed = TrimLeft(lines[i + 1]);
+            bool isH1 = !nextTrimmed.empty() && nextTrimmed.find_first_not_of(L"= ") == std::wstring_view::npos
+                         && nextTrimmed.find(L'=') != std::wstring_view::npos;
+            bool isH2 = !nextTrimmed.empty() && nextTrimmed.find_first_not_of(L"- ") == std::wstring_view::npos
+                         && nextTrimmed.find(L'-') != std::wstring_view::npos
                          && std::count(nextTrimmed.begin(), nextTrimmed.end(), L'-') >= 3;
             if (isH1 || isH2) {
                 flushParagraph();
                 int level = isH1 ? 1 : 2;
                 std::wstring slug = uniqueSlug(trimmed);
-                html += L"<h" + std::to_wstring(level);
+                blk.headingLevel = level;
+                blk.html += L"<h" + std::to_wstring(level);
                 if (!slug.empty()) {
-                    html += L" id=\"";
-                    html += HtmlEscape(slug);
-                    html += L"\"";
+                    blk.html += L" id=\"";
+                    blk.html += HtmlEscape(slug);
+                    blk.html += L"\"";
                 }
-                html += L" data-line-start=\""
-                     + std::to_wstring((int)i) + L"\" data-line-end=\""
-                     + std::to_wstring((int)(i + 1)) + L"\">";
-                html += ProcessInline(trimmed);
-                html += L"</h" + std::to_wstring(level) + L">\n";
+                blk.html += L" data-line-start=\""
+                          + lineNo(i) + L"\" data-line-end=\""
+                          + lineNo(i + 1) + L"\">";
+                blk.html += ProcessInline(trimmed);
+                blk.html += L"</h" + std::to_wstring(level) + L">\n";
+                emit((int)i, (int)(i + 1));
                 i += 2;
                 continue;
             }
@@ -1159,13 +1584,311 @@ std::wstring MarkdownParser::ConvertToHtml(const std::wstring& markdown)
         if (paraStartLine < 0) paraStartLine = (int)i;
         paraEndLine = (int)i;
         if (!paraAccum.empty())
-            paraAccum += L" ";
+            paraAccum += L' ';
         paraAccum += trimmed;
         i++;
     }
 
     // Flush any remaining paragraph
     flushParagraph();
+}
+
+// ============================================================================
+// Helper: add `delta` to every data-line-start / data-line-end value in a
+// block's HTML. Attribute values are written by the block parser only —
+// text content is HTML-escaped, so a literal `data-line-start="` (with a
+// real quote) can never come from the document itself. The block's mermaid
+// placeholder spans move with the digits.
+// ============================================================================
+static void RebaseLineAttrs(std::wstring& html, std::vector<MermaidBlock>& mermaid, int delta)
+{
+    if (delta == 0) return;
+    static const wchar_t kAttr[] = L"data-line-";
+    const size_t kAttrLen = sizeof(kAttr) / sizeof(kAttr[0]) - 1;
+
+    // Placeholder spans, as positions in `html`, are mapped to `out` while
+    // the copy passes them (ascending; each end follows its start).
+    std::vector<size_t*> marks;
+    for (auto& m : mermaid) {
+        m.htmlLength += m.htmlOffset;   // end, until mapped back below
+        marks.push_back(&m.htmlOffset);
+        marks.push_back(&m.htmlLength);
+    }
+    size_t nextMark = 0;
+    auto mapMarks = [&](size_t upTo, size_t outPos, size_t inPos) {
+        for (; nextMark < marks.size() && *marks[nextMark] <= upTo; ++nextMark)
+            *marks[nextMark] = outPos + (*marks[nextMark] - inPos);
+    };
 
+    std::wstring out;
+    out.reserve(html.size() + 16);
+    size_t pos = 0;
+    while (true) {
+        size_t hit = html.find(kAttr, pos);
+        if (hit == std::wstring::npos) break;
+        size_t q = html.find(L"=\"", hit + kAttrLen);
+        if (q == std::wstring::npos) break;
+        size_t numStart = q + 2;
+        size_t numEnd = numStart;
+        int val = 0;
+        while (numEnd < html.size() && html[numEnd] >= L'0' && html[numEnd] <= L'9')
+            val = val * 10 + (html[numEnd++] - L'0');
+        mapMarks(numStart, out.size(), pos);
+        out.append(html, pos, numStart - pos);
+        if (numEnd > numStart)
+            out += std::to_wstring(val + delta);
+        pos = numEnd;
+    }
+    mapMarks(html.size(), out.size(), pos);
+    out.append(html, pos, std::wstring::npos);
+    html.swap(out);
+    for (auto& m : mermaid)
+        m.htmlLength -= m.htmlOffset;
+}
+
+// ============================================================================
+// MarkdownDocument - incremental block tree
+// ============================================================================
+void MarkdownDocument::SetText(std::wstring text)
+{
+    if (!text.empty() && text.back() != L'\n')
+        text += L'\n';
+    m_text = std::move(text);
+    m_lines.Assign(m_text);
+}
+
+void MarkdownDocument::Reset(const std::wstring& content)
+{
+    SetText(content);
+    m_blocks.clear();
+    MarkdownParser::BlockContext ctx;
+    ctx.mermaidSalt = m_mermaidSalt;
+    MarkdownParser::ParseBlocks(m_lines, 0, 0, ctx, [&](MarkdownBlock& blk) {
+        m_blocks.push_back(std::move(blk));
+        return true;
+    });
+}
+
+std::wstring MarkdownDocument::Html() const
+{
+    size_t total = 0;
+    for (const auto& b : m_blocks) total += b.html.size();
+    std::wstring html;
+    html.reserve(total);
+    for (const auto& b : m_blocks) html += b.html;
     return html;
 }
+
+MarkdownParseResult MarkdownDocument::Result() const
+{
+    MarkdownParseResult r;
+    r.html = Html();
+    r.lineMap.reserve(m_blocks.size());
+    size_t offset = 0;
+    for (const auto& b : m_blocks) {
+        AppendMaps(r, b, offset);
+        for (const auto& m : b.mermaid) {
+            r.mermaidBlocks.push_back(m);
+            r.mermaidBlocks.back().htmlOffset += offset;
+        }
+        offset += b.html.size();
+    }
+    return r;
+}
+
+bool MarkdownDocument::HasMermaid() const
+{
+    for (const auto& b : m_blocks)
+        if (!b.mermaid.empty()) return true;
+    return false;
+}
+
+const MermaidBlock* MarkdownDocument::FindMermaid(const std::wstring& id) const
+{
+    for (const auto& b : m_blocks)
+        for (const auto& m : b.mermaid)
+            if (m.id == id) return &m;
+    return nullptr;
+}
+
+// Advance `ctx` past block `b` as if the parser had just emitted it.
+// Returns false when the suffixes stored in `b` disagree with `ctx`,
+// i.e. the block must be re-emitted.
+bool MarkdownDocument::ReplayBlock(MarkdownParser::BlockContext& ctx, const MarkdownBlock& b)
+{
+    bool consistent = true;
+    if (!b.slug.empty()) {
+        int ordinal = 0;
+        auto it = ctx.slugCount.find(b.slug);
+        if (it != ctx.slugCount.end()) ordinal = ++it->second;
+        else ctx.slugCount[b.slug] = 0;
+        consistent = (ordinal == b.slugOrdinal);
+    }
+    for (const auto& m : b.mermaid) {
+        int ordinal = 0;
+        auto it = ctx.mermaidCount.find(m.hash);
+        if (it != ctx.mermaidCount.end()) ordinal = ++it->second;
+        else ctx.mermaidCount[m.hash] = 0;
+        if (ordinal != m.ordinal) consistent = false;
+    }
+    return consistent;
+}
+
+MarkdownBlockDelta MarkdownDocument::SetMermaidSalt(const std::wstring& salt)
+{
+    MarkdownBlockDelta delta;
+    if (salt == m_mermaidSalt) return delta;
+    m_mermaidSalt = salt;
+
+    MarkdownParser::BlockContext ctx;
+    ctx.mermaidSalt = m_mermaidSalt;
+    for (size_t k = 0; k < m_blocks.size(); k++) {
+        if (m_blocks[k].mermaid.empty()) {
+            ReplayBlock(ctx, m_blocks[k]);
+            continue;
+        }
+        ReemitBlock(k, ctx);
+        ReplayBlock(ctx, m_blocks[k]);
+        delta.reemitted.push_back(k);
+    }
+    return delta;
+}
+
+void MarkdownDocument::ReemitBlock(size_t idx, const MarkdownParser::BlockContext& ctx)
+{
+    MarkdownParser::BlockContext local = ctx;
+    MarkdownBlock& target = m_blocks[idx];
+    MarkdownParser::ParseBlocks(m_lines, (size_t)target.startLine, 0, local,
+        [&](MarkdownBlock& blk) {
+            target = std::move(blk);
+            return false; // first block only
+        });
+}
+
+MarkdownBlockDelta MarkdownDocument::ApplyEdit(int firstLine, int oldLineCount,
+                                               const std::vector<std::wstring>& newLines)
+{
+    const int oldTotal = (int)m_lines.size();
+    if (firstLine < 0) firstLine = 0;
+    if (firstLine > oldTotal) firstLine = oldTotal;
+    if (oldLineCount < 0) oldLineCount = 0;
+    if (oldLineCount > oldTotal - firstLine) oldLineCount = oldTotal - firstLine;
+
+    // Every line in m_text is '\n'-terminated, so the edited range is
+    // exactly [Offset(first), Offset(first + old)).
+    size_t from = m_lines.Offset(firstLine);
+    size_t to = m_lines.Offset(firstLine + oldLineCount);
+    std::wstring replacement;
+    for (const auto& l : newLines) {
+        replacement += l;
+        replacement += L'\n';
+    }
+    m_text.replace(from, to - from, replacement);
+    m_lines.Assign(m_text);
+
+    return Reparse(firstLine, oldLineCount, (int)newLines.size());
+}
+
+MarkdownBlockDelta MarkdownDocument::Reparse(int firstLine, int oldLineCount, int newCount)
+{
+    MarkdownBlockDelta delta;
+    const int lineDelta = newCount - oldLineCount;
+
+    // First block that can be affected. A block's extent is decided by at
+    // most two lines past its end (table separator / setext underline
+    // lookahead), so anything ending two or more lines above the edit is
+    // untouched.
+    size_t j = 0;
+    while (j < m_blocks.size() && m_blocks[j].endLine + 2 < firstLine) j++;
+    int restartLine = (j < m_blocks.size()) ? std::min(m_blocks[j].startLine, firstLine)
+                                            : firstLine;
+
+    // Replay document-wide state of the untouched prefix.
+    MarkdownParser::BlockContext startCtx;
+    startCtx.mermaidSalt = m_mermaidSalt;
+    for (size_t k = 0; k < j; k++) ReplayBlock(startCtx, m_blocks[k]);
+
+    // Reparse forward until a new block starts exactly where an old block
+    // below the edit started (shifted by lineDelta). From that point on the
+    // old tree is still valid.
+    const int oldEditEnd = firstLine + oldLineCount;
+    const int newEditEnd = firstLine + newCount;
+    size_t resync = j;
+    while (resync < m_blocks.size() && m_blocks[resync].startLine < oldEditEnd) resync++;
+    bool synced = false;
+
+    std::vector<MarkdownBlock> fresh;
+    MarkdownParser::BlockContext ctx = startCtx;
+    MarkdownParser::ParseBlocks(m_lines, (size_t)restartLine, 0, ctx, [&](MarkdownBlock& blk) {
+        if (blk.startLine >= newEditEnd) {
+            int oldStart = blk.startLine - lineDelta;
+            while (resync < m_blocks.size() && m_blocks[resync].startLine < oldStart) resync++;
+            if (resync < m_blocks.size() && m_blocks[resync].startLine == oldStart) {
+                synced = true;
+                return false;
+            }
+        }
+        fresh.push_back(std::move(blk));
+        return true;
+    });
+    size_t removeEnd = synced ? resync : m_blocks.size();
+
+    delta.firstBlock = j;
+    delta.removedCount = removeEnd - j;
+    delta.insertedCount = fresh.size();
+    delta.lineDelta = lineDelta;
+
+    m_blocks.erase(m_blocks.begin() + j, m_blocks.begin() + removeEnd);
+    m_blocks.insert(m_blocks.begin() + j,
+                    std::make_move_iterator(fresh.begin()),
+                    std::make_move_iterator(fresh.end()));
+
+    // Shift the reused tail and re-emit any block whose slug suffix or
+    // duplicate-diagram suffix changed because of blocks added/removed
+    // above it. Diagrams themselves are addressed by content, so moving
+    // one never changes its id.
+    ctx = startCtx;
+    for (size_t k = j; k < m_blocks.size(); k++) {
+        MarkdownBlock& b = m_blocks[k];
+        bool reused = k >= j + fresh.size();
+        if (reused && lineDelta != 0) {
+            b.startLine += lineDelta;
+            b.endLine += lineDelta;
+            for (auto& m : b.mermaid) {
+                m.startLine += lineDelta;
+                m.endLine += lineDelta;
+            }
+            RebaseLineAttrs(b.html, b.mermaid, lineDelta);
+        }
+        MarkdownParser::BlockContext before = ctx;
+        if (!ReplayBlock(ctx, b) && reused) {
+            ReemitBlock(k, before);
+            delta.reemitted.push_back(k);
+        }
+    }
+
+    return delta;
+}
+
+MarkdownBlockDelta MarkdownDocument::Update(const std::wstring& content)
+{
+    LineIndex lines(content);
+
+    size_t oldN = m_lines.size();
+    size_t newN = lines.size();
+    size_t prefix = 0;
+    while (prefix < oldN && prefix < newN && m_lines[prefix] == lines[prefix]) prefix++;
+    size_t suffix = 0;
+    while (suffix < oldN - prefix && suffix < newN - prefix &&
+           m_lines[oldN - 1 - suffix] == lines[newN - 1 - suffix])
+        suffix++;
+
+    if (prefix == oldN && prefix == newN)
+        return {};
+
+    // Adopt the new buffer wholesale (one copy) rather than splicing the
+    // changed lines into the old one; the block tree is still only
+    // reparsed around the edit.
+    SetText(content);
+    return Reparse((int)prefix, (int)(oldN - prefix - suffix), (int)(newN - prefix - suffix));
+}
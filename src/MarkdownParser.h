@@ -1,13 +1,60 @@
 #pragma once
 
+// Platform-neutral: everything here builds into the portable `mdparser`
+// library except GetDocumentContent, which talks to EmEditor and lives in
+// MarkdownParserWin32.cpp (plugin DLL only).
+#ifdef _WIN32
 #include <windows.h>
+#endif
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <functional>
+#include <unordered_map>
 
 struct MermaidBlock {
     std::wstring code;
     int startLine;
     int endLine;
+    std::wstring id;        // data-mermaid-id of its placeholder in the HTML
+    uint64_t hash = 0;      // MermaidHash(code, salt) - content address
+    int ordinal = 0;        // 0 = first block with this hash, N = "-N" suffix
+    bool closed = true;     // false → fence runs to end of document (endLine
+                            // is the last body line, not a closing fence)
+    // Placeholder `<div …></div>` in the HTML: offset into
+    // MarkdownParseResult::html (into MarkdownBlock::html while the block
+    // is held in a MarkdownBlock), so results can be spliced without
+    // searching for it.
+    size_t htmlOffset = 0;
+    size_t htmlLength = 0;
+};
+
+// One ATX / setext heading, as anchored in the generated HTML.
+struct MarkdownHeading {
+    int          level = 0;
+    int          line = 0;          // first source line (0-based)
+    std::wstring id;                // id attribute (slug + "-N" for repeats)
+};
+
+// Source line range of one top-level block of the generated HTML, and
+// where the block sits in that HTML.
+struct MarkdownLineSpan {
+    int startLine = 0;
+    int endLine = 0;                // inclusive
+    uint64_t key = 0;               // data-key (see MarkdownBlock)
+    size_t htmlOffset = 0;          // into MarkdownParseResult::html
+    size_t htmlLength = 0;
+};
+
+// Everything one parse pass produces. Consumers (preview coordinator, Bun
+// dispatch, auto-open detection, inline-edit writeback) share this instead
+// of re-scanning the document for mermaid fences.
+struct MarkdownParseResult {
+    std::wstring                  html;
+    std::vector<MermaidBlock>     mermaidBlocks;   // document order, incl. nested in blockquotes
+    std::vector<MarkdownHeading>  headings;        // top-level headings
+    std::vector<MarkdownLineSpan> lineMap;         // one entry per top-level block
 };
 
 // One node-label range inside a flowchart mermaid block source. Produced
@@ -23,17 +70,138 @@ struct MermaidNodeRef {
     bool         isQuoted = false; // true → label was already wrapped in "..."
 };
 
+// One top-level block of converted HTML together with the source line
+// range it came from. Produced by the block parser for both the one-shot
+// ConvertToHtml path and the incremental MarkdownDocument tree.
+//
+// The opening tag of every top-level block carries its reconciliation key
+// for the preview: `data-key` hashes the block's HTML (line numbers
+// excluded) and its line count, `data-line-block` is its first line. A
+// block that only moved keeps its data-key, so the preview patches its
+// line attributes instead of replacing it.
+struct MarkdownBlock {
+    int          startLine = 0;     // first source line (0-based)
+    int          endLine = 0;       // last source line (inclusive)
+    std::wstring html;
+    // Document-wide state this block consumed; replayed by MarkdownDocument
+    // to decide whether a block below an edit must be re-emitted.
+    std::wstring slug;              // base heading slug (empty if none)
+    int          slugOrdinal = 0;   // 0 = first use, N = "-N" suffix
+    int          headingLevel = 0;  // 1–6 for headings, 0 otherwise
+    uint64_t     key = 0;           // data-key value (0: not stamped)
+    std::vector<MermaidBlock> mermaid; // fences in this block (a blockquote
+                                       // may hold several); hash/ordinal are
+                                       // replayed like slug/slugOrdinal
+};
+
+// What MarkdownDocument::ApplyEdit changed. Blocks [firstBlock,
+// firstBlock + removedCount) of the previous tree were replaced by the
+// blocks now at [firstBlock, firstBlock + insertedCount). Every block from
+// firstBlock + insertedCount onward moved by lineDelta lines (their
+// data-line-* attributes were rebased), and the ones listed in `reemitted`
+// were regenerated because a heading slug / duplicate-diagram ordinal
+// above them changed.
+struct MarkdownBlockDelta {
+    size_t              firstBlock = 0;
+    size_t              removedCount = 0;
+    size_t              insertedCount = 0;
+    int                 lineDelta = 0;
+    std::vector<size_t> reemitted;
+
+    bool Empty() const {
+        return removedCount == 0 && insertedCount == 0 && lineDelta == 0 && reemitted.empty();
+    }
+};
+
+// Zero-copy line index over a text buffer: one offset/length pair per line
+// ('\r' of a CRLF ending excluded), handed out as std::wstring_view. The
+// buffer is not owned and must outlive every view taken from the index;
+// since lines are stored as offsets, Rebind() can re-point the index at a
+// moved / reallocated copy of the same text.
+//
+// Line splitting matches the old SplitLines: "a\nb" and "a\nb\n" both
+// have two lines, "" has none.
+class LineIndex {
+public:
+    LineIndex() = default;
+    explicit LineIndex(std::wstring_view text) { Assign(text); }
+
+    // Re-index `text`. Reuses the span vector, so re-indexing a document
+    // of similar size does not allocate.
+    void Assign(std::wstring_view text);
+
+    // Point at a different buffer with identical content (offsets kept).
+    void Rebind(std::wstring_view text) { m_text = text; }
+
+    // Start a sub-index over `text` with no lines; fill it with Append().
+    void Clear(std::wstring_view text) { m_text = text; m_spans.clear(); }
+
+    // Append a line that is a substring of the indexed buffer (e.g. a
+    // blockquote line with its "> " marker stripped).
+    void Append(std::wstring_view line) {
+        m_spans.push_back({ (size_t)(line.data() - m_text.data()), line.size() });
+    }
+
+    size_t size() const { return m_spans.size(); }
+    bool empty() const { return m_spans.empty(); }
+
+    std::wstring_view operator[](size_t i) const {
+        return std::wstring_view(m_text.data() + m_spans[i].offset, m_spans[i].length);
+    }
+
+    // Buffer offset where line i starts; Offset(size()) is the buffer end.
+    size_t Offset(size_t i) const {
+        return i < m_spans.size() ? m_spans[i].offset : m_text.size();
+    }
+
+    std::wstring_view Text() const { return m_text; }
+
+private:
+    struct Span {
+        size_t offset;
+        size_t length;
+    };
+    std::wstring_view m_text;
+    std::vector<Span> m_spans;
+};
+
 class MarkdownParser {
+    friend class MarkdownDocument;
 public:
-    // Extract all ```mermaid code blocks from document content
-    static std::vector<MermaidBlock> ExtractMermaidBlocks(const std::wstring& content);
+    // Extract all mermaid code blocks from document content. Same set, order
+    // and ids as the placeholders ConvertToHtml emits; prefer Parse() when
+    // the HTML is needed too.
+    static std::vector<MermaidBlock> ExtractMermaidBlocks(const std::wstring& content,
+                                                          std::wstring_view mermaidSalt = {});
 
     // Get full document content from EmEditor view window
+#ifdef _WIN32
     static std::wstring GetDocumentContent(HWND hwndView);
+#endif
 
     // Convert raw Markdown to HTML (C++ native, no JS dependency)
     // Mermaid blocks become <div class="mermaid-container" data-mermaid-src="...">
-    static std::wstring ConvertToHtml(const std::wstring& markdown);
+    // `mermaidSalt` (render theme + look) is folded into every mermaid id.
+    static std::wstring ConvertToHtml(const std::wstring& markdown,
+                                      std::wstring_view mermaidSalt = {});
+
+    // ConvertToHtml plus the mermaid block list and heading / line maps,
+    // all from a single pass.
+    static MarkdownParseResult Parse(const std::wstring& markdown,
+                                     std::wstring_view mermaidSalt = {});
+
+    // Content address of a mermaid block: 64-bit FNV-1a over the source and
+    // the render settings that change its SVG. Stable across runs/builds.
+    static uint64_t MermaidHash(std::wstring_view code, std::wstring_view salt);
+
+    // Placeholder id for a block: "mermaid-<16 hex>" plus "-N" for the Nth
+    // repeat of identical source. Unchanged diagrams keep their id (and
+    // every cache keyed on it) when blocks above them are added/removed.
+    static std::wstring MermaidBlockId(uint64_t hash, int ordinal);
+
+    // True for ids MermaidBlockId can produce (used to validate ids that
+    // come back from the WebView).
+    static bool IsMermaidBlockId(std::wstring_view id);
 
     // Index every flowchart node label in a mermaid block source. Supports
     // square `A[label]`, round `A(label)`, decision `A{label}`, and the
@@ -44,29 +212,113 @@ public:
     ExtractFlowchartNodes(const std::wstring& blockSource);
 
     // HTML-escape special characters (public for use by other modules)
-    static std::wstring HtmlEscape(const std::wstring& text);
+    static std::wstring HtmlEscape(std::wstring_view text);
 
 private:
+    // Document-wide state threaded through the block parser: duplicate
+    // heading slugs and duplicate mermaid sources get "-N" suffixes.
+    struct BlockContext {
+        std::unordered_map<std::wstring, int> slugCount;
+        std::unordered_map<uint64_t, int>     mermaidCount;
+        std::wstring_view                     mermaidSalt;
+        bool                                  blockKeys = true; // stamp data-key (top level only)
+    };
+
+    // Parse top-level blocks starting at lines[first]. `emit` is called once
+    // per block (in document order) and may take ownership of block.html;
+    // returning false stops the parse. `lineBase` is added to every emitted
+    // line number (used for blockquote content, which is parsed from a
+    // sub-index of its marker-stripped lines).
+    static void ParseBlocks(const LineIndex& lines, size_t first,
+                            int lineBase, BlockContext& ctx,
+                            const std::function<bool(MarkdownBlock&)>& emit);
+
     // Inline formatting: bold, italic, code, links, images, strikethrough.
-    // `depth` guards against pathologically nested markdown (e.g.
-    // `**[***x***](u)**`) overflowing the call stack.
-    static std::wstring ProcessInline(const std::wstring& text, int depth = 0);
+    // Single pass with a delimiter stack (see InlineParser), linear in the
+    // length of `text` and non-recursive.
+    static std::wstring ProcessInline(std::wstring_view text);
+    class InlineParser;
 
     // URL-encode for data attributes
-    static std::wstring UrlEncode(const std::wstring& text);
+    static std::wstring UrlEncode(std::wstring_view text);
 
     // Check if a line is a horizontal rule (---, ***, ___)
-    static bool IsHorizontalRule(const std::wstring& line);
+    static bool IsHorizontalRule(std::wstring_view line);
 
     // Check if a line is a table separator (|---|---|)
-    static bool IsTableSeparator(const std::wstring& line);
+    static bool IsTableSeparator(std::wstring_view line);
 
-    // Parse a table row into cells
-    static std::vector<std::wstring> ParseTableRow(const std::wstring& line);
+    // Parse a table row into cells (views into `line`)
+    static std::vector<std::wstring_view> ParseTableRow(std::wstring_view line);
 
     // Check if URL scheme is safe (block javascript:, data:, vbscript:)
-    static bool IsSafeUrl(const std::wstring& url);
+    static bool IsSafeUrl(std::wstring_view url);
 
     // Generate a URL-safe slug from heading text (for id attributes)
-    static std::wstring GenerateSlug(const std::wstring& text);
+    static std::wstring GenerateSlug(std::wstring_view text);
+};
+
+// Persistent, incrementally updated parse of one document. Keeps the source
+// lines and a flat tree of top-level blocks keyed by line range, so an edit
+// only re-tokenizes the blocks it touches instead of the whole document.
+class MarkdownDocument {
+public:
+    MarkdownDocument() = default;
+    // m_lines holds views into m_text; not copyable.
+    MarkdownDocument(const MarkdownDocument&) = delete;
+    MarkdownDocument& operator=(const MarkdownDocument&) = delete;
+
+    // Full (re)parse of `content`.
+    void Reset(const std::wstring& content);
+
+    // Replace source lines [firstLine, firstLine + oldLineCount) with
+    // newLines and reparse only the affected blocks. The reparse range is
+    // grown back to the block whose trailing lookahead can see the edit,
+    // and runs forward until a new block starts on an old, unedited block
+    // boundary (so an opened fence / list / blockquote extends naturally).
+    MarkdownBlockDelta ApplyEdit(int firstLine, int oldLineCount,
+                                 const std::vector<std::wstring>& newLines);
+
+    // Diff `content` against the current lines (common prefix / suffix)
+    // and ApplyEdit the changed middle. Returns an empty delta if nothing
+    // changed.
+    MarkdownBlockDelta Update(const std::wstring& content);
+
+    // Concatenated HTML of every block; identical to ConvertToHtml().
+    std::wstring Html() const;
+
+    // Full structured result; identical to MarkdownParser::Parse().
+    MarkdownParseResult Result() const;
+
+    // Cheap queries over the block tree (no HTML concatenation).
+    bool HasMermaid() const;
+    const MermaidBlock* FindMermaid(const std::wstring& id) const;
+
+    // Change the render settings folded into mermaid ids (theme + look).
+    // Only blocks holding mermaid fences are regenerated.
+    MarkdownBlockDelta SetMermaidSalt(const std::wstring& salt);
+
+    const std::vector<MarkdownBlock>& Blocks() const { return m_blocks; }
+    int LineCount() const { return (int)m_lines.size(); }
+
+private:
+    // Take ownership of `text` as the document buffer and index it. Every
+    // line is '\n'-terminated in m_text so ApplyEdit can splice at line
+    // offsets.
+    void SetText(std::wstring text);
+
+    // Block-tree half of ApplyEdit; m_text / m_lines already hold the
+    // edited document.
+    MarkdownBlockDelta Reparse(int firstLine, int oldLineCount, int newLineCount);
+
+    // Replay the slug / duplicate-diagram state one block consumed.
+    static bool ReplayBlock(MarkdownParser::BlockContext& ctx, const MarkdownBlock& b);
+
+    // Re-run the block parser on m_blocks[idx] with the given context.
+    void ReemitBlock(size_t idx, const MarkdownParser::BlockContext& ctx);
+
+    std::wstring               m_text;
+    LineIndex                  m_lines;
+    std::vector<MarkdownBlock> m_blocks;
+    std::wstring               m_mermaidSalt;
 };
@@ -0,0 +1,49 @@
+#include <windows.h>
+#include "MarkdownParser.h"
+#include "plugin.h"
+
+// EmEditor-facing half of MarkdownParser. Kept out of MarkdownParser.cpp so
+// the parser itself stays platform-neutral (see the mdparser target).
+
+// ============================================================================
+// GetDocumentContent - pull every line out of EmEditor via EE_GET_LINEW
+// ============================================================================
+std::wstring MarkdownParser::GetDocumentContent(HWND hwndView)
+{
+    std::wstring content;
+
+    UINT_PTR totalLines = (UINT_PTR)SendMessage(
+        hwndView, EE_GET_LINES, (WPARAM)0, 0);
+
+    if (totalLines == 0)
+        return content;
+
+    content.reserve(totalLines * 80);
+
+    for (UINT_PTR i = 0; i < totalLines; i++) {
+        GET_LINE_INFO gli = {};
+        gli.cch = 0;
+        gli.flags = 0;
+        gli.yLine = i;
+
+        UINT_PTR cch = (UINT_PTR)SendMessage(
+            hwndView, EE_GET_LINEW, (WPARAM)&gli, (LPARAM)nullptr);
+
+        if (cch == 0)
+            continue;
+
+        // Read straight into the tail of `content` instead of a per-line
+        // temporary; the terminating NUL(s) are trimmed off afterwards.
+        size_t base = content.size();
+        content.resize(base + cch);
+        gli.cch = cch;
+        SendMessage(hwndView, EE_GET_LINEW, (WPARAM)&gli, (LPARAM)(content.data() + base));
+
+        while (content.size() > base && content.back() == L'\0')
+            content.pop_back();
+
+        content += L'\n';
+    }
+
+    return content;
+}
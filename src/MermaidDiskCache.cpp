@@ -0,0 +1,423 @@
+#include "MermaidDiskCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+static const wchar_t kPathSep = L'\\';
+#else
+static const wchar_t kPathSep = L'/';
+#endif
+
+static const uint32_t kFormat = 1;
+
+// On-disk layouts. Plain little-endian PODs, written by this machine and
+// read back by it; charSize guards against a file from a build whose
+// wchar_t differs.
+struct MermaidDiskCache::IndexHeader {
+    char     magic[4];      // "MPCI"
+    uint32_t format;
+    uint32_t slots;
+    uint32_t charSize;
+    uint64_t logId;         // LogHeader::logId of the blobs.bin this describes
+    uint64_t clock;         // last-use counter
+    uint32_t count;         // occupied slots
+    uint32_t reserved;
+};
+
+struct MermaidDiskCache::Slot {
+    uint64_t key;
+    uint64_t offset;        // 0 = empty (the log header occupies offset 0)
+    uint64_t used;          // IndexHeader::clock at the last hit / insert
+    uint32_t size;          // whole record, header included
+    uint32_t reserved;
+};
+
+struct LogHeader {
+    char     magic[4];      // "MPCL"
+    uint32_t format;
+    uint32_t charSize;
+    uint32_t reserved;
+    uint64_t logId;
+};
+
+struct RecordHeader {
+    char     magic[4];      // "MPCR"
+    uint32_t codeLen;       // wchar_t units of each string that follows
+    uint32_t svgLen;
+    uint32_t errorLen;
+    uint64_t key;
+    uint64_t check;         // Checksum of the fields above + the strings
+};
+
+// ============================================================================
+// Fnv1a - the same FNV-1a as MarkdownParser::MermaidHash, over raw bytes
+// ============================================================================
+static uint64_t Fnv1a(const void* data, size_t size, uint64_t h = 14695981039346656037ull)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+static uint64_t RecordChecksum(const RecordHeader& rh, const char* payload, size_t size)
+{
+    return Fnv1a(payload, size, Fnv1a(&rh, offsetof(RecordHeader, check)));
+}
+
+static uint64_t RecordSize(const RecordHeader& rh)
+{
+    return sizeof(RecordHeader) +
+           ((uint64_t)rh.codeLen + rh.svgLen + rh.errorLen) * sizeof(wchar_t);
+}
+
+// A new log must never reuse the id an existing index remembers.
+static uint64_t NewLogId(uint64_t previous)
+{
+    uint64_t now = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+    uint64_t id = Fnv1a(&now, sizeof(now), Fnv1a(&previous, sizeof(previous)));
+    return id == previous ? id + 1 : id;
+}
+
+MermaidDiskCache::MermaidDiskCache(uint64_t maxBytes)
+    : m_maxBytes(maxBytes)
+{
+}
+
+MermaidDiskCache::~MermaidDiskCache()
+{
+    Close();
+}
+
+size_t MermaidDiskCache::IndexBytes()
+{
+    return sizeof(IndexHeader) + (size_t)kSlots * sizeof(Slot);
+}
+
+std::wstring MermaidDiskCache::IndexPath() const { return m_dir + kPathSep + L"index.bin"; }
+std::wstring MermaidDiskCache::LogPath() const   { return m_dir + kPathSep + L"blobs.bin"; }
+
+size_t MermaidDiskCache::Count() const
+{
+    return m_index ? m_index->count : 0;
+}
+
+// ============================================================================
+// Open - map the index, validate it against the log, rebuild on mismatch
+// ============================================================================
+bool MermaidDiskCache::Open(const std::wstring& dir, const std::wstring& version)
+{
+    Close();
+    if (!MakeDir(dir)) return false;
+    m_dir = dir;
+
+    // Hash UTF-16 units like MermaidHash, so the key doesn't depend on the
+    // size of wchar_t.
+    m_versionHash = 14695981039346656037ull;
+    for (wchar_t ch : version) {
+        uint16_t u = (uint16_t)ch;
+        m_versionHash = Fnv1a(&u, sizeof(u), m_versionHash);
+    }
+
+    m_indexFile = OpenFile(IndexPath(), false);
+    m_logFile = OpenFile(LogPath(), false);
+    uint64_t indexSize = 0;
+    if (m_indexFile == kNoFile || m_logFile == kNoFile || !FileSize(m_indexFile, indexSize)) {
+        Close();
+        return false;
+    }
+    bool fresh = indexSize != IndexBytes();
+    void* view = nullptr;
+    if ((fresh && !Resize(m_indexFile, IndexBytes())) || !(view = MapIndex())) {
+        Close();
+        return false;
+    }
+    m_index = (IndexHeader*)view;
+    m_slots = (Slot*)(m_index + 1);
+
+    bool valid = !fresh && memcmp(m_index->magic, "MPCI", 4) == 0 &&
+                 m_index->format == kFormat && m_index->slots == kSlots &&
+                 m_index->charSize == sizeof(wchar_t);
+
+    LogHeader lh = {};
+    if (!FileSize(m_logFile, m_logSize) || m_logSize < sizeof(lh) ||
+        !ReadAt(m_logFile, 0, &lh, sizeof(lh)) || memcmp(lh.magic, "MPCL", 4) != 0 ||
+        lh.format != kFormat || lh.charSize != sizeof(wchar_t)) {
+        if (!ResetLog()) {
+            Close();
+            return false;
+        }
+        valid = false;
+    } else {
+        m_logId = lh.logId;
+    }
+
+    bool ok = valid && m_index->logId == m_logId ? TrimLog() : Rebuild();
+    if (!ok) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MermaidDiskCache::Close()
+{
+    if (m_index) UnmapIndex(m_index);
+    m_index = nullptr;
+    m_slots = nullptr;
+    CloseFile(m_indexFile);
+    CloseFile(m_logFile);
+    m_indexFile = m_logFile = kNoFile;
+    m_logSize = 0;
+}
+
+// ============================================================================
+// ResetLog - empty blobs.bin under a fresh id
+// ============================================================================
+bool MermaidDiskCache::ResetLog()
+{
+    LogHeader lh = {};
+    memcpy(lh.magic, "MPCL", 4);
+    lh.format = kFormat;
+    lh.charSize = sizeof(wchar_t);
+    lh.logId = NewLogId(m_logId);
+    if (!Resize(m_logFile, 0) || !WriteAt(m_logFile, 0, &lh, sizeof(lh)))
+        return false;
+    m_logId = lh.logId;
+    m_logSize = sizeof(lh);
+    return true;
+}
+
+// ============================================================================
+// Rebuild - reindex every record in the log, in order (later ones win);
+// a torn record at the tail ends the scan and is cut off
+// ============================================================================
+bool MermaidDiskCache::Rebuild()
+{
+    memset(m_index, 0, IndexBytes());
+    memcpy(m_index->magic, "MPCI", 4);
+    m_index->format = kFormat;
+    m_index->slots = kSlots;
+    m_index->charSize = sizeof(wchar_t);
+
+    uint64_t pos = sizeof(LogHeader);
+    while (pos + sizeof(RecordHeader) <= m_logSize) {
+        RecordHeader rh;
+        if (!ReadAt(m_logFile, pos, &rh, sizeof(rh)) || memcmp(rh.magic, "MPCR", 4) != 0)
+            break;
+        uint64_t size = RecordSize(rh);
+        if (size > m_logSize - pos || size > UINT32_MAX || m_index->count >= kSlots / 4 * 3)
+            break;
+        // Checksums are verified on read; a bad record is then just a miss.
+        Slot* s = Probe(rh.key);
+        if (s->offset == 0) m_index->count++;
+        *s = { rh.key, pos, ++m_index->clock, (uint32_t)size, 0 };
+        pos += size;
+    }
+    if (pos < m_logSize) {
+        if (!Resize(m_logFile, pos)) return false;
+        m_logSize = pos;
+    }
+    m_index->logId = m_logId;
+    return true;
+}
+
+// ============================================================================
+// TrimLog - a crash mid-append leaves a torn record behind the last one the
+// index points at. Cut it off: appended behind it, new records would be
+// lost to the next rebuild scan, which stops at the torn one.
+// ============================================================================
+bool MermaidDiskCache::TrimLog()
+{
+    std::vector<const Slot*> byEnd;
+    byEnd.reserve(m_index->count);
+    for (uint32_t i = 0; i < kSlots; i++)
+        if (m_slots[i].offset != 0 && m_slots[i].offset + m_slots[i].size <= m_logSize)
+            byEnd.push_back(&m_slots[i]);
+    std::sort(byEnd.begin(), byEnd.end(), [](const Slot* a, const Slot* b) {
+        return a->offset + a->size > b->offset + b->size;
+    });
+
+    // The last record of the log is the newest for its key, so a slot
+    // points at it; slots left pointing into a region since overwritten
+    // fail the header check.
+    uint64_t end = sizeof(LogHeader);
+    for (const Slot* s : byEnd) {
+        RecordHeader rh;
+        if (ReadAt(m_logFile, s->offset, &rh, sizeof(rh)) && memcmp(rh.magic, "MPCR", 4) == 0 &&
+            rh.key == s->key && RecordSize(rh) == s->size) {
+            end = s->offset + s->size;
+            break;
+        }
+    }
+    if (end < m_logSize) {
+        if (!Resize(m_logFile, end)) return false;
+        m_logSize = end;
+    }
+    return true;
+}
+
+uint64_t MermaidDiskCache::Key(uint64_t hash) const
+{
+    return Fnv1a(&hash, sizeof(hash), m_versionHash);
+}
+
+// Linear probing. Slots are only cleared all at once (Rebuild / Compact),
+// so a probe may stop at the first empty one. The load factor is kept at
+// or below 3/4, so there always is one.
+MermaidDiskCache::Slot* MermaidDiskCache::Probe(uint64_t key)
+{
+    const uint32_t mask = kSlots - 1;
+    for (uint32_t i = (uint32_t)key & mask;; i = (i + 1) & mask) {
+        Slot& s = m_slots[i];
+        if (s.offset == 0 || s.key == key) return &s;
+    }
+}
+
+// ============================================================================
+// ReadRecord - read the slot's record into buf and check it end to end
+// ============================================================================
+bool MermaidDiskCache::ReadRecord(const Slot& slot, std::vector<char>& buf) const
+{
+    if (slot.size < sizeof(RecordHeader) || slot.offset > m_logSize ||
+        slot.size > m_logSize - slot.offset)
+        return false;
+    buf.resize(slot.size);
+    if (!ReadAt(m_logFile, slot.offset, buf.data(), slot.size))
+        return false;
+    RecordHeader rh;
+    memcpy(&rh, buf.data(), sizeof(rh));
+    return memcmp(rh.magic, "MPCR", 4) == 0 && rh.key == slot.key &&
+           RecordSize(rh) == slot.size &&
+           rh.check == RecordChecksum(rh, buf.data() + sizeof(rh), slot.size - sizeof(rh));
+}
+
+// ============================================================================
+// Find - index probe, then the record's full source must match too
+// ============================================================================
+bool MermaidDiskCache::Find(uint64_t hash, const std::wstring& code, Entry& out)
+{
+    if (!IsOpen()) return false;
+    Slot* s = Probe(Key(hash));
+    if (s->offset == 0 || !ReadRecord(*s, m_buf)) return false;
+
+    RecordHeader rh;
+    memcpy(&rh, m_buf.data(), sizeof(rh));
+    const char* p = m_buf.data() + sizeof(rh);
+    if (rh.codeLen != code.size() || memcmp(p, code.data(), code.size() * sizeof(wchar_t)) != 0)
+        return false;
+    p += (size_t)rh.codeLen * sizeof(wchar_t);
+    out.svg.resize(rh.svgLen);
+    memcpy(&out.svg[0], p, (size_t)rh.svgLen * sizeof(wchar_t));
+    p += (size_t)rh.svgLen * sizeof(wchar_t);
+    out.error.resize(rh.errorLen);
+    memcpy(&out.error[0], p, (size_t)rh.errorLen * sizeof(wchar_t));
+
+    s->used = ++m_index->clock;
+    return true;
+}
+
+// ============================================================================
+// Insert - append the record, then point the index at it
+// ============================================================================
+void MermaidDiskCache::Insert(uint64_t hash, const std::wstring& code,
+                              const std::wstring& svg, const std::wstring& error)
+{
+    if (!IsOpen() || (svg.empty() && error.empty())) return;
+
+    RecordHeader rh = {};
+    memcpy(rh.magic, "MPCR", 4);
+    rh.codeLen = (uint32_t)code.size();
+    rh.svgLen = (uint32_t)svg.size();
+    rh.errorLen = (uint32_t)error.size();
+    rh.key = Key(hash);
+    uint64_t size = RecordSize(rh);
+    if (size > m_maxBytes / 4) return; // would evict most of the cache for one diagram
+
+    if (m_logSize + size > m_maxBytes || m_index->count >= kSlots / 4 * 3) {
+        Compact();
+        if (!IsOpen()) return;
+    }
+
+    m_buf.resize((size_t)size);
+    char* p = m_buf.data() + sizeof(rh);
+    for (const std::wstring* str : { &code, &svg, &error }) {
+        memcpy(p, str->data(), str->size() * sizeof(wchar_t));
+        p += str->size() * sizeof(wchar_t);
+    }
+    rh.check = RecordChecksum(rh, m_buf.data() + sizeof(rh), (size_t)size - sizeof(rh));
+    memcpy(m_buf.data(), &rh, sizeof(rh));
+    if (!WriteAt(m_logFile, m_logSize, m_buf.data(), (size_t)size))
+        return; // a partial record past m_logSize is overwritten by the next one
+
+    Slot* s = Probe(rh.key);
+    if (s->offset == 0) m_index->count++;
+    *s = { rh.key, m_logSize, ++m_index->clock, (uint32_t)size, 0 };
+    m_logSize += size;
+}
+
+// ============================================================================
+// Compact - LRU eviction: copy the most recently used entries (up to half
+// the byte budget and half the table, so this stays rare) into a new log,
+// make it durable, swap it in and reindex
+// ============================================================================
+void MermaidDiskCache::Compact()
+{
+    std::vector<Slot> live;
+    live.reserve(m_index->count);
+    for (uint32_t i = 0; i < kSlots; i++)
+        if (m_slots[i].offset != 0) live.push_back(m_slots[i]);
+    std::sort(live.begin(), live.end(),
+        [](const Slot& a, const Slot& b) { return a.used > b.used; });
+
+    std::wstring tmpPath = LogPath() + L".tmp";
+    FileHandle tmp = OpenFile(tmpPath, true);
+    if (tmp == kNoFile) {
+        Close();
+        return;
+    }
+
+    LogHeader lh = {};
+    memcpy(lh.magic, "MPCL", 4);
+    lh.format = kFormat;
+    lh.charSize = sizeof(wchar_t);
+    lh.logId = NewLogId(m_logId);
+    bool ok = WriteAt(tmp, 0, &lh, sizeof(lh));
+
+    uint64_t pos = sizeof(lh);
+    std::vector<Slot> kept;
+    for (Slot s : live) {
+        if (!ok || pos + s.size > m_maxBytes / 2 || kept.size() >= kSlots / 2)
+            break;
+        if (!ReadRecord(s, m_buf))
+            continue; // damaged: dropped
+        ok = WriteAt(tmp, pos, m_buf.data(), s.size);
+        s.offset = pos;
+        kept.push_back(s);
+        pos += s.size;
+    }
+    ok = ok && Flush(tmp);
+    CloseFile(tmp);
+
+    // The index still names the old log until it is rewritten below, so a
+    // crash in between only costs a rebuild on the next Open.
+    CloseFile(m_logFile);
+    m_logFile = kNoFile;
+    if (!ok || !Rename(tmpPath, LogPath()) || (m_logFile = OpenFile(LogPath(), false)) == kNoFile) {
+        Close();
+        return;
+    }
+    m_logId = lh.logId;
+    m_logSize = pos;
+
+    uint64_t clock = m_index->clock;
+    memset(m_slots, 0, (size_t)kSlots * sizeof(Slot));
+    m_index->count = 0;
+    for (const Slot& s : kept) {
+        *Probe(s.key) = s;
+        m_index->count++;
+    }
+    m_index->clock = clock;
+    m_index->logId = m_logId;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Persistent second tier behind MermaidRenderCache: Bun render output kept
+// across EmEditor sessions, so reopening a document paints its diagrams from
+// disk instead of waiting for Bun to start and render them again.
+//
+// Two files in one directory:
+//   index.bin  fixed-size open-addressing table, memory-mapped:
+//              key → {record offset, size, last use}.
+//   blobs.bin  append-only log of records {key, source, svg, error}, each
+//              with a checksum.
+// Keys are MermaidBlock::hash (source + theme + look) mixed with a version
+// string (installed mermaid + renderer.ts), so an upgrade never serves
+// output of the old renderer.
+//
+// Crash safety: a record is written before the index points at it, and every
+// read checks the record's magic, key, size, checksum and full source, so a
+// torn write or stale slot is only a miss; a torn tail is cut off at the
+// next Open. Eviction (LRU) compacts: the entries kept are copied to a new
+// log beside the old one, which is flushed and renamed into place; the
+// index records which log it describes and is rebuilt by scanning the log
+// whenever the two disagree.
+//
+// Not thread-safe. The plugin keeps one per process (s_diskCache in
+// MermaidPreview.cpp, shared by every frame) behind s_diskCacheMutex: the
+// builder thread looks blocks up in it through FindCachedRender, the UI
+// thread stores Bun's results. The files are opened exclusively; a second
+// process finds them locked and runs without the disk tier.
+class MermaidDiskCache {
+public:
+    struct Entry {
+        std::wstring svg;    // empty on error
+        std::wstring error;  // empty on success
+    };
+
+    static constexpr uint64_t kDefaultMaxBytes = 64 * 1024 * 1024;
+    static constexpr uint32_t kSlots = 16384;   // power of two
+
+    explicit MermaidDiskCache(uint64_t maxBytes = kDefaultMaxBytes);
+    ~MermaidDiskCache();
+
+    MermaidDiskCache(const MermaidDiskCache&) = delete;
+    MermaidDiskCache& operator=(const MermaidDiskCache&) = delete;
+
+    // Open (creating if needed) the cache in `dir`, whose parent must exist.
+    // False if the files can't be opened (e.g. locked by another process).
+    bool Open(const std::wstring& dir, const std::wstring& version);
+    void Close();
+    bool IsOpen() const { return m_index != nullptr; }
+
+    // Look up a rendered block; a hit marks it most-recently used.
+    bool Find(uint64_t hash, const std::wstring& code, Entry& out);
+
+    // Store a Bun result (same rules as MermaidRenderCache::Insert).
+    void Insert(uint64_t hash, const std::wstring& code,
+                const std::wstring& svg, const std::wstring& error);
+
+    size_t Count() const;
+    uint64_t Bytes() const { return m_logSize; }
+
+private:
+#ifdef _WIN32
+    using FileHandle = void*;   // HANDLE
+    static constexpr FileHandle kNoFile = nullptr;
+#else
+    using FileHandle = int;     // file descriptor
+    static constexpr FileHandle kNoFile = -1;
+#endif
+
+    struct IndexHeader;
+    struct Slot;
+
+    static size_t IndexBytes();         // header + slot table
+    uint64_t Key(uint64_t hash) const;
+    Slot* Probe(uint64_t key);          // matching or first empty slot
+    bool ReadRecord(const Slot& slot, std::vector<char>& buf) const;
+    bool Rebuild();                     // index from a scan of the log
+    bool TrimLog();                     // cut a torn tail off behind a valid index
+    bool ResetLog();
+    void Compact();
+
+    // Platform layer (MermaidDiskCacheWin32.cpp / MermaidDiskCachePosix.cpp)
+    static bool MakeDir(const std::wstring& dir);
+    static FileHandle OpenFile(const std::wstring& path, bool truncate); // exclusive, created if missing
+    static void CloseFile(FileHandle f);
+    static bool FileSize(FileHandle f, uint64_t& size);
+    static bool ReadAt(FileHandle f, uint64_t offset, void* dst, size_t size);
+    static bool WriteAt(FileHandle f, uint64_t offset, const void* src, size_t size);
+    static bool Resize(FileHandle f, uint64_t size);
+    static bool Flush(FileHandle f);
+    static bool Rename(const std::wstring& from, const std::wstring& to);
+    void* MapIndex();                   // IndexBytes() of m_indexFile, read/write, shared
+    void UnmapIndex(void* view);
+
+    std::wstring IndexPath() const;
+    std::wstring LogPath() const;
+
+    uint64_t     m_maxBytes;
+    uint64_t     m_versionHash = 0;
+    std::wstring m_dir;
+    FileHandle   m_indexFile = kNoFile;
+    FileHandle   m_logFile = kNoFile;
+    void*        m_mapping = nullptr;   // Win32 file-mapping object
+    IndexHeader* m_index = nullptr;     // mapped index.bin
+    Slot*        m_slots = nullptr;     // follows the header
+    uint64_t     m_logId = 0;           // identifies the current blobs.bin
+    uint64_t     m_logSize = 0;         // append position in blobs.bin
+    std::vector<char> m_buf;            // record scratch
+};
@@ -0,0 +1,104 @@
+#include "MermaidDiskCache.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// POSIX half of MermaidDiskCache: pread/pwrite, flock() as the exclusive
+// lock and mmap() for the index. Not used by the plugin itself; it lets the
+// cache be exercised on Linux.
+
+static std::string Narrow(const std::wstring& ws)
+{
+    std::string s(ws.size() * MB_CUR_MAX + 1, '\0');
+    size_t n = wcstombs(&s[0], ws.c_str(), s.size());
+    if (n == (size_t)-1) return std::string();
+    s.resize(n);
+    return s;
+}
+
+bool MermaidDiskCache::MakeDir(const std::wstring& dir)
+{
+    return mkdir(Narrow(dir).c_str(), 0700) == 0 || errno == EEXIST;
+}
+
+MermaidDiskCache::FileHandle MermaidDiskCache::OpenFile(const std::wstring& path, bool truncate)
+{
+    int fd = open(Narrow(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return kNoFile;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || (truncate && ftruncate(fd, 0) != 0)) {
+        close(fd);
+        return kNoFile;
+    }
+    return fd;
+}
+
+void MermaidDiskCache::CloseFile(FileHandle f)
+{
+    if (f != kNoFile) close(f);
+}
+
+bool MermaidDiskCache::FileSize(FileHandle f, uint64_t& size)
+{
+    struct stat st;
+    if (fstat(f, &st) != 0) return false;
+    size = (uint64_t)st.st_size;
+    return true;
+}
+
+bool MermaidDiskCache::ReadAt(FileHandle f, uint64_t offset, void* dst, size_t size)
+{
+    char* p = (char*)dst;
+    while (size > 0) {
+        ssize_t n = pread(f, p, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        offset += (uint64_t)n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool MermaidDiskCache::WriteAt(FileHandle f, uint64_t offset, const void* src, size_t size)
+{
+    const char* p = (const char*)src;
+    while (size > 0) {
+        ssize_t n = pwrite(f, p, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        offset += (uint64_t)n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+bool MermaidDiskCache::Resize(FileHandle f, uint64_t size)
+{
+    return ftruncate(f, (off_t)size) == 0;
+}
+
+bool MermaidDiskCache::Flush(FileHandle f)
+{
+    return fsync(f) == 0;
+}
+
+bool MermaidDiskCache::Rename(const std::wstring& from, const std::wstring& to)
+{
+    return rename(Narrow(from).c_str(), Narrow(to).c_str()) == 0;
+}
+
+void* MermaidDiskCache::MapIndex()
+{
+    void* view = mmap(nullptr, IndexBytes(), PROT_READ | PROT_WRITE, MAP_SHARED, m_indexFile, 0);
+    return view == MAP_FAILED ? nullptr : view;
+}
+
+void MermaidDiskCache::UnmapIndex(void* view)
+{
+    munmap(view, IndexBytes());
+}
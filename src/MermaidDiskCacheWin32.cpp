@@ -0,0 +1,88 @@
+#include <windows.h>
+#include "MermaidDiskCache.h"
+
+// Windows half of MermaidDiskCache: plain overlapped-offset I/O on handles
+// opened without sharing (the lock against a second EmEditor process), and
+// a file mapping for the index.
+
+bool MermaidDiskCache::MakeDir(const std::wstring& dir)
+{
+    return CreateDirectoryW(dir.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+MermaidDiskCache::FileHandle MermaidDiskCache::OpenFile(const std::wstring& path, bool truncate)
+{
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                           truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return h == INVALID_HANDLE_VALUE ? kNoFile : h;
+}
+
+void MermaidDiskCache::CloseFile(FileHandle f)
+{
+    if (f) CloseHandle(f);
+}
+
+bool MermaidDiskCache::FileSize(FileHandle f, uint64_t& size)
+{
+    LARGE_INTEGER li;
+    if (!GetFileSizeEx(f, &li)) return false;
+    size = (uint64_t)li.QuadPart;
+    return true;
+}
+
+bool MermaidDiskCache::ReadAt(FileHandle f, uint64_t offset, void* dst, size_t size)
+{
+    if (size > MAXDWORD) return false;
+    OVERLAPPED ov = {};
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD got = 0;
+    return ReadFile(f, dst, (DWORD)size, &got, &ov) && got == size;
+}
+
+bool MermaidDiskCache::WriteAt(FileHandle f, uint64_t offset, const void* src, size_t size)
+{
+    if (size > MAXDWORD) return false;
+    OVERLAPPED ov = {};
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD put = 0;
+    return WriteFile(f, src, (DWORD)size, &put, &ov) && put == size;
+}
+
+bool MermaidDiskCache::Resize(FileHandle f, uint64_t size)
+{
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)size;
+    return SetFilePointerEx(f, li, nullptr, FILE_BEGIN) && SetEndOfFile(f);
+}
+
+bool MermaidDiskCache::Flush(FileHandle f)
+{
+    return FlushFileBuffers(f) != FALSE;
+}
+
+bool MermaidDiskCache::Rename(const std::wstring& from, const std::wstring& to)
+{
+    return MoveFileExW(from.c_str(), to.c_str(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+}
+
+void* MermaidDiskCache::MapIndex()
+{
+    m_mapping = CreateFileMappingW(m_indexFile, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    if (!m_mapping) return nullptr;
+    void* view = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, IndexBytes());
+    if (!view) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    return view;
+}
+
+void MermaidDiskCache::UnmapIndex(void* view)
+{
+    UnmapViewOfFile(view);
+    if (m_mapping) CloseHandle(m_mapping);
+    m_mapping = nullptr;
+}
@@ -1,6 +1,7 @@
 #include <windows.h>
 #include <windowsx.h>
 #include <commctrl.h>
+#include <shlobj.h>
 
 #ifndef VERIFY
 #ifdef _DEBUG
@@ -16,12 +17,14 @@
 
 #include "MermaidPreview.h"
 #include "WebView2Manager.h"
-#include "BunRenderer.h"
+#include "BunRendererPool.h"
 #include "MarkdownParser.h"
+#include "MermaidDiskCache.h"
 #include "resource.h"
+#include <algorithm>
 #include <functional>
 #include <chrono>
-#include <thread>
+#include <mutex>
 
 // ============================================================================
 // Custom Bar host window class name
@@ -83,13 +86,18 @@ LRESULT CALLBACK CMermaidFrame::HostWndProc(HWND hwnd, UINT msg, WPARAM wParam,
             if (pFrame) pFrame->m_bSyncFromPreview = false;
             return 0;
         }
-        if (wParam == IDT_BUN_POLL) {
-            CMermaidFrame* pFrame = GetFrameFromHost(hwnd);
-            if (pFrame) pFrame->OnBunRenderComplete();
-            return 0;
-        }
         break;
     }
+    case WM_BUN_RENDER_READY: {
+        CMermaidFrame* pFrame = GetFrameFromHost(hwnd);
+        if (pFrame) pFrame->OnBunRenderComplete();
+        return 0;
+    }
+    case WM_PREVIEW_READY: {
+        CMermaidFrame* pFrame = GetFrameFromHost(hwnd);
+        if (pFrame) pFrame->OnPreviewBuilt();
+        return 0;
+    }
     case WM_DESTROY:
         return 0;
     }
@@ -97,17 +105,43 @@ LRESULT CALLBACK CMermaidFrame::HostWndProc(HWND hwnd, UINT msg, WPARAM wParam,
 }
 
 // ============================================================================
-// ~CMermaidFrame - Detach any in-flight Bun render future before it would
-// otherwise block this destructor for up to 15 s. The worker holds a
-// shared_ptr<BunRenderer> so the renderer survives until the pipe drains.
+// Parking Window Procedure - also receives the pages built while the
+// preview is closed (auto-open probes), since there is no host window then
 // ============================================================================
-CMermaidFrame::~CMermaidFrame()
+LRESULT CALLBACK CMermaidFrame::ParkingWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
-    if (m_renderFuture.valid()) {
-        std::thread([f = std::move(m_renderFuture)]() mutable {
-            try { f.wait(); } catch (...) {}
-        }).detach();
+    if (msg == WM_PREVIEW_READY) {
+        CMermaidFrame* pFrame = GetFrameFromHost(hwnd);
+        if (pFrame) pFrame->OnPreviewBuilt();
+        return 0;
     }
+    return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+// ============================================================================
+// ~CMermaidFrame - Cancel in-flight renders, then stop the pipeline thread
+// (bounded wait: it is detached if Bun is stuck starting) and the builder
+// thread (joined: a build is one parse).
+// ============================================================================
+CMermaidFrame::~CMermaidFrame()
+{
+    CancelRenderJobs();
+    m_pRenderPipeline.reset();
+    m_pPreviewBuilder.reset();
+}
+
+// ============================================================================
+// CancelRenderJobs - forget every in-flight Bun render: the pipeline drops
+// the waiting job and cancels the running one, and the queues stop posting
+// to the host window. Nothing here blocks.
+// ============================================================================
+void CMermaidFrame::CancelRenderJobs()
+{
+    for (auto& job : m_renderJobs)
+        job.queue->Detach();
+    if (!m_renderJobs.empty() && m_pRenderPipeline)
+        m_pRenderPipeline->CancelAll();
+    m_renderJobs.clear();
 }
 
 // ============================================================================
@@ -140,11 +174,12 @@ void CMermaidFrame::OnEvents(HWND hwndView, UINT nEvent, LPARAM lParam)
 {
     if (nEvent & EVENT_CREATE_FRAME) {
         LoadSettings();
+        m_pPreviewBuilder = std::make_unique<PreviewBuilder>();
         // Create a 1x1 hidden popup to serve as parking window for WebView2
         if (!s_bParkingClassRegistered) {
             WNDCLASSEX wc = {};
             wc.cbSize = sizeof(wc);
-            wc.lpfnWndProc = DefWindowProc;
+            wc.lpfnWndProc = ParkingWndProc;
             wc.hInstance = EEGetInstanceHandle();
             wc.lpszClassName = kParkingClassName;
             if (RegisterClassEx(&wc))
@@ -154,6 +189,8 @@ void CMermaidFrame::OnEvents(HWND hwndView, UINT nEvent, LPARAM lParam)
             L"MermaidPreviewParking", WS_POPUP,
             0, 0, 1, 1,
             nullptr, nullptr, EEGetInstanceHandle(), nullptr);
+        if (m_hwndParking)
+            SetWindowLongPtr(m_hwndParking, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
         return;
     }
 
@@ -187,8 +224,11 @@ void CMermaidFrame::OnEvents(HWND hwndView, UINT nEvent, LPARAM lParam)
                 m_bunStartFuture.get(); // consume the future
             }
             // If timeout: Bun is stuck — proceed with cleanup anyway.
-            // BunRenderer::Stop() will terminate the process.
+            // BunRendererPool::Stop() will terminate the processes.
         }
+        CancelRenderJobs();
+        m_pRenderPipeline.reset();
+        m_pPreviewBuilder.reset();
         if (m_pBunRenderer) {
             m_pBunRenderer->Stop();
             m_pBunRenderer.reset();
@@ -207,8 +247,7 @@ void CMermaidFrame::OnEvents(HWND hwndView, UINT nEvent, LPARAM lParam)
         if (!m_bVisible) {
             TryAutoOpen(hwndView);
         } else {
-            m_nLastHash = 0;
-            m_sLastContent.clear();
+            m_pLastContent.reset();
             UpdatePreview(hwndView);
         }
         return;
@@ -235,12 +274,15 @@ void CMermaidFrame::OnEvents(HWND hwndView, UINT nEvent, LPARAM lParam)
                 TryAutoOpen(hwndView);
             }
         } else {
-            // Preview is visible — check if new tab still has mermaid
-            if (!IsMarkdownFile(hwndView) || !HasMermaidBlocks(hwndView)) {
+            // Preview is visible — check if new tab still has mermaid. The
+            // builder answers with the tab's page (OnPreviewBuilt closes
+            // the preview if it has none); nothing is parsed here.
+            if (!IsMarkdownFile(hwndView)) {
                 CloseCustomBar(hwndView);
             } else {
-                m_nLastHash = 0;
-                m_sLastContent.clear();
+                m_bCloseIfNoMermaid = true;
+                m_mermaidEdits.clear(); // their blocks were in the other tab
+                m_pLastContent.reset();
                 UpdatePreview(hwndView);
             }
         }
@@ -277,8 +319,7 @@ void CMermaidFrame::OnEvents(HWND hwndView, UINT nEvent, LPARAM lParam)
                 m_bDarkMode = dark;
                 if (m_pWebView && m_pWebView->IsReady()) {
                     m_pWebView->SetTheme(m_bDarkMode);
-                    m_nLastHash = 0;
-                    m_sLastContent.clear();
+                    m_pLastContent.reset();
                     UpdatePreview(hwndView);
                 }
             }
@@ -303,7 +344,8 @@ void CMermaidFrame::EnsureBunRenderer()
     }
 
     if (!m_pBunRenderer) {
-        m_pBunRenderer = std::make_shared<BunRenderer>();
+        m_pBunRenderer = std::make_shared<BunRendererPool>((unsigned)m_iBunWorkers);
+        m_pRenderPipeline = std::make_unique<RenderPipeline>(m_pBunRenderer);
     }
 
     // Launch Bun startup in background thread to avoid freezing UI
@@ -317,7 +359,7 @@ void CMermaidFrame::EnsureBunRenderer()
 // ============================================================================
 // OpenCustomBar
 // ============================================================================
-void CMermaidFrame::OpenCustomBar(HWND hwndView, std::wstring prefetchedContent)
+void CMermaidFrame::OpenCustomBar(HWND hwndView)
 {
     if (m_bVisible)
         return;
@@ -378,9 +420,10 @@ void CMermaidFrame::OpenCustomBar(HWND hwndView, std::wstring prefetchedContent)
         if (SUCCEEDED(hr)) {
             m_bParked = false;
             m_pWebView->SetTheme(m_bDarkMode);
-            // Force re-render with current content
-            m_nLastHash = 0;
-            m_sLastContent.clear();
+            // Force re-render with current content; pages dropped while
+            // parked never reached it, so send the next one whole.
+            m_pLastContent.reset();
+            if (m_pPreviewBuilder) m_pPreviewBuilder->Resync();
             UpdatePreview(hwndView);
             return;
         }
@@ -398,7 +441,9 @@ void CMermaidFrame::OpenCustomBar(HWND hwndView, std::wstring prefetchedContent)
     }
 
     // === FULL INIT: Create new WebView2 ===
+    // A new page holds no blocks: the next patch is the whole page.
     m_pWebView = std::make_unique<WebView2Manager>();
+    if (m_pPreviewBuilder) m_pPreviewBuilder->Resync();
     m_pWebView->Initialize(m_hwndHost, [this]() {
         if (m_pWebView) {
             m_pWebView->SetTheme(m_bDarkMode);
@@ -430,8 +475,7 @@ void CMermaidFrame::OpenCustomBar(HWND hwndView, std::wstring prefetchedContent)
                 m_bDarkMode = dark;
                 m_bDarkModeOverride = true;
                 // Force re-render on next update (Bun theme sync)
-                m_nLastHash = 0;
-                m_sLastContent.clear();
+                m_pLastContent.reset();
             });
 
             // Register scroll sync callback (Preview → Editor)
@@ -454,6 +498,11 @@ void CMermaidFrame::OpenCustomBar(HWND hwndView, std::wstring prefetchedContent)
                     OnOpenFileLink(m_hWndLastView, path);
             });
 
+            // Register resync callback (the page could not apply a patch)
+            m_pWebView->SetResyncCallback([this]() {
+                if (m_pPreviewBuilder) m_pPreviewBuilder->Resync();
+            });
+
             // Register font size callback (from right-click context menu)
             m_pWebView->SetFontSizeCallback([this](int size) {
                 m_iFontSize = size;
@@ -465,32 +514,20 @@ void CMermaidFrame::OpenCustomBar(HWND hwndView, std::wstring prefetchedContent)
                 m_pWebView->SetFontSize(m_iFontSize);
             }
 
-            // Optimization 3: Use pre-fetched content if available
-            if (m_bHasPrefetch) {
-                m_pWebView->RenderContent(m_sPrefetchedHtml, m_bDarkMode);
-                if (m_hWndLastView && IsWindow(m_hWndLastView))
-                    SyncScrollToPreview(m_hWndLastView);
-                m_bHasPrefetch = false;
-                m_sPrefetchedHtml.clear();
-            } else if (m_hWndLastView && IsWindow(m_hWndLastView)) {
+            // Optimization 3: the page built during startup has just been
+            // rendered; catch up with any edit made since, and sync scroll.
+            if (m_hWndLastView && IsWindow(m_hWndLastView)) {
                 UpdatePreview(m_hWndLastView);
+                SyncScrollToPreview(m_hWndLastView);
             }
         }
     });
 
-    // Optimization 3: Pre-fetch document content while WebView2 initializes async
-    // This overlaps content preparation with the ~800-1500ms WebView2 startup
-    {
-        // Use prefetched content if provided (from TryAutoOpen), else read fresh
-        std::wstring content = prefetchedContent.empty()
-            ? MarkdownParser::GetDocumentContent(hwndView)
-            : std::move(prefetchedContent);
-        std::hash<std::wstring> hasher;
-        m_nLastHash = hasher(content);
-        m_sLastContent = content;
-        m_sPrefetchedHtml = MarkdownParser::ConvertToHtml(content);
-        m_bHasPrefetch = true;
-    }
+    // Optimization 3: build the page while WebView2 initializes async.
+    // This overlaps content preparation with the ~800-1500ms WebView2
+    // startup; WebView2Manager keeps the page until it is ready. After an
+    // auto-open the builder's document already holds the probed parse.
+    UpdatePreview(hwndView);
 }
 
 // ============================================================================
@@ -507,23 +544,12 @@ void CMermaidFrame::CloseCustomBar(HWND /*hwndView*/)
         KillTimer(m_hwndHost, IDT_SCROLL_SYNC);
         KillTimer(m_hwndHost, IDT_SYNC_RESET_E2P);
         KillTimer(m_hwndHost, IDT_SYNC_RESET_P2E);
-        KillTimer(m_hwndHost, IDT_BUN_POLL);
-    }
-    m_renderDirty = false;
-    m_renderPendingHtml.clear();
-    m_renderPendingView = nullptr;
-
-    // Detach any in-flight Bun render. std::async(launch::async) futures
-    // *block in their destructor* until the shared state is ready — moving
-    // the future into a self-joining thread keeps the worker running but
-    // unblocks the UI close path. The worker holds a shared_ptr<BunRenderer>,
-    // so the renderer stays alive until the pipe drains naturally.
-    if (m_renderFuture.valid()) {
-        std::thread([f = std::move(m_renderFuture)]() mutable {
-            try { f.wait(); } catch (...) {}
-        }).detach();
     }
 
+    // Cancel in-flight Bun renders and page builds; nobody will see them.
+    CancelRenderJobs();
+    if (m_pPreviewBuilder) m_pPreviewBuilder->Cancel();
+
     // 2. Restore focus to EmEditor BEFORE parking WebView2.
     //    WebView2 browser process may own the focus; reclaim it first
     //    so that parking doesn't leave focus on the hidden parking window.
@@ -556,8 +582,9 @@ void CMermaidFrame::CloseCustomBar(HWND /*hwndView*/)
     m_bVisible = false;
     m_bSyncFromEditor = false;
     m_bSyncFromPreview = false;
-    m_sLastContent.clear();
-    m_nLastHash = 0;
+    m_pLastContent.reset();
+    m_bCloseIfNoMermaid = false;
+    m_mermaidEdits.clear();
 }
 
 // ============================================================================
@@ -576,11 +603,9 @@ void CMermaidFrame::OnCustomBarClosed(HWND /*hwndView*/, LPARAM lParam)
         KillTimer(m_hwndHost, IDT_SCROLL_SYNC);
         KillTimer(m_hwndHost, IDT_SYNC_RESET_E2P);
         KillTimer(m_hwndHost, IDT_SYNC_RESET_P2E);
-        KillTimer(m_hwndHost, IDT_BUN_POLL);
     }
-    m_renderDirty = false;
-    m_renderPendingHtml.clear();
-    m_renderPendingView = nullptr;
+    CancelRenderJobs();
+    if (m_pPreviewBuilder) m_pPreviewBuilder->Cancel();
 
     // Restore focus before parking (WebView2 browser process may own focus)
     if (m_hWnd && IsWindow(m_hWnd))
@@ -604,8 +629,9 @@ void CMermaidFrame::OnCustomBarClosed(HWND /*hwndView*/, LPARAM lParam)
     m_bVisible = false;
     m_bSyncFromEditor = false;
     m_bSyncFromPreview = false;
-    m_sLastContent.clear();
-    m_nLastHash = 0;
+    m_pLastContent.reset();
+    m_bCloseIfNoMermaid = false;
+    m_mermaidEdits.clear();
 
     SaveSettings();
 }
@@ -634,121 +660,185 @@ bool CMermaidFrame::IsMarkdownFile(HWND hwndView) const
             _wcsicmp(pExt, L".mermaid") == 0);
 }
 
-// ============================================================================
-// HasMermaidBlocks
-// ============================================================================
-bool CMermaidFrame::HasMermaidBlocks(HWND hwndView) const
-{
-    if (!hwndView || !IsWindow(hwndView))
-        return false;
-
-    std::wstring content = MarkdownParser::GetDocumentContent(hwndView);
-    auto blocks = MarkdownParser::ExtractMermaidBlocks(content);
-    return !blocks.empty();
-}
-
 // TryAutoClose was wired to no caller (audit v2 LOW-4.4). The auto-close
 // behaviour is undesirable in practice — a user transiently deleting a
 // mermaid block while editing should not yank the preview panel — so the
 // dead function is intentionally removed. Manual close still works via
 // the toolbar button.
 
+// ============================================================================
+// TryAutoOpen - post the document to the builder as a probe; OnPreviewBuilt
+// opens the preview if it has diagrams. The parse stays in the builder's
+// document, so the page built on opening reuses it.
+// ============================================================================
 void CMermaidFrame::TryAutoOpen(HWND hwndView)
 {
     if (m_bVisible) return;
-    if (!IsMarkdownFile(hwndView)) return;
-
-    // Read content once (avoids double read in HasMermaidBlocks + OpenCustomBar prefetch)
-    std::wstring content = MarkdownParser::GetDocumentContent(hwndView);
-    auto blocks = MarkdownParser::ExtractMermaidBlocks(content);
-    if (!blocks.empty()) {
-        OpenCustomBar(hwndView, std::move(content));
-        m_bAutoOpened = true;
-    }
+    if (!IsMarkdownFile(hwndView) || !m_pPreviewBuilder || !m_hwndParking) return;
+
+    HWND hwndParking = m_hwndParking;
+    PreviewBuilder::Request request;
+    request.content = std::make_shared<const std::wstring>(
+        MarkdownParser::GetDocumentContent(hwndView));
+    request.salt = MermaidRenderSalt();
+    request.dark = m_bDarkMode;
+    request.generation = ++m_renderGeneration;
+    request.probe = true;
+    request.notify = [hwndParking]() {
+        PostMessage(hwndParking, WM_PREVIEW_READY, 0, 0);
+    };
+    m_hwndProbeView = hwndView;
+    m_pPreviewBuilder->Build(std::move(request));
 }
 
 // ============================================================================
-// SpliceSvgIntoHtml - Replace `<div class="mermaid-container">` placeholders
-// with the SVG (or error block) that Bun produced. Pure string surgery; safe
-// to call on either the UI thread or after a background render completes.
+// MermaidRenderSalt - render settings folded into every mermaid block id.
+// Look is fixed to 'classic' (renderer.ts / _mmdInit default) for now;
+// it is part of the salt so a future per-document look can't collide.
 // ============================================================================
-void CMermaidFrame::SpliceSvgIntoHtml(std::wstring& html,
-                                      const std::vector<MermaidRenderResult>& results)
+std::wstring CMermaidFrame::MermaidRenderSalt() const
 {
-    for (auto& r : results) {
-        std::wstring placeholder = L"data-mermaid-id=\"" + r.id + L"\"";
-        size_t pos = html.find(placeholder);
-        if (pos == std::wstring::npos) continue;
-
-        size_t divStart = html.rfind(L"<div ", pos);
-        size_t divEnd = html.find(L"</div>", pos);
-        if (divStart == std::wstring::npos || divEnd == std::wstring::npos) continue;
-        divEnd += 6;
-
-        std::wstring origDiv = html.substr(divStart, divEnd - divStart);
-        std::wstring dataSrc, dataLineStart, dataLineEnd;
-        size_t srcAttr = origDiv.find(L"data-mermaid-src=\"");
-        if (srcAttr != std::wstring::npos) {
-            srcAttr += 18;
-            size_t srcEnd = origDiv.find(L'"', srcAttr);
-            if (srcEnd != std::wstring::npos)
-                dataSrc = origDiv.substr(srcAttr, srcEnd - srcAttr);
-        }
-        size_t lsAttr = origDiv.find(L"data-line-start=\"");
-        if (lsAttr != std::wstring::npos) {
-            lsAttr += 17;
-            size_t lsEnd = origDiv.find(L'"', lsAttr);
-            if (lsEnd != std::wstring::npos)
-                dataLineStart = origDiv.substr(lsAttr, lsEnd - lsAttr);
-        }
-        size_t leAttr = origDiv.find(L"data-line-end=\"");
-        if (leAttr != std::wstring::npos) {
-            leAttr += 15;
-            size_t leEnd = origDiv.find(L'"', leAttr);
-            if (leEnd != std::wstring::npos)
-                dataLineEnd = origDiv.substr(leAttr, leEnd - leAttr);
-        }
+    return std::wstring(m_bDarkMode ? L"dark" : L"default") + L"/classic";
+}
 
-        std::wstring attrs = L"class=\"mermaid-container\" data-mermaid-id=\"" + r.id + L"\"";
-        if (!dataSrc.empty())       attrs += L" data-mermaid-src=\"" + dataSrc + L"\"";
-        if (!dataLineStart.empty()) attrs += L" data-line-start=\"" + dataLineStart + L"\"";
-        if (!dataLineEnd.empty())   attrs += L" data-line-end=\"" + dataLineEnd + L"\"";
-
-        if (!r.svg.empty()) {
-            std::wstring svgDiv = L"<div " + attrs + L">" + r.svg + L"</div>";
-            html = html.substr(0, divStart) + svgDiv + html.substr(divEnd);
-        } else if (!r.error.empty()) {
-            std::wstring errDiv = L"<div " + attrs + L"><div class=\"mermaid-error\">Mermaid error: "
-                + MarkdownParser::HtmlEscape(r.error) + L"</div></div>";
-            html = html.substr(0, divStart) + errDiv + html.substr(divEnd);
-        }
+// ============================================================================
+// Disk tier of the render cache: %LOCALAPPDATA%\MermaidPreview\svgcache.
+// One per process, shared by every frame (its files are opened exclusively),
+// opened on first use once the renderer version it is keyed by is known,
+// and reopened under the new key when that version changes (mermaid
+// upgraded or renderer.ts edited while EmEditor runs; the pool re-reads it
+// once per render batch). A version whose open failed isn't retried.
+// ============================================================================
+static std::mutex       s_diskCacheMutex;
+static MermaidDiskCache s_diskCache;
+static std::wstring     s_diskCacheVersion;    // key of the last open attempt
+
+static bool OpenDiskCache(BunRendererPool* renderer)
+{
+    if (!renderer) return s_diskCache.IsOpen();
+
+    std::wstring version = renderer->OutputVersion();
+    if (version.empty()) return false; // mermaid not installed yet; retry later
+    if (version == s_diskCacheVersion) return s_diskCache.IsOpen();
+    s_diskCache.Close();
+    s_diskCacheVersion = version;
+
+    WCHAR appData[MAX_PATH] = {};
+    if (FAILED(SHGetFolderPathW(nullptr, CSIDL_LOCAL_APPDATA, nullptr, 0, appData)))
+        return false;
+    std::wstring dir = std::wstring(appData) + L"\\MermaidPreview";
+    CreateDirectoryW(dir.c_str(), nullptr);
+    return s_diskCache.Open(dir + L"\\svgcache", version);
+}
+
+static bool DiskCacheFind(BunRendererPool* renderer, const MermaidBlock& mb,
+                          MermaidDiskCache::Entry& out)
+{
+    std::lock_guard<std::mutex> lock(s_diskCacheMutex);
+    return OpenDiskCache(renderer) && s_diskCache.Find(mb.hash, mb.code, out);
+}
+
+static void DiskCacheInsert(BunRendererPool* renderer, const MermaidBlock& mb,
+                            const MermaidRenderResult& r)
+{
+    std::lock_guard<std::mutex> lock(s_diskCacheMutex);
+    if (OpenDiskCache(renderer))
+        s_diskCache.Insert(mb.hash, mb.code, r.svg, r.error);
+}
+
+// ============================================================================
+// GetViewportLines - source lines [first, last] the editor is showing. The
+// preview is scroll-synced to the editor, so this is also what it shows.
+// ============================================================================
+static void GetViewportLines(HWND hwndView, int& first, int& last)
+{
+    POINT_PTR pt = {};
+    SIZE_PTR page = {};
+    Editor_GetScrollPos(hwndView, &pt);
+    Editor_GetPageSize(hwndView, &page);
+    int rows = (int)page.cy;
+    first = (int)pt.y;
+    last = first + (rows > 0 ? rows : 1) - 1;
+}
+
+static double MsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// ============================================================================
+// OrderByViewport - visible blocks first, then those below the viewport,
+// then those above, each nearest first
+// ============================================================================
+static void OrderByViewport(std::vector<MermaidBlock>& blocks, int first, int last)
+{
+    auto rank = [first, last](const MermaidBlock& mb) -> std::pair<int, int> {
+        if (mb.endLine >= first && mb.startLine <= last) return { 0, mb.startLine };
+        if (mb.startLine > last) return { 1, mb.startLine - last };
+        return { 2, first - mb.endLine };
+    };
+    std::stable_sort(blocks.begin(), blocks.end(),
+        [&](const MermaidBlock& a, const MermaidBlock& b) { return rank(a) < rank(b); });
+}
+
+// ============================================================================
+// PrioritizeVisibleRenders - after a scroll, let the current job's diagrams
+// that came into view jump the rest of its queue
+// ============================================================================
+void CMermaidFrame::PrioritizeVisibleRenders(HWND hwndView)
+{
+    if (m_renderJobs.empty() || !m_pBunRenderer || !hwndView || !IsWindow(hwndView))
+        return;
+    const RenderJob& job = m_renderJobs.back(); // newest = current generation, if any
+    if (job.generation != m_renderGeneration)
+        return;
+
+    int first, last;
+    GetViewportLines(hwndView, first, last);
+    std::vector<std::wstring> ids;
+    for (const auto& mb : job.blocks) {
+        // Delivered blocks have their id cleared by OnBunRenderComplete.
+        if (!mb.id.empty() && mb.endLine >= first && mb.startLine <= last)
+            ids.push_back(mb.id);
     }
+    m_pBunRenderer->Prioritize(job.generation, ids);
 }
 
 // ============================================================================
 // UpdatePreview - Hybrid: C++ markdown + Bun mermaid SVG (fallback: WebView2 JS)
 //
-// Bun's RenderBlocks call can take ~50–500 ms (or up to 15 s if Bun hangs),
-// so it must NOT run on the UI thread. The flow:
+// Neither parsing a large document nor Bun's RenderBlocks (~50–500 ms, up
+// to 15 s if Bun hangs) may run on the UI thread. The flow:
 //
-//   1. Parse markdown → HTML synchronously (cheap, ~1 ms).
-//   2. If a previous Bun job is still running, set m_renderDirty and bail —
-//      the polling timer (IDT_BUN_POLL) will re-trigger UpdatePreview after
-//      the in-flight job completes, picking up the latest editor content.
-//   3. Otherwise, render the placeholder HTML immediately so the user sees
-//      text without waiting for Bun, then kick off RenderBlocks on a worker
-//      thread via std::async + start IDT_BUN_POLL to splice in the SVG.
-//   4. If Bun isn't available at all, render once and we're done (the JS-side
-//      mermaid.js will handle the placeholders client-side).
+//   1. UpdatePreview (UI): capture the document text. If it changed, start
+//      a new render generation, cancel the Bun jobs of older ones (Bun
+//      skips their remaining blocks; what they still deliver only goes to
+//      the cache) and post the snapshot to the preview builder. A snapshot
+//      still waiting there is replaced (latest wins).
+//   2. Builder thread: incremental parse → HTML, splice the diagrams found
+//      in the render caches, diff the page against the blocks the WebView
+//      holds into a patch message (PreviewPatch), post WM_PREVIEW_READY.
+//   3. OnPreviewBuilt (UI): post the patch, so the user sees text without
+//      waiting for Bun, then post the uncached diagrams to the render
+//      pipeline's thread (latest wins too), viewport first; scrolling
+//      later reprioritizes the ones still queued (PrioritizeVisibleRenders).
+//   4. OnBunRenderComplete (UI): as SVGs arrive, cache them and hand them
+//      to the builder, which splices them into the page and posts it back.
+//
+// If Bun isn't available at all, step 3 is the last (the JS-side
+// mermaid.js handles the placeholders client-side).
 // ============================================================================
 void CMermaidFrame::UpdatePreview(HWND hwndView)
 {
-    if (!m_bVisible || !m_pWebView)
+    if (!m_bVisible || !m_pWebView || !m_pPreviewBuilder)
         return;
 
     if (!hwndView || !IsWindow(hwndView))
         return;
 
+    auto start = std::chrono::steady_clock::now();
+
     // Check if async Bun startup has completed
     if (!m_bBunAvailable && m_bunStartFuture.valid()) {
         if (m_bunStartFuture.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
@@ -756,118 +846,223 @@ void CMermaidFrame::UpdatePreview(HWND hwndView)
         }
     }
 
-    // If a Bun render is already in flight, mark dirty and bail. The poll
-    // timer will re-enter UpdatePreview when the future resolves.
-    if (m_renderFuture.valid() &&
-        m_renderFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
-        m_renderDirty = true;
+    auto content = std::make_shared<const std::wstring>(
+        MarkdownParser::GetDocumentContent(hwndView));
+    if (m_pLastContent && *m_pLastContent == *content)
         return;
-    }
+    m_pLastContent = content;
+
+    // Whatever is being rendered now is for text that no longer exists.
+    ++m_renderGeneration;
+    if (!m_renderJobs.empty() && m_pBunRenderer)
+        m_pBunRenderer->CancelBefore(m_renderGeneration);
+
+    // Diagram ids are content hashes salted with theme + look: an
+    // unchanged diagram keeps its id across structural edits (JS and Bun
+    // results are reused), a theme switch gives every diagram a new one.
+    // Bun's results this session, or an earlier one via the disk cache,
+    // are looked up by the builder.
+    HWND hwndHost = m_hwndHost;
+    PreviewBuilder::Request request;
+    request.content = std::move(content);
+    request.salt = MermaidRenderSalt();
+    request.dark = m_bDarkMode;
+    request.generation = m_renderGeneration;
+    request.lookup = [this, renderer = m_pBunRenderer](const MermaidBlock& mb,
+                                                       MermaidRenderResult& out) {
+        return FindCachedRender(renderer.get(), mb, out);
+    };
+    request.notify = [hwndHost]() {
+        PostMessage(hwndHost, WM_PREVIEW_READY, 0, 0);
+    };
+    m_pPreviewBuilder->Build(std::move(request));
 
-    std::wstring content = MarkdownParser::GetDocumentContent(hwndView);
+    m_uiMs = MsSince(start);
+}
 
-    // Quick hash comparison
-    std::hash<std::wstring> hasher;
-    size_t h = hasher(content);
-    if (h == m_nLastHash && content == m_sLastContent)
-        return;
+// ============================================================================
+// FindCachedRender - builder-thread lookup: this session's results, then the
+// disk cache (promoted into memory)
+// ============================================================================
+bool CMermaidFrame::FindCachedRender(BunRendererPool* renderer, const MermaidBlock& mb,
+                                     MermaidRenderResult& out)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_renderCacheMutex);
+        if (const MermaidRenderCache::Entry* e = m_renderCache.Find(mb.hash, mb.code)) {
+            out.svg = e->svg;
+            out.error = e->error;
+            return true;
+        }
+    }
+    MermaidDiskCache::Entry disk;
+    if (!DiskCacheFind(renderer, mb, disk))
+        return false;
+    out.svg = disk.svg;
+    out.error = disk.error;
+    std::lock_guard<std::mutex> lock(m_renderCacheMutex);
+    m_renderCache.Insert(mb.hash, mb.code, std::move(disk.svg), std::move(disk.error));
+    return true;
+}
 
-    m_nLastHash = h;
-    m_sLastContent = content;
+// ============================================================================
+// OnPreviewBuilt - WM_PREVIEW_READY, posted by the builder when a page is
+// ready. Posts its patch; for a new document version, also sends the
+// diagrams the caches didn't have to Bun, and runs what was waiting for
+// the page: the auto-open probe, the tab-switch check, inline edits.
+// ============================================================================
+void CMermaidFrame::OnPreviewBuilt()
+{
+    PreviewBuilder::Page page;
+    if (!m_pPreviewBuilder || !m_pPreviewBuilder->Take(page))
+        return;
+    if (page.generation != m_renderGeneration)
+        return;
 
-    // C++ native: convert markdown to HTML with line tracking
-    std::wstring html = MarkdownParser::ConvertToHtml(content);
+    if (page.probe) {
+        // TryAutoOpen's answer, if its view is still the one shown.
+        HWND hwndProbed = m_hwndProbeView;
+        m_hwndProbeView = nullptr;
+        if (!m_bVisible && page.hasMermaid && hwndProbed == m_hWndLastView &&
+            hwndProbed && IsWindow(hwndProbed)) {
+            OpenCustomBar(hwndProbed);
+            m_bAutoOpened = true;
+        }
+        return;
+    }
+    if (!m_bVisible || !m_pWebView)
+        return;
 
-    // Decide whether to dispatch Bun
-    bool useBun = m_bBunAvailable && m_pBunRenderer && m_pBunRenderer->IsReady();
-    std::vector<MermaidBlock> mermaidBlocks;
-    if (useBun) {
-        mermaidBlocks = MarkdownParser::ExtractMermaidBlocks(content);
-        if (mermaidBlocks.empty()) useBun = false;
+    // The first page of a newly selected tab decides whether it keeps the
+    // preview.
+    if (page.full && m_bCloseIfNoMermaid) {
+        m_bCloseIfNoMermaid = false;
+        if (!page.hasMermaid) {
+            CloseCustomBar(m_hWndLastView);
+            return;
+        }
     }
 
-    if (!useBun) {
-        // No Bun → ship HTML now; client-side mermaid.js handles placeholders.
-        m_pWebView->RenderContent(html, m_bDarkMode);
-        SyncScrollToPreview(hwndView);
+    auto start = std::chrono::steady_clock::now();
+    m_pWebView->PostPatch(std::move(page.message), page.resets);
+    if (!page.full) {
+        double ms = MsSince(start);
+        m_uiMs += ms;
+        LogUiTime(L"diagrams", ms, page.buildMs);
         return;
     }
 
-    // Show text + placeholders immediately (sub-second perceived latency).
-    // The client-side mermaid.js will start rendering them; we'll overwrite
-    // with server-side SVG when Bun completes.
-    m_pWebView->RenderContent(html, m_bDarkMode);
-    SyncScrollToPreview(hwndView);
-
-    // Capture render context for the completion handler.
-    m_renderPendingHtml = std::move(html);
-    m_renderPendingDark = m_bDarkMode;
-    m_renderPendingView = hwndView;
-
-    std::vector<std::pair<std::wstring, std::wstring>> bunBlocks;
-    bunBlocks.reserve(mermaidBlocks.size());
-    for (size_t i = 0; i < mermaidBlocks.size(); i++) {
-        bunBlocks.push_back({
-            L"mermaid-placeholder-" + std::to_wstring(i),
-            mermaidBlocks[i].code
+    HWND hwndView = m_hWndLastView;
+    if (hwndView && IsWindow(hwndView))
+        SyncScrollToPreview(hwndView);
+
+    // Dispatch Bun for what is left (client-side mermaid.js has already
+    // started on the placeholders; server-side SVG replaces them as it
+    // arrives).
+    bool useBun = m_bBunAvailable && m_pBunRenderer && m_pBunRenderer->IsReady()
+                  && !page.misses.empty() && hwndView && IsWindow(hwndView);
+    if (useBun) {
+        // The pool hands blocks out in this order: what the user is looking
+        // at renders first, not whatever happens to be at the top of the
+        // document.
+        int firstLine, lastLine;
+        GetViewportLines(hwndView, firstLine, lastLine);
+        OrderByViewport(page.misses, firstLine, lastLine);
+
+        std::vector<std::pair<std::wstring, std::wstring>> bunBlocks;
+        bunBlocks.reserve(page.misses.size());
+        for (const auto& mb : page.misses)
+            bunBlocks.push_back({ mb.id, mb.code });
+        std::wstring theme = m_bDarkMode ? L"dark" : L"default";
+
+        // Results stream into the queue one block at a time; the queue
+        // posts WM_BUN_RENDER_READY when some arrive (once until the UI
+        // drains them) and when the job is finished or replaced, so the UI
+        // reacts at once and sleeps while Bun works.
+        HWND hwndHost = m_hwndHost;
+        RenderJob job;
+        job.queue = std::make_shared<MermaidResultQueue>([hwndHost]() {
+            PostMessage(hwndHost, WM_BUN_RENDER_READY, 0, 0);
         });
+        job.blocks = std::move(page.misses);
+        job.generation = page.generation;
+        m_pRenderPipeline->Post({ std::move(bunBlocks), std::move(theme),
+                                  job.generation, job.queue });
+        m_renderJobs.push_back(std::move(job));
     }
-    std::wstring theme = m_bDarkMode ? L"dark" : L"default";
-
-    // Capture renderer by shared_ptr — keeps BunRenderer alive even if
-    // CMermaidFrame is being torn down while the worker is mid-pipe.
-    auto renderer = m_pBunRenderer;
-    m_renderFuture = std::async(std::launch::async,
-        [renderer, blocks = std::move(bunBlocks), theme]() {
-            return renderer->RenderBlocks(blocks, theme);
-        });
 
-    if (m_hwndHost) {
-        SetTimer(m_hwndHost, IDT_BUN_POLL, BUN_POLL_MS, nullptr);
-    }
+    double ms = MsSince(start);
+    m_uiMs += ms;
+    LogUiTime(L"page", ms, page.buildMs);
+
+    if (!m_mermaidEdits.empty() && hwndView && IsWindow(hwndView))
+        ApplyMermaidEdits(hwndView);
 }
 
 // ============================================================================
-// OnBunRenderComplete - IDT_BUN_POLL fires every BUN_POLL_MS ms while a
-// background Bun render is in flight. When the future resolves, splice the
-// SVGs into the cached HTML and re-render. If the document changed while Bun
-// was working (m_renderDirty), kick off another UpdatePreview pass.
+// OnBunRenderComplete - WM_BUN_RENDER_READY, posted by a render job's queue
+// when results arrive or the job finishes. Caches what arrived and hands
+// the current generation's SVGs to the builder, which splices them into
+// the page, so diagrams appear one by one instead of all after the
+// slowest. Jobs of older generations (cancelled) only fill the cache.
+// Finished jobs (including ones the pipeline replaced before they
+// started) are retired.
 // ============================================================================
 void CMermaidFrame::OnBunRenderComplete()
 {
-    if (!m_renderFuture.valid()) {
-        if (m_hwndHost) KillTimer(m_hwndHost, IDT_BUN_POLL);
+    if (m_renderJobs.empty())
         return;
-    }
-    if (m_renderFuture.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
-        return; // still working — keep polling
 
+    auto start = std::chrono::steady_clock::now();
     std::vector<MermaidRenderResult> results;
-    try {
-        results = m_renderFuture.get();
-    } catch (...) {
-        // Swallow worker exceptions; client-side mermaid.js already drew
-        // something on the placeholder path so the user isn't stuck.
-        results.clear();
-    }
-    if (m_hwndHost) KillTimer(m_hwndHost, IDT_BUN_POLL);
+    for (auto it = m_renderJobs.begin(); it != m_renderJobs.end(); ) {
+        // Sample completion before draining: the worker pushes every result
+        // before it finishes, so a finished job is drained fully.
+        bool finished = it->queue->Finished();
+
+        // Remember what Bun produced so the next update only sends new or
+        // modified diagrams. Results are matched back to their block by id.
+        // A superseded job's results are still valid renders of their
+        // source, but the page they were for is gone.
+        bool current = it->generation == m_renderGeneration;
+        for (auto& r : it->queue->Drain()) {
+            for (auto& mb : it->blocks) {
+                if (mb.id != r.id) continue;
+                DiskCacheInsert(m_pBunRenderer.get(), mb, r);
+                std::lock_guard<std::mutex> lock(m_renderCacheMutex);
+                m_renderCache.Insert(mb.hash, std::move(mb.code), r.svg, r.error);
+                mb.id.clear(); // ids are unique; don't match twice
+                break;
+            }
+            if (current) results.push_back(std::move(r));
+        }
 
-    // Bun returned (or timed out). If we got SVGs, splice and re-render.
-    if (!results.empty() && m_pWebView) {
-        std::wstring html = std::move(m_renderPendingHtml);
-        SpliceSvgIntoHtml(html, results);
-        m_pWebView->RenderContent(html, m_renderPendingDark);
-    }
-    m_renderPendingHtml.clear();
-    m_renderPendingView = nullptr;
-
-    // If the editor changed while Bun was working, run another pass now
-    // so the preview catches up with the latest content.
-    if (m_renderDirty) {
-        m_renderDirty = false;
-        if (m_hWndLastView && IsWindow(m_hWndLastView))
-            UpdatePreview(m_hWndLastView);
+        if (finished)
+            it = m_renderJobs.erase(it);
+        else
+            ++it;
     }
+
+    // Splicing happens on the builder thread; the page comes back as
+    // WM_PREVIEW_READY.
+    if (!results.empty() && m_pPreviewBuilder)
+        m_pPreviewBuilder->Splice(m_renderGeneration, std::move(results));
+    m_uiMs += MsSince(start);
+}
+
+// ============================================================================
+// LogUiTime - with iTimingLog set, one debugger-output line (DebugView) per
+// page: UI time of this step, UI time so far for the generation (snapshot
+// + pages + Bun result handling), and the builder thread's time
+// ============================================================================
+void CMermaidFrame::LogUiTime(const wchar_t* step, double stepMs, double builderMs) const
+{
+    if (!m_bTimingLog)
+        return;
+    wchar_t line[160];
+    swprintf_s(line, L"MermaidPreview: generation %llu %s: UI %.2f ms (%.2f ms total), builder %.2f ms\n",
+               (unsigned long long)m_renderGeneration, step, stepMs, m_uiMs, builderMs);
+    OutputDebugStringW(line);
 }
 
 // ============================================================================
@@ -886,6 +1081,7 @@ void CMermaidFrame::SyncScrollToPreview(HWND hwndView)
 
     m_bSyncFromEditor = true;
     m_pWebView->ScrollToLine(topLine);
+    PrioritizeVisibleRenders(hwndView);
 
     // Reset flag after 150ms to re-enable Preview→Editor sync
     if (m_hwndHost) {
@@ -908,6 +1104,7 @@ void CMermaidFrame::OnPreviewScrolled(HWND hwndView, int line)
     POINT_PTR pt = {};
     pt.y = line;
     Editor_SetScrollPos(hwndView, &pt);
+    PrioritizeVisibleRenders(hwndView);
 
     // Reset flag after 150ms to re-enable Editor→Preview sync
     if (m_hwndHost) {
@@ -1080,45 +1277,77 @@ void CMermaidFrame::OnPreviewTextEdited(HWND hwndView, int lineStart, int lineEn
     Editor_InsertW(hwndView, replacement.c_str(), false);
 
     // Invalidate cache so preview re-renders
-    m_nLastHash = 0;
-    m_sLastContent.clear();
+    m_pLastContent.reset();
+}
+
+// ============================================================================
+// IsBareFenceLine - true when the fence line starts (after indentation)
+// with ``` or ~~~. Mermaid blocks nested in a blockquote carry a "> "
+// prefix on every line; the writeback below re-joins the body without it,
+// so those blocks are left to the editor.
+// ============================================================================
+static bool IsBareFenceLine(const std::wstring& line)
+{
+    size_t i = 0;
+    while (i < line.size() && (line[i] == L' ' || line[i] == L'\t')) ++i;
+    return i < line.size() && (line[i] == L'`' || line[i] == L'~');
+}
+
+// ============================================================================
+// ApplyMermaidEdits - apply the inline mermaid edits waiting for the page
+// of the current text. Blocks are looked up by id in the builder's table,
+// which is only trusted for the text it was parsed from: if the editor
+// text moved on, UpdatePreview posts it and its page brings us back here
+// (OnPreviewBuilt). One edit per page, since each changes the text.
+// ============================================================================
+void CMermaidFrame::ApplyMermaidEdits(HWND hwndView)
+{
+    while (!m_mermaidEdits.empty() && m_pPreviewBuilder) {
+        UpdatePreview(hwndView);
+        if (m_pPreviewBuilder->BuiltGeneration() != m_renderGeneration)
+            return;
+
+        MermaidEdit edit = std::move(m_mermaidEdits.front());
+        m_mermaidEdits.erase(m_mermaidEdits.begin());
+        MermaidBlock blk;
+        if (!m_pPreviewBuilder->FindMermaid(edit.blockId, blk))
+            continue; // the block was edited away meanwhile
+        if (!blk.closed)
+            continue; // no closing fence to preserve
+        if (edit.nodeId.empty())
+            ReplaceMermaidBlock(hwndView, blk, edit.text);
+        else
+            ReplaceMermaidNodeLabel(hwndView, blk, edit.nodeId, edit.text);
+    }
 }
 
 // ============================================================================
 // OnPreviewMermaidNodeEdited (M2)
 //
-// blockId is "mermaid-placeholder-N" (validated by the dispatcher).
-// We refresh the live document, locate the Nth mermaid block, then ask
-// MarkdownParser::ExtractFlowchartNodes to find the [labelStart, labelEnd)
-// span for this nodeId. Replace it in-place, optionally promote to the
-// quoted form when newLabel contains characters that would otherwise
-// terminate the bracket pair, and feed the rebuilt block through the
-// existing line-range writeback pipeline (OnPreviewTextEdited).
+// blockId is a placeholder id (validated by the dispatcher). The edit waits
+// for the page of the live text (ApplyMermaidEdits), then
+// ReplaceMermaidNodeLabel asks MarkdownParser::ExtractFlowchartNodes to
+// find the [labelStart, labelEnd) span for this nodeId. Replace it
+// in-place, optionally promote to the quoted form when newLabel contains
+// characters that would otherwise terminate the bracket pair, and feed the
+// rebuilt block through the existing line-range writeback pipeline
+// (OnPreviewTextEdited).
 // ============================================================================
 void CMermaidFrame::OnPreviewMermaidNodeEdited(HWND hwndView,
                                                const std::wstring& blockId,
                                                const std::wstring& nodeId,
                                                const std::wstring& newLabel)
 {
-    if (!hwndView || !IsWindow(hwndView)) return;
-    if (blockId.size() <= 20) return; // "mermaid-placeholder-" + at least one digit
-
-    // Block index = trailing integer of blockId.
-    int blockIdx = 0;
-    for (size_t i = 20; i < blockId.size(); ++i) {
-        wchar_t c = blockId[i];
-        if (c < L'0' || c > L'9') return;
-        blockIdx = blockIdx * 10 + (c - L'0');
-        if (blockIdx > 100000) return; // sanity cap
-    }
+    if (!hwndView || !IsWindow(hwndView) || nodeId.empty()) return;
 
-    // Pull the freshest content from EmEditor — m_sLastContent may be stale
-    // if the user typed in the editor between render and edit-commit.
-    std::wstring content = MarkdownParser::GetDocumentContent(hwndView);
-    auto blocks = MarkdownParser::ExtractMermaidBlocks(content);
-    if (blockIdx < 0 || blockIdx >= (int)blocks.size()) return;
-    const MermaidBlock& blk = blocks[blockIdx];
+    m_mermaidEdits.push_back({ blockId, nodeId, newLabel });
+    ApplyMermaidEdits(hwndView);
+}
 
+void CMermaidFrame::ReplaceMermaidNodeLabel(HWND hwndView, const MermaidBlock& blk,
+                                            const std::wstring& nodeId,
+                                            const std::wstring& newLabel)
+{
     auto nodes = MarkdownParser::ExtractFlowchartNodes(blk.code);
     const MermaidNodeRef* ref = nullptr;
     for (const auto& n : nodes) { if (n.nodeId == nodeId) { ref = &n; break; } }
@@ -1188,8 +1417,8 @@ void CMermaidFrame::OnPreviewMermaidNodeEdited(HWND hwndView,
                + targetLine.substr(ref->labelEnd);
 
     // Rebuild the full mermaid block text — fences + body — to feed back
-    // through the existing line-range edit path. ExtractMermaidBlocks
-    // sets startLine = the ```mermaid line and endLine = the closing ```.
+    // through the existing line-range edit path. The parser sets
+    // startLine = the ```mermaid line and endLine = the closing ```.
     std::wstring newBlock;
     // Reconstruct opening fence line by reading the actual document line —
     // keep any leading whitespace / language tag untouched.
@@ -1215,6 +1444,7 @@ void CMermaidFrame::OnPreviewMermaidNodeEdited(HWND hwndView,
             return buf;
         };
         std::wstring openFence = getLine(blk.startLine);
+        if (!IsBareFenceLine(openFence)) return;
         std::wstring closeFence = (blk.endLine >= 0 && blk.endLine < (int)totalLines)
                                     ? getLine(blk.endLine)
                                     : L"```";
@@ -1236,36 +1466,32 @@ void CMermaidFrame::OnPreviewMermaidNodeEdited(HWND hwndView,
 // OnPreviewMermaidBlockEdited (Phase 1 auto-correction)
 //
 // Whole-block replacement: JS computed and validated newSource, we just
-// preserve the original ```mermaid / ``` fence lines and feed the full
-// rebuilt block through OnPreviewTextEdited.
+// preserve the original ```mermaid / ``` fence lines (once the block is
+// located in the live text, ApplyMermaidEdits) and feed the full rebuilt
+// block through OnPreviewTextEdited.
 // ============================================================================
 void CMermaidFrame::OnPreviewMermaidBlockEdited(HWND hwndView,
                                                 const std::wstring& blockId,
                                                 const std::wstring& newSource)
 {
     if (!hwndView || !IsWindow(hwndView)) return;
-    if (blockId.size() <= 20) return;
-
-    int blockIdx = 0;
-    for (size_t i = 20; i < blockId.size(); ++i) {
-        wchar_t c = blockId[i];
-        if (c < L'0' || c > L'9') return;
-        blockIdx = blockIdx * 10 + (c - L'0');
-        if (blockIdx > 100000) return;
-    }
 
     // SEC-006: refuse any body that contains a fence-closing sequence —
     // a triple backtick inside the new mermaid source would prematurely
     // terminate the markdown code fence on writeback and corrupt the doc
     // structure. mermaid.parse on the JS side normally rejects such
     // input, but this is a defence-in-depth check we can do for free.
+    // The same applies to "~~~" now that tilde fences are recognised.
     if (newSource.find(L"```") != std::wstring::npos) return;
+    if (newSource.find(L"~~~") != std::wstring::npos) return;
 
-    std::wstring content = MarkdownParser::GetDocumentContent(hwndView);
-    auto blocks = MarkdownParser::ExtractMermaidBlocks(content);
-    if (blockIdx < 0 || blockIdx >= (int)blocks.size()) return;
-    const MermaidBlock& blk = blocks[blockIdx];
+    m_mermaidEdits.push_back({ blockId, std::wstring(), newSource });
+    ApplyMermaidEdits(hwndView);
+}
 
+void CMermaidFrame::ReplaceMermaidBlock(HWND hwndView, const MermaidBlock& blk,
+                                        const std::wstring& newSource)
+{
     // Read the actual fence lines so we keep any leading whitespace / lang
     // tag the user wrote (e.g. `\t```mermaid` inside a list).
     auto getLine = [&](int y) -> std::wstring {
@@ -1287,6 +1513,7 @@ void CMermaidFrame::OnPreviewMermaidBlockEdited(HWND hwndView,
         hwndView, EE_GET_LINES, (WPARAM)0, 0);
     if (blk.startLine < 0 || blk.startLine >= (int)totalLines) return;
     std::wstring openFence  = getLine(blk.startLine);
+    if (!IsBareFenceLine(openFence)) return;
     std::wstring closeFence = (blk.endLine >= 0 && blk.endLine < (int)totalLines)
                                 ? getLine(blk.endLine)
                                 : L"```";
@@ -1358,6 +1585,10 @@ void CMermaidFrame::LoadSettings()
     m_iFontSize = GetProfileInt(L"iFontSize", 14);
     if (m_iFontSize < 8 || m_iFontSize > 32)
         m_iFontSize = 14;
+    m_iBunWorkers = GetProfileInt(L"iBunWorkers", 0);
+    if (m_iBunWorkers < 0 || m_iBunWorkers > 16)
+        m_iBunWorkers = 0; // 0 = BunRendererPool::DefaultWorkerCount()
+    m_bTimingLog = GetProfileInt(L"iTimingLog", 0) != 0;
 }
 
 void CMermaidFrame::SaveSettings()
@@ -1367,4 +1598,6 @@ void CMermaidFrame::SaveSettings()
     WriteProfileInt(L"iDarkMode", m_bDarkMode ? 1 : 0);
     WriteProfileInt(L"iDarkModeOverride", m_bDarkModeOverride ? 1 : 0);
     WriteProfileInt(L"iFontSize", m_iFontSize);
+    WriteProfileInt(L"iBunWorkers", m_iBunWorkers);
+    WriteProfileInt(L"iTimingLog", m_bTimingLog ? 1 : 0);
 }
@@ -8,7 +8,12 @@
 #include <vector>
 #include <future>
 #include "resource.h"
-#include "BunRenderer.h"   // for MermaidRenderResult (used in std::future member)
+#include "BunRendererPool.h" // BunRendererPool, MermaidResultQueue (via BunRenderer.h)
+#include "MarkdownParser.h" // for MermaidBlock
+#include "MermaidRenderCache.h" // Bun results reused across updates
+#include "RenderPipeline.h"     // render thread in front of the pool
+#include "PreviewBuilder.h"     // parse / splice thread
+#include <mutex>
 
 class WebView2Manager;
 
@@ -39,8 +44,8 @@ public:
     };
 
     // CETLFrame instantiates/destroys this on plugin (un)load. Provide an
-    // explicit destructor so we can detach any in-flight Bun render future
-    // before its blocking destructor runs (audit v3 NEW-003).
+    // explicit destructor so in-flight Bun renders are cancelled before the
+    // render pipeline thread is stopped (audit v3 NEW-003).
     ~CMermaidFrame();
 
     // --- EmEditor callbacks ---
@@ -58,16 +63,20 @@ public:
 
 private:
     // --- Custom Bar management ---
-    void OpenCustomBar(HWND hwndView, std::wstring prefetchedContent = {});
+    void OpenCustomBar(HWND hwndView);
     void CloseCustomBar(HWND hwndView);
     void OnCustomBarClosed(HWND hwndView, LPARAM lParam);
 
     // --- Preview logic ---
     void UpdatePreview(HWND hwndView);
+    void OnPreviewBuilt();
     void OnBunRenderComplete();
-    void SpliceSvgIntoHtml(std::wstring& html,
-                           const std::vector<MermaidRenderResult>& results);
+    void CancelRenderJobs();
+    bool FindCachedRender(BunRendererPool* renderer, const MermaidBlock& mb,
+                          MermaidRenderResult& out);
+    void LogUiTime(const wchar_t* step, double stepMs, double builderMs) const;
     bool IsDarkMode(HWND hwndView) const;
+    std::wstring MermaidRenderSalt() const;
 
     // --- Bun renderer ---
     void EnsureBunRenderer();
@@ -92,17 +101,27 @@ private:
                                      const std::wstring& blockId,
                                      const std::wstring& newSource);
 
+    // Both edits locate their block in the builder's table of the current
+    // text, so they wait for its page: queued here, applied one per page
+    // (each edit changes the text the next one is located in).
+    void ApplyMermaidEdits(HWND hwndView);
+    void ReplaceMermaidNodeLabel(HWND hwndView, const MermaidBlock& blk,
+                                 const std::wstring& nodeId,
+                                 const std::wstring& newLabel);
+    void ReplaceMermaidBlock(HWND hwndView, const MermaidBlock& blk,
+                             const std::wstring& newSource);
+
     // --- Scroll sync ---
     void SyncScrollToPreview(HWND hwndView);
     void OnPreviewScrolled(HWND hwndView, int line);
     void OnPreviewNavigate(HWND hwndView, int line);
+    void PrioritizeVisibleRenders(HWND hwndView);
 
     // --- Open relative-path file link ---
     void OnOpenFileLink(HWND hwndView, const std::wstring& relativePath);
 
     // --- Auto-open detection ---
     bool IsMarkdownFile(HWND hwndView) const;
-    bool HasMermaidBlocks(HWND hwndView) const;
     void TryAutoOpen(HWND hwndView);
     // TryAutoClose was removed (audit v2 LOW-4.4): it was never called and
     // its intended behaviour — yanking the panel when a user transiently
@@ -112,8 +131,9 @@ private:
     void LoadSettings();
     void SaveSettings();
 
-    // --- Window procedure for the custom bar host ---
+    // --- Window procedures: custom bar host, parking window ---
     static LRESULT CALLBACK HostWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+    static LRESULT CALLBACK ParkingWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
     // --- State ---
     HWND                            m_hwndHost = nullptr;
@@ -124,9 +144,8 @@ private:
     bool                            m_bParked = false;        // WebView2 is parked (hidden, not destroyed)
     bool                            m_bAutoOpened = false;
     std::unique_ptr<WebView2Manager> m_pWebView;
-    std::shared_ptr<BunRenderer>    m_pBunRenderer;
-    std::wstring                    m_sLastContent;
-    size_t                          m_nLastHash = 0;
+    std::shared_ptr<BunRendererPool> m_pBunRenderer;
+    std::shared_ptr<const std::wstring> m_pLastContent;       // last snapshot built (null: rebuild)
     bool                            m_bDarkMode = false;
     bool                            m_bDarkModeOverride = false; // User manual override
     bool                            m_bSyncFromEditor = false;   // Anti-feedback: Editor→Preview
@@ -135,17 +154,42 @@ private:
     std::future<bool>               m_bunStartFuture;
 
     // --- Async Bun render state (UI thread only) ---
-    std::future<std::vector<MermaidRenderResult>> m_renderFuture;
-    std::wstring                    m_renderPendingHtml;
-    bool                            m_renderPendingDark = false;
-    HWND                            m_renderPendingView = nullptr;
-    bool                            m_renderDirty = false;   // re-trigger after current job
-
-    // Optimization 3: Pre-fetched HTML (prepared while WebView2 initializes)
-    std::wstring                    m_sPrefetchedHtml;
-    bool                            m_bHasPrefetch = false;
+    // One job per UpdatePreview that sent diagrams to Bun, tagged with the
+    // document generation it rendered, and posted to m_pRenderPipeline. A
+    // newer generation cancels the older jobs (or replaces one still
+    // waiting); their results only go to the cache. A job stays here until
+    // its queue reports Finished.
+    struct RenderJob {
+        std::shared_ptr<MermaidResultQueue> queue;   // results streamed by the pipeline
+        std::vector<MermaidBlock>           blocks;  // misses sent to Bun (cache keys)
+        uint64_t                            generation = 0;
+    };
+    std::unique_ptr<RenderPipeline> m_pRenderPipeline;       // created with m_pBunRenderer
+    std::vector<RenderJob>          m_renderJobs;            // oldest first
+    uint64_t                        m_renderGeneration = 0;  // bumped per document change
+    std::mutex                      m_renderCacheMutex;      // UI thread + builder lookups
+    MermaidRenderCache              m_renderCache;           // Bun results by source+theme+look
+
+    // --- Page building (PreviewBuilder thread) ---
+    // Created with the frame, after the cache its lookups read. Owns the
+    // incremental block tree; the UI posts snapshots and posts the patches
+    // of the pages it hands back. Questions about the text are answered by
+    // those pages too: the auto-open probe, the tab-switch check and the
+    // inline edits wait for them.
+    std::unique_ptr<PreviewBuilder> m_pPreviewBuilder;
+    double                          m_uiMs = 0;              // UI time spent on the current generation
+    HWND                            m_hwndProbeView = nullptr; // auto-open probe posted for this view
+    bool                            m_bCloseIfNoMermaid = false; // tab switched: close on a page without diagrams
+    struct MermaidEdit {
+        std::wstring blockId;
+        std::wstring nodeId;        // empty: replace the whole block with `text`
+        std::wstring text;          // new label / new block source
+    };
+    std::vector<MermaidEdit>        m_mermaidEdits;          // waiting for the current text's page
 
     // --- Settings ---
     int                             m_iBarPos = 2;
     int                             m_iFontSize = 14;
+    int                             m_iBunWorkers = 0;       // Bun processes (0 = auto)
+    bool                            m_bTimingLog = false;    // UI time per update → debugger output
 };
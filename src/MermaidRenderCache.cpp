@@ -0,0 +1,56 @@
+#include "MermaidRenderCache.h"
+
+MermaidRenderCache::MermaidRenderCache(size_t maxBytes)
+    : m_maxBytes(maxBytes)
+{
+}
+
+// ============================================================================
+// Find - hash lookup, then full source compare (64-bit hash collisions are
+// unlikely but would otherwise show the wrong diagram)
+// ============================================================================
+const MermaidRenderCache::Entry* MermaidRenderCache::Find(uint64_t hash, const std::wstring& code)
+{
+    auto it = m_index.find(hash);
+    if (it == m_index.end()) return nullptr;
+    if (it->second->entry.code != code) return nullptr;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return &it->second->entry;
+}
+
+// ============================================================================
+// Insert - replace / add, then evict from the LRU tail down to the budget
+// ============================================================================
+void MermaidRenderCache::Insert(uint64_t hash, std::wstring code,
+                                std::wstring svg, std::wstring error)
+{
+    if (svg.empty() && error.empty()) return;
+
+    size_t bytes = (code.size() + svg.size() + error.size()) * sizeof(wchar_t);
+    if (bytes > m_maxBytes) return; // would evict everything else for one diagram
+
+    auto it = m_index.find(hash);
+    if (it != m_index.end()) {
+        m_bytes -= it->second->bytes;
+        m_lru.erase(it->second);
+        m_index.erase(it);
+    }
+
+    m_lru.push_front({ hash, { std::move(code), std::move(svg), std::move(error) }, bytes });
+    m_index[hash] = m_lru.begin();
+    m_bytes += bytes;
+
+    while (m_bytes > m_maxBytes && !m_lru.empty()) {
+        Node& victim = m_lru.back();
+        m_bytes -= victim.bytes;
+        m_index.erase(victim.hash);
+        m_lru.pop_back();
+    }
+}
+
+void MermaidRenderCache::Clear()
+{
+    m_lru.clear();
+    m_index.clear();
+    m_bytes = 0;
+}
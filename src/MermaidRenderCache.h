@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// In-memory LRU of Bun render output, keyed by MermaidBlock::hash (diagram
+// source + theme + look, see MarkdownParser::MermaidHash). UpdatePreview
+// splices hits straight into the HTML and only sends misses to Bun, so
+// editing prose in a document with dozens of diagrams costs no Bun time.
+//
+// Not thread-safe: owned by CMermaidFrame behind m_renderCacheMutex (the
+// preview builder's lookups and OnBunRenderComplete on the UI thread).
+class MermaidRenderCache {
+public:
+    struct Entry {
+        std::wstring code;   // full source; a hash match with different code is a miss
+        std::wstring svg;    // empty on error
+        std::wstring error;  // empty on success
+    };
+
+    static constexpr size_t kDefaultMaxBytes = 64 * 1024 * 1024;
+
+    explicit MermaidRenderCache(size_t maxBytes = kDefaultMaxBytes);
+
+    // Look up a rendered block. Marks it most-recently used. The pointer is
+    // valid until the next Insert / Clear.
+    const Entry* Find(uint64_t hash, const std::wstring& code);
+
+    // Store a Bun result. Replaces any entry with the same hash and evicts
+    // least-recently-used entries until the byte budget holds. Results with
+    // neither SVG nor error (Bun died mid-reply) are not cached.
+    void Insert(uint64_t hash, std::wstring code, std::wstring svg, std::wstring error);
+
+    void Clear();
+
+    size_t Count() const { return m_index.size(); }
+    size_t Bytes() const { return m_bytes; }
+
+private:
+    struct Node {
+        uint64_t hash;
+        Entry    entry;
+        size_t   bytes;
+    };
+
+    std::list<Node>                                          m_lru;   // front = most recent
+    std::unordered_map<uint64_t, std::list<Node>::iterator>  m_index;
+    size_t                                                   m_bytes = 0;
+    size_t                                                   m_maxBytes;
+};
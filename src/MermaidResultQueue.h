@@ -0,0 +1,77 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct MermaidRenderResult {
+    std::wstring id;
+    std::wstring svg;    // Empty on error
+    std::wstring error;  // Empty on success
+};
+
+// Render results handed from a render worker to the UI thread as they
+// stream in. Instead of the UI polling, the queue calls `notify` (the
+// plugin posts a window message) when results arrive and when the worker
+// finishes. Notifications are coalesced: after one fires, no other does
+// until the consumer calls Drain, which takes everything that arrived in
+// the meantime — a burst of results costs one wake-up.
+//
+// Platform-neutral: the Win32 side is just the notify callback.
+class MermaidResultQueue {
+public:
+    using Notify = std::function<void()>;
+
+    explicit MermaidResultQueue(Notify notify = nullptr) : m_notify(std::move(notify)) {}
+
+    void Push(MermaidRenderResult r) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.push_back(std::move(r));
+        Signal();
+    }
+
+    // The worker is done: nothing more will be pushed.
+    void Finish() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+        Signal();
+    }
+
+    // Check Finished() *before* Drain(): if it was set, that Drain got the
+    // last result.
+    bool Finished() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_finished;
+    }
+
+    std::vector<MermaidRenderResult> Drain() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<MermaidRenderResult> out;
+        out.swap(m_items);
+        m_signalled = false;
+        return out;
+    }
+
+    // Stop notifying (the consumer is going away). No notify call is in
+    // progress or made once this returns.
+    void Detach() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_notify = nullptr;
+    }
+
+private:
+    // Called under m_mutex, so Detach can't race a notification; notify
+    // must not block or call back into the queue.
+    void Signal() {
+        if (m_signalled || !m_notify) return;
+        m_signalled = true;
+        m_notify();
+    }
+
+    std::mutex                       m_mutex;
+    std::vector<MermaidRenderResult> m_items;
+    Notify                           m_notify;
+    bool                             m_signalled = false;  // notified, not yet drained
+    bool                             m_finished = false;
+};
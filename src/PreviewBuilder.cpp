@@ -0,0 +1,390 @@
+#include "PreviewBuilder.h"
+#include <chrono>
+
+static double MsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Splice fragments (SpliceSvgIntoHtml)
+static const wchar_t kCloseDiv[] = L"</div>";
+static const wchar_t kErrorOpen[] = L"<div class=\"mermaid-error\">Mermaid error: ";
+static const wchar_t kErrorClose[] = L"</div></div>";
+static constexpr size_t kCloseDivLen = sizeof(kCloseDiv) / sizeof(wchar_t) - 1;
+static constexpr size_t kErrorOpenLen = sizeof(kErrorOpen) / sizeof(wchar_t) - 1;
+static constexpr size_t kErrorCloseLen = sizeof(kErrorClose) / sizeof(wchar_t) - 1;
+
+PreviewBuilder::PreviewBuilder()
+    : m_thread(&PreviewBuilder::Run, this)
+{
+}
+
+// A build is bounded by the parse of one snapshot, so this joins.
+PreviewBuilder::~PreviewBuilder()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_notify = nullptr;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+// ============================================================================
+// Build - replace the waiting snapshot (latest wins) and wake the thread
+// ============================================================================
+void PreviewBuilder::Build(Request request)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation = request.generation;
+        m_notify = std::move(request.notify);
+        m_request = std::make_unique<Request>(std::move(request));
+        m_splices.clear(); // all for older pages
+        m_page.reset();    // likewise
+    }
+    m_wake.notify_one();
+}
+
+void PreviewBuilder::Splice(uint64_t generation, std::vector<MermaidRenderResult> results)
+{
+    if (results.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (generation != m_generation) return;
+        m_splices.push_back({ generation, std::move(results) });
+    }
+    m_wake.notify_one();
+}
+
+// The taken page is what the WebView will hold: the base of the next diff.
+bool PreviewBuilder::Take(Page& page)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_page) return false;
+    if (!m_page->probe && m_pageEpoch == m_epoch) {
+        m_sent = std::move(m_pageState);
+        m_sentVersion = m_pageVersion;
+    }
+    page = std::move(*m_page);
+    m_page.reset();
+    return true;
+}
+
+void PreviewBuilder::Cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_request.reset();
+    m_splices.clear();
+    m_page.reset();
+    m_notify = nullptr;
+    m_generation = 0; // the page being built is dropped too
+}
+
+void PreviewBuilder::Resync()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_epoch++;
+        m_sent.clear();
+        m_sentVersion = 0;
+        m_resync = true;
+    }
+    m_wake.notify_one();
+}
+
+// ============================================================================
+// BuiltGeneration / FindMermaid - the block table of the newest snapshot
+// parsed, as the builder published it
+// ============================================================================
+uint64_t PreviewBuilder::BuiltGeneration()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_mermaidGeneration;
+}
+
+bool PreviewBuilder::FindMermaid(const std::wstring& id, MermaidBlock& out)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& mb : m_mermaid) {
+        if (mb.id != id) continue;
+        out = mb;
+        return true;
+    }
+    return false;
+}
+
+// ============================================================================
+// Run - the builder thread: the newest snapshot first, then Bun results
+// ============================================================================
+void PreviewBuilder::Run()
+{
+    while (true) {
+        std::unique_ptr<Request> request;
+        std::vector<std::pair<uint64_t, std::vector<MermaidRenderResult>>> splices;
+        bool resync;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] {
+                return m_stop || m_request || !m_splices.empty() || m_resync;
+            });
+            if (m_stop) break;
+            request = std::move(m_request);
+            splices.swap(m_splices);
+            resync = m_resync;
+            m_resync = false;
+        }
+
+        // A waiting snapshot supersedes every splice taken with it.
+        if (request) {
+            BuildPage(*request);
+            continue;
+        }
+
+        std::vector<MermaidRenderResult> results;
+        for (auto& s : splices) {
+            if (s.first != m_htmlGeneration) continue;
+            for (auto& r : s.second) results.push_back(std::move(r));
+        }
+        if ((!results.empty() || resync) && m_htmlGeneration != 0)
+            SplicePage(results, resync);
+    }
+}
+
+// ============================================================================
+// BuildPage - parse the snapshot, splice what is already rendered and
+// collect the rest for Bun
+// ============================================================================
+void PreviewBuilder::BuildPage(Request& request)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // The block tree is kept across snapshots, so only blocks touched by
+    // the edit (plus the one above it) are reparsed. The same pass yields
+    // the mermaid block list with each placeholder's id and position.
+    m_doc.SetMermaidSalt(request.salt);
+    m_doc.Update(*request.content);
+    MarkdownParseResult parsed = m_doc.Result();
+    request.content.reset();
+
+    // Published before the page, so the UI finds the table current when
+    // the page arrives.
+    {
+        std::vector<MermaidBlock> outline = parsed.mermaidBlocks;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_mermaid.swap(outline);
+        m_mermaidGeneration = request.generation;
+    }
+
+    // A probe (auto-open) only asks whether there are diagrams; the parse
+    // is kept in m_doc for the build that follows if there are.
+    if (request.probe) {
+        Page page;
+        page.generation = request.generation;
+        page.probe = true;
+        page.hasMermaid = !parsed.mermaidBlocks.empty();
+        page.buildMs = MsSince(start);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (page.generation != m_generation) return;
+        m_page = std::make_unique<Page>(std::move(page));
+        if (m_notify) m_notify();
+        return;
+    }
+
+    Page page;
+    page.generation = request.generation;
+    page.full = true;
+    m_slots.clear();
+    m_slotIndex.clear();
+    m_slots.reserve(parsed.mermaidBlocks.size());
+    for (auto& mb : parsed.mermaidBlocks) {
+        Slot slot;
+        slot.offset = mb.htmlOffset;
+        slot.length = mb.htmlLength;
+        if (!request.lookup || !request.lookup(mb, slot.result))
+            page.misses.push_back(mb);
+        slot.result.id = std::move(mb.id);
+        m_slotIndex[slot.result.id] = m_slots.size();
+        m_slots.push_back(std::move(slot));
+    }
+
+    m_html = std::move(parsed.html);
+    m_blocks = std::move(parsed.lineMap);
+    m_htmlGeneration = request.generation;
+    m_htmlDark = request.dark;
+    Publish(std::move(page), start);
+}
+
+// ============================================================================
+// SplicePage - record Bun results and republish the page (also with
+// nothing new when `resend`: a resync)
+// ============================================================================
+void PreviewBuilder::SplicePage(std::vector<MermaidRenderResult>& results, bool resend)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool changed = false;
+    for (auto& r : results) {
+        auto it = m_slotIndex.find(r.id);
+        if (it == m_slotIndex.end()) continue;
+        m_slots[it->second].result = std::move(r);
+        changed = true;
+    }
+    if (!changed && !resend) return;
+
+    Page page;
+    page.generation = m_htmlGeneration;
+    Publish(std::move(page), start);
+}
+
+// ============================================================================
+// Publish - assemble the page once, diff it against what the WebView holds
+// and hand the patch to the UI, unless a newer snapshot is already
+// waiting. If a page is taken (or a resync comes in) while diffing, the
+// base moved: diff again. A splice that lands on an untaken full page of
+// its generation keeps the page full, misses included: the UI has not
+// dispatched them yet.
+// ============================================================================
+void PreviewBuilder::Publish(Page page, std::chrono::steady_clock::time_point start)
+{
+    // Block starts and placeholder spans, mapped into the assembled page.
+    std::vector<size_t> marks;
+    marks.reserve(m_blocks.size() + 2 * m_slots.size() + 1);
+    size_t slot = 0;
+    for (const auto& b : m_blocks) {
+        marks.push_back(b.htmlOffset);
+        for (; slot < m_slots.size() && m_slots[slot].offset < b.htmlOffset + b.htmlLength; slot++) {
+            marks.push_back(m_slots[slot].offset);
+            marks.push_back(m_slots[slot].offset + m_slots[slot].length);
+        }
+    }
+    marks.push_back(m_html.size());
+    std::wstring html = SpliceSvgIntoHtml(m_html, m_slots, &marks);
+
+    std::vector<PreviewPatch::Block> blocks(m_blocks.size());
+    size_t mark = 0;
+    slot = 0;
+    for (size_t i = 0; i < m_blocks.size(); i++) {
+        PreviewPatch::Block& b = blocks[i];
+        b.state.key = m_blocks[i].key;
+        b.state.line = m_blocks[i].startLine;
+        b.offset = marks[mark++];
+        size_t end = m_blocks[i].htmlOffset + m_blocks[i].htmlLength;
+        for (int k = 0; slot < m_slots.size() && m_slots[slot].offset < end; slot++, k++) {
+            const Slot& s = m_slots[slot];
+            size_t from = marks[mark++], to = marks[mark++];
+            if (!s.result.svg.empty() || !s.result.error.empty())
+                b.state.rendered |= 1ull << (k < 63 ? k : 63);
+            PreviewPatch::Diagram d;
+            d.id = s.result.id;
+            if (to - from > s.length) {   // spliced: between `<div …>` and `</div>`
+                d.offset = from + s.length - kCloseDivLen;
+                d.length = to - from - s.length;
+            }
+            b.diagrams.push_back(d);
+        }
+        b.length = marks[mark] - b.offset;
+    }
+
+    while (true) {
+        std::vector<PreviewPatch::BlockState> prev;
+        uint64_t base, epoch;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (page.generation != m_generation) return;
+            prev = m_sent;
+            base = m_sentVersion;
+            epoch = m_epoch;
+        }
+        std::vector<PreviewPatch::BlockState> applied;
+        uint64_t version = ++m_version;
+        page.message = PreviewPatch::Diff(prev, base, html, blocks, version, m_htmlDark, applied);
+        page.resets = base == 0;
+        page.buildMs = MsSince(start);
+
+        page.hasMermaid = !m_slots.empty();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (page.generation != m_generation) return;
+        if (base != m_sentVersion || epoch != m_epoch) continue;
+        if (m_page && m_page->full && m_page->generation == page.generation) {
+            page.full = true;
+            page.misses = std::move(m_page->misses);
+        }
+        m_page = std::make_unique<Page>(std::move(page));
+        m_pageState = std::move(applied);
+        m_pageVersion = version;
+        m_pageEpoch = epoch;
+        if (m_notify) m_notify();
+        return;
+    }
+}
+
+// ============================================================================
+// SpliceSvgIntoHtml - Replace `<div class="mermaid-container">` placeholders
+// with the SVG (or error block) that Bun produced. The placeholder's own
+// opening tag (id, source, line range) is kept around the fragment. Sizes
+// are summed first, so the page is written once, with no reallocation and
+// no copy per diagram.
+// ============================================================================
+std::wstring PreviewBuilder::SpliceSvgIntoHtml(const std::wstring& html,
+                                               const std::vector<Slot>& slots,
+                                               std::vector<size_t>* marks)
+{
+    // A slot is spliced when rendered and its span still is a placeholder
+    // of this HTML (`<div …></div>`), in order.
+    auto usable = [&](const Slot& s, size_t from) {
+        return (!s.result.svg.empty() || !s.result.error.empty()) &&
+               s.offset >= from && s.length > kCloseDivLen &&
+               s.offset + s.length <= html.size() &&
+               html.compare(s.offset, 5, L"<div ") == 0 &&
+               html.compare(s.offset + s.length - kCloseDivLen, kCloseDivLen, kCloseDiv) == 0;
+    };
+
+    std::vector<std::wstring> errors;   // escaped, in slot order
+    size_t total = html.size();
+    size_t from = 0;
+    for (const auto& s : slots) {
+        if (!usable(s, from)) continue;
+        from = s.offset + s.length;
+        if (!s.result.svg.empty()) {
+            total += s.result.svg.size();
+        } else {
+            errors.push_back(MarkdownParser::HtmlEscape(s.result.error));
+            total += kErrorOpenLen + errors.back().size() + kErrorCloseLen - kCloseDivLen;
+        }
+    }
+
+    // Marks up to `upTo` lie in the text copied from `pos` onward.
+    size_t nextMark = 0;
+    auto mapMarks = [&](size_t upTo, size_t pos, size_t outPos) {
+        if (!marks) return;
+        for (; nextMark < marks->size() && (*marks)[nextMark] <= upTo; nextMark++)
+            (*marks)[nextMark] = outPos + ((*marks)[nextMark] - pos);
+    };
+
+    std::wstring out;
+    out.reserve(total);
+    size_t pos = 0, err = 0;
+    from = 0;
+    for (const auto& s : slots) {
+        if (!usable(s, from)) continue;
+        from = s.offset + s.length;
+        size_t tagEnd = s.offset + s.length - kCloseDivLen;   // after `<div …>`
+        mapMarks(s.offset, pos, out.size());
+        out.append(html, pos, tagEnd - pos);
+        if (!s.result.svg.empty()) {
+            out += s.result.svg;
+            out.append(kCloseDiv, kCloseDivLen);
+        } else {
+            out.append(kErrorOpen, kErrorOpenLen);
+            out += errors[err++];
+            out.append(kErrorClose, kErrorCloseLen);
+        }
+        pos = from;
+    }
+    mapMarks(html.size(), pos, out.size());
+    out.append(html, pos, std::wstring::npos);
+    return out;
+}
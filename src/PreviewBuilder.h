@@ -0,0 +1,154 @@
+#pragma once
+
+#include "MarkdownParser.h"
+#include "MermaidResultQueue.h" // MermaidRenderResult
+#include "PreviewPatch.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Builds preview pages off the UI thread. The UI only captures a snapshot
+// of the document text and posts it here; the builder thread parses it
+// into the incremental MarkdownDocument, splices the diagrams that are
+// already rendered, diffs the page against the blocks the WebView holds
+// (PreviewPatch), and calls `notify` (the plugin posts a window message)
+// for the UI to pick the patch up with Take. Bun results for the page are
+// spliced here as well. The UI never parses: what it needs to know about
+// the text (does it have diagrams, where is a block) comes with the pages
+// built from it.
+//
+// Latest wins, like RenderPipeline: a snapshot posted while another is
+// waiting replaces it, and only the newest finished page is kept. A page
+// counts as sent to the WebView once taken; the next one is diffed
+// against it.
+//
+// Platform-neutral: the Win32 side is the notify callback.
+class PreviewBuilder {
+public:
+    using Notify = std::function<void()>;
+    // An already rendered diagram, if any (render caches).
+    using Lookup = std::function<bool(const MermaidBlock& mb, MermaidRenderResult& out)>;
+
+    struct Request {
+        std::shared_ptr<const std::wstring> content;  // document snapshot
+        std::wstring salt;                  // mermaid id salt (theme + look)
+        bool         dark = false;
+        uint64_t     generation = 0;        // stamped on every page built from it
+        bool         probe = false;         // only parse: the page reports hasMermaid, no patch
+        Lookup       lookup;                // called on the builder thread
+        Notify       notify;                // called under the builder's lock; must not block
+    };
+
+    struct Page {
+        uint64_t                  generation = 0;
+        bool                      full = false;  // false: Bun results spliced into the last full page
+        std::wstring              message;       // PreviewPatch JSON
+        bool                      resets = false; // base 0: replaces whatever the WebView shows
+        bool                      probe = false;  // from a probe request: no message
+        bool                      hasMermaid = false; // the snapshot has mermaid blocks
+        std::vector<MermaidBlock> misses;        // full pages: diagrams left for Bun, document order
+        double                    buildMs = 0;   // builder-thread time for this page
+    };
+
+    PreviewBuilder();
+    ~PreviewBuilder();
+
+    PreviewBuilder(const PreviewBuilder&) = delete;
+    PreviewBuilder& operator=(const PreviewBuilder&) = delete;
+
+    // Replace the waiting snapshot (latest wins) and wake the thread.
+    void Build(Request request);
+
+    // Splice Bun results into the page of `generation`; dropped if a newer
+    // snapshot has been built or is waiting.
+    void Splice(uint64_t generation, std::vector<MermaidRenderResult> results);
+
+    // The newest finished page not taken yet.
+    bool Take(Page& page);
+
+    // Drop waiting work and the untaken page, and stop notifying (the
+    // preview is closing). No notify call is in progress once this returns.
+    void Cancel();
+
+    // The WebView's blocks are unknown (a new page was loaded, or it
+    // rejected a patch): send the current page whole.
+    void Resync();
+
+    // The mermaid blocks of the newest snapshot parsed (built or probed),
+    // for the UI's inline edits: a copy under the lock, never a parse.
+    // BuiltGeneration is that snapshot's generation (0: none yet).
+    uint64_t BuiltGeneration();
+    bool FindMermaid(const std::wstring& id, MermaidBlock& out);
+
+    // One diagram placeholder of a page: its `<div …></div>` span in the
+    // HTML (MermaidBlock::htmlOffset / htmlLength) and the result spliced
+    // over it — svg and error both empty: not rendered, keep the
+    // placeholder.
+    struct Slot {
+        size_t              offset = 0;
+        size_t              length = 0;
+        MermaidRenderResult result;     // id = the placeholder's
+    };
+
+    // Write `html` with the SVG (or error block) of every rendered slot in
+    // place of its placeholder: one pass into one preallocated buffer,
+    // text segments interleaved with fragments. Slots are in document
+    // order. `marks` (ascending offsets into `html`, none inside a slot's
+    // span), if given, are mapped to offsets in the result. Pure string
+    // work.
+    static std::wstring SpliceSvgIntoHtml(const std::wstring& html,
+                                          const std::vector<Slot>& slots,
+                                          std::vector<size_t>* marks = nullptr);
+
+private:
+    void Run();
+    void BuildPage(Request& request);
+    void SplicePage(std::vector<MermaidRenderResult>& results, bool resend);
+    void Publish(Page page, std::chrono::steady_clock::time_point start);
+
+    // Work handed over by the UI, guarded by m_mutex.
+    std::mutex                       m_mutex;
+    std::condition_variable          m_wake;
+    std::unique_ptr<Request>         m_request;    // waiting snapshot, if any
+    std::vector<std::pair<uint64_t, std::vector<MermaidRenderResult>>> m_splices;
+    std::unique_ptr<Page>            m_page;       // finished, not taken
+    Notify                           m_notify;     // of the newest request
+    uint64_t                         m_generation = 0; // newest request
+    bool                             m_resync = false;
+    bool                             m_stop = false;
+
+    // What the WebView holds, as of the last page taken (version 0: not
+    // known), and what it will hold once m_page is taken. Pages diffed
+    // before a Resync (older epoch) never become the base.
+    std::vector<PreviewPatch::BlockState> m_sent;
+    uint64_t                         m_sentVersion = 0;
+    std::vector<PreviewPatch::BlockState> m_pageState;
+    uint64_t                         m_pageVersion = 0;
+    uint64_t                         m_pageEpoch = 0;
+    uint64_t                         m_epoch = 0;
+
+    // The mermaid blocks of the newest snapshot parsed, guarded by m_mutex.
+    std::vector<MermaidBlock>        m_mermaid;
+    uint64_t                         m_mermaidGeneration = 0;
+
+    // Builder thread only: the document, the last full page as parsed
+    // (placeholders intact), and what has been rendered for its diagrams.
+    MarkdownDocument                 m_doc;
+    std::wstring                     m_html;
+    std::vector<MarkdownLineSpan>    m_blocks;     // top-level blocks of m_html
+    std::vector<Slot>                m_slots;      // document order
+    std::unordered_map<std::wstring, size_t> m_slotIndex; // id → m_slots
+    uint64_t                         m_htmlGeneration = 0;
+    bool                             m_htmlDark = false;
+    uint64_t                         m_version = 0;  // last patch version issued
+
+    std::thread                      m_thread;     // last: starts in the constructor
+};
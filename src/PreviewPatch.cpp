@@ -0,0 +1,177 @@
+#include "PreviewPatch.h"
+#include <unordered_map>
+
+// ============================================================================
+// AppendJsonString - JSON string literal for PostWebMessageAsJson. Control
+// characters and unpaired surrogates are \u-escaped so the message is
+// always valid JSON.
+// ============================================================================
+void PreviewPatch::AppendJsonString(std::wstring& out, const wchar_t* text, size_t length)
+{
+    static const wchar_t kHex[] = L"0123456789abcdef";
+    auto escapeUnit = [&](unsigned u) {
+        out += L"\\u";
+        for (int shift = 12; shift >= 0; shift -= 4)
+            out += kHex[(u >> shift) & 0xF];
+    };
+
+    out.reserve(out.size() + length + length / 8 + 2);
+    out += L'"';
+    for (size_t i = 0; i < length; i++) {
+        wchar_t ch = text[i];
+        switch (ch) {
+        case L'"':  out += L"\\\""; continue;
+        case L'\\': out += L"\\\\"; continue;
+        case L'\n': out += L"\\n";  continue;
+        case L'\r': out += L"\\r";  continue;
+        case L'\t': out += L"\\t";  continue;
+        default: break;
+        }
+        unsigned u = (unsigned)ch;
+        if (u < 0x20) {
+            escapeUnit(u);
+        } else if (u >= 0xD800 && u <= 0xDBFF) {
+            if (i + 1 < length && (unsigned)text[i + 1] >= 0xDC00 && (unsigned)text[i + 1] <= 0xDFFF) {
+                out += ch;
+                out += text[++i];
+            } else {
+                escapeUnit(u);
+            }
+        } else if (u >= 0xDC00 && u <= 0xDFFF) {
+            escapeUnit(u);
+        } else {
+            out += ch;
+        }
+    }
+    out += L'"';
+}
+
+// ============================================================================
+// Diff - walk both block lists once. A block matches the WebView's next
+// block when the keys agree; host SVG it brings that the WebView lacks is
+// sent per diagram. Otherwise the WebView's block is removed if its key no
+// longer occurs in the rest of the page, and the page's block is inserted
+// if not. Keys still to come are counted, so an edit in the middle costs
+// only the blocks it touched, and blocks below it are kept with a line
+// shift.
+// ============================================================================
+std::wstring PreviewPatch::Diff(const std::vector<BlockState>& prev, uint64_t base,
+                                const std::wstring& html, const std::vector<Block>& next,
+                                uint64_t version, bool dark,
+                                std::vector<BlockState>& applied)
+{
+    std::wstring out = L"{\"type\":\"patch\",\"base\":";
+    out += std::to_wstring(base);
+    out += L",\"version\":";
+    out += std::to_wstring(version);
+    out += L",\"theme\":\"";
+    out += dark ? L"dark" : L"light";
+    out += L"\",\"ops\":[";
+
+    std::unordered_map<uint64_t, size_t> ahead;   // key → blocks left in `next`
+    ahead.reserve(next.size());
+    for (const auto& b : next) ahead[b.state.key]++;
+
+    // Pending run, flushed when the op kind (or keep shift) changes.
+    enum { kNone = -1, kKeep = 0, kRemove = 1, kInsert = 2, kFill = 3 };
+    int runKind = kNone;
+    size_t runCount = 0;
+    int runShift = 0;
+    size_t insertBegin = 0, insertEnd = 0;
+    bool first = true;
+    auto flush = [&]() {
+        if (runKind == kNone) return;
+        if (!first) out += L',';
+        first = false;
+        out += L'[';
+        out += std::to_wstring(runKind);
+        out += L',';
+        if (runKind == kInsert) {
+            AppendJsonString(out, html.data() + insertBegin, insertEnd - insertBegin);
+        } else {
+            out += std::to_wstring(runCount);
+            if (runKind == kKeep) {
+                out += L',';
+                out += std::to_wstring(runShift);
+            }
+        }
+        out += L']';
+        runKind = kNone;
+        runCount = 0;
+    };
+    auto keep = [&](int shift) {
+        if (runKind != kKeep || runShift != shift) { flush(); runKind = kKeep; runShift = shift; }
+        runCount++;
+    };
+    auto remove = [&]() {
+        if (runKind != kRemove) { flush(); runKind = kRemove; }
+        runCount++;
+    };
+    auto fill = [&](const Diagram& d) {
+        flush();
+        if (!first) out += L',';
+        first = false;
+        out += L"[3,";
+        AppendJsonString(out, d.id.data(), d.id.size());
+        out += L',';
+        AppendJsonString(out, html.data() + d.offset, d.length);
+        out += L']';
+    };
+    // Every diagram that gained host SVG can be filled on its own. Bit 63
+    // stands for the 64th diagram onward, of which the page may hold any
+    // subset, so while it is set every rendered diagram past it is filled
+    // again (refilling shown SVG is harmless).
+    auto fillable = [](const Block& b, uint64_t gained) {
+        for (size_t k = 0; k < 63; k++)
+            if ((gained >> k & 1) && (k >= b.diagrams.size() || b.diagrams[k].length == 0))
+                return false;
+        return true;
+    };
+    auto insert = [&](const Block& b) {
+        // Blocks are contiguous in the page, so a run is one span.
+        if (runKind != kInsert || insertEnd != b.offset) {
+            flush();
+            runKind = kInsert;
+            insertBegin = b.offset;
+        }
+        insertEnd = b.offset + b.length;
+    };
+
+    applied.clear();
+    applied.reserve(next.size());
+    size_t a = 0;
+    for (size_t n = 0; n < next.size(); ) {
+        const BlockState& want = next[n].state;
+        if (a < prev.size()) {
+            const BlockState& have = prev[a];
+            uint64_t gained = want.rendered & ~have.rendered;
+            if (have.key == want.key && fillable(next[n], gained)) {
+                for (size_t k = 0; k < 63 && gained; k++, gained >>= 1)
+                    if (gained & 1) fill(next[n].diagrams[k]);
+                if (want.rendered >> 63)
+                    for (size_t k = 63; k < next[n].diagrams.size(); k++)
+                        if (next[n].diagrams[k].length != 0) fill(next[n].diagrams[k]);
+                keep(want.line - have.line);
+                applied.push_back({ want.key, want.line, have.rendered | want.rendered });
+                ahead[want.key]--;
+                a++;
+                n++;
+                continue;
+            }
+            auto it = ahead.find(have.key);
+            if (it == ahead.end() || it->second == 0) {
+                remove();
+                a++;
+                continue;
+            }
+        }
+        insert(next[n]);
+        applied.push_back(want);
+        ahead[want.key]--;
+        n++;
+    }
+    for (; a < prev.size(); a++) remove();
+    flush();
+    out += L"]}";
+    return out;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Block-level diff of preview pages. Instead of the whole page as a
+// renderContent() script, the host sends the WebView only what changed, as
+// a JSON message for PostWebMessageAsJson:
+//
+//   {"type":"patch","base":B,"version":V,"theme":"dark"|"light","ops":[…]}
+//     [0, n, d]     keep the next n blocks, moving their data-line-* by d
+//     [1, n]        remove the next n blocks
+//     [2, "html"]   insert these blocks before the next one
+//     [3, "id", "html"]  fill diagram `id` of the next block with this SVG
+//                   (or error block) in place; the block is not passed
+//
+// Blocks are the top-level elements of the page, known here by their
+// reconciliation key (MarkdownBlock data-key), first line, and which of
+// their diagrams carry a host-rendered SVG. The page applies a patch only
+// on top of version `base`; base 0 means "whatever is shown": the message
+// then holds the whole page as one insert. A page that cannot apply a
+// patch asks the host to resync, which starts over from base 0.
+//
+// Pure and platform-neutral.
+class PreviewPatch {
+public:
+    // One block as the WebView holds it.
+    struct BlockState {
+        uint64_t key = 0;
+        int      line = 0;      // data-line-block
+        uint64_t rendered = 0;  // bit k: the block's k-th diagram has host SVG (or error)
+    };
+
+    // One diagram of a block: its placeholder id and the SVG (or error
+    // block) spliced into it, as a span of the page HTML (empty: not
+    // rendered).
+    struct Diagram {
+        std::wstring_view id;
+        size_t            offset = 0;
+        size_t            length = 0;
+    };
+
+    // One block of the next page: its state, its span in the page HTML
+    // and its diagrams in order (bit k of `rendered` ↔ diagrams[k]).
+    struct Block {
+        BlockState           state;
+        size_t               offset = 0;
+        size_t               length = 0;
+        std::vector<Diagram> diagrams;
+    };
+
+    // Write the message turning `prev` (the WebView's blocks at version
+    // `base`) into `next`, blocks of `html` in document order, as version
+    // `version`. `applied` receives the blocks the WebView holds once the
+    // patch is applied — a kept block keeps host SVG the next page lacks
+    // (a diagram evicted from the caches is not taken back to a
+    // placeholder), and host SVG that arrived for a kept block is sent
+    // on its own.
+    static std::wstring Diff(const std::vector<BlockState>& prev, uint64_t base,
+                             const std::wstring& html, const std::vector<Block>& next,
+                             uint64_t version, bool dark,
+                             std::vector<BlockState>& applied);
+
+    // Append `text` as a JSON string literal (quotes included).
+    static void AppendJsonString(std::wstring& out, const wchar_t* text, size_t length);
+};
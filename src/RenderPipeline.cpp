@@ -0,0 +1,90 @@
+#include "RenderPipeline.h"
+#include <chrono>
+#include <limits>
+
+// How long the destructor waits for the thread before detaching it. A
+// cancelled render returns at once; only a worker stuck (re)starting Bun
+// takes longer.
+static constexpr std::chrono::milliseconds kJoinTimeout(500);
+
+RenderPipeline::RenderPipeline(std::shared_ptr<BunRendererPool> renderer)
+    : m_state(std::make_shared<State>())
+{
+    m_state->renderer = std::move(renderer);
+    std::promise<void> exited;
+    m_exited = exited.get_future();
+    m_thread = std::thread(Run, m_state, std::move(exited));
+}
+
+RenderPipeline::~RenderPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->stop = true;
+    }
+    m_state->wake.notify_one();
+    CancelAll();
+    if (m_exited.wait_for(kJoinTimeout) == std::future_status::ready)
+        m_thread.join();
+    else
+        m_thread.detach(); // keeps m_state alive until the render returns
+}
+
+// ============================================================================
+// Post - replace the waiting job (latest wins) and wake the thread
+// ============================================================================
+void RenderPipeline::Post(Job job)
+{
+    std::unique_ptr<Job> replaced;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        replaced = std::move(m_state->mailbox);
+        m_state->mailbox = std::make_unique<Job>(std::move(job));
+    }
+    m_state->wake.notify_one();
+    if (replaced) replaced->queue->Finish();
+}
+
+void RenderPipeline::CancelAll()
+{
+    std::unique_ptr<Job> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        dropped = std::move(m_state->mailbox);
+    }
+    if (dropped) dropped->queue->Finish();
+    m_state->renderer->CancelBefore(std::numeric_limits<uint64_t>::max());
+}
+
+// ============================================================================
+// Run - the pipeline thread: one job at a time, newest first
+// ============================================================================
+void RenderPipeline::Run(std::shared_ptr<State> state, std::promise<void> exited)
+{
+    while (true) {
+        std::unique_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->wake.wait(lock, [&] { return state->stop || state->mailbox; });
+            if (state->stop) break;
+            job = std::move(state->mailbox);
+        }
+        try {
+            auto& queue = job->queue;
+            state->renderer->RenderBlocks(job->blocks, job->theme,
+                [&queue](MermaidRenderResult& r) { queue->Push(r); }, job->generation);
+        } catch (...) {
+            // Whatever arrived was pushed; the UI's client-side mermaid.js
+            // draws the rest.
+        }
+        job->queue->Finish();
+    }
+
+    std::unique_ptr<Job> dropped;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        dropped = std::move(state->mailbox);
+    }
+    if (dropped) dropped->queue->Finish();
+    exited.set_value();
+}
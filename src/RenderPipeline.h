@@ -0,0 +1,60 @@
+#pragma once
+
+#include "BunRendererPool.h"
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Long-lived render thread between the UI and the Bun pool. The UI posts a
+// job (the uncached diagrams of one document version) into a single-slot
+// mailbox; the thread takes the newest job, renders it through the pool
+// and streams the results into the job's MermaidResultQueue.
+//
+// Latest wins: a job posted while another is still waiting replaces it, and
+// the replaced one is finished without being rendered, so a burst of edits
+// costs one render. The job being rendered is superseded the usual way
+// (BunRendererPool::CancelBefore with a newer generation). At most one job
+// renders at a time and no thread is created per update.
+class RenderPipeline {
+public:
+    struct Job {
+        std::vector<std::pair<std::wstring, std::wstring>> blocks;  // {id, code}
+        std::wstring                        theme;
+        uint64_t                            generation = 0;
+        std::shared_ptr<MermaidResultQueue> queue;    // Finish()ed when done or dropped
+    };
+
+    explicit RenderPipeline(std::shared_ptr<BunRendererPool> renderer);
+    ~RenderPipeline();
+
+    RenderPipeline(const RenderPipeline&) = delete;
+    RenderPipeline& operator=(const RenderPipeline&) = delete;
+
+    void Post(Job job);
+
+    // Drop the waiting job and cancel the one rendering.
+    void CancelAll();
+
+private:
+    // Owned jointly with the thread, so a thread that can't be joined in
+    // time (Bun stuck starting) can be detached safely.
+    struct State {
+        std::shared_ptr<BunRendererPool> renderer;
+        std::mutex                       mutex;
+        std::condition_variable          wake;
+        std::unique_ptr<Job>             mailbox;   // the waiting job, if any
+        bool                             stop = false;
+    };
+
+    static void Run(std::shared_ptr<State> state, std::promise<void> exited);
+
+    std::shared_ptr<State> m_state;
+    std::thread            m_thread;
+    std::future<void>      m_exited;
+};
@@ -1,4 +1,5 @@
 #include "WebView2Manager.h"
+#include "MarkdownParser.h"
 #include "resource.h"
 #include <shlobj.h>
 #include <sstream>
@@ -10,7 +11,7 @@ using namespace Microsoft::WRL;
 extern HINSTANCE EEGetInstanceHandle();
 
 // HTML cache version tag — increment when BuildHtmlPage() content changes
-static const char* kHtmlVersionTag = "<!-- MermaidPreview-v14 -->";
+static const char* kHtmlVersionTag = "<!-- MermaidPreview-v21 -->";
 
 WebView2Manager::WebView2Manager() = default;
 
@@ -378,42 +379,86 @@ std::wstring WebView2Manager::BuildHtmlPage() const
     //
     // We use viewport-relative getBoundingClientRect so transforms /
     // nested clusters compose correctly without manual coordinate math.
+    //
+    // Results are cached per rendered diagram (content-hash id + SVG id +
+    // host / client), so a diagram kept across edits is not measured again.
+    var _overlapCache = new Map();
+    function _overlapKey(container, svg) {
+      var id = container.getAttribute('data-mermaid-id');
+      return id ? id + '|' + svg.id + '|' + (container._hostSvg ? 'h' : 'c') : null;
+    }
     function _detectOverlaps(container) {
       var svg = container && container.querySelector ? container.querySelector('svg') : null;
       if (!svg) return [];
+      var key = _overlapKey(container, svg);
+      var cached = key && _overlapCache.get(key);
+      if (cached) return cached;
       var nodes = svg.querySelectorAll('g.node');
       var edgeLabels = svg.querySelectorAll('g.edgeLabels g.label');
       var clusterLabels = svg.querySelectorAll('g.cluster-label');
       if (!nodes.length || (!edgeLabels.length && !clusterLabels.length)) return [];
-      // Chromium coalesces consecutive layout reads as long as no DOM /
-      // style write happens between them; this loop is read-only so we
-      // get a single layout flush even though it walks N + M + K rects.
-      var nodeBoxes = [];
-      for (var i = 0; i < nodes.length; i++) {
+      // One read-only pass over every rect: with no DOM / style write in
+      // between, Chromium lays out once for the whole diagram.
+      var labels = [];
+      function collect(els, kind) {
+        for (var j = 0; j < els.length; j++) {
+          var txt = (els[j].textContent || '').trim();
+          if (txt) labels.push({ el: els[j], text: txt, kind: kind });
+        }
+      }
+      collect(edgeLabels, 'edge');
+      collect(clusterLabels, 'cluster');
+      var boxes = [], i;
+      for (i = 0; i < nodes.length; i++) {
         var nb = nodes[i].getBoundingClientRect();
-        if (nb.width > 0 && nb.height > 0) nodeBoxes.push(nb);
+        if (nb.width > 0 && nb.height > 0) boxes.push(nb);
+      }
+      for (i = 0; i < labels.length; i++) labels[i].box = labels[i].el.getBoundingClientRect();
+      if (!boxes.length) return [];   // not laid out (hidden): don't cache
+
+      // Uniform grid over the node boxes, one cell ≈ the mean node size:
+      // a label is tested against the nodes sharing its cells, not all N.
+      var minX = Infinity, minY = Infinity, maxX = -Infinity, maxY = -Infinity, size = 0;
+      boxes.forEach(function(b){
+        minX = Math.min(minX, b.left); minY = Math.min(minY, b.top);
+        maxX = Math.max(maxX, b.right); maxY = Math.max(maxY, b.bottom);
+        size += b.width + b.height;
+      });
+      var cell = Math.max(8, size / (2 * boxes.length));
+      while (Math.ceil((maxX - minX) / cell) * Math.ceil((maxY - minY) / cell) > 4 * boxes.length + 64) cell *= 2;
+      var cols = Math.floor((maxX - minX) / cell) + 1, rows = Math.floor((maxY - minY) / cell) + 1;
+      var grid = new Array(cols * rows);
+      function span(lo, hi, min, n) {
+        return [Math.max(0, Math.floor((lo - min) / cell)), Math.min(n - 1, Math.floor((hi - min) / cell))];
       }
+      boxes.forEach(function(b){
+        var cx = span(b.left, b.right, minX, cols), cy = span(b.top, b.bottom, minY, rows);
+        for (var y = cy[0]; y <= cy[1]; y++)
+          for (var x = cx[0]; x <= cx[1]; x++)
+            (grid[y * cols + x] || (grid[y * cols + x] = [])).push(b);
+      });
+
       var hits = [];
-      function probe(els, kind) {
-        for (var j = 0; j < els.length; j++) {
-          var L = els[j];
-          var txt = (L.textContent || '').trim();
-          if (!txt) continue;
-          var lb = L.getBoundingClientRect();
-          if (lb.width <= 0 || lb.height <= 0) continue;
-          for (var k = 0; k < nodeBoxes.length; k++) {
-            var nb2 = nodeBoxes[k];
-            var ovX = Math.max(0, Math.min(nb2.right, lb.right) - Math.max(nb2.left, lb.left));
-            var ovY = Math.max(0, Math.min(nb2.bottom, lb.bottom) - Math.max(nb2.top, lb.top));
-            if (ovX * ovY > 9) {
-              hits.push({ label: L, text: txt, kind: kind });
-              break;
+      labels.forEach(function(L){
+        var lb = L.box;
+        if (lb.width <= 0 || lb.height <= 0) return;
+        var cx = span(lb.left, lb.right, minX, cols), cy = span(lb.top, lb.bottom, minY, rows);
+        for (var y = cy[0]; y <= cy[1]; y++) {
+          for (var x = cx[0]; x <= cx[1]; x++) {
+            var cellBoxes = grid[y * cols + x] || [];
+            for (var k = 0; k < cellBoxes.length; k++) {
+              var nb2 = cellBoxes[k];
+              var ovX = Math.max(0, Math.min(nb2.right, lb.right) - Math.max(nb2.left, lb.left));
+              var ovY = Math.max(0, Math.min(nb2.bottom, lb.bottom) - Math.max(nb2.top, lb.top));
+              if (ovX * ovY > 9) { hits.push({ text: L.text, kind: L.kind }); return; }
             }
           }
         }
+      });
+      if (key) {
+        _overlapCache.set(key, hits);
+        if (_overlapCache.size > 256) _overlapCache.delete(_overlapCache.keys().next().value);
       }
-      probe(edgeLabels, 'edge');
-      probe(clusterLabels, 'cluster');
       return hits;
     }
 
@@ -424,7 +469,10 @@ std::wstring WebView2Manager::BuildHtmlPage() const
     // Detection runs in requestAnimationFrame so the synchronous
     // getBoundingClientRect() walk doesn't tax-on top of the
     // mermaid render commit (each call forces a style + layout flush;
-    // the user's 14-node flowcharts noticed it as a slow open).
+    // the user's 14-node flowcharts noticed it as a slow open). Every
+    // container queued in a frame is measured first and its button
+    // updated after, so one layout serves them all.
+    var _overlapQueue = [];
     function _refreshAutoFixBtn(container) {
       // Cheap pre-check: if there's no SVG yet (placeholder still empty),
       // there's nothing to measure — skip the rAF entirely.
@@ -432,18 +480,24 @@ std::wstring WebView2Manager::BuildHtmlPage() const
         if (container) container.classList.remove('mp-has-overlap');
         return;
       }
+      if (_overlapQueue.indexOf(container) !== -1) return;
+      if (_overlapQueue.push(container) > 1) return;
       var raf = window.requestAnimationFrame || function(cb){ return setTimeout(cb, 16); };
-      raf(function(){ _refreshAutoFixBtnNow(container); });
+      raf(function(){
+        var batch = _overlapQueue;
+        _overlapQueue = [];
+        var results = batch.map(_detectOverlaps);
+        batch.forEach(function(c, i){ _refreshAutoFixBtnNow(c, results[i]); });
+      });
     }
 )P1c";
 
     // Continue Part 1c in a fresh raw string — adding the deferred-render
     // helper pushed us back over MSVC's 16380-char string-literal limit.
     html += LR"P1ca(
-    function _refreshAutoFixBtnNow(container) {
-      var hits = _detectOverlaps(container);
+    function _refreshAutoFixBtnNow(container, hits) {
       // PERF-006: stash the latest detection result so `_applyAutoFix`
-      // can read it instead of re-running the N×M intersection scan.
+      // can read it instead of running the scan again.
       // Stored as a non-enumerable expando — never serialized into the
       // DOM, never round-tripped to C++.
       container.__mpHits = hits;
@@ -637,7 +691,123 @@ std::wstring WebView2Manager::BuildHtmlPage() const
       document.head.appendChild(s);
     })();
 
-    async function _processPendingMermaid() {
+    // Containers the host already filled with Bun output (streamed in
+    // per diagram) are final: keep them and seed the id cache instead of
+    // re-rendering client-side over the top.
+    function _hasServerSvg(el) {
+      return !!el.querySelector(':scope > svg, :scope > .mermaid-error');
+    }
+
+    // ===== Lazy client-side rendering =====
+    // mermaid.js renders what the host has no SVG for (no Bun, or Bun still
+    // busy). Diagrams within a screen of the viewport render at once, the
+    // rest one per idle slice, or as soon as they are scrolled near. A
+    // placeholder reserves the height its diagram last rendered at (ids are
+    // content hashes), so late renders do not shift the page. The heights
+    // of the newest 1000 ids are kept in localStorage, so this also holds
+    // on the next page load, not just after a resync.
+    var _lazyPending = new Set(), _lazyNear = [], _lazyBusy = false, _lazyIdle = false;
+    var _lazyHeights = _loadHeights(), _lazyMeasure = [], _lazySeq = 0, _heightsSaving = false;
+    var _lazyIO = window.IntersectionObserver ? new IntersectionObserver(function(entries){
+      entries.forEach(function(e){
+        if (e.isIntersecting && _lazyPending.has(e.target)) _lazyNear.push(e.target);
+      });
+      _pumpLazy(false);
+    }, { rootMargin: '100% 0px' }) : null;
+    var _idle = window.requestIdleCallback || function(cb){ return setTimeout(cb, 50); };
+
+    function _loadHeights() {
+      try { return JSON.parse(localStorage.getItem('mmdHeights')) || {}; } catch(e) { return {}; }
+    }
+    // Heights are read once per frame, for every diagram filled in it
+    // (client-side render or host SVG).
+    function _measureHeight(el) {
+      if (_lazyMeasure.push(el) !== 1) return;
+      requestAnimationFrame(function(){
+        _lazyMeasure.forEach(function(c){
+          var k = c.getAttribute('data-mermaid-id'), h = c.offsetHeight;
+          if (!k || !h || !c.isConnected) return;
+          delete _lazyHeights[k];   // re-added last: key order is recency
+          _lazyHeights[k] = h;
+        });
+        _lazyMeasure = [];
+        _saveHeights();
+      });
+    }
+    function _saveHeights() {
+      if (_heightsSaving) return;
+      _heightsSaving = true;
+      _idle(function(){
+        _heightsSaving = false;
+        var ids = Object.keys(_lazyHeights);
+        for (var i = 0; i < ids.length - 1000; i++) delete _lazyHeights[ids[i]];
+        try { localStorage.setItem('mmdHeights', JSON.stringify(_lazyHeights)); } catch(e) {}
+      });
+    }
+
+    function _queueLazy(el) {
+      var id = el.getAttribute('data-mermaid-id');
+      if (id && _lazyHeights[id]) el.style.minHeight = _lazyHeights[id] + 'px';
+      _lazyPending.add(el);
+      if (_lazyIO) _lazyIO.observe(el); else _lazyNear.push(el);
+      _scheduleLazy();
+    }
+    function _scheduleLazy() {
+      if (_lazyIdle || !_lazyPending.size) return;
+      _lazyIdle = true;
+      _idle(function(){ _lazyIdle = false; _pumpLazy(true); });
+    }
+    // Near the viewport first; otherwise, in idle time, the oldest queued.
+    function _nextLazy(idle) {
+      while (_lazyNear.length) {
+        var el = _lazyNear.shift();
+        if (_lazyPending.has(el)) return el;
+      }
+      if (!idle) return null;
+      var next = _lazyPending.values().next();
+      return next.done ? null : next.value;
+    }
+    async function _pumpLazy(idle) {
+      if (_lazyBusy) return;
+      _lazyBusy = true;
+      var el;
+      while ((el = _nextLazy(idle))) {
+        idle = false;
+        await _renderLazy(el);
+      }
+      _lazyBusy = false;
+      _scheduleLazy();
+    }
+    async function _renderLazy(el) {
+      _lazyPending.delete(el);
+      if (_lazyIO) _lazyIO.unobserve(el);
+      if (!el.isConnected || el._hostSvg || _hasServerSvg(el)) return;
+      var src = decodeURIComponent(el.getAttribute('data-mermaid-src'));
+      var id = el.getAttribute('data-mermaid-id') || ('mmd-lazy-' + (++_lazySeq));
+      var html;
+      if (renderedMermaidSrcs[id] && renderedMermaidSrcs[id].src === src) {
+        html = renderedMermaidSrcs[id].svg;
+      } else {
+        try {
+          html = (await mermaid.render(id, src)).svg;
+        } catch(e) {
+          html = '<div class="mermaid-error">Mermaid: '+String(e.message||e).replace(/&/g,'&amp;').replace(/</g,'&lt;').replace(/>/g,'&gt;').replace(/"/g,'&quot;')+'</div>';
+        }
+        if (el._hostSvg) return;
+      }
+      el.innerHTML = html;
+      el.style.minHeight = '';
+      renderedMermaidSrcs[id] = { src: src, svg: html };
+      initSvgDrag(el); _addExpandBtn(el); _liftEdgeLabels(el); _refreshAutoFixBtn(el);
+      _measureHeight(el);
+    }
+    function _resetLazy() {
+      if (_lazyIO) _lazyPending.forEach(function(el){ _lazyIO.unobserve(el); });
+      _lazyPending.clear();
+      _lazyNear = [];
+    }
+
+    function _processPendingMermaid() {
       if (!_pendingRender) return;
       var isDark = (_pendingRender.theme === 'dark');
       _mmdInit(isDark ? 'dark' : 'default');
@@ -649,14 +819,8 @@ std::wstring WebView2Manager::BuildHtmlPage() const
         var el = placeholders[i];
         var src = decodeURIComponent(el.getAttribute('data-mermaid-src'));
         var id = el.getAttribute('data-mermaid-id') || ('mmd-'+i+'-'+Date.now());
-        try {
-          var result = await mermaid.render(id, src);
-          el.innerHTML = result.svg;
-          newSrcs[id] = { src: src, svg: result.svg };
-        } catch(e) {
-          el.innerHTML = '<div class="mermaid-error">Mermaid: '+String(e.message||e).replace(/&/g,'&amp;').replace(/</g,'&lt;').replace(/>/g,'&gt;').replace(/"/g,'&quot;')+'</div>';
-          newSrcs[id] = { src: src, svg: el.innerHTML };
-        }
+        if (_hasServerSvg(el)) { newSrcs[id] = { src: src, svg: el.innerHTML }; _measureHeight(el); continue; }
+        _queueLazy(el);
       }
       renderedMermaidSrcs = newSrcs;
       container.querySelectorAll('.mermaid-container').forEach(function(c){ initSvgDrag(c); _addExpandBtn(c); });
@@ -666,45 +830,222 @@ std::wstring WebView2Manager::BuildHtmlPage() const
       container.querySelectorAll('.mermaid-container').forEach(_refreshAutoFixBtn);
     }
 
-    window.renderContent = async function(htmlContent, theme) {
-      var isDark = (theme === 'dark');
+)P2";
+
+    // Continue Part 2 in a fresh raw string — lazy rendering pushed it
+    // past MSVC's 16380-char string-literal limit.
+    html += LR"P2a(
+    // ===== Keyed patching =====
+    // Every top-level block carries data-key (hash of its HTML, line
+    // numbers excluded) and data-line-block (its first line). A block whose
+    // key is still in the new page keeps its DOM node — SVG, pan / zoom,
+    // listeners — and only gets its data-line-* values updated if it moved;
+    // other blocks come from the new HTML and leftovers are removed, so
+    // layout and paint follow the size of the edit.
+    function _containersOf(block) {
+      if (block.classList.contains('mermaid-container')) return [block];
+      if (block.tagName !== 'BLOCKQUOTE') return [];
+      return Array.prototype.slice.call(block.querySelectorAll('.mermaid-container'));
+    }
+    function _lineEls(block) {
+      var list = [block];
+      if (block.classList.contains('mermaid-container')) return list;
+      var inner = block.querySelectorAll('[data-line-start]');
+      for (var i = 0; i < inner.length; i++) list.push(inner[i]);
+      return list;
+    }
+    function _syncLines(oldBlock, newBlock) {
+      if (oldBlock.getAttribute('data-line-block') === newBlock.getAttribute('data-line-block')) return true;
+      var o = _lineEls(oldBlock), n = _lineEls(newBlock);
+      if (o.length !== n.length) return false;
+      var names = ['data-line-block', 'data-line-start', 'data-line-end'];
+      for (var i = 0; i < o.length; i++) {
+        for (var j = 0; j < names.length; j++) {
+          var v = n[i].getAttribute(names[j]);
+          if (v === null) o[i].removeAttribute(names[j]); else o[i].setAttribute(names[j], v);
+        }
+      }
+      return true;
+    }
+    // The host's SVG for a diagram this node still shows as a placeholder
+    // or client-side render: take the new block.
+    function _hostSvgArrived(oldBlock, newBlock) {
+      var o = _containersOf(oldBlock), n = _containersOf(newBlock);
+      for (var i = 0; i < n.length; i++)
+        if (_hasServerSvg(n[i]) && !(o[i] && o[i]._hostSvg)) return true;
+      return false;
+    }
+    function _markHostSvg(block) {
+      _containersOf(block).forEach(function(c){ if (_hasServerSvg(c)) c._hostSvg = true; });
+    }
+    // Returns the blocks inserted from the new HTML, in document order.
+    function _patchContent(container, htmlContent) {
+      var tpl = document.createElement('template');
+      tpl.innerHTML = htmlContent;
+      var pool = {};
+      for (var el = container.firstElementChild; el; el = el.nextElementSibling) {
+        var key = el.getAttribute('data-key');
+        if (key) (pool[key] || (pool[key] = [])).push(el);
+      }
+      var blocks = [], fresh = [];
+      for (var n = tpl.content.firstElementChild; n; n = n.nextElementSibling) {
+        var k = n.getAttribute('data-key');
+        var old = k && pool[k] && pool[k].shift();
+        if (old && !_hostSvgArrived(old, n) && _syncLines(old, n)) { blocks.push(old); continue; }
+        _markHostSvg(n);
+        blocks.push(n);
+        fresh.push(n);
+      }
+      var cursor = container.firstElementChild;
+      for (var i = 0; i < blocks.length; i++) {
+        if (blocks[i] === cursor) { cursor = cursor.nextElementSibling; continue; }
+        container.insertBefore(blocks[i], cursor);
+      }
+      while (cursor) { var next = cursor.nextElementSibling; container.removeChild(cursor); cursor = next; }
+      return fresh;
+    }
+
+    // ===== Patch messages =====
+    // The host diffs every page against the blocks shown here (PreviewPatch)
+    // and posts only the change: runs of kept blocks with their line shift,
+    // removed blocks, the HTML of inserted ones, and host SVG for diagrams
+    // of kept blocks, swapped into their container in place (text, scroll
+    // position and selection stay untouched). A patch applies on top
+    // of version `base`; base 0 carries the whole page, reconciled by key.
+    // A patch that does not fit asks the host to resync (base 0 again).
+    var _docVersion = 0, _resyncing = false;
+    function _shiftLines(block, d) {
+      var names = ['data-line-block', 'data-line-start', 'data-line-end'];
+      _lineEls(block).forEach(function(el){
+        for (var j = 0; j < names.length; j++) {
+          var v = el.getAttribute(names[j]);
+          if (v !== null) el.setAttribute(names[j], String(parseInt(v, 10) + d));
+        }
+      });
+    }
+    // Host SVG (or error block) for a diagram shown as a placeholder or
+    // client-side render.
+    function _setDiagramSvg(block, id, html) {
+      var c = _containersOf(block).filter(function(x){ return x.getAttribute('data-mermaid-id') === id; })[0];
+      if (!c) return null;
+      c.innerHTML = html;
+      c.style.minHeight = '';
+      c._hostSvg = true;
+      _measureHeight(c);
+      var src = c.getAttribute('data-mermaid-src');
+      if (src !== null) renderedMermaidSrcs[id] = { src: decodeURIComponent(src), svg: html };
+      return c;
+    }
+    // Returns the inserted blocks and filled containers, or null if the
+    // ops do not fit the page.
+    function _applyOps(container, ops) {
+      var cursor = container.firstElementChild, fresh = [], filled = [];
+      for (var i = 0; i < ops.length; i++) {
+        var op = ops[i], n;
+        if (op[0] === 0) {
+          for (n = 0; n < op[1]; n++) {
+            if (!cursor) return null;
+            if (op[2]) _shiftLines(cursor, op[2]);
+            cursor = cursor.nextElementSibling;
+          }
+        } else if (op[0] === 1) {
+          for (n = 0; n < op[1]; n++) {
+            if (!cursor) return null;
+            var next = cursor.nextElementSibling;
+            container.removeChild(cursor);
+            cursor = next;
+          }
+        } else if (op[0] === 2) {
+          var tpl = document.createElement('template');
+          tpl.innerHTML = op[1];
+          for (var el = tpl.content.firstElementChild; el; el = el.nextElementSibling) {
+            _markHostSvg(el);
+            fresh.push(el);
+          }
+          container.insertBefore(tpl.content, cursor);
+        } else if (op[0] === 3) {
+          var c = cursor && _setDiagramSvg(cursor, op[1], op[2]);
+          if (!c) return null;
+          filled.push(c);
+        }
+      }
+      return cursor ? null : { fresh: fresh, filled: filled };
+    }
+    function _requestResync() {
+      if (_resyncing) return;
+      _resyncing = true;
+      if (window.chrome && window.chrome.webview) window.chrome.webview.postMessage({type:'resync'});
+    }
+
+    function _applyPatch(m) {
+      var isDark = (m.theme === 'dark');
       document.body.className = isDark ? 'dark' : 'light';
       if (mermaidReady) {
         _mmdInit(isDark ? 'dark' : 'default');
       }
       var container = document.getElementById('content');
-      container.innerHTML = htmlContent;
+      var fresh, filled = [];
+      if (m.base === 0) {
+        var html = '';
+        m.ops.forEach(function(op){ if (op[0] === 2) html += op[1]; });
+        fresh = _patchContent(container, html);
+        _resyncing = false;
+      } else if (m.base !== _docVersion) {
+        _requestResync();
+        return;
+      } else {
+        var applied = _applyOps(container, m.ops);
+        if (!applied) {
+          _docVersion = 0;
+          _requestResync();
+          return;
+        }
+        fresh = applied.fresh;
+        filled = applied.filled;
+      }
+      _docVersion = m.version;
+      filled.forEach(function(c){ initSvgDrag(c); _addExpandBtn(c); _liftEdgeLabels(c); _refreshAutoFixBtn(c); });
+      var placeholders = [];
+      fresh.forEach(function(b){ placeholders = placeholders.concat(_containersOf(b)); });
       if (mermaidReady) {
-        var placeholders = container.querySelectorAll('.mermaid-container[data-mermaid-src]');
-        var newSrcs = {};
+        // Kept diagrams keep their cache entries; only inserted ones are
+        // read back or queued for rendering.
+        var newSrcs = {}, inserted = new Set(fresh);
+        for (var blk = container.firstElementChild; blk; blk = blk.nextElementSibling) {
+          if (inserted.has(blk)) continue;
+          _containersOf(blk).forEach(function(c){
+            var kid = c.getAttribute('data-mermaid-id');
+            if (kid && renderedMermaidSrcs[kid]) newSrcs[kid] = renderedMermaidSrcs[kid];
+          });
+        }
         for (var i = 0; i < placeholders.length; i++) {
           var el = placeholders[i];
+          if (!el.hasAttribute('data-mermaid-src')) continue;
           var src = decodeURIComponent(el.getAttribute('data-mermaid-src'));
           var id = el.getAttribute('data-mermaid-id') || ('mmd-'+i+'-'+Date.now());
+          if (_hasServerSvg(el)) { newSrcs[id] = { src: src, svg: el.innerHTML }; _measureHeight(el); continue; }
           if (renderedMermaidSrcs[id] && renderedMermaidSrcs[id].src === src) {
             el.innerHTML = renderedMermaidSrcs[id].svg; newSrcs[id] = renderedMermaidSrcs[id]; continue;
           }
-          try {
-            var result = await mermaid.render(id, src);
-            el.innerHTML = result.svg;
-            newSrcs[id] = { src: src, svg: result.svg };
-          } catch(e) {
-            el.innerHTML = '<div class="mermaid-error">Mermaid: '+String(e.message||e).replace(/&/g,'&amp;').replace(/</g,'&lt;').replace(/>/g,'&gt;').replace(/"/g,'&quot;')+'</div>';
-            newSrcs[id] = { src: src, svg: el.innerHTML };
-          }
+          _queueLazy(el);
         }
         renderedMermaidSrcs = newSrcs;
       } else {
-        _pendingRender = { theme: theme };
+        _pendingRender = { theme: m.theme };
       }
-      container.querySelectorAll('.mermaid-container').forEach(function(c){ initSvgDrag(c); _addExpandBtn(c); });
-      _liftEdgeLabels(container);
+      placeholders.forEach(function(c){ initSvgDrag(c); _addExpandBtn(c); });
+      fresh.forEach(_liftEdgeLabels);
       // Run overlap detection AFTER lift — lifted painter order can resolve
       // borderline overlaps without auto-fix.
-      container.querySelectorAll('.mermaid-container').forEach(_refreshAutoFixBtn);
-    };
+      placeholders.forEach(_refreshAutoFixBtn);
+    }
+    if (window.chrome && window.chrome.webview) {
+      window.chrome.webview.addEventListener('message', function(e) {
+        if (e.data && e.data.type === 'patch') _applyPatch(e.data);
+      });
+    }
     window.setTheme = function(dark) { document.body.className = dark ? 'dark' : 'light'; };
-    window.clearContent = function() { document.getElementById('content').innerHTML = '<div class="empty">Open a Markdown file to preview</div>'; renderedMermaidSrcs = {}; _pendingRender = null; };
+    window.clearContent = function() { document.getElementById('content').innerHTML = '<div class="empty">Open a Markdown file to preview</div>'; renderedMermaidSrcs = {}; _pendingRender = null; _docVersion = 0; _resetLazy(); };
 
     // ===== Font Size =====
     var _fontSize = 14;
@@ -729,7 +1070,7 @@ std::wstring WebView2Manager::BuildHtmlPage() const
         window.chrome.webview.postMessage({type:'fontSize', size:14});
       }
     }
-)P2";
+)P2a";
 
     // --- Part 2: Scroll Sync + Editing + Context Menu + SVG Drag JS ---
     html += LR"P3(
@@ -1003,32 +1344,6 @@ std::wstring WebView2Manager::BuildHtmlPage() const
     return html;
 }
 
-// ============================================================================
-// EscapeForJS
-// ============================================================================
-std::wstring WebView2Manager::EscapeForJS(const std::wstring& input)
-{
-    std::wstring result;
-    result.reserve(input.size() + input.size() / 4);
-    for (wchar_t ch : input) {
-        switch (ch) {
-        case L'\0': result += L"\\u0000"; break;         // Avoid silent JS string truncation
-        case L'\\': result += L"\\\\"; break;
-        case L'\'': result += L"\\'";  break;
-        case L'"':  result += L"\\\""; break;
-        case L'\n': result += L"\\n";  break;
-        case L'\r': result += L"\\r";  break;
-        case L'\t': result += L"\\t";  break;
-        case L'<':  result += L"\\x3C"; break;
-        case L'>':  result += L"\\x3E"; break;           // Prevent </script> injection
-        case L'\u2028': result += L"\\u2028"; break;     // Line Separator
-        case L'\u2029': result += L"\\u2029"; break;     // Paragraph Separator
-        default:    result += ch;       break;
-        }
-    }
-    return result;
-}
-
 // ============================================================================
 // Initialize
 // ============================================================================
@@ -1144,14 +1459,13 @@ HRESULT WebView2Manager::Initialize(HWND hwndParent, std::function<void()> onRea
                                         args->get_IsSuccess(&success);
                                         if (success) {
                                             m_bReady = true;
+                                            // Content first, so what onReady
+                                            // runs (scroll sync) sees the page.
+                                            for (auto& msg : m_pendingMessages)
+                                                m_webview->PostWebMessageAsJson(msg.c_str());
+                                            m_pendingMessages.clear();
                                             if (m_onReady)
                                                 m_onReady();
-
-                                            if (m_hasPendingRender) {
-                                                RenderContent(m_pendingHtml, m_pendingDarkMode);
-                                                m_pendingHtml.clear();
-                                                m_hasPendingRender = false;
-                                            }
                                         }
                                         return S_OK;
                                     }).Get(),
@@ -1165,25 +1479,17 @@ HRESULT WebView2Manager::Initialize(HWND hwndParent, std::function<void()> onRea
 }
 
 // ============================================================================
-// RenderContent - Send pre-parsed HTML to WebView2
+// PostPatch - Send a PreviewPatch message to the page. JSON messages skip
+// the script parser and the JS string escaping of the whole page.
 // ============================================================================
-void WebView2Manager::RenderContent(const std::wstring& htmlContent, bool darkMode)
+void WebView2Manager::PostPatch(std::wstring json, bool resets)
 {
     if (!m_bReady || !m_webview) {
-        m_pendingHtml = htmlContent;
-        m_pendingDarkMode = darkMode;
-        m_hasPendingRender = true;
+        if (resets) m_pendingMessages.clear();
+        m_pendingMessages.push_back(std::move(json));
         return;
     }
-
-    // Build JS call: renderContent('...escaped HTML...', 'dark'|'light')
-    std::wstring js = L"renderContent('";
-    js += EscapeForJS(htmlContent);
-    js += L"', '";
-    js += darkMode ? L"dark" : L"light";
-    js += L"');";
-
-    m_webview->ExecuteScript(js.c_str(), nullptr);
+    m_webview->PostWebMessageAsJson(json.c_str());
 }
 
 void WebView2Manager::SetTheme(bool darkMode)
@@ -1259,6 +1565,12 @@ void WebView2Manager::SetEditCallback(EditCallback callback)
                 }
                 if (msgType.empty()) return S_OK;
 
+                // Dispatch: resync request (the page could not apply a patch)
+                if (msgType == L"resync") {
+                    if (m_resyncCallback) m_resyncCallback();
+                    return S_OK;
+                }
+
                 // Dispatch: theme change message
                 if (msgType == L"theme") {
                     if (m_themeCallback) {
@@ -1404,13 +1716,7 @@ void WebView2Manager::SetEditCallback(EditCallback callback)
                     std::wstring blockId   = extractStrField(L"\"blockId\"");
                     std::wstring newSource = extractStrField(L"\"newSource\"");
 
-                    bool blockOk = blockId.rfind(L"mermaid-placeholder-", 0) == 0 &&
-                                   blockId.size() > 20;
-                    if (blockOk) {
-                        for (size_t bi = 20; bi < blockId.size(); ++bi) {
-                            if (blockId[bi] < L'0' || blockId[bi] > L'9') { blockOk = false; break; }
-                        }
-                    }
+                    bool blockOk = MarkdownParser::IsMermaidBlockId(blockId);
                     // Generous cap — whole mermaid block can legitimately be
                     // a few hundred KB for huge architectural diagrams.
                     constexpr size_t kMaxBlockBytes = 4 * 1024 * 1024;
@@ -1422,7 +1728,7 @@ void WebView2Manager::SetEditCallback(EditCallback callback)
                 }
 
                 // Dispatch: editMermaidNode (M2 — inline mermaid label edit).
-                // Inputs: blockId="mermaid-placeholder-N", nodeId, newLabel
+                // Inputs: blockId="mermaid-<hash>[-N]", nodeId, newLabel
                 // (newLabel arrives with `\n` representing `<br/>` in source).
                 if (msgType == L"editMermaidNode" && m_editMermaidNodeCallback) {
                     auto extractStr = [&](const std::wstring& key) -> std::wstring {
@@ -1480,14 +1786,8 @@ void WebView2Manager::SetEditCallback(EditCallback callback)
                     std::wstring nodeId   = extractStr(L"\"nodeId\"");
                     std::wstring newLabel = extractStr(L"\"newLabel\"");
 
-                    // Validate blockId == "mermaid-placeholder-<digits>".
-                    bool blockOk = blockId.rfind(L"mermaid-placeholder-", 0) == 0;
-                    if (blockOk) {
-                        for (size_t bi = 20; bi < blockId.size(); ++bi) {
-                            if (blockId[bi] < L'0' || blockId[bi] > L'9') { blockOk = false; break; }
-                        }
-                        if (blockId.size() <= 20) blockOk = false;
-                    }
+                    // Validate blockId == "mermaid-<16 hex>[-<digits>]".
+                    bool blockOk = MarkdownParser::IsMermaidBlockId(blockId);
                     // Validate nodeId — mermaid identifier grammar.
                     // SEC-003: cap length to defend against future SVG-id
                     // schema changes that could make capture group `.+`
@@ -1607,6 +1907,11 @@ void WebView2Manager::SetFontSizeCallback(FontSizeCallback callback)
     m_fontSizeCallback = std::move(callback);
 }
 
+void WebView2Manager::SetResyncCallback(ResyncCallback callback)
+{
+    m_resyncCallback = std::move(callback);
+}
+
 void WebView2Manager::SetFontSize(int size)
 {
     if (!m_bReady || !m_webview)
@@ -1660,8 +1965,7 @@ void WebView2Manager::Destroy()
 {
     m_bDestroyed = true;
     m_bReady = false;
-    m_hasPendingRender = false;
-    m_pendingHtml.clear();
+    m_pendingMessages.clear();
     m_bMessageHandlerRegistered = false;
 
     // Unsubscribe COM event handlers before releasing objects
@@ -16,9 +16,10 @@ public:
     // onReady is called when the WebView2 is fully initialized.
     HRESULT Initialize(HWND hwndParent, std::function<void()> onReady);
 
-    // Render pre-parsed HTML content (C++ side already converted markdown to HTML).
-    // Mermaid placeholders are rendered incrementally by comparing with previous state.
-    void RenderContent(const std::wstring& htmlContent, bool darkMode);
+    // Post a PreviewPatch message (built off the UI thread) to the page,
+    // or queue it until the page is ready. A patch that `resets` (base 0)
+    // supersedes the queue.
+    void PostPatch(std::wstring json, bool resets);
 
     // Switch light/dark theme
     void SetTheme(bool darkMode);
@@ -85,6 +86,11 @@ public:
     using FontSizeCallback = std::function<void(int size)>;
     void SetFontSizeCallback(FontSizeCallback callback);
 
+    // Set callback for a page that cannot apply a patch (or has just been
+    // loaded) and needs the whole preview again
+    using ResyncCallback = std::function<void()>;
+    void SetResyncCallback(ResyncCallback callback);
+
     // Execute setFontSize(n) in WebView2
     void SetFontSize(int size);
 
@@ -99,9 +105,6 @@ private:
     // Get the local resource directory path
     std::wstring GetResourceDir() const;
 
-    // Escape a string for safe embedding in JavaScript
-    static std::wstring EscapeForJS(const std::wstring& input);
-
     Microsoft::WRL::ComPtr<ICoreWebView2Environment> m_env;
     Microsoft::WRL::ComPtr<ICoreWebView2Controller> m_controller;
     Microsoft::WRL::ComPtr<ICoreWebView2>           m_webview;
@@ -120,10 +123,8 @@ private:
     // Local resource directory (mermaid.min.js location)
     std::wstring m_resourceDir;
 
-    // Pending render request (if called before ready)
-    std::wstring m_pendingHtml;
-    bool m_pendingDarkMode = false;
-    bool m_hasPendingRender = false;
+    // Patches posted before the page was ready, in order
+    std::vector<std::wstring> m_pendingMessages;
 
     // Callbacks from preview panel
     EditCallback m_editCallback;
@@ -134,4 +135,5 @@ private:
     NavigateCallback m_navigateCallback;
     OpenFileCallback m_openFileCallback;
     FontSizeCallback m_fontSizeCallback;
+    ResyncCallback m_resyncCallback;
 };
@@ -0,0 +1,308 @@
+// diskcache - MermaidDiskCache persistence, recovery and compaction (POSIX; builds against svgcache)
+//
+// Usage: diskcache [-d DIR]
+//
+// Works in a fresh directory under DIR (default: the system temp dir),
+// removed afterwards:
+//
+//   reopen      entries (SVGs and errors) survive Close / Open; a second
+//               cache on the same directory is locked out meanwhile; a hash
+//               hit with different source is a miss
+//   version     a new version string misses every old entry, the old
+//               version still finds them
+//   torn        blobs.bin cut mid-record: the torn entry misses, Open cuts
+//               it off and the next insert takes its place; with index.bin
+//               gone too, the rebuild scan stops at the torn record, cuts it
+//               off and keeps every record before it
+//   checksum    a flipped byte in one record's SVG: that entry misses, with
+//               and without a rebuild, and can be stored again
+//   compaction  writing past the default 64 MB budget (and past the slot
+//               limit with small entries) compacts to the most recently
+//               used entries: the log is renamed into place, stays within
+//               budget, and a reopen finds the same entries
+//
+// Exits 1 on the first failure.
+
+#include "MermaidDiskCache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static int Fail(const char* test, const char* what)
+{
+    std::fprintf(stderr, "diskcache: %s: %s\n", test, what);
+    return 1;
+}
+
+static const wchar_t kVersion[] = L"mermaid 11.14.0 / renderer 3";
+
+static std::wstring CodeOf(uint64_t hash)
+{
+    return L"graph TD\n  A" + std::to_wstring(hash) + L" --> B";
+}
+
+static std::wstring SvgOf(uint64_t hash, size_t pad = 0)
+{
+    return L"<svg id=\"d" + std::to_wstring(hash) + L"\">" + std::wstring(pad, L'x') + L"</svg>";
+}
+
+// Entries with hash % 5 == 0 are cached errors.
+static void Put(MermaidDiskCache& cache, uint64_t hash, size_t pad = 0)
+{
+    if (hash % 5 == 0) cache.Insert(hash, CodeOf(hash), L"", L"Parse error " + std::to_wstring(hash));
+    else cache.Insert(hash, CodeOf(hash), SvgOf(hash, pad), L"");
+}
+
+static bool Has(MermaidDiskCache& cache, uint64_t hash, size_t pad = 0)
+{
+    MermaidDiskCache::Entry e;
+    if (!cache.Find(hash, CodeOf(hash), e)) return false;
+    if (hash % 5 == 0) return e.svg.empty() && e.error == L"Parse error " + std::to_wstring(hash);
+    return e.error.empty() && e.svg == SvgOf(hash, pad);
+}
+
+// Byte offset of `needle` (as stored: raw wchar_t units) in a file.
+static long long FindInFile(const fs::path& file, const std::wstring& needle)
+{
+    std::ifstream in(file, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t at = bytes.find(std::string((const char*)needle.data(), needle.size() * sizeof(wchar_t)));
+    return at == std::string::npos ? -1 : (long long)at;
+}
+
+static void FlipByte(const fs::path& file, long long offset)
+{
+    std::fstream f(file, std::ios::binary | std::ios::in | std::ios::out);
+    f.seekg(offset);
+    char c = 0;
+    f.read(&c, 1);
+    c ^= 0x20;
+    f.seekp(offset);
+    f.write(&c, 1);
+}
+
+// ============================================================================
+// Passes - each gets an empty cache directory
+// ============================================================================
+static int RunReopen(const fs::path& dir)
+{
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("reopen", "open failed");
+        for (uint64_t h = 1; h <= 200; h++) Put(cache, h);
+        if (cache.Count() != 200) return Fail("reopen", "wrong count after inserts");
+
+        MermaidDiskCache other;
+        if (other.Open(dir.wstring(), kVersion)) return Fail("reopen", "second open not locked out");
+    }
+    MermaidDiskCache cache;
+    if (!cache.Open(dir.wstring(), kVersion)) return Fail("reopen", "reopen failed");
+    if (cache.Count() != 200) return Fail("reopen", "wrong count after reopen");
+    for (uint64_t h = 1; h <= 200; h++)
+        if (!Has(cache, h)) return Fail("reopen", "entry lost or changed across reopen");
+    MermaidDiskCache::Entry e;
+    if (cache.Find(7, CodeOf(8), e)) return Fail("reopen", "hit with different source");
+    if (cache.Find(1000, CodeOf(1000), e)) return Fail("reopen", "hit for an absent entry");
+    return 0;
+}
+
+static int RunVersion(const fs::path& dir)
+{
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("version", "open failed");
+        for (uint64_t h = 1; h <= 50; h++) Put(cache, h);
+    }
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), L"mermaid 11.15.0 / renderer 3")) return Fail("version", "open failed");
+        for (uint64_t h = 1; h <= 50; h++)
+            if (Has(cache, h)) return Fail("version", "old renderer's output served to a new version");
+        Put(cache, 1);
+        if (!Has(cache, 1)) return Fail("version", "insert under the new version lost");
+    }
+    MermaidDiskCache cache;
+    if (!cache.Open(dir.wstring(), kVersion)) return Fail("version", "open failed");
+    for (uint64_t h = 1; h <= 50; h++)
+        if (!Has(cache, h)) return Fail("version", "entries of the old version lost");
+    return 0;
+}
+
+static int RunTorn(const fs::path& dir)
+{
+    const fs::path log = dir / "blobs.bin";
+    uint64_t before = 0;
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("torn", "open failed");
+        for (uint64_t h = 1; h <= 20; h++) Put(cache, h);
+        before = cache.Bytes();
+        Put(cache, 21, 300);
+    }
+    // Cut the last record in half, as a crash during its write would.
+    std::error_code ec;
+    uint64_t torn = before + (fs::file_size(log) - before) / 2;
+    fs::resize_file(log, torn, ec);
+    if (ec) return Fail("torn", "could not truncate blobs.bin");
+
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("torn", "open after truncation failed");
+        if (Has(cache, 21, 300)) return Fail("torn", "torn record served");
+        for (uint64_t h = 1; h <= 20; h++)
+            if (!Has(cache, h)) return Fail("torn", "complete record lost");
+        Put(cache, 22);
+        if (cache.Bytes() <= before || !Has(cache, 22)) return Fail("torn", "insert after the torn record lost");
+    }
+
+    // Index gone as well: the rebuild scan must stop at a torn tail.
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("torn", "open failed");
+        before = cache.Bytes();
+        Put(cache, 23, 300);
+    }
+    fs::resize_file(log, before + 100, ec);
+    fs::remove(dir / "index.bin", ec);
+    MermaidDiskCache cache;
+    if (!cache.Open(dir.wstring(), kVersion)) return Fail("torn", "open without index failed");
+    if (cache.Bytes() != before || fs::file_size(log) != before)
+        return Fail("torn", "rebuild did not cut the torn tail off");
+    if (Has(cache, 23, 300)) return Fail("torn", "torn record served after rebuild");
+    for (uint64_t h = 1; h <= 22; h++)
+        if (h != 21 && !Has(cache, h)) return Fail("torn", "record lost in rebuild");
+    return 0;
+}
+
+static int RunChecksum(const fs::path& dir)
+{
+    const fs::path log = dir / "blobs.bin";
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("checksum", "open failed");
+        for (uint64_t h = 1; h <= 20; h++) Put(cache, h);
+    }
+    long long at = FindInFile(log, SvgOf(13));
+    if (at < 0) return Fail("checksum", "record not found in blobs.bin");
+    FlipByte(log, at + 12);
+
+    for (int rebuild = 0; rebuild < 2; rebuild++) {
+        std::error_code ec;
+        if (rebuild) fs::remove(dir / "index.bin", ec);
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("checksum", "open failed");
+        MermaidDiskCache::Entry e;
+        if (cache.Find(13, CodeOf(13), e)) return Fail("checksum", "corrupt record served");
+        for (uint64_t h = 1; h <= 20; h++)
+            if (h != 13 && !Has(cache, h)) return Fail("checksum", "intact record lost");
+    }
+    MermaidDiskCache cache;
+    if (!cache.Open(dir.wstring(), kVersion)) return Fail("checksum", "open failed");
+    Put(cache, 13);
+    if (!Has(cache, 13)) return Fail("checksum", "corrupt entry not replaced by a new insert");
+    return 0;
+}
+
+static int RunCompaction(const fs::path& dir)
+{
+    // Large SVGs: ~200 KB records, the budget is crossed after ~330.
+    const size_t pad = 50000;
+    const uint64_t budget = MermaidDiskCache::kDefaultMaxBytes;
+    std::vector<uint64_t> kept;
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("compaction", "open failed");
+        for (uint64_t k = 1; k <= 4; k++) Put(cache, k, pad);
+        uint64_t h = 6, peak = 0;
+        bool compacted = false;
+        for (; h < 1000 && !compacted; h++) {
+            if (h % 5 == 0) continue;               // errors are tiny; keep the records large
+            Put(cache, h, pad);
+            // Keep the first few entries in use; they must survive.
+            for (uint64_t k = 1; k <= 4; k++)
+                if (!Has(cache, k, pad)) return Fail("compaction", "entry in use evicted");
+            if (cache.Bytes() > budget) return Fail("compaction", "log grew past the budget");
+            compacted = cache.Bytes() < peak;
+            peak = std::max(peak, cache.Bytes());
+        }
+        if (!compacted) return Fail("compaction", "no compaction past the budget");
+        if (cache.Bytes() > budget / 2 + budget / 4) return Fail("compaction", "compaction kept too much");
+        if (!Has(cache, h - 1, pad)) return Fail("compaction", "newest entry lost");
+        if (Has(cache, 8, pad) || Has(cache, 9, pad)) return Fail("compaction", "least recently used entries kept");
+        if (fs::exists(dir / "blobs.bin.tmp")) return Fail("compaction", "compacted log not renamed into place");
+        if (fs::file_size(dir / "blobs.bin") != cache.Bytes()) return Fail("compaction", "log size differs on disk");
+        for (uint64_t k = 1; k < h; k++)
+            if (k % 5 != 0 && Has(cache, k, pad)) kept.push_back(k);
+        std::printf("  compaction: %llu entries written, %zu kept, %.1f MB log\n",
+                    (unsigned long long)(h - 1), kept.size(), cache.Bytes() / 1048576.0);
+    }
+    {
+        MermaidDiskCache cache;
+        if (!cache.Open(dir.wstring(), kVersion)) return Fail("compaction", "reopen failed");
+        if (cache.Count() != kept.size()) return Fail("compaction", "wrong count after reopen");
+        for (uint64_t k : kept)
+            if (!Has(cache, k, pad)) return Fail("compaction", "kept entry lost across reopen");
+    }
+
+    // Small entries: the slot table, not the byte budget, forces compaction.
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    MermaidDiskCache cache;
+    if (!cache.Open(dir.wstring(), kVersion)) return Fail("compaction", "open failed");
+    const uint64_t many = MermaidDiskCache::kSlots;
+    for (uint64_t h = 1; h <= many; h++) {
+        Put(cache, h);
+        if (cache.Count() > MermaidDiskCache::kSlots / 4 * 3) return Fail("compaction", "slot table over 3/4 full");
+    }
+    if (cache.Count() >= many) return Fail("compaction", "no compaction past the slot limit");
+    for (uint64_t h = many - 100; h <= many; h++)
+        if (!Has(cache, h)) return Fail("compaction", "recent small entry lost");
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    fs::path base = fs::temp_directory_path();
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if ((a == "-d" || a == "--dir") && i + 1 < argc) {
+            base = argv[++i];
+        } else {
+            std::printf("usage: diskcache [-d DIR]\n");
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    std::string pattern = (base / "diskcache.XXXXXX").string();
+    if (!mkdtemp(&pattern[0])) {
+        std::fprintf(stderr, "diskcache: cannot create a directory under %s\n", base.string().c_str());
+        return 1;
+    }
+    const fs::path root = pattern;
+
+    struct Pass {
+        const char* name;
+        int (*run)(const fs::path&);
+    };
+    static const Pass kPasses[] = {
+        { "reopen", RunReopen }, { "version", RunVersion }, { "torn", RunTorn },
+        { "checksum", RunChecksum }, { "compaction", RunCompaction },
+    };
+    int failed = 0;
+    for (const Pass& p : kPasses) {
+        if ((failed = p.run(root / p.name)) != 0) break;
+    }
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+    if (failed) return 1;
+    std::printf("diskcache: ok\n");
+    return 0;
+}
@@ -0,0 +1,145 @@
+// inlinecases - inline Markdown cases with expected HTML (portable; builds against mdparser)
+//
+// Usage: inlinecases
+//
+// Each case is one paragraph run through MarkdownParser::ConvertToHtml; the
+// HTML inside its <p> must equal the expected string. The table covers the
+// delimiter-stack inline parser: emphasis and strong (incl. the rule of 3
+// and `***a**b*`), unmatched `*` / `~` runs and `_` (not a delimiter here),
+// code spans and their precedence, links and images nested with emphasis
+// and code, backticks inside link text, escapes and unsafe URLs. Two
+// stress lines check that long unmatched runs stay literal.
+//
+// Prints every failing case; exits 1 if there was one.
+
+#include "MarkdownParser.h"
+
+#include <cstdio>
+#include <string>
+
+struct Case {
+    const wchar_t* markdown;
+    const wchar_t* html;
+};
+
+static const Case kCases[] = {
+    // --- Emphasis / strong ---
+    { L"a *b* c",               L"a <em>b</em> c" },
+    { L"**b**",                 L"<strong>b</strong>" },
+    { L"***a***",               L"<em><strong>a</strong></em>" },
+    { L"***a**b*",              L"<em><strong>a</strong>b</em>" },
+    { L"***a*b**",              L"<strong><em>a</em>b</strong>" },
+    { L"**a *b* c**",           L"<strong>a <em>b</em> c</strong>" },
+    { L"*a **b** c*",           L"<em>a <strong>b</strong> c</em>" },
+    { L"foo*bar*",              L"foo<em>bar</em>" },
+    { L"*a*b*c*",               L"<em>a</em>b<em>c</em>" },
+    { L"**a****b**",            L"<strong>a****b</strong>" },          // rule of 3
+    { L"~~s~~",                 L"<del>s</del>" },
+    { L"~~a *b~~ c*",           L"<del>a *b</del> c*" },
+
+    // --- Unmatched runs ---
+    { L"*a **b",                L"*a **b" },
+    { L"a **b",                 L"a **b" },
+    { L"**a*",                  L"*<em>a</em>" },
+    { L"*a**",                  L"<em>a</em>*" },
+    { L"a * b * c",             L"a * b * c" },
+    { L"x * a*",                L"x * a*" },
+    { L"**",                    L"**" },
+    { L"~s~",                   L"~s~" },
+    { L"a ~~~b~~~",             L"a ~~~b~~~" },
+    { L"_a_",                   L"_a_" },
+    { L"__a__",                 L"__a__" },
+    { L"_a_b_",                 L"_a_b_" },
+    { L"\\*a*",                 L"*a*" },
+    { L"*a\\*",                 L"*a*" },
+
+    // --- Code spans ---
+    { L"`a*b*`",                L"<code>a*b*</code>" },
+    { L"``a`b``",               L"<code>a`b</code>" },
+    { L"`<b>&`",                L"<code>&lt;b&gt;&amp;</code>" },
+    { L"*foo`*`",               L"*foo<code>*</code>" },
+    { L"*a `*` b*",             L"<em>a <code>*</code> b</em>" },
+    { L"`a",                    L"`a" },
+    { L"``a`",                  L"``a`" },
+    { L"\\`a`",                 L"`a`" },
+
+    // --- Links / images ---
+    { L"[a](u)",                L"<a href=\"u\">a</a>" },
+    { L"[**x**](u)",            L"<a href=\"u\"><strong>x</strong></a>" },
+    { L"[*a*](u)",              L"<a href=\"u\"><em>a</em></a>" },
+    { L"*[a](u)*",              L"<em><a href=\"u\">a</a></em>" },
+    { L"**[a](u)**",            L"<strong><a href=\"u\">a</a></strong>" },
+    { L"*a [b*](u)",            L"*a <a href=\"u\">b*</a>" },
+    { L"[a *b](u)*",            L"<a href=\"u\">a *b</a>*" },
+    { L"[a [b](c) d](e)",       L"[a <a href=\"c\">b</a> d](e)" },
+    { L"[![i](p)](u)",          L"<a href=\"u\"><img src=\"p\" alt=\"i\"></a>" },
+    { L"[a](javascript:x)",     L"a" },
+    { L"[a]",                   L"[a]" },
+    { L"[a](",                  L"[a](" },
+
+    // --- Backticks inside links ---
+    { L"[a `b` c](u)",          L"<a href=\"u\">a <code>b</code> c</a>" },
+    { L"[a `]` b](http://x)",   L"<a href=\"http://x\">a <code>]</code> b</a>" },
+    { L"[`a]`](u)",             L"<a href=\"u\"><code>a]</code></a>" },
+    { L"`[a](u)`",              L"<code>[a](u)</code>" },
+
+    // --- Escaping ---
+    { L"<b>&",                  L"&lt;b&gt;&amp;" },
+};
+
+// The HTML between <p ...> and </p> of a one-paragraph document.
+static bool Inline(const std::wstring& markdown, std::wstring& out)
+{
+    std::wstring html = MarkdownParser::ConvertToHtml(markdown);
+    size_t open = html.find(L'>');
+    size_t close = html.rfind(L"</p>");
+    if (html.compare(0, 3, L"<p ") != 0 || open == std::wstring::npos ||
+        close == std::wstring::npos || close < open)
+        return false;
+    out = html.substr(open + 1, close - open - 1);
+    return true;
+}
+
+static std::string Narrow(const std::wstring& s)
+{
+    std::string out;
+    for (wchar_t c : s) out += c < 128 ? (char)c : '?';
+    return out;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 1) {
+        std::printf("usage: inlinecases\n");
+        return std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help" ? 0 : 1;
+    }
+
+    int failed = 0, total = 0;
+    auto check = [&](const std::wstring& markdown, const std::wstring& want) {
+        total++;
+        std::wstring got;
+        if (!Inline(markdown, got)) got = L"(not a single paragraph)";
+        if (got == want) return;
+        failed++;
+        std::fprintf(stderr, "inlinecases: %s\n  want: %s\n  got:  %s\n",
+                     Narrow(markdown).substr(0, 60).c_str(), Narrow(want).substr(0, 60).c_str(),
+                     Narrow(got).substr(0, 60).c_str());
+    };
+
+    for (const Case& c : kCases) check(c.markdown, c.html);
+
+    // Long unmatched runs: literal text, no deep recursion.
+    std::wstring brackets = std::wstring(50000, L'[') + L"a";
+    check(brackets, brackets);
+    std::wstring openers;
+    for (int i = 0; i < 20000; i++) openers += L"*a ";
+    openers += L"b";
+    check(openers, openers);
+
+    if (failed) {
+        std::fprintf(stderr, "inlinecases: %d of %d cases failed\n", failed, total);
+        return 1;
+    }
+    std::printf("inlinecases: %d cases ok\n", total);
+    return 0;
+}
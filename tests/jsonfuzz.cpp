@@ -0,0 +1,447 @@
+// jsonfuzz - JsonReader differential / robustness fuzz (portable; builds against bunipc)
+//
+// Usage: jsonfuzz [-n ITERATIONS] [-s SEED]
+//
+// Four passes, each ITERATIONS cases (default 20000) from one seeded
+// generator, so a failure is reproduced by its seed:
+//
+//   strings    random JSON strings built from pieces whose decoding is known
+//              (ASCII, simple and \uXXXX escapes, surrogate pairs, lone
+//              surrogates, valid UTF-8 of every length, malformed UTF-8 with
+//              its U+FFFD count); ReadString must produce exactly the
+//              pieces' expected text, also through a maxChars cap
+//   messages   Bun protocol lines with the known fields in random order and
+//              unknown members of every type (nested) around them; a
+//              NextMember / Skip loop must recover the known fields
+//   truncated  every prefix of a valid line must fail, never succeed or
+//              read past the end
+//   mutated    random byte edits of valid lines: no crash, no hang, and a
+//              failed reader stays failed
+//
+// Build with -fsanitize=address,undefined to turn out-of-bounds reads into
+// failures. Exits 1 on the first mismatch.
+
+#include "JsonReader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937 g_rng;
+
+static uint32_t Rand(uint32_t n) { return (uint32_t)(g_rng() % n); }
+
+static int Fail(const char* pass, int iteration, const std::string& input, const char* what)
+{
+    std::fprintf(stderr, "jsonfuzz: %s #%d: %s\n  input (%zu bytes): ", pass, iteration,
+                 what, input.size());
+    for (size_t i = 0; i < input.size() && i < 200; i++) {
+        unsigned char c = (unsigned char)input[i];
+        if (c >= 0x20 && c < 0x7F) std::fputc(c, stderr);
+        else std::fprintf(stderr, "\\x%02x", c);
+    }
+    std::fputc('\n', stderr);
+    return 1;
+}
+
+// ============================================================================
+// Expected text - code points as JsonReader stores them (UTF-16 where
+// wchar_t is 16-bit)
+// ============================================================================
+static void AppendExpected(std::wstring& out, uint32_t cp)
+{
+    if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+        cp -= 0x10000;
+        out.push_back((wchar_t)(0xD800 + (cp >> 10)));
+        out.push_back((wchar_t)(0xDC00 + (cp & 0x3FF)));
+    } else {
+        out.push_back((wchar_t)cp);
+    }
+}
+
+static void AppendUtf8(std::string& out, uint32_t cp)
+{
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    } else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+static void AppendEscape(std::string& out, uint32_t unit)
+{
+    static const char kHex[] = "0123456789abcdef";
+    out += "\\u";
+    for (int shift = 12; shift >= 0; shift -= 4) {
+        char h = kHex[(unit >> shift) & 0xF];
+        out += Rand(2) ? (char)std::toupper((unsigned char)h) : h;
+    }
+}
+
+// Any scalar value: mostly BMP, some astral, never a surrogate, and no
+// ASCII that would need escaping.
+static uint32_t RandomScalar()
+{
+    switch (Rand(4)) {
+    case 0:  return 0x80 + Rand(0x800 - 0x80);
+    case 1:  { uint32_t cp = 0x800 + Rand(0x10000 - 0x800);
+               return (cp >= 0xD800 && cp <= 0xDFFF) ? 0x4E2D : cp; }
+    case 2:  return 0x10000 + Rand(0x110000 - 0x10000);
+    default: { uint32_t cp = 0x20 + Rand(0x5F);
+               return (cp == '"' || cp == '\\') ? 'x' : cp; }
+    }
+}
+
+// ============================================================================
+// RandomString - one JSON string literal (quotes included) and the text
+// ReadString must decode it to
+// ============================================================================
+static void RandomString(std::string& json, std::wstring& expected)
+{
+    static const char kSimple[] = "\"\\/bfnrt";
+    static const wchar_t kSimpleValue[] = L"\"\\/\b\f\n\r\t";
+    // Malformed UTF-8 and what it decodes to (one U+FFFD per maximal
+    // subpart, Unicode 3.9). Truncated sequences end in ASCII so the next
+    // piece can't complete them.
+    static const struct { const char* bytes; const wchar_t* text; } kBad[] = {
+        { "\x80", L"\xFFFD" },                              // stray continuation
+        { "\xBF\x80", L"\xFFFD\xFFFD" },
+        { "\xC0\xAF", L"\xFFFD\xFFFD" },                    // overlong lead
+        { "\xC1", L"\xFFFD" },
+        { "\xE0\x80\x80", L"\xFFFD\xFFFD\xFFFD" },          // overlong 3-byte
+        { "\xE4\xB8z", L"\xFFFDz" },                        // truncated 3-byte
+        { "\xED\xA0\x80", L"\xFFFD\xFFFD\xFFFD" },          // encoded surrogate
+        { "\xF0\x80\x80\x80", L"\xFFFD\xFFFD\xFFFD\xFFFD" },// overlong 4-byte
+        { "\xF0\x9F\x98z", L"\xFFFDz" },                    // truncated 4-byte
+        { "\xF4\x90\x80\x80", L"\xFFFD\xFFFD\xFFFD\xFFFD" },// above U+10FFFF
+        { "\xF5", L"\xFFFD" },
+        { "\xFF", L"\xFFFD" },
+    };
+
+    json = "\"";
+    expected.clear();
+    bool loneHigh = false;  // last piece was a lone high-surrogate escape
+    int pieces = (int)Rand(24);
+    for (int p = 0; p < pieces; p++) {
+        int kind = (int)Rand(9);
+        // A lone high surrogate followed by a low one would pair up.
+        if (loneHigh && kind == 5) kind = 0;
+        loneHigh = false;
+        switch (kind) {
+        case 0: {   // ASCII run, no quote / backslash
+            int len = 1 + (int)Rand(12);
+            for (int i = 0; i < len; i++) {
+                char c = (char)(0x20 + Rand(0x5F));
+                if (c == '"' || c == '\\') c = 'x';
+                json += c;
+                expected += (wchar_t)c;
+            }
+            break;
+        }
+        case 1: {   // simple escape
+            int i = (int)Rand(8);
+            json += '\\';
+            json += kSimple[i];
+            expected += kSimpleValue[i];
+            break;
+        }
+        case 2: {   // \uXXXX, BMP, not a surrogate
+            uint32_t cp = Rand(0xD800);
+            if (Rand(2)) cp = 0xE000 + Rand(0x10000 - 0xE000);
+            AppendEscape(json, cp);
+            AppendExpected(expected, cp);
+            break;
+        }
+        case 3: {   // surrogate pair escape
+            uint32_t cp = 0x10000 + Rand(0x100000);
+            AppendEscape(json, 0xD800 + ((cp - 0x10000) >> 10));
+            AppendEscape(json, 0xDC00 + ((cp - 0x10000) & 0x3FF));
+            AppendExpected(expected, cp);
+            break;
+        }
+        case 4:     // lone high surrogate
+            AppendEscape(json, 0xD800 + Rand(0x400));
+            expected += (wchar_t)0xFFFD;
+            loneHigh = true;
+            break;
+        case 5:     // lone low surrogate
+            AppendEscape(json, 0xDC00 + Rand(0x400));
+            expected += (wchar_t)0xFFFD;
+            break;
+        case 6:
+        case 7: {   // valid UTF-8
+            uint32_t cp = RandomScalar();
+            AppendUtf8(json, cp);
+            AppendExpected(expected, cp);
+            break;
+        }
+        default: {  // malformed UTF-8
+            const auto& bad = kBad[Rand(sizeof(kBad) / sizeof(kBad[0]))];
+            json += bad.bytes;
+            expected += bad.text;
+            break;
+        }
+        }
+    }
+    json += '"';
+}
+
+// ============================================================================
+// Pass 1: strings
+// ============================================================================
+static int RunStrings(int iterations)
+{
+    for (int it = 0; it < iterations; it++) {
+        std::string json;
+        std::wstring expected;
+        RandomString(json, expected);
+
+        JsonReader r(json);
+        std::wstring out;
+        if (!r.ReadString(out) || out != expected || r.Peek() != JsonReader::Type::End)
+            return Fail("strings", it, json, "decoded text differs");
+
+        // Capped: either the whole text fits, or nothing is kept, the
+        // truncation is reported and the next value is still readable.
+        size_t cap = Rand((uint32_t)expected.size() + 2);
+        std::string pair = "[" + json + ",\"next\"]";
+        JsonReader c(pair);
+        bool truncated = false;
+        std::wstring next;
+        if (!c.EnterArray() || !c.NextElement() || !c.ReadString(out, cap, &truncated))
+            return Fail("strings", it, json, "capped read failed");
+        if (truncated != (expected.size() > cap) || out != (truncated ? L"" : expected))
+            return Fail("strings", it, json, "cap not honoured");
+        if (!c.NextElement() || !c.ReadString(next) || next != L"next" || c.NextElement() ||
+            c.Failed())
+            return Fail("strings", it, json, "reader lost its place after a capped read");
+    }
+    return 0;
+}
+
+// ============================================================================
+// Protocol lines with unknown members
+// ============================================================================
+static std::string RandomValue(int depth)
+{
+    switch (Rand(depth > 3 ? 5 : 7)) {
+    case 0:  return "null";
+    case 1:  return Rand(2) ? "true" : "false";
+    case 2:  { static const char* kNumbers[] = { "0", "-1", "42", "3.25", "-0.5e-3", "1E+9", "12345678901234567890" };
+               return kNumbers[Rand(7)]; }
+    case 3:
+    case 4:  { std::string s; std::wstring unused; RandomString(s, unused); return s; }
+    case 5: {
+        std::string s = "[";
+        int n = (int)Rand(4);
+        for (int i = 0; i < n; i++) s += (i ? "," : "") + RandomValue(depth + 1);
+        return s + "]";
+    }
+    default: {
+        std::string s = "{";
+        int n = (int)Rand(4);
+        for (int i = 0; i < n; i++)
+            s += std::string(i ? "," : "") + "\"k" + std::to_string(i) + "\":" + RandomValue(depth + 1);
+        return s + "}";
+    }
+    }
+}
+
+static std::string Ws()
+{
+    static const char* kWs[] = { "", "", " ", "\t", "\r\n  " };
+    return kWs[Rand(5)];
+}
+
+// A {"type":"result",...} line (the shape BunRenderer decodes), and the
+// id / svg / error it carries.
+static std::string RandomMessage(std::wstring& id, std::wstring& svg, std::wstring& error,
+                                 bool& errorNull)
+{
+    std::string idJson, svgJson, errorJson;
+    RandomString(idJson, id);
+    RandomString(svgJson, svg);
+    errorNull = Rand(2) != 0;
+    if (errorNull) {
+        errorJson = "null";
+        error.clear();
+    } else {
+        RandomString(errorJson, error);
+    }
+
+    std::vector<std::string> members = {
+        "\"type\":" + Ws() + "\"result\"",
+        "\"id\":" + Ws() + idJson,
+        "\"svg\":" + Ws() + svgJson,
+        "\"error\":" + Ws() + errorJson,
+    };
+    int unknown = (int)Rand(5);
+    for (int i = 0; i < unknown; i++)
+        members.push_back("\"x" + std::to_string(i) + "\":" + Ws() + RandomValue(0));
+    std::shuffle(members.begin(), members.end(), g_rng);
+
+    std::string line = Ws() + "{";
+    for (size_t i = 0; i < members.size(); i++)
+        line += (i ? "," : "") + Ws() + members[i] + Ws();
+    return line + "}" + Ws();
+}
+
+// ============================================================================
+// Pass 2: messages
+// ============================================================================
+static int RunMessages(int iterations)
+{
+    for (int it = 0; it < iterations; it++) {
+        std::wstring id, svg, error;
+        bool errorNull;
+        std::string line = RandomMessage(id, svg, error, errorNull);
+
+        JsonReader r(line);
+        std::string_view key, type;
+        std::wstring gotId, gotSvg, gotError;
+        int seen = 0;
+        if (!r.EnterObject())
+            return Fail("messages", it, line, "not an object");
+        while (r.NextMember(key)) {
+            bool ok;
+            if (key == "type")       ok = r.ReadRawString(type);
+            else if (key == "id")    ok = r.ReadString(gotId);
+            else if (key == "svg")   ok = r.ReadString(gotSvg);
+            else if (key == "error") ok = r.ReadString(gotError, SIZE_MAX, nullptr, true);
+            else { ok = r.Skip(); seen--; }
+            seen++;
+            if (!ok) return Fail("messages", it, line, "member failed to decode");
+        }
+        if (r.Failed() || r.Peek() != JsonReader::Type::End)
+            return Fail("messages", it, line, "object not consumed cleanly");
+        if (seen != 4 || type != "result" || gotId != id || gotSvg != svg || gotError != error)
+            return Fail("messages", it, line, "known fields differ");
+
+        JsonReader s(line);
+        if (!s.Skip() || s.Peek() != JsonReader::Type::End)
+            return Fail("messages", it, line, "Skip did not consume the line");
+    }
+    return 0;
+}
+
+// ============================================================================
+// Pass 3: truncated
+// ============================================================================
+static int RunTruncated(int iterations)
+{
+    for (int it = 0; it < iterations; it++) {
+        std::wstring id, svg, error;
+        bool errorNull;
+        std::string line = RandomMessage(id, svg, error, errorNull);
+        // Trailing whitespace isn't part of the value; cut inside it.
+        size_t end = line.find_last_of('}');
+        size_t cut = Rand((uint32_t)end + 1);
+        std::string prefix = line.substr(0, cut); // own allocation: ASan sees the end
+
+        JsonReader r(prefix);
+        if (r.Skip())
+            return Fail("truncated", it, prefix, "a truncated value was accepted");
+        if (!r.Failed() || r.Peek() != JsonReader::Type::Invalid)
+            return Fail("truncated", it, prefix, "reader did not stay failed");
+
+        // The same line cut inside a string, read as a string.
+        std::string str;
+        std::wstring unused;
+        RandomString(str, unused);
+        std::string strPrefix = str.substr(0, Rand((uint32_t)str.size()));
+        JsonReader rs(strPrefix);
+        std::wstring out;
+        if (rs.ReadString(out))
+            return Fail("truncated", it, strPrefix, "a truncated string was accepted");
+    }
+    return 0;
+}
+
+// ============================================================================
+// Pass 4: mutated
+// ============================================================================
+static int RunMutated(int iterations)
+{
+    int valid = 0;
+    for (int it = 0; it < iterations; it++) {
+        std::wstring id, svg, error;
+        bool errorNull;
+        std::string line = RandomMessage(id, svg, error, errorNull);
+        int edits = 1 + (int)Rand(6);
+        for (int e = 0; e < edits; e++) {
+            size_t p = Rand((uint32_t)line.size() + 1);
+            switch (Rand(3)) {
+            case 0:  line.insert(line.begin() + p, (char)g_rng()); break;
+            case 1:  if (p < line.size()) line.erase(p, 1); break;
+            default: if (p < line.size()) line[p] = (char)g_rng(); break;
+            }
+        }
+
+        JsonReader r(line);
+        if (r.Skip()) valid++;
+        else if (!r.Failed())
+            return Fail("mutated", it, line, "Skip failed without failing the reader");
+
+        JsonReader m(line);
+        std::string_view key;
+        std::wstring value;
+        if (m.EnterObject()) {
+            while (m.NextMember(key)) {
+                bool ok = m.Peek() == JsonReader::Type::String ? m.ReadString(value, 64) : m.Skip();
+                if (!ok) break;
+            }
+        }
+        if (m.Failed() && m.Peek() != JsonReader::Type::Invalid)
+            return Fail("mutated", it, line, "failed reader recovered");
+    }
+    std::printf("  mutated: %d of %d lines still parsed\n", valid, iterations);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 20000;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if ((a == "-n" || a == "--iterations") && i + 1 < argc) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else if ((a == "-s" || a == "--seed") && i + 1 < argc) {
+            seed = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::printf("usage: jsonfuzz [-n ITERATIONS] [-s SEED]\n");
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    std::printf("jsonfuzz: %d cases per pass, seed %u\n", iterations, seed);
+    g_rng.seed(seed);
+    if (RunStrings(iterations) || RunMessages(iterations) ||
+        RunTruncated(iterations) || RunMutated(iterations))
+        return 1;
+
+    // Nesting far past kMaxDepth fails cleanly instead of recursing.
+    std::string deep(100000, '[');
+    JsonReader d(deep);
+    if (d.Skip() || !d.Failed()) {
+        std::fprintf(stderr, "jsonfuzz: deep nesting accepted\n");
+        return 1;
+    }
+
+    std::printf("jsonfuzz: ok\n");
+    return 0;
+}
@@ -0,0 +1,315 @@
+// parsefuzz - incremental MarkdownDocument against a fresh parse (portable; builds against mdparser)
+//
+// Usage: parsefuzz [-n STEPS] [-s SEED]
+//
+// A random document built from block-boundary-heavy lines (headings with
+// repeated slugs, setext underlines, lists, blockquotes, tables, mermaid
+// and code fences, often left open) is edited STEPS times (default 20000;
+// a fresh document every 250 steps): lines inserted, deleted, replaced,
+// moved or duplicated, blank lines removed to join blocks or added to
+// split them, fence lines added or removed. Each edit goes through
+// MarkdownDocument::ApplyEdit or Update (sometimes with CRLF text), and
+// now and then the mermaid salt changes.
+//
+// After every edit Result() must equal MarkdownParser::Parse of the same
+// text - HTML, mermaid blocks, headings, line map - and the returned delta
+// must describe the change: blocks before it untouched, blocks after it
+// the old ones moved by lineDelta. Exits 1 on the first mismatch (the
+// document is dumped), or if tail reuse, joins, splits, open fences or
+// re-emits were never exercised.
+
+#include "MarkdownParser.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937 g_rng;
+
+static uint32_t Rand(uint32_t n) { return (uint32_t)(g_rng() % n); }
+
+// ============================================================================
+// Document model - one wstring per source line
+// ============================================================================
+typedef std::vector<std::wstring> Lines;
+
+static const wchar_t* const kLines[] = {
+    L"# Title", L"## Title", L"### Other *title*", L"Title", L"===", L"---",
+    L"Some *text* with `code` and [a link](http://x)", L"more **text** here",
+    L"- item", L"- [ ] task", L"  - nested", L"1. one", L"2. two", L"* star",
+    L"> quote", L"> ## Title", L"> ```mermaid", L"> graph TD", L"> ```", L">",
+    L"```mermaid", L"```", L"~~~", L"```js", L"graph TD", L"A-->B", L"B-->C",
+    L"    indented code", L"| a | b |", L"|---|---|", L"| 1 | 2 |", L"***",
+    L"café 中文", L"tab\there",
+};
+
+static std::wstring RandomLine()
+{
+    if (Rand(4) == 0) return std::wstring();
+    std::wstring line = kLines[Rand(sizeof(kLines) / sizeof(kLines[0]))];
+    if (Rand(8) == 0) line += L" " + std::to_wstring(Rand(4));     // near-duplicates
+    return line;
+}
+
+static Lines RandomLines(int n)
+{
+    Lines out;
+    for (int i = 0; i < n; i++) out.push_back(RandomLine());
+    return out;
+}
+
+static bool IsFence(const std::wstring& l)
+{
+    return l.compare(0, 3, L"```") == 0 || l.compare(0, 3, L"~~~") == 0 ||
+           l.compare(0, 5, L"> ```") == 0;
+}
+
+static std::wstring TextOf(const Lines& doc, bool crlf)
+{
+    std::wstring text;
+    for (const auto& l : doc) {
+        text += l;
+        text += crlf ? L"\r\n" : L"\n";
+    }
+    return text;
+}
+
+static void Dump(const Lines& doc)
+{
+    std::fprintf(stderr, "document (%zu lines):\n", doc.size());
+    for (size_t i = 0; i < doc.size(); i++) {
+        std::string narrow;
+        for (wchar_t c : doc[i]) narrow += c < 128 ? (char)c : '?';
+        std::fprintf(stderr, "%4zu| %s\n", i, narrow.c_str());
+    }
+}
+
+// ============================================================================
+// Edits - each is a replacement of lines [first, first + count)
+// ============================================================================
+struct Edit {
+    int   first = 0;
+    int   count = 0;
+    Lines lines;
+    bool  viaUpdate = false;   // only expressible as a whole-text change
+};
+
+static Edit RandomEdit(const Lines& doc)
+{
+    Edit e;
+    int n = (int)doc.size();
+    int at = (int)Rand((uint32_t)n + 1);
+    auto span = [&](int max) { return std::min(n - at, 1 + (int)Rand((uint32_t)max)); };
+    e.first = at;
+
+    switch (n == 0 ? 0 : Rand(10)) {
+    case 0:     // insert
+        e.lines = RandomLines(1 + (int)Rand(4));
+        break;
+    case 1:     // delete
+        e.count = span(4);
+        break;
+    case 2:     // replace
+        e.count = span(3);
+        e.lines = RandomLines(1 + (int)Rand(3));
+        break;
+    case 3: {   // join: drop a blank line between two blocks
+        std::vector<int> blanks;
+        for (int i = 0; i < n; i++)
+            if (doc[i].empty()) blanks.push_back(i);
+        if (blanks.empty()) break;
+        e.first = blanks[Rand((uint32_t)blanks.size())];
+        e.count = 1;
+        break;
+    }
+    case 4:     // split: a blank line inside whatever is there
+        e.lines = { std::wstring() };
+        break;
+    case 5:     // open (or close) a fence
+        e.lines = { Rand(2) ? L"```mermaid" : L"```" };
+        break;
+    case 6: {   // drop a fence line, reopening the fence above it
+        std::vector<int> fences;
+        for (int i = 0; i < n; i++)
+            if (IsFence(doc[i])) fences.push_back(i);
+        if (fences.empty()) break;
+        e.first = fences[Rand((uint32_t)fences.size())];
+        e.count = 1;
+        break;
+    }
+    case 7:     // retype one line
+        if (at == n) at = n - 1;
+        e.first = at;
+        e.count = 1;
+        e.lines = { doc[at] + (Rand(2) ? L"x" : L" *a*") };
+        break;
+    default: {  // move or duplicate a range: a whole-text change
+        e.viaUpdate = true;
+        int from = (int)Rand((uint32_t)n), len = std::min(n - from, 1 + (int)Rand(6));
+        Lines next = doc;
+        Lines range(next.begin() + from, next.begin() + from + len);
+        if (Rand(2)) next.erase(next.begin() + from, next.begin() + from + len);
+        int to = (int)Rand((uint32_t)next.size() + 1);
+        next.insert(next.begin() + to, range.begin(), range.end());
+        e.first = 0;
+        e.count = n;
+        e.lines = std::move(next);
+        break;
+    }
+    }
+    return e;
+}
+
+// ============================================================================
+// Checks
+// ============================================================================
+static const char* Compare(const MarkdownParseResult& got, const MarkdownParseResult& want)
+{
+    if (got.html != want.html) return "HTML differs from a fresh parse";
+    if (got.mermaidBlocks.size() != want.mermaidBlocks.size()) return "mermaid block count differs";
+    for (size_t i = 0; i < got.mermaidBlocks.size(); i++) {
+        const MermaidBlock& a = got.mermaidBlocks[i];
+        const MermaidBlock& b = want.mermaidBlocks[i];
+        if (a.code != b.code || a.startLine != b.startLine || a.endLine != b.endLine ||
+            a.id != b.id || a.hash != b.hash || a.ordinal != b.ordinal || a.closed != b.closed ||
+            a.htmlOffset != b.htmlOffset || a.htmlLength != b.htmlLength)
+            return "mermaid block differs";
+    }
+    if (got.headings.size() != want.headings.size()) return "heading count differs";
+    for (size_t i = 0; i < got.headings.size(); i++) {
+        const MarkdownHeading& a = got.headings[i];
+        const MarkdownHeading& b = want.headings[i];
+        if (a.level != b.level || a.line != b.line || a.id != b.id) return "heading differs";
+    }
+    if (got.lineMap.size() != want.lineMap.size()) return "line map size differs";
+    for (size_t i = 0; i < got.lineMap.size(); i++) {
+        const MarkdownLineSpan& a = got.lineMap[i];
+        const MarkdownLineSpan& b = want.lineMap[i];
+        if (a.startLine != b.startLine || a.endLine != b.endLine || a.key != b.key ||
+            a.htmlOffset != b.htmlOffset || a.htmlLength != b.htmlLength)
+            return "line map differs";
+    }
+    return nullptr;
+}
+
+// The delta against the tree before the edit: the head is untouched, the
+// tail is the old tail moved by lineDelta (re-emitted blocks excepted).
+static const char* CheckDelta(const std::vector<MarkdownBlock>& before,
+                              const std::vector<MarkdownBlock>& after,
+                              const MarkdownBlockDelta& d)
+{
+    if (d.firstBlock + d.removedCount > before.size() ||
+        before.size() - d.removedCount + d.insertedCount != after.size())
+        return "delta block counts do not add up";
+    auto reemitted = [&](size_t i) {
+        return std::find(d.reemitted.begin(), d.reemitted.end(), i) != d.reemitted.end();
+    };
+    for (size_t i = 0; i < d.firstBlock; i++) {
+        if (reemitted(i)) continue;
+        if (after[i].html != before[i].html || after[i].startLine != before[i].startLine)
+            return "block before the delta changed";
+    }
+    for (size_t i = d.firstBlock + d.insertedCount; i < after.size(); i++) {
+        const MarkdownBlock& old = before[i - d.insertedCount + d.removedCount];
+        if (after[i].startLine != old.startLine + d.lineDelta ||
+            after[i].endLine != old.endLine + d.lineDelta)
+            return "tail block not moved by lineDelta";
+        if (!reemitted(i) && after[i].key != old.key) return "tail block changed but not re-emitted";
+    }
+    return nullptr;
+}
+
+struct Coverage {
+    size_t tailShift = 0;   // blocks after the edit reused, lines shifted
+    size_t join = 0;        // fewer blocks than were replaced
+    size_t split = 0;       // more blocks than were replaced
+    size_t openFence = 0;   // a mermaid fence running to the end
+    size_t reemit = 0;      // slug / ordinal change re-emitted a block below
+    size_t salt = 0;
+};
+
+int main(int argc, char** argv)
+{
+    int steps = 20000;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if ((a == "-n" || a == "--steps") && i + 1 < argc) {
+            steps = std::max(1, std::atoi(argv[++i]));
+        } else if ((a == "-s" || a == "--seed") && i + 1 < argc) {
+            seed = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::printf("usage: parsefuzz [-n STEPS] [-s SEED]\n");
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+    std::printf("parsefuzz: %d steps, seed %u\n", steps, seed);
+    g_rng.seed(seed);
+
+    static const wchar_t* const kSalts[] = { L"", L"dark", L"default|neo" };
+    Lines doc;
+    MarkdownDocument md;
+    std::wstring salt;
+    Coverage cov;
+
+    for (int step = 0; step < steps; step++) {
+        if (step % 250 == 0) {
+            doc = RandomLines(20 + (int)Rand(150));
+            md.Reset(TextOf(doc, false));
+        }
+        std::vector<MarkdownBlock> before = md.Blocks();
+
+        MarkdownBlockDelta delta;
+        bool crlf = false;
+        if (Rand(30) == 0) {
+            salt = kSalts[Rand(3)];
+            delta = md.SetMermaidSalt(salt);
+            cov.salt++;
+        } else {
+            Edit e = RandomEdit(doc);
+            doc.erase(doc.begin() + e.first, doc.begin() + e.first + e.count);
+            doc.insert(doc.begin() + e.first, e.lines.begin(), e.lines.end());
+            if (e.viaUpdate || Rand(3) == 0) {
+                crlf = Rand(4) == 0;
+                delta = md.Update(TextOf(doc, crlf));
+            } else {
+                delta = md.ApplyEdit(e.first, e.count, e.lines);
+            }
+        }
+
+        std::wstring text = TextOf(doc, crlf);
+        MarkdownParseResult want = MarkdownParser::Parse(text, salt);
+        const char* error = Compare(md.Result(), want);
+        if (!error && md.Html() != MarkdownParser::ConvertToHtml(text, salt))
+            error = "Html() differs from ConvertToHtml";
+        if (!error) error = CheckDelta(before, md.Blocks(), delta);
+        if (error) {
+            std::fprintf(stderr, "parsefuzz: step %d: %s\n", step, error);
+            Dump(doc);
+            return 1;
+        }
+
+        size_t tail = md.Blocks().size() - delta.firstBlock - delta.insertedCount;
+        if (tail > 0 && delta.lineDelta != 0) cov.tailShift++;
+        if (delta.removedCount > delta.insertedCount && delta.insertedCount > 0) cov.join++;
+        if (delta.insertedCount > delta.removedCount && delta.removedCount > 0) cov.split++;
+        for (const auto& m : want.mermaidBlocks)
+            if (!m.closed) { cov.openFence++; break; }
+        for (size_t i : delta.reemitted)
+            if (i >= delta.firstBlock + delta.insertedCount) { cov.reemit++; break; }
+    }
+
+    std::printf("  tail shifts %zu, joins %zu, splits %zu, open fences %zu, re-emits %zu, "
+                "salt changes %zu\n", cov.tailShift, cov.join, cov.split, cov.openFence,
+                cov.reemit, cov.salt);
+    if (steps >= 1000 && (!cov.tailShift || !cov.join || !cov.split || !cov.openFence ||
+                          !cov.reemit || !cov.salt)) {
+        std::fprintf(stderr, "parsefuzz: some edit kind was never exercised\n");
+        return 1;
+    }
+    std::printf("parsefuzz: ok\n");
+    return 0;
+}
@@ -0,0 +1,571 @@
+// patchfuzz - PreviewPatch round trip against a simulated page (portable; builds against previewbuild)
+//
+// Usage: patchfuzz [-n STEPS] [-s SEED]
+//
+// A random document is edited STEPS times (default 20000; a fresh document
+// every 200 steps): blocks inserted, deleted, edited, moved, duplicated,
+// grown or shrunk by a few lines, and diagrams rendered or evicted from the
+// caches. Each version is built into a page like PreviewBuilder's, diffed
+// against what the host last sent with PreviewPatch::Diff, and the message
+// is applied to a simulated WebView page that follows the page script
+// (_applyPatch / _applyOps in WebView2Manager.cpp). The simulated page must
+// then match the new page block for block: key, data-line-block, text, and
+// each diagram's SVG or placeholder.
+//
+// Some messages are lost, the page is cleared, or its last block removed
+// behind the host's back; the page must then ask for a resync, and the
+// base-0 message that follows must rebuild it. Exits 1 on the first
+// mismatch, or if some op kind or the resync path was never exercised.
+
+#include "PreviewPatch.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937 g_rng;
+
+static uint32_t Rand(uint32_t n) { return (uint32_t)(g_rng() % n); }
+
+// ============================================================================
+// Document model - the key stands for a block's source, so it fixes the
+// block's text and diagrams; which diagrams are rendered is cache state.
+// ============================================================================
+struct DocBlock {
+    uint64_t          key = 0;
+    int               lines = 1;
+    std::vector<bool> rendered;     // one per diagram
+};
+
+static std::wstring TextOf(uint64_t key)
+{
+    std::wstring text = L"p" + std::to_wstring(key);
+    switch (key % 6) {
+    case 1: text += L" \"quoted\" back\\slash"; break;
+    case 2: text += L" tab\there\r\nnext line"; break;
+    case 3: text += L" café 中文"; break;
+    case 4: text += L" lone "; text += (wchar_t)0xD800; break;
+    case 5: text += (wchar_t)0x01; break;
+    default: break;
+    }
+    return text;
+}
+
+static std::wstring IdOf(uint64_t key, size_t k)
+{
+    return L"mmd-" + std::to_wstring(key) + L"-" + std::to_wstring(k);
+}
+
+static std::wstring SvgOf(uint64_t key, size_t k)
+{
+    return L"<svg data-k=\"" + std::to_wstring(k) + L"\">" + std::to_wstring(key) + L"</svg>";
+}
+
+static const wchar_t kPlaceholder[] = L"pending";
+
+// ============================================================================
+// Page - the next page as PreviewBuilder hands it to Diff: HTML plus
+// per-block state and diagram spans
+// ============================================================================
+struct Page {
+    std::wstring                      html;
+    std::vector<PreviewPatch::Block>  blocks;
+    std::deque<std::wstring>          ids;      // storage behind Diagram::id
+};
+
+static void BuildPage(const std::vector<DocBlock>& doc, Page& page)
+{
+    page.html.clear();
+    page.blocks.clear();
+    page.ids.clear();
+    int line = 1;
+    for (const auto& d : doc) {
+        PreviewPatch::Block b;
+        b.state.key = d.key;
+        b.state.line = line;
+        b.offset = page.html.size();
+        page.html += L"<div data-key=\"" + std::to_wstring(d.key) + L"\" data-line-block=\"" +
+                     std::to_wstring(line) + L"\">" + TextOf(d.key);
+        for (size_t k = 0; k < d.rendered.size(); k++) {
+            page.ids.push_back(IdOf(d.key, k));
+            page.html += L"<div data-mermaid-id=\"" + page.ids.back() + L"\">";
+            PreviewPatch::Diagram diagram;
+            diagram.id = page.ids.back();
+            if (d.rendered[k]) {
+                diagram.offset = page.html.size();
+                page.html += SvgOf(d.key, k);
+                diagram.length = page.html.size() - diagram.offset;
+                b.state.rendered |= 1ull << (k < 63 ? k : 63);
+            } else {
+                page.html += kPlaceholder;
+            }
+            page.html += L"</div>";
+            b.diagrams.push_back(diagram);
+        }
+        page.html += L"</div>";
+        b.length = page.html.size() - b.offset;
+        page.blocks.push_back(std::move(b));
+        line += d.lines;
+    }
+}
+
+// ============================================================================
+// Message - just enough JSON for the patch message (objects, arrays,
+// strings, integers), written apart from JsonReader / AppendJsonString
+// ============================================================================
+struct Json {
+    enum Kind { Number, String, Array, Object } kind = Number;
+    long long                                  number = 0;
+    std::wstring                               string;
+    std::vector<Json>                          items;
+    std::vector<std::pair<std::wstring, Json>> members;
+
+    const Json* Find(const wchar_t* key) const
+    {
+        for (const auto& m : members)
+            if (m.first == key) return &m.second;
+        return nullptr;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::wstring& text) : m_text(text) {}
+
+    bool Parse(Json& out) { return Value(out) && m_pos == m_text.size(); }
+
+private:
+    bool Value(Json& out)
+    {
+        if (m_pos >= m_text.size()) return false;
+        wchar_t c = m_text[m_pos];
+        if (c == L'"') { out.kind = Json::String; return String(out.string); }
+        if (c == L'[') {
+            out.kind = Json::Array;
+            m_pos++;
+            if (Eat(L']')) return true;
+            do {
+                out.items.emplace_back();
+                if (!Value(out.items.back())) return false;
+            } while (Eat(L','));
+            return Eat(L']');
+        }
+        if (c == L'{') {
+            out.kind = Json::Object;
+            m_pos++;
+            if (Eat(L'}')) return true;
+            do {
+                out.members.emplace_back();
+                if (!String(out.members.back().first) || !Eat(L':') ||
+                    !Value(out.members.back().second))
+                    return false;
+            } while (Eat(L','));
+            return Eat(L'}');
+        }
+        out.kind = Json::Number;
+        bool negative = Eat(L'-');
+        size_t start = m_pos;
+        while (m_pos < m_text.size() && m_text[m_pos] >= L'0' && m_text[m_pos] <= L'9')
+            out.number = out.number * 10 + (m_text[m_pos++] - L'0');
+        if (negative) out.number = -out.number;
+        return m_pos > start;
+    }
+
+    bool String(std::wstring& out)
+    {
+        if (!Eat(L'"')) return false;
+        while (m_pos < m_text.size()) {
+            wchar_t c = m_text[m_pos++];
+            if (c == L'"') return true;
+            if ((unsigned)c < 0x20) return false;   // must have been escaped
+            if (c != L'\\') { out += c; continue; }
+            if (m_pos >= m_text.size()) return false;
+            switch (m_text[m_pos++]) {
+            case L'"':  out += L'"';  break;
+            case L'\\': out += L'\\'; break;
+            case L'/':  out += L'/';  break;
+            case L'n':  out += L'\n'; break;
+            case L'r':  out += L'\r'; break;
+            case L't':  out += L'\t'; break;
+            case L'b':  out += L'\b'; break;
+            case L'f':  out += L'\f'; break;
+            case L'u': {
+                if (m_pos + 4 > m_text.size()) return false;
+                unsigned u = 0;
+                for (int i = 0; i < 4; i++) {
+                    wchar_t h = m_text[m_pos++];
+                    u <<= 4;
+                    if (h >= L'0' && h <= L'9') u |= h - L'0';
+                    else if (h >= L'a' && h <= L'f') u |= h - L'a' + 10;
+                    else if (h >= L'A' && h <= L'F') u |= h - L'A' + 10;
+                    else return false;
+                }
+                out += (wchar_t)u;
+                break;
+            }
+            default: return false;
+            }
+        }
+        return false;
+    }
+
+    bool Eat(wchar_t c)
+    {
+        if (m_pos < m_text.size() && m_text[m_pos] == c) { m_pos++; return true; }
+        return false;
+    }
+
+    const std::wstring& m_text;
+    size_t              m_pos = 0;
+};
+
+// ============================================================================
+// SimPage - the page script's view of #content
+// ============================================================================
+struct SimDiagram {
+    std::wstring id;
+    std::wstring content;
+};
+
+struct SimBlock {
+    uint64_t                key = 0;
+    int                     line = 0;
+    std::wstring            text;
+    std::vector<SimDiagram> diagrams;
+};
+
+// Inserted HTML back into blocks (the format BuildPage writes).
+static bool ParseBlocks(const std::wstring& html, std::vector<SimBlock>& out)
+{
+    static const std::wstring kOpen = L"<div data-key=\"", kLine = L"\" data-line-block=\"",
+                              kDiagram = L"<div data-mermaid-id=\"", kClose = L"</div>";
+    size_t p = 0;
+    auto expect = [&](const std::wstring& s) {
+        if (html.compare(p, s.size(), s) != 0) return false;
+        p += s.size();
+        return true;
+    };
+    auto until = [&](const std::wstring& s, std::wstring& text) {
+        size_t end = html.find(s, p);
+        if (end == std::wstring::npos) return false;
+        text.assign(html, p, end - p);
+        p = end + s.size();
+        return true;
+    };
+    while (p < html.size()) {
+        SimBlock b;
+        std::wstring key, line;
+        if (!expect(kOpen) || !until(kLine, key) || !until(L"\">", line)) return false;
+        b.key = std::stoull(key);
+        b.line = std::stoi(line);
+        size_t end = html.find(L"<div", p), close = html.find(kClose, p);
+        if (close == std::wstring::npos) return false;
+        if (end == std::wstring::npos || end > close) end = close;
+        b.text.assign(html, p, end - p);
+        p = end;
+        while (html.compare(p, kDiagram.size(), kDiagram) == 0) {
+            SimDiagram d;
+            p += kDiagram.size();
+            if (!until(L"\">", d.id) || !until(kClose, d.content)) return false;
+            b.diagrams.push_back(std::move(d));
+        }
+        if (!expect(kClose)) return false;
+        out.push_back(std::move(b));
+    }
+    return true;
+}
+
+struct OpCounts {
+    size_t keep = 0, shift = 0, remove = 0, insert = 0, fill = 0, resync = 0;
+};
+
+class SimPage {
+public:
+    std::vector<SimBlock> blocks;
+    uint64_t              version = 0;
+
+    // Apply one message; false when the page asks for a resync instead.
+    // A malformed message is a test failure (`error` set).
+    bool Apply(const std::wstring& message, OpCounts& counts, const char*& error)
+    {
+        Json m;
+        const Json *base, *ver, *ops;
+        if (!JsonParser(message).Parse(m) || m.kind != Json::Object ||
+            !(base = m.Find(L"base")) || !(ver = m.Find(L"version")) || !(ops = m.Find(L"ops")) ||
+            ops->kind != Json::Array || !m.Find(L"theme")) {
+            error = "malformed message";
+            return false;
+        }
+
+        if (base->number == 0) {
+            std::wstring html;
+            for (const auto& op : ops->items) {
+                if (op.items.size() != 2 || op.items[0].number != 2) {
+                    error = "base-0 message with an op other than insert";
+                    return false;
+                }
+                html += op.items[1].string;
+            }
+            blocks.clear();
+            if (!ParseBlocks(html, blocks)) {
+                error = "inserted HTML does not parse";
+                return false;
+            }
+        } else if ((uint64_t)base->number != version) {
+            return false;
+        } else if (!ApplyOps(ops->items, counts, error)) {
+            version = 0;
+            return false;
+        }
+        version = (uint64_t)ver->number;
+        return true;
+    }
+
+private:
+    bool ApplyOps(const std::vector<Json>& ops, OpCounts& counts, const char*& error)
+    {
+        std::vector<SimBlock> out;
+        size_t cursor = 0;
+        for (const auto& op : ops) {
+            if (op.kind != Json::Array || op.items.empty()) { error = "malformed op"; return false; }
+            switch (op.items[0].number) {
+            case 0:
+                counts.keep++;
+                if (op.items[2].number) counts.shift++;
+                for (long long n = 0; n < op.items[1].number; n++) {
+                    if (cursor >= blocks.size()) return false;
+                    blocks[cursor].line += (int)op.items[2].number;
+                    out.push_back(std::move(blocks[cursor++]));
+                }
+                break;
+            case 1:
+                counts.remove++;
+                for (long long n = 0; n < op.items[1].number; n++) {
+                    if (cursor >= blocks.size()) return false;
+                    cursor++;
+                }
+                break;
+            case 2:
+                counts.insert++;
+                if (!ParseBlocks(op.items[1].string, out)) {
+                    error = "inserted HTML does not parse";
+                    return false;
+                }
+                break;
+            case 3: {
+                counts.fill++;
+                if (cursor >= blocks.size()) return false;
+                SimDiagram* target = nullptr;
+                for (auto& d : blocks[cursor].diagrams)
+                    if (d.id == op.items[1].string) { target = &d; break; }
+                if (!target) return false;
+                target->content = op.items[2].string;
+                break;
+            }
+            default:
+                error = "unknown op";
+                return false;
+            }
+        }
+        if (cursor != blocks.size()) return false;
+        blocks = std::move(out);
+        return true;
+    }
+};
+
+// ============================================================================
+// Check - the page matches `page`, holding host SVG exactly where the host
+// believes it does (`shown`; kept blocks keep SVG the page lost)
+// ============================================================================
+static const char* Check(const SimPage& sim, const Page& page,
+                         const std::vector<PreviewPatch::BlockState>& shown)
+{
+    if (sim.blocks.size() != page.blocks.size() || shown.size() != page.blocks.size())
+        return "block count differs";
+    for (size_t i = 0; i < sim.blocks.size(); i++) {
+        const SimBlock& s = sim.blocks[i];
+        const PreviewPatch::Block& b = page.blocks[i];
+        if (s.key != b.state.key || shown[i].key != b.state.key) return "block key differs";
+        if (s.line != b.state.line || shown[i].line != b.state.line) return "data-line-block differs";
+        if (s.text != TextOf(s.key)) return "block text differs";
+        if (s.diagrams.size() != b.diagrams.size()) return "diagram count differs";
+        if ((shown[i].rendered & b.state.rendered) != b.state.rendered)
+            return "host state lost a rendered diagram";
+        for (size_t k = 0; k < s.diagrams.size(); k++) {
+            const SimDiagram& d = s.diagrams[k];
+            if (d.id != b.diagrams[k].id) return "diagram id differs";
+            bool svg = b.diagrams[k].length != 0 ||
+                       (k < 63 && (shown[i].rendered >> k & 1));
+            if (k >= 63 && b.diagrams[k].length == 0 && d.content != kPlaceholder &&
+                d.content != SvgOf(s.key, k))
+                return "diagram content is neither SVG nor placeholder";
+            if (k < 63 || b.diagrams[k].length != 0)
+                if (d.content != (svg ? SvgOf(s.key, k) : std::wstring(kPlaceholder)))
+                    return svg ? "diagram SVG missing" : "diagram should be a placeholder";
+        }
+    }
+    return nullptr;
+}
+
+// ============================================================================
+// Edits
+// ============================================================================
+static uint64_t g_nextKey = 1;
+
+static DocBlock FreshBlock()
+{
+    DocBlock b;
+    b.key = g_nextKey++;
+    b.lines = 1 + (int)Rand(6);
+    size_t diagrams = Rand(10) < 6 ? 0 : 1 + Rand(3);
+    if (Rand(100) == 0) diagrams = 62 + Rand(10);    // past the 63-bit mask
+    b.rendered.assign(diagrams, false);
+    return b;
+}
+
+static void Edit(std::vector<DocBlock>& doc)
+{
+    size_t at = doc.empty() ? 0 : Rand((uint32_t)doc.size());
+    switch (doc.empty() ? 0 : Rand(10)) {
+    case 0:     // insert
+        doc.insert(doc.begin() + Rand((uint32_t)doc.size() + 1), FreshBlock());
+        break;
+    case 1:     // delete
+        doc.erase(doc.begin() + at);
+        break;
+    case 2:     // edit in place (new source)
+        doc[at] = FreshBlock();
+        break;
+    case 3: {   // move
+        DocBlock b = doc[at];
+        doc.erase(doc.begin() + at);
+        doc.insert(doc.begin() + Rand((uint32_t)doc.size() + 1), b);
+        break;
+    }
+    case 4:     // duplicate (same source twice)
+        doc.insert(doc.begin() + Rand((uint32_t)doc.size() + 1), doc[at]);
+        break;
+    case 5:     // lines added / removed inside a block
+        doc[at].lines = 1 + (int)Rand(6);
+        break;
+    case 6:     // evicted from the caches
+        if (!doc[at].rendered.empty())
+            doc[at].rendered[Rand((uint32_t)doc[at].rendered.size())] = false;
+        break;
+    default: {  // rendered (around the 63-bit mask's edge half the time)
+        uint32_t count = (uint32_t)doc[at].rendered.size();
+        if (count == 0) break;
+        if (Rand(4) == 0) doc[at].rendered.assign(count, true);
+        else doc[at].rendered[count > 63 && Rand(2) ? 60 + Rand(count - 60) : Rand(count)] = true;
+        break;
+    }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int steps = 20000;
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if ((a == "-n" || a == "--steps") && i + 1 < argc) {
+            steps = std::max(1, std::atoi(argv[++i]));
+        } else if ((a == "-s" || a == "--seed") && i + 1 < argc) {
+            seed = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            std::printf("usage: patchfuzz [-n STEPS] [-s SEED]\n");
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+    std::printf("patchfuzz: %d steps, seed %u\n", steps, seed);
+    g_rng.seed(seed);
+
+    std::vector<DocBlock> doc;
+    std::vector<PreviewPatch::BlockState> shown;   // host: what the page holds at `shownVersion`
+    uint64_t shownVersion = 0, version = 0;
+    SimPage sim;
+    OpCounts counts;
+    Page page;
+    size_t chars = 0;
+
+    for (int step = 0; step < steps; step++) {
+        if (step % 200 == 0) {
+            doc.clear();
+            for (int i = (int)Rand(30); i > 0; i--) doc.push_back(FreshBlock());
+        }
+        for (int e = 1 + (int)Rand(3); e > 0; e--) Edit(doc);
+        BuildPage(doc, page);
+        bool dark = Rand(2) != 0;
+
+        std::vector<PreviewPatch::BlockState> applied;
+        uint64_t base = shownVersion;
+        std::wstring message = PreviewPatch::Diff(shown, base, page.html, page.blocks,
+                                                  ++version, dark, applied);
+        chars += message.size();
+        shown = std::move(applied);
+        shownVersion = version;
+
+        // Now and then the page falls out of step with the host.
+        bool mustResync = false;
+        switch (Rand(40)) {
+        case 0:     // message lost; the next one no longer fits
+            continue;
+        case 1:     // page cleared (clearContent)
+            sim.blocks.clear();
+            sim.version = 0;
+            mustResync = base != 0;
+            break;
+        case 2:     // a block vanished from the page, version still current
+            if (!sim.blocks.empty()) {
+                sim.blocks.pop_back();
+                mustResync = base != 0;
+            }
+            break;
+        default:
+            break;
+        }
+
+        const char* error = nullptr;
+        bool fits = sim.Apply(message, counts, error);
+        if (error) {
+            std::fprintf(stderr, "patchfuzz: step %d: %s\n", step, error);
+            return 1;
+        }
+        if (fits && mustResync) {
+            std::fprintf(stderr, "patchfuzz: step %d: page out of step but no resync\n", step);
+            return 1;
+        }
+        if (!fits) {
+            // Resync: the host starts over from base 0.
+            counts.resync++;
+            message = PreviewPatch::Diff({}, 0, page.html, page.blocks, ++version, dark, applied);
+            chars += message.size();
+            shown = std::move(applied);
+            shownVersion = version;
+            if (!sim.Apply(message, counts, error) || error) {
+                std::fprintf(stderr, "patchfuzz: step %d: resync message not applied: %s\n", step,
+                             error ? error : "rejected");
+                return 1;
+            }
+        }
+        if (const char* diff = Check(sim, page, shown)) {
+            std::fprintf(stderr, "patchfuzz: step %d: %s\n", step, diff);
+            return 1;
+        }
+    }
+
+    std::printf("  ops: keep %zu (shifted %zu), remove %zu, insert %zu, fill %zu; resyncs %zu; "
+                "%.1fM chars of messages\n", counts.keep, counts.shift, counts.remove, counts.insert,
+                counts.fill, counts.resync, chars / 1e6);
+    if (steps >= 1000 && (!counts.keep || !counts.shift || !counts.remove || !counts.insert ||
+                          !counts.fill || !counts.resync)) {
+        std::fprintf(stderr, "patchfuzz: some op kind was never exercised\n");
+        return 1;
+    }
+    std::printf("patchfuzz: ok\n");
+    return 0;
+}
@@ -0,0 +1,329 @@
+// pipereader - BunPipeReader against a stub child process (POSIX; builds against bunipc)
+//
+// Usage: pipereader
+//
+// The test re-runs itself as the child (`pipereader --stub SCENARIO`),
+// with stdout on a CreateStdoutPipe pipe, like the plugin runs Bun. The
+// stub writes its messages in pieces with pauses in between, so the
+// reader sees them split across reads:
+//
+//   lines     a JSON line split mid-token, CRLF and empty lines, a line in
+//             three writes; then EOF: Wait drains and fails, onClosed runs
+//             exactly once (also when the handler is installed after EOF)
+//   frames    a text line, then stray text and an MPF2 frame whose magic
+//             and header are split across reads, then a frame larger than
+//             one read chunk
+//   burst     many short lines, then many small frames, each batch in a
+//             single write: all arrive, in order
+//   overflow  a frame header announcing more than kMaxMessageBytes, and a
+//             text line longer than that: the reader closes with
+//             Overflowed() and onClosed once
+//   stop      the stub writes nothing: Stop() during the blocking read
+//             returns promptly and runs onClosed once
+//
+// Exits 1 on the first failure.
+
+#include "BunPipeReader.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <mutex>
+#include <spawn.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+static const char* g_self;
+
+// Messages per batch in the burst scenario.
+static constexpr int kBurst = 50000;
+
+static int Fail(const char* test, const char* what)
+{
+    std::fprintf(stderr, "pipereader: %s: %s\n", test, what);
+    return 1;
+}
+
+// ============================================================================
+// Stub child
+// ============================================================================
+static void Put(std::string_view bytes, int pauseMs = 30)
+{
+    while (!bytes.empty()) {
+        ssize_t n = write(1, bytes.data(), bytes.size());
+        if (n <= 0) _exit(0);   // reader gone
+        bytes.remove_prefix((size_t)n);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(pauseMs));
+}
+
+static std::string LargePayload()
+{
+    std::string payload(BunPipeReader::kMaxMessageBytes / 8, 'x');
+    for (size_t i = 0; i < payload.size(); i += 4096) payload[i] = (char)('a' + i / 4096 % 26);
+    return payload;
+}
+
+static int RunStub(const std::string& scenario)
+{
+    if (scenario == "lines") {
+        Put("{\"type\":\"rea");
+        Put("dy\"}\r\n\n\r\n");
+        Put("{\"type\":\"result\",");
+        Put("\"id\":\"a\",");
+        Put("\"svg\":\"<svg/>\"}\n", 0);
+        Put("{\"last\":true}\n");
+    } else if (scenario == "frames") {
+        Put("hello\n", 200);                    // the host switches to frames now
+        Put("warning: stray stderr text ");
+        std::string frame;
+        BunPipeReader::AppendFrame(frame, 'R', 7, "mmd-1", "<svg>one</svg>");
+        Put(frame.substr(0, 2));                // "MP" | "F2..."
+        Put(frame.substr(2, 10));               // header split too
+        Put(frame.substr(12));
+        frame.clear();
+        BunPipeReader::AppendFrame(frame, 'R', 8, "mmd-2", LargePayload());
+        for (size_t at = 0; at < frame.size(); at += 1000 * 1000)
+            Put(std::string_view(frame).substr(at, 1000 * 1000), 5);
+    } else if (scenario == "burst") {
+        std::string lines;
+        for (int i = 0; i < kBurst; i++) lines += "line " + std::to_string(i) + (i % 3 ? "\n" : "\r\n\n");
+        Put(lines, 200);                        // the host switches to frames now
+        std::string frames = "stray ";
+        for (int i = 0; i < kBurst; i++)
+            BunPipeReader::AppendFrame(frames, 'R', (uint32_t)i, "mmd-" + std::to_string(i), "<svg/>");
+        Put(frames);
+    } else if (scenario == "overflow-frame") {
+        Put("ready\n", 200);
+        std::string header;
+        BunPipeReader::AppendFrame(header, 'R', 1, "id", "");
+        uint32_t claimed = (uint32_t)BunPipeReader::kMaxMessageBytes + 1;
+        for (int i = 0; i < 4; i++) header[16 + i] = (char)(claimed >> (8 * i));   // payload length
+        Put(header);
+        Put(std::string(64 * 1024, 'y'), 2000); // blocks once the reader stops reading
+    } else if (scenario == "overflow-line") {
+        std::string chunk(1024 * 1024, 'z');
+        for (size_t sent = 0; sent <= BunPipeReader::kMaxMessageBytes; sent += chunk.size())
+            Put(chunk, 0);
+        Put("\n", 2000);
+    } else if (scenario == "stop") {
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+    } else {
+        return 2;
+    }
+    return 0;
+}
+
+// ============================================================================
+// Child - spawn the stub with stdout on a fresh pipe, reader started on it
+// ============================================================================
+struct Child {
+    pid_t pid = -1;
+
+    bool Spawn(const char* scenario, BunPipeReader& reader)
+    {
+        BunPipeReader::PipeHandle readEnd, writeEnd;
+        if (!BunPipeReader::CreateStdoutPipe(readEnd, writeEnd)) return false;
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, writeEnd, 1);
+        char* argv[] = { const_cast<char*>(g_self), const_cast<char*>("--stub"),
+                         const_cast<char*>(scenario), nullptr };
+        int rc = posix_spawn(&pid, g_self, &actions, nullptr, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        BunPipeReader::ClosePipe(writeEnd);
+        if (rc != 0) {
+            BunPipeReader::ClosePipe(readEnd);
+            return false;
+        }
+        return reader.Start(readEnd);
+    }
+
+    ~Child()
+    {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+};
+
+// onMessage / onClosed recorders for SetHandler.
+struct Recorder {
+    std::mutex               mutex;
+    std::vector<std::string> messages;
+    std::atomic<int>         closed{0};
+
+    void Install(BunPipeReader& reader)
+    {
+        reader.SetHandler([this](std::string& m) {
+                              std::lock_guard<std::mutex> lock(mutex);
+                              messages.push_back(m);
+                          },
+                          [this] { closed++; });
+    }
+
+    bool WaitClosed(int timeoutMs)
+    {
+        for (int waited = 0; closed == 0 && waited < timeoutMs; waited += 5)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return closed != 0;
+    }
+};
+
+// ============================================================================
+// Scenarios
+// ============================================================================
+static int RunLines()
+{
+    // Wait() for the first message, then the handler for the rest.
+    {
+        Recorder rec;
+        BunPipeReader reader;
+        Child child;
+        if (!child.Spawn("lines", reader)) return Fail("lines", "spawn failed");
+        std::string m;
+        if (!reader.Wait(m, 5000) || m != "{\"type\":\"ready\"}")
+            return Fail("lines", "split line not reassembled");
+        rec.Install(reader);
+        if (!rec.WaitClosed(5000)) return Fail("lines", "EOF not reported");
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (rec.messages.size() != 2 ||
+            rec.messages[0] != "{\"type\":\"result\",\"id\":\"a\",\"svg\":\"<svg/>\"}" ||
+            rec.messages[1] != "{\"last\":true}")
+            return Fail("lines", "handler got the wrong messages");
+        if (!reader.IsClosed() || reader.Overflowed())
+            return Fail("lines", "wrong close state at EOF");
+        if (reader.Wait(m, 10)) return Fail("lines", "Wait succeeded after EOF");
+        reader.Stop();
+        if (rec.closed != 1) return Fail("lines", "onClosed not called exactly once");
+    }
+
+    // Handler installed only after EOF: queued messages and onClosed are
+    // delivered from SetHandler, once.
+    {
+        Recorder rec;
+        BunPipeReader reader;
+        Child child;
+        if (!child.Spawn("lines", reader)) return Fail("lines", "spawn failed");
+        for (int waited = 0; !reader.IsClosed() && waited < 5000; waited += 5)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        if (!reader.IsClosed()) return Fail("lines", "EOF not reached");
+        rec.Install(reader);
+        if (rec.messages.size() != 3 || rec.closed != 1)
+            return Fail("lines", "late handler missed messages or onClosed");
+        reader.Stop();
+        if (rec.closed != 1) return Fail("lines", "onClosed ran again on Stop");
+        std::string m;
+        if (reader.Wait(m, 10)) return Fail("lines", "message left after Stop");
+    }
+    return 0;
+}
+
+static int RunFrames()
+{
+    BunPipeReader reader;
+    Child child;
+    if (!child.Spawn("frames", reader)) return Fail("frames", "spawn failed");
+    std::string m;
+    if (!reader.Wait(m, 5000) || m != "hello") return Fail("frames", "text line before frames lost");
+    reader.SetFramed(true);
+
+    BunPipeReader::Frame f;
+    if (!reader.Wait(m, 5000)) return Fail("frames", "split frame not delivered");
+    if (!BunPipeReader::ParseFrame(m, f) || f.type != 'R' || f.request != 7 || f.id != "mmd-1" ||
+        f.payload != "<svg>one</svg>")
+        return Fail("frames", "split frame decoded wrong");
+    if (!reader.Wait(m, 10000)) return Fail("frames", "large frame not delivered");
+    if (!BunPipeReader::ParseFrame(m, f) || f.request != 8 || f.id != "mmd-2" ||
+        f.payload != LargePayload())
+        return Fail("frames", "large frame decoded wrong");
+    if (reader.Wait(m, 5000) || !reader.IsClosed() || reader.Overflowed())
+        return Fail("frames", "no clean EOF after the frames");
+    return 0;
+}
+
+static int RunBurst()
+{
+    BunPipeReader reader;
+    Child child;
+    if (!child.Spawn("burst", reader)) return Fail("burst", "spawn failed");
+    std::string m;
+    for (int i = 0; i < kBurst; i++)
+        if (!reader.Wait(m, 5000) || m != "line " + std::to_string(i))
+            return Fail("burst", "line lost or out of order");
+    reader.SetFramed(true);
+
+    BunPipeReader::Frame f;
+    for (int i = 0; i < kBurst; i++)
+        if (!reader.Wait(m, 5000) || !BunPipeReader::ParseFrame(m, f) || f.request != (uint32_t)i ||
+            f.id != "mmd-" + std::to_string(i) || f.payload != "<svg/>")
+            return Fail("burst", "frame lost or out of order");
+    if (reader.Wait(m, 5000) || !reader.IsClosed() || reader.Overflowed())
+        return Fail("burst", "no clean EOF after the burst");
+    return 0;
+}
+
+static int RunOverflow(const char* scenario, bool framed)
+{
+    Recorder rec;
+    BunPipeReader reader;
+    Child child;
+    if (!child.Spawn(scenario, reader)) return Fail(scenario, "spawn failed");
+    std::string m;
+    if (framed) {
+        if (!reader.Wait(m, 5000) || m != "ready") return Fail(scenario, "text line lost");
+        reader.SetFramed(true);
+    }
+    rec.Install(reader);
+    if (!rec.WaitClosed(10000)) return Fail(scenario, "oversize message did not close the reader");
+    if (!reader.Overflowed() || !reader.IsClosed()) return Fail(scenario, "close not flagged as overflow");
+    if (!rec.messages.empty()) return Fail(scenario, "oversize message delivered");
+    reader.Stop();  // the stub is still writing; this unblocks it
+    if (rec.closed != 1) return Fail(scenario, "onClosed not called exactly once");
+    return 0;
+}
+
+static int RunStop()
+{
+    Recorder rec;
+    BunPipeReader reader;
+    Child child;
+    if (!child.Spawn("stop", reader)) return Fail("stop", "spawn failed");
+    rec.Install(reader);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));   // reader blocked in poll()
+    if (reader.IsClosed()) return Fail("stop", "closed before Stop");
+
+    auto t0 = std::chrono::steady_clock::now();
+    reader.Stop();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - t0).count();
+    std::printf("  stop: Stop() during a blocking read took %lld ms\n", (long long)ms);
+    if (ms > 500) return Fail("stop", "Stop() did not interrupt the blocking read");
+    if (rec.closed != 1) return Fail("stop", "onClosed not called exactly once");
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    signal(SIGPIPE, SIG_IGN);
+    g_self = argv[0];
+    if (argc == 3 && std::string(argv[1]) == "--stub")
+        return RunStub(argv[2]);
+    if (argc != 1) {
+        std::printf("usage: pipereader\n");
+        return std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help" ? 0 : 1;
+    }
+
+    if (RunLines() || RunFrames() || RunBurst() || RunOverflow("overflow-frame", true) ||
+        RunOverflow("overflow-line", false) || RunStop())
+        return 1;
+    std::printf("pipereader: ok\n");
+    return 0;
+}
@@ -0,0 +1,205 @@
+// resultqueue - MermaidResultQueue notify / order / Detach checks (portable; header-only queue)
+//
+// Usage: resultqueue [-n RESULTS]
+//
+//   coalescing  one notify per batch of pushes: none until Drain, whatever
+//               arrives meanwhile (and Finish) rides on it
+//   order       producers stream RESULTS results (default 200000) to a
+//               consumer that wakes on notify like the UI thread; every
+//               producer's results come out in push order, none lost, at
+//               most one wake-up outstanding, and the Finished-before-Drain
+//               check sees the last result
+//   detach      Detach while a push is inside notify waits for it, and no
+//               notify runs once Detach has returned
+//
+// Exits 1 on the first failure.
+
+#include "MermaidResultQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int Fail(const char* test, const char* what)
+{
+    std::fprintf(stderr, "resultqueue: %s: %s\n", test, what);
+    return 1;
+}
+
+static MermaidRenderResult Result(int producer, int seq)
+{
+    MermaidRenderResult r;
+    r.id = std::to_wstring(producer) + L":" + std::to_wstring(seq);
+    r.svg = L"<svg/>";
+    return r;
+}
+
+// ============================================================================
+// Coalescing
+// ============================================================================
+static int RunCoalescing()
+{
+    int notifies = 0;
+    MermaidResultQueue q([&] { notifies++; });
+
+    for (int i = 0; i < 100; i++) q.Push(Result(0, i));
+    if (notifies != 1) return Fail("coalescing", "a burst of pushes notified more than once");
+
+    auto batch = q.Drain();
+    if (batch.size() != 100) return Fail("coalescing", "drain lost results");
+    if (q.Drain().size() != 0 || notifies != 1) return Fail("coalescing", "empty drain changed state");
+
+    for (int i = 0; i < 5; i++) q.Push(Result(0, 100 + i));
+    q.Finish();
+    if (notifies != 2) return Fail("coalescing", "next batch / Finish not coalesced into one notify");
+    if (!q.Finished() || q.Drain().size() != 5) return Fail("coalescing", "second batch lost");
+
+    MermaidResultQueue done([&] { notifies++; });
+    done.Finish();
+    if (notifies != 3 || !done.Finished()) return Fail("coalescing", "Finish alone did not notify");
+    return 0;
+}
+
+// ============================================================================
+// Order - a mailbox stands in for the window message queue
+// ============================================================================
+struct Mailbox {
+    std::mutex              mutex;
+    std::condition_variable cv;
+    int                     pending = 0;
+    int                     maxPending = 0;
+
+    void Post()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+        if (pending > maxPending) maxPending = pending;
+        cv.notify_one();
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return pending > 0; });
+        pending--;
+    }
+};
+
+static int RunOrder(int results)
+{
+    const int kProducers = 4;
+    Mailbox mailbox;
+    std::atomic<int> notifies{0};
+    MermaidResultQueue q([&] { notifies++; mailbox.Post(); });
+
+    std::atomic<int> running{kProducers};
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&, p] {
+            for (int i = p; i < results; i += kProducers) {
+                q.Push(Result(p, i / kProducers));
+                if (i % 1024 == 0) std::this_thread::yield();
+            }
+            if (--running == 0) q.Finish();
+        });
+    }
+
+    std::vector<int> next(kProducers, 0);
+    int received = 0, wakeups = 0;
+    bool finished = false, disorder = false;
+    while (!finished) {
+        mailbox.Wait();
+        wakeups++;
+        finished = q.Finished();
+        for (auto& r : q.Drain()) {
+            size_t colon = r.id.find(L':');
+            int p = std::stoi(r.id.substr(0, colon)), seq = std::stoi(r.id.substr(colon + 1));
+            if (seq != next[p]++) disorder = true;
+            received++;
+        }
+    }
+    for (auto& t : producers) t.join();
+
+    std::printf("  order: %d results, %d wake-ups\n", received, wakeups);
+    if (disorder) return Fail("order", "results of a producer out of push order");
+    if (received != results) return Fail("order", "results lost or duplicated");
+    if (mailbox.maxPending > 1) return Fail("order", "more than one wake-up outstanding");
+    if (notifies != wakeups) return Fail("order", "a notify was not followed by a wake-up");
+    if (!q.Drain().empty()) return Fail("order", "results after Finished");
+    return 0;
+}
+
+// ============================================================================
+// Detach
+// ============================================================================
+static int RunDetach()
+{
+    // A push is parked inside notify; Detach must wait it out.
+    {
+        std::atomic<bool> inNotify{false}, notifyDone{false};
+        MermaidResultQueue q([&] {
+            inNotify = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            notifyDone = true;
+        });
+        std::thread producer([&] { q.Push(Result(0, 0)); });
+        while (!inNotify) std::this_thread::yield();
+        q.Detach();
+        bool waited = notifyDone;
+        producer.join();
+        if (!waited) return Fail("detach", "Detach returned while notify was running");
+    }
+
+    // Producers keep pushing while the consumer detaches and goes away.
+    for (int round = 0; round < 200; round++) {
+        std::atomic<bool> detached{false}, late{false}, stop{false};
+        std::atomic<int> calls{0};
+        MermaidResultQueue q([&] {
+            if (detached) late = true;
+            calls++;
+        });
+        std::vector<std::thread> producers;
+        for (int p = 0; p < 2; p++) {
+            producers.emplace_back([&, p] {
+                for (int i = 0; !stop; i++) {
+                    q.Push(Result(p, i));
+                    if (i % 16 == 0) q.Drain();   // re-arm notify
+                }
+            });
+        }
+        while (calls == 0) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::microseconds(round * 10));
+        q.Detach();
+        detached = true;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        stop = true;
+        for (auto& t : producers) t.join();
+        if (late) return Fail("detach", "notify ran after Detach returned");
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int results = 200000;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if ((a == "-n" || a == "--results") && i + 1 < argc) {
+            results = std::max(1, std::atoi(argv[++i]));
+        } else {
+            std::printf("usage: resultqueue [-n RESULTS]\n");
+            return a == "-h" || a == "--help" ? 0 : 1;
+        }
+    }
+
+    if (RunCoalescing() || RunOrder(results) || RunDetach())
+        return 1;
+    std::printf("resultqueue: ok\n");
+    return 0;
+}